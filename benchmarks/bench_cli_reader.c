@@ -0,0 +1,247 @@
+/*
+ * bench_cli_reader.c
+ *
+ * Measures how fast the standalone C program (old_dont_git_code.c) reads
+ * its input, in MB of text parsed per second:
+ * - "buffered": its reader, read() in large blocks, a hand-written number
+ *   tokenizer, and the coordinates appended to one growable matrix
+ * - "scanf":    the reader it used to have, one scanf("%lf%c") per number
+ *   and one malloc'd list node per coordinate and per point
+ *
+ * Both read the same generated file (rows lines of dim coordinates printed
+ * with %.4f, as in the course's inputs) and must end up with the same
+ * values; each is timed `repeats` times and the best run is reported.
+ *
+ * Build and run from the repository root:
+ *     gcc -O2 -o bench_cli_reader benchmarks/bench_cli_reader.c -lm
+ *     ./bench_cli_reader [rows=1000000] [dim=8] [repeats=3]
+ */
+
+/* The program itself, without its main */
+#define main cli_main
+#include "../old_dont_git_code.c"
+#undef main
+
+#include <fcntl.h>
+#include <time.h>
+
+/*declaration of structs*/
+struct cord;
+struct vector;
+
+/*declaration of functions*/
+static double seconds_now(void);
+static void free_vector_list(struct vector *head_vec);
+static struct vector *scanf_read(size_t *N);
+static int same_values(const struct vector *head_vec, size_t N, const struct matrix *points);
+static int write_input(const char *path, long rows, int dim);
+
+/*implementations of structs*/
+struct cord
+{
+    double value;
+    struct cord *next;
+};
+struct vector
+{
+    struct vector *next;
+    struct cord *cords;
+};
+
+
+/* Monotonic wall clock, in seconds */
+static double seconds_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Frees a list of points and their coordinate lists */
+static void free_vector_list(struct vector *head_vec) {
+    struct vector *next_vec;
+    struct cord *curr_c, *next_c;
+
+    while (head_vec != NULL) {
+        for (curr_c = head_vec->cords; curr_c != NULL; curr_c = next_c) {
+            next_c = curr_c->next;
+            free(curr_c);
+        }
+        next_vec = head_vec->next;
+        free(head_vec);
+        head_vec = next_vec;
+    }
+}
+
+/*
+ * The former reader of the program: scanf("%lf%c") from stdin into linked
+ * lists, then a second walk to drop the empty point after the last line.
+ * Returns the list (N points), or NULL if memory ran out.
+ */
+static struct vector *scanf_read(size_t *N) {
+    struct vector *head_vec, *curr_vec, *temp, *prev = NULL;
+    struct cord *curr_cord;
+    double n;
+    char c;
+    size_t i;
+
+    *N = 0;
+    head_vec = malloc(sizeof(struct vector));
+    if (head_vec == NULL) {
+        return NULL;
+    }
+    head_vec->next = NULL;
+    head_vec->cords = malloc(sizeof(struct cord));
+    if (head_vec->cords == NULL) {
+        free(head_vec);
+        return NULL;
+    }
+    curr_vec = head_vec;
+    curr_cord = head_vec->cords;
+    curr_cord->next = NULL;
+
+    while (scanf("%lf%c", &n, &c) == 2) {
+        curr_cord->value = n;
+        if (c == '\n') {
+            (*N)++;
+            curr_vec->next = malloc(sizeof(struct vector));
+            if (curr_vec->next == NULL) {
+                free_vector_list(head_vec);
+                return NULL;
+            }
+            curr_vec = curr_vec->next;
+            curr_vec->next = NULL;
+            curr_vec->cords = malloc(sizeof(struct cord));
+            if (curr_vec->cords == NULL) {
+                free_vector_list(head_vec);
+                return NULL;
+            }
+            curr_cord = curr_vec->cords;
+            curr_cord->next = NULL;
+            continue;
+        }
+        curr_cord->next = malloc(sizeof(struct cord));
+        if (curr_cord->next == NULL) {
+            free_vector_list(head_vec);
+            return NULL;
+        }
+        curr_cord = curr_cord->next;
+        curr_cord->next = NULL;
+    }
+
+    temp = head_vec;
+    for (i = 0; i < *N; i++) {
+        prev = temp;
+        temp = temp->next;
+    }
+    if (prev != NULL) {
+        prev->next = NULL;
+        free_vector_list(temp);
+    }
+    return head_vec;
+}
+
+/* Whether the list and the matrix hold the same points, bit for bit */
+static int same_values(const struct vector *head_vec, size_t N, const struct matrix *points) {
+    const struct cord *c;
+    size_t i = 0;
+    int j;
+
+    if (N != points->rows) {
+        return 0;
+    }
+    for (; head_vec != NULL; head_vec = head_vec->next, i++) {
+        for (c = head_vec->cords, j = 0; c != NULL; c = c->next, j++) {
+            if (j >= points->dim || memcmp(&c->value, &points->data[i * (size_t)points->dim + (size_t)j],
+                                           sizeof(double)) != 0) {
+                return 0;
+            }
+        }
+        if (j != points->dim) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Writes rows x dim random coordinates with four decimals. Returns 0, or -1 on failure */
+static int write_input(const char *path, long rows, int dim) {
+    FILE *out = fopen(path, "w");
+    unsigned long state = 12345;
+    long i;
+    int j;
+
+    if (out == NULL) {
+        return -1;
+    }
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < dim; j++) {
+            state = state * 1103515245UL + 12345UL;
+            fprintf(out, "%.4f%c", ((double)((state >> 8) % 2000000UL) - 1000000.0) / 997.0,
+                    j < dim - 1 ? ',' : '\n');
+        }
+    }
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    long rows = argc > 1 ? atol(argv[1]) : 1000000L;
+    int dim = argc > 2 ? atoi(argv[2]) : 8;
+    int repeats = argc > 3 ? atoi(argv[3]) : 3;
+    char path[] = "/tmp/bench_cli_reader_XXXXXX";
+    struct matrix points;
+    struct vector *list;
+    double start, best_buffered = 0.0, best_scanf = 0.0, t, megabytes;
+    size_t N = 0;
+    int fd, r, ok = 1;
+
+    fd = mkstemp(path);
+    if (fd < 0 || rows <= 0 || dim <= 0 || repeats <= 0) {
+        fprintf(stderr, "usage: %s [rows] [dim] [repeats]\n", argv[0]);
+        return 1;
+    }
+    close(fd);
+    if (write_input(path, rows, dim) != 0) {
+        fprintf(stderr, "could not write %s\n", path);
+        remove(path);
+        return 1;
+    }
+
+    for (r = 0; r < repeats; r++) {
+        fd = open(path, O_RDONLY);
+        start = seconds_now();
+        if (read_points(fd, &points) != 0) {
+            ok = 0;
+        }
+        t = seconds_now() - start;
+        close(fd);
+        best_buffered = r == 0 || t < best_buffered ? t : best_buffered;
+
+        if (freopen(path, "r", stdin) == NULL) {
+            ok = 0;
+            free(points.data);
+            break;
+        }
+        start = seconds_now();
+        list = scanf_read(&N);
+        t = seconds_now() - start;
+        best_scanf = r == 0 || t < best_scanf ? t : best_scanf;
+
+        if (list == NULL || !same_values(list, N, &points)) {
+            ok = 0;
+        }
+        free_vector_list(list);
+        free(points.data);
+    }
+
+    fd = open(path, O_RDONLY);
+    megabytes = (double)lseek(fd, 0, SEEK_END) / 1e6;
+    close(fd);
+    remove(path);
+
+    printf("input: %ld rows x %d dims, %.1f MB\n", rows, dim, megabytes);
+    printf("buffered: %8.3f s  %8.1f MB/s\n", best_buffered, megabytes / best_buffered);
+    printf("scanf:    %8.3f s  %8.1f MB/s\n", best_scanf, megabytes / best_scanf);
+    printf("speedup:  %.1fx, values %s\n", best_scanf / best_buffered, ok ? "identical" : "DIFFER");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+"""
+bench_end_to_end.py
+
+Times kmeans_pp.py as the course runs it - two CSV files in, centroids out -
+on generated inputs of up to millions of points:
+- load: everything but the Lloyd iterations (interpreter start, reading and
+  joining the files, k-means++ seeding, printing)
+- per iteration: one Assignment + Update Step over all the points
+- ns_per_point_centroid: time per iteration / (N x K)
+- gb_per_s: bytes of points one iteration scans (N x dim doubles) / time per iteration
+
+Like bench_storage.py, every cell runs in a fresh process with 1 and with
+1 + iters iterations (epsilon = 0, so the loop never stops early), the best
+of --repeats runs each: the difference is pure Lloyd time, the rest of the
+short run is the load.
+
+The inputs are written once per (N, dim) to --data-dir and reused, since
+writing the 10M-point ones takes a while. N = 10000000 is the largest the
+suite is meant for:
+    python3 benchmarks/bench_end_to_end.py --n 10000000 --k 8
+
+Results are printed as a table, then as one JSON line (also written to
+--output when given), so runs of two builds can be compared.
+
+Usage:
+    python3 benchmarks/bench_end_to_end.py [--n 10000,100000,1000000] [--k 8,64]
+                                           [--dim 8] [--iters 5] [--repeats 3]
+                                           [--data-dir /tmp/kmeans_bench]
+                                           [--output results.json] [--module-dir .]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+import numpy as np
+
+
+def write_inputs(data_dir, n, dim, seed=0):
+    """
+    Writes the two input files for N points of dim coordinates (unless they
+    are there already) and returns their paths. The first file holds the key
+    and the first half of the coordinates, the second one the key and the
+    rest, each in its own random row order, as the course's inputs.
+    """
+    file1 = os.path.join(data_dir, f"points_{n}x{dim}_1.txt")
+    file2 = os.path.join(data_dir, f"points_{n}x{dim}_2.txt")
+    if os.path.exists(file1) and os.path.exists(file2):
+        return file1, file2
+
+    os.makedirs(data_dir, exist_ok=True)
+    rng = np.random.default_rng(seed)
+    # A few dozen blobs, so the clusters are worth finding
+    centers = rng.standard_normal((32, dim)) * 5.0
+    points = centers[rng.integers(0, len(centers), n)] + rng.standard_normal((n, dim))
+    half = dim // 2
+    for path, columns in ((file1, points[:, :half]), (file2, points[:, half:])):
+        order = rng.permutation(n)
+        table = np.column_stack([order.astype(np.float64), columns[order]])
+        # Written under a temporary name, so an interrupted run leaves no half file
+        np.savetxt(path + ".tmp", table, fmt=["%d"] + ["%.4f"] * columns.shape[1], delimiter=",")
+        os.replace(path + ".tmp", path)
+    return file1, file2
+
+
+def run_cli(module_dir, k, iters, file1, file2, repeats):
+    """Runs kmeans_pp.py `repeats` times and returns its best wall time in seconds."""
+    env = dict(os.environ)
+    env["PYTHONPATH"] = module_dir + os.pathsep + env.get("PYTHONPATH", "")
+    env.pop("MYKMEANSSP_CACHE", None)
+    cmd = [sys.executable, os.path.join(module_dir, "kmeans_pp.py"), str(k), str(iters), "0", file1, file2]
+    best = None
+    for _ in range(repeats):
+        start = time.perf_counter()
+        subprocess.run(cmd, env=env, stdout=subprocess.DEVNULL, check=True)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark kmeans_pp.py end to end")
+    parser.add_argument("--n", default="10000,100000,1000000", help="comma-separated point counts")
+    parser.add_argument("--k", default="8,64", help="comma-separated cluster counts")
+    parser.add_argument("--dim", type=int, default=8, help="coordinates per point, split over the two files")
+    parser.add_argument("--iters", type=int, default=5, help="iterations of the long run")
+    parser.add_argument("--repeats", type=int, default=3, help="runs per measurement, the best one kept")
+    parser.add_argument("--data-dir", default=os.path.join("/tmp", "kmeans_bench"),
+                        help="where the generated inputs are kept between runs")
+    parser.add_argument("--output", help="file to write the JSON results to")
+    parser.add_argument("--module-dir", default=os.getcwd(),
+                        help="directory containing kmeans_pp.py and the compiled mykmeanssp module")
+    args = parser.parse_args()
+
+    module_dir = os.path.abspath(args.module_dir)
+    ns = [int(value) for value in args.n.split(",")]
+    ks = [int(value) for value in args.k.split(",")]
+    if args.dim < 2:
+        parser.error("--dim must be at least 2 (one coordinate per file)")
+    if not 1 <= args.iters < 798:
+        parser.error("--iters must be between 1 and 797 (kmeans_pp.py takes fewer than 800)")
+    if args.repeats < 1:
+        parser.error("--repeats must be at least 1")
+
+    reports = []
+    print(f"dim={args.dim} iters={args.iters}  ({module_dir})")
+    print(f"{'N':>10} {'K':>5} {'input MB':>9} {'load s':>8} {'ms/iter':>9} {'ns/pt/cent':>11} {'GB/s':>7}")
+    for n in ns:
+        file1, file2 = write_inputs(args.data_dir, n, args.dim)
+        input_mb = (os.path.getsize(file1) + os.path.getsize(file2)) / 1e6
+        for k in ks:
+            if k >= n:
+                continue
+            short = run_cli(module_dir, k, 1, file1, file2, args.repeats)
+            long = run_cli(module_dir, k, 1 + args.iters, file1, file2, args.repeats)
+            per_iteration = max((long - short) / args.iters, 0.0)
+            load = max(short - per_iteration, 0.0)
+            ns_per_point_centroid = per_iteration * 1e9 / (n * k)
+            gb_per_s = n * args.dim * 8 / per_iteration / 1e9 if per_iteration > 0 else 0.0
+
+            print(f"{n:>10} {k:>5} {input_mb:>9.1f} {load:>8.3f} {per_iteration * 1000:>9.2f}"
+                  f" {ns_per_point_centroid:>11.4f} {gb_per_s:>7.2f}")
+            reports.append({
+                "n": n, "k": k, "dim": args.dim, "iters": args.iters, "input_mb": input_mb,
+                "load_seconds": load, "seconds_per_iteration": per_iteration,
+                "ns_per_point_centroid": ns_per_point_centroid, "gb_per_s": gb_per_s,
+                "total_seconds": long,
+            })
+
+    if args.output:
+        with open(args.output, "w") as out:
+            json.dump(reports, out, indent=1)
+    print(json.dumps(reports))
+
+
+if __name__ == "__main__":
+    main()
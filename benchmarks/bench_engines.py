@@ -0,0 +1,99 @@
+"""
+bench_engines.py
+
+Compares the Assignment Step engines of mykmeanssp.fit on large K:
+- wall time and time per iteration of every engine
+- share of the point-to-centroid distances it avoided
+- whether it reproduced the Lloyd centroids and labels exactly
+
+The data is N points drawn around K random centers, so the clusters settle
+the way real ones do and the bounded engines have something to skip. All
+engines start from the same centroids and run the same number of iterations
+(epsilon = 0).
+
+Usage:
+    python3 benchmarks/bench_engines.py [--n 20000] [--dim 16]
+                                        [--k 1000,4000,16000] [--iters 20]
+                                        [--algorithms lloyd,blocked,yinyang]
+                                        [--n-threads 1] [--module-dir .]
+"""
+
+import argparse
+import json
+import os
+import sys
+import time
+
+import numpy as np
+
+
+def make_data(n, dim, k, seed=0):
+    """N points around K random centers, plus K of them as initial centroids."""
+    rng = np.random.default_rng(seed)
+    centers = rng.standard_normal((k, dim)) * 4.0
+    points = centers[rng.integers(0, k, n)] + rng.standard_normal((n, dim))
+    centroids = points[rng.choice(n, k, replace=False)].copy()
+    return points, centroids
+
+
+def run_engine(mykmeanssp, algorithm, points, centroids, iters, n_threads):
+    """Runs one fit and returns (seconds, centroids, labels, stats)."""
+    stats = {}
+    start = time.perf_counter()
+    final, labels = mykmeanssp.fit(len(centroids), iters, 0.0, points, centroids,
+                                   output="buffer", algorithm=algorithm,
+                                   n_threads=n_threads, stats=stats)
+    elapsed = time.perf_counter() - start
+    return elapsed, np.asarray(final), np.asarray(labels), stats
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the mykmeanssp engines for large K")
+    parser.add_argument("--n", type=int, default=20000, help="number of points")
+    parser.add_argument("--dim", type=int, default=16, help="dimension of each point")
+    parser.add_argument("--k", default="1000,4000,16000", help="comma-separated cluster counts")
+    parser.add_argument("--iters", type=int, default=20, help="iterations per fit")
+    parser.add_argument("--algorithms", default="lloyd,blocked,yinyang",
+                        help="comma-separated engines; the first one is the reference")
+    parser.add_argument("--n-threads", type=int, default=1, help="threads per fit (0 = all CPUs)")
+    parser.add_argument("--module-dir", default=os.getcwd(),
+                        help="directory containing the compiled mykmeanssp module")
+    args = parser.parse_args()
+
+    sys.path.insert(0, os.path.abspath(args.module_dir))
+    import mykmeanssp
+
+    algorithms = args.algorithms.split(",")
+    ks = [int(value) for value in args.k.split(",")]
+    if max(ks) > args.n:
+        parser.error("every K must be at most --n")
+
+    reports = []
+    for k in ks:
+        points, centroids = make_data(args.n, args.dim, k)
+        print(f"N={args.n} dim={args.dim} K={k} iters={args.iters} threads={args.n_threads}")
+
+        reference = None
+        for algorithm in algorithms:
+            seconds, final, labels, stats = run_engine(mykmeanssp, algorithm, points, centroids,
+                                                       args.iters, args.n_threads)
+            if reference is None:
+                reference = (final, labels)
+            exact = bool(np.array_equal(final, reference[0]) and np.array_equal(labels, reference[1]))
+            full = stats["distance_evals"] + stats["distance_evals_avoided"]
+            avoided = stats["distance_evals_avoided"] / full if full else 0.0
+
+            print(f"  {algorithm:8s}: {seconds:8.3f} s  {seconds / max(stats['iterations'], 1) * 1000:9.1f} ms/iter"
+                  f"  avoided {avoided * 100:5.1f}%  {'exact' if exact else 'DIFFERS'}")
+            reports.append({
+                "n": args.n, "dim": args.dim, "k": k, "algorithm": algorithm,
+                "n_threads": args.n_threads, "iterations": stats["iterations"],
+                "seconds": seconds, "distance_evals": stats["distance_evals"],
+                "avoided_fraction": avoided, "exact": exact,
+            })
+
+    print(json.dumps(reports))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,300 @@
+/*
+ * bench_kernels.c
+ *
+ * Micro-benchmarks of the inner kernels of the engine (kmeans.c), over a
+ * grid of N points, K centroids and dim dimensions:
+ * - "compute_distance":      one call per point and centroid
+ * - "find_closest_centroid": the row-major scan of the K centroids, per point
+ * - "closest_simd":          the dispatched SIMD kernel for this K and dim
+ *                            (kmeans_simd_kernel), as the Lloyd engine uses it
+ * - "accumulate_update":     accumulate_range over all the points (fixed
+ *                            labels) followed by kmeans_update_step
+ *
+ * Every cell is timed `repeats` times and the best run is kept. It reports:
+ * - ns_per_point_centroid: run time / (N x K), comparable across kernels
+ *   (for accumulate_update, whose work does not grow with K, ns_per_point
+ *   is the one to look at)
+ * - gb_per_s: bytes of operands the kernel reads / run time: the point and
+ *   the centroid for every distance (2 x dim doubles), the point once plus
+ *   every centroid per point for the scans, and the points, labels and
+ *   K x dim sums and centroids for accumulate_update
+ *
+ * Human-readable lines come first; the last line is the JSON array of every
+ * cell, for comparing engines and builds.
+ *
+ * Build and run from the repository root (the engine without the Python glue):
+ *     gcc -O2 -ffp-contract=off -pthread -o bench_kernels benchmarks/bench_kernels.c \
+ *         kmeans.c kmeans_*.c -lm
+ *     ./bench_kernels [--n=10000,100000] [--k=4,16,64,256] [--dim=2,8,32]
+ *                     [--repeats=3] [--simd=auto]
+ */
+
+#include "../kmeans.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Most values a grid axis takes */
+#define MAX_AXIS 16
+
+/* The kernels, in report order */
+#define N_KERNELS 4
+
+/*declaration of structs*/
+struct grid_axis;
+struct cell_result;
+
+/*declaration of functions*/
+static double seconds_now(void);
+static int parse_axis(const char *text, struct grid_axis *axis);
+static void fill_random(double *v, size_t count, unsigned long *state);
+static double run_kernel(int kernel, const struct matrix *data, const struct matrix *centroids,
+                         struct kmeans_workspace *ws, int *labels, double *sink);
+static double kernel_bytes(int kernel, size_t N, int K, int dim);
+
+/*implementations of structs*/
+
+/* The values of one of N, K and dim */
+struct grid_axis
+{
+    long values[MAX_AXIS];
+    int count;
+};
+
+/* What one kernel did on one cell of the grid */
+struct cell_result
+{
+    int kernel;
+    size_t n;
+    int k;
+    int dim;
+    double seconds;
+    double ns_per_point;
+    double ns_per_point_centroid;
+    double gb_per_s;
+};
+
+static const char *const kernel_names[N_KERNELS] = {
+    "compute_distance", "find_closest_centroid", "closest_simd", "accumulate_update"
+};
+
+
+/* Monotonic wall clock, in seconds */
+static double seconds_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Parses "a,b,c" into axis. Returns 0, or -1 if a value is not a positive number */
+static int parse_axis(const char *text, struct grid_axis *axis) {
+    char *end;
+
+    axis->count = 0;
+    while (*text != '\0' && axis->count < MAX_AXIS) {
+        axis->values[axis->count] = strtol(text, &end, 10);
+        if (end == text || axis->values[axis->count] <= 0 || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        axis->count++;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return axis->count > 0 ? 0 : -1;
+}
+
+/* Uniform values in [-10, 10) from a small LCG, the same on every run */
+static void fill_random(double *v, size_t count, unsigned long *state) {
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        *state = *state * 1103515245UL + 12345UL;
+        v[i] = (double)((*state >> 8) % 2000000UL) / 100000.0 - 10.0;
+    }
+}
+
+/*
+ * Runs one kernel over every point once and returns its wall time. sink
+ * receives something that depends on every result, so nothing is optimized out.
+ */
+static double run_kernel(int kernel, const struct matrix *data, const struct matrix *centroids,
+                         struct kmeans_workspace *ws, int *labels, double *sink) {
+    int K = (int)centroids->rows;
+    int dim = data->dim;
+    double start, elapsed, acc = 0.0;
+    struct matrix moved;
+    closest_centroid_fn closest;
+    size_t i;
+    int k;
+
+    start = seconds_now();
+    switch (kernel) {
+    case 0:
+        for (i = 0; i < data->rows; i++) {
+            for (k = 0; k < K; k++) {
+                acc += compute_distance(MATRIX_ROW(data, i), MATRIX_ROW(centroids, k), dim);
+            }
+        }
+        break;
+    case 1:
+        for (i = 0; i < data->rows; i++) {
+            acc += find_closest_centroid(centroids, MATRIX_ROW(data, i));
+        }
+        break;
+    case 2:
+        closest = kmeans_simd_kernel(K, dim);
+        for (i = 0; i < data->rows; i++) {
+            acc += closest(ws->centroids_soa, K, dim, MATRIX_ROW(data, i), NULL);
+        }
+        break;
+    default:
+        /* The Update Step moves the centroids: work on a copy in the batch scratch */
+        moved = ws->batch;
+        memcpy(moved.data, centroids->data, (size_t)K * (size_t)dim * sizeof(double));
+        start = seconds_now();
+        zero_out_vector(ws->sums.data, K * dim);
+        memset(ws->counts, 0, (size_t)K * sizeof(int));
+        accumulate_range(data, 0, data->rows, labels, ws);
+        acc += kmeans_update_step(&moved, ws, data->data, 0.0);
+        acc += moved.data[0];
+        break;
+    }
+    elapsed = seconds_now() - start;
+    *sink += acc;
+    return elapsed;
+}
+
+/* Bytes of operands one run of the kernel reads (see the top of the file) */
+static double kernel_bytes(int kernel, size_t N, int K, int dim) {
+    double n = (double)N, k = (double)K, d = (double)dim, word = (double)sizeof(double);
+
+    switch (kernel) {
+    case 0:
+        return n * k * 2.0 * d * word;
+    case 1:
+    case 2:
+        return n * d * word + n * k * d * word;
+    default:
+        return n * d * word + n * (double)sizeof(int) + 2.0 * k * d * word;
+    }
+}
+
+int main(int argc, char **argv) {
+    struct grid_axis ns, ks, dims;
+    struct kmeans_options opts;
+    struct kmeans_workspace ws;
+    struct arena arena;
+    struct matrix data, centroids;
+    struct cell_result *results, *result;
+    int n_results = 0;
+    const char *simd = "auto";
+    unsigned long state = 12345;
+    double sink = 0.0, best, t;
+    int *labels;
+    int repeats = 3;
+    int a, in, ik, id, kernel, r;
+    size_t N, i;
+    int K, dim;
+
+    parse_axis("10000,100000", &ns);
+    parse_axis("4,16,64,256", &ks);
+    parse_axis("2,8,32", &dims);
+    for (a = 1; a < argc; a++) {
+        if ((strncmp(argv[a], "--n=", 4) == 0 && parse_axis(argv[a] + 4, &ns) == 0)
+            || (strncmp(argv[a], "--k=", 4) == 0 && parse_axis(argv[a] + 4, &ks) == 0)
+            || (strncmp(argv[a], "--dim=", 6) == 0 && parse_axis(argv[a] + 6, &dims) == 0)
+            || (strncmp(argv[a], "--repeats=", 10) == 0 && (repeats = atoi(argv[a] + 10)) > 0)) {
+            continue;
+        }
+        if (strncmp(argv[a], "--simd=", 7) == 0) {
+            simd = argv[a] + 7;
+            continue;
+        }
+        fprintf(stderr, "usage: %s [--n=N,...] [--k=K,...] [--dim=D,...] [--repeats=R] [--simd=NAME]\n",
+                argv[0]);
+        return 1;
+    }
+    if (kmeans_simd_select(simd) != 0) {
+        fprintf(stderr, "unknown or unsupported --simd=%s\n", simd);
+        return 1;
+    }
+
+    results = malloc((size_t)ns.count * (size_t)ks.count * (size_t)dims.count * N_KERNELS
+                     * sizeof(struct cell_result));
+    if (results == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    opts.iter = 1;
+    opts.epsilon = 0.0;
+    opts.algorithm = KMEANS_LLOYD;
+    opts.n_threads = 1;
+
+    printf("simd: %s, best of %d runs\n", kmeans_simd_name(), repeats);
+    printf("%-22s %9s %5s %4s %12s %14s %9s\n", "kernel", "N", "K", "dim", "ns/point", "ns/point/cent",
+           "GB/s");
+    for (in = 0; in < ns.count; in++) {
+        for (ik = 0; ik < ks.count; ik++) {
+            for (id = 0; id < dims.count; id++) {
+                N = (size_t)ns.values[in];
+                K = (int)ks.values[ik];
+                dim = (int)dims.values[id];
+                if (arena_init(&arena, arena_block_size(N * (size_t)dim * sizeof(double))
+                                       + 2 * arena_block_size((size_t)K * (size_t)dim * sizeof(double))
+                                       + arena_block_size(N * sizeof(int))
+                                       + kmeans_workspace_bytes(N, K, dim, &opts)) != 0) {
+                    fprintf(stderr, "out of memory at N=%lu K=%d dim=%d\n", (unsigned long)N, K, dim);
+                    return 1;
+                }
+                matrix_carve(&data, &arena, N, dim);
+                matrix_carve(&centroids, &arena, (size_t)K, dim);
+                labels = arena_alloc(&arena, N * sizeof(int));
+                kmeans_workspace_carve(&ws, &arena, N, K, dim, &opts);
+                matrix_carve(&ws.batch, &arena, (size_t)K, dim);
+                fill_random(data.data, N * (size_t)dim, &state);
+                fill_random(centroids.data, (size_t)K * (size_t)dim, &state);
+                matrix_to_soa(&centroids, ws.centroids_soa);
+                for (i = 0; i < N; i++) {
+                    labels[i] = (int)(i % (size_t)K);
+                }
+
+                for (kernel = 0; kernel < N_KERNELS; kernel++) {
+                    best = 0.0;
+                    for (r = 0; r < repeats; r++) {
+                        t = run_kernel(kernel, &data, &centroids, &ws, labels, &sink);
+                        best = r == 0 || t < best ? t : best;
+                    }
+                    result = &results[n_results++];
+                    result->kernel = kernel;
+                    result->n = N;
+                    result->k = K;
+                    result->dim = dim;
+                    result->seconds = best;
+                    result->ns_per_point = best * 1e9 / (double)N;
+                    result->ns_per_point_centroid = best * 1e9 / ((double)N * (double)K);
+                    result->gb_per_s = best > 0.0 ? kernel_bytes(kernel, N, K, dim) / best / 1e9 : 0.0;
+                    printf("%-22s %9lu %5d %4d %12.2f %14.4f %9.2f\n", kernel_names[kernel], (unsigned long)N,
+                           K, dim, result->ns_per_point, result->ns_per_point_centroid, result->gb_per_s);
+                }
+                arena_free(&arena);
+            }
+        }
+    }
+    /* Printed so the compiler cannot drop the kernels' work */
+    printf("checksum: %.6g\n", sink);
+
+    printf("[");
+    for (r = 0; r < n_results; r++) {
+        result = &results[r];
+        printf("%s{\"kernel\": \"%s\", \"simd\": \"%s\", \"n\": %lu, \"k\": %d, \"dim\": %d, "
+               "\"seconds\": %.9g, \"ns_per_point\": %.6g, \"ns_per_point_centroid\": %.6g, "
+               "\"gb_per_s\": %.6g}", r > 0 ? ", " : "", kernel_names[result->kernel], kmeans_simd_name(),
+               (unsigned long)result->n, result->k, result->dim, result->seconds, result->ns_per_point,
+               result->ns_per_point_centroid, result->gb_per_s);
+    }
+    printf("]\n");
+    free(results);
+    return 0;
+}
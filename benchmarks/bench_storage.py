@@ -0,0 +1,115 @@
+"""
+bench_storage.py
+
+Measures the cost of the storage layer behind mykmeanssp.fit:
+- ingestion time (Python lists -> native blocks, plus building the result)
+- time per Lloyd iteration
+- peak RSS of the whole process
+
+With --dtype float32 the points are handed over as float32 arrays and fit
+runs in float32 mode (float distances, double accumulators); run it next to
+the default float64 to compare memory and time per iteration.
+
+Every measurement runs in a fresh subprocess so peak RSS is not polluted by
+earlier runs. To compare two builds (e.g. before/after a change), build each
+one in its own checkout and point --module-dir at the directory holding the
+compiled mykmeanssp*.so.
+
+Usage:
+    python3 benchmarks/bench_storage.py [--n 200000] [--dim 32] [--k 64]
+                                        [--iters 5] [--input list|numpy]
+                                        [--dtype float64|float32]
+                                        [--module-dir .]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+# The child does the actual work and prints one JSON line back to the parent.
+CHILD_CODE = r"""
+import json, random, resource, sys, time
+sys.path.insert(0, sys.argv[1])
+import mykmeanssp
+
+n, dim, k, iters = (int(a) for a in sys.argv[2:6])
+rnd = random.Random(0)
+points = [[rnd.uniform(-10, 10) for _ in range(dim)] for _ in range(n)]
+centroids = [p[:] for p in points[:k]]
+dtype = sys.argv[7]
+if sys.argv[6] == "numpy":
+    import numpy as np
+    points = np.array(points, dtype=dtype)
+    centroids = np.array(centroids)
+rss_before = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+
+start = time.perf_counter()
+# epsilon = 0 keeps the loop from stopping early on random data
+if dtype == "float32":
+    mykmeanssp.fit(k, iters, 0.0, points, centroids, dtype=dtype)
+else:
+    # Older builds of fit take no keywords at all
+    mykmeanssp.fit(k, iters, 0.0, points, centroids)
+elapsed = time.perf_counter() - start
+
+print(json.dumps({
+    "seconds": elapsed,
+    "inputs_rss_kb": rss_before,
+    "peak_rss_kb": resource.getrusage(resource.RUSAGE_SELF).ru_maxrss,
+}))
+"""
+
+
+def run_child(module_dir, n, dim, k, iters, input_kind, dtype):
+    """Runs one fit in a fresh interpreter and returns its JSON report."""
+    cmd = [sys.executable, "-c", CHILD_CODE, module_dir,
+           str(n), str(dim), str(k), str(iters), input_kind, dtype]
+    result = subprocess.run(cmd, capture_output=True, text=True, check=True)
+    return json.loads(result.stdout)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the mykmeanssp storage layer")
+    parser.add_argument("--n", type=int, default=200000, help="number of points")
+    parser.add_argument("--dim", type=int, default=32, help="dimension of each point")
+    parser.add_argument("--k", type=int, default=64, help="number of clusters")
+    parser.add_argument("--iters", type=int, default=5, help="iterations for the long run")
+    parser.add_argument("--input", choices=("list", "numpy"), default="list",
+                        help="pass the data as lists of floats or as numpy arrays")
+    parser.add_argument("--dtype", choices=("float64", "float32"), default="float64",
+                        help="precision fit runs in (and of the numpy input)")
+    parser.add_argument("--module-dir", default=os.getcwd(),
+                        help="directory containing the compiled mykmeanssp module")
+    args = parser.parse_args()
+
+    module_dir = os.path.abspath(args.module_dir)
+
+    # One iteration vs. 1 + iters iterations: the difference is pure Lloyd time,
+    # the remainder of the short run is ingestion and result conversion.
+    short = run_child(module_dir, args.n, args.dim, args.k, 1, args.input, args.dtype)
+    long = run_child(module_dir, args.n, args.dim, args.k, 1 + args.iters, args.input, args.dtype)
+
+    per_iteration = (long["seconds"] - short["seconds"]) / args.iters
+    ingestion = max(short["seconds"] - per_iteration, 0.0)
+
+    report = {
+        "module_dir": module_dir,
+        "n": args.n, "dim": args.dim, "k": args.k, "input": args.input, "dtype": args.dtype,
+        "ingestion_seconds": ingestion,
+        "seconds_per_iteration": per_iteration,
+        "peak_rss_mb": long["peak_rss_kb"] / 1024.0,
+        "native_rss_mb": (long["peak_rss_kb"] - long["inputs_rss_kb"]) / 1024.0,
+    }
+
+    print(f"N={args.n} dim={args.dim} K={args.k} input={args.input} dtype={args.dtype}  ({module_dir})")
+    print(f"  ingestion       : {ingestion * 1000:10.1f} ms")
+    print(f"  per iteration   : {per_iteration * 1000:10.1f} ms")
+    print(f"  peak RSS        : {report['peak_rss_mb']:10.1f} MB")
+    print(f"  native overhead : {report['native_rss_mb']:10.1f} MB  (peak RSS above the Python inputs)")
+    print(json.dumps(report))
+
+
+if __name__ == "__main__":
+    main()
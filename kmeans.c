@@ -0,0 +1,709 @@
+#include "kmeans.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+/*
+ * Rounds a byte count up to the arena alignment.
+ * Used both to size an arena up front and to advance it in arena_alloc.
+ */
+size_t arena_block_size(size_t bytes) {
+    return (bytes + (KMEANS_ALIGNMENT - 1)) & ~(size_t)(KMEANS_ALIGNMENT - 1);
+}
+
+/*
+ * Reserves one block of `capacity` bytes for the arena.
+ * Returns 0 on success, -1 if allocation fails.
+ */
+int arena_init(struct arena *a, size_t capacity) {
+    a->used = 0;
+    a->capacity = arena_block_size(capacity);
+    a->base = NULL;
+    if (a->capacity == 0) {
+        return 0;
+    }
+    /* Over-allocate by one line so the first block can be aligned by hand */
+    a->base = malloc(a->capacity + KMEANS_ALIGNMENT);
+    if (a->base == NULL) {
+        a->capacity = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Hands out the next `bytes` of the arena, aligned to KMEANS_ALIGNMENT.
+ * Returns NULL when the arena is exhausted (the caller sized it wrong).
+ */
+void *arena_alloc(struct arena *a, size_t bytes) {
+    unsigned char *start;
+    size_t offset;
+    size_t size = arena_block_size(bytes);
+
+    if (a->base == NULL || size > a->capacity - a->used) {
+        return NULL;
+    }
+
+    /* Align the absolute address, not the offset, since malloc only guarantees 16 bytes */
+    offset = (size_t)(-(uintptr_t)a->base & (KMEANS_ALIGNMENT - 1));
+    start = a->base + offset + a->used;
+    a->used += size;
+    return start;
+}
+
+/* Releases the whole arena; every block carved from it becomes invalid */
+void arena_free(struct arena *a) {
+    free(a->base);
+    a->base = NULL;
+    a->capacity = 0;
+    a->used = 0;
+}
+
+/*
+ * Carves a rows x dim matrix out of the arena.
+ * Returns 0 on success, -1 if the arena has no room left.
+ */
+int matrix_carve(struct matrix *m, struct arena *a, size_t rows, int dim) {
+    m->rows = rows;
+    m->dim = dim;
+    m->data = arena_alloc(a, rows * (size_t)dim * sizeof(double));
+    return m->data == NULL ? -1 : 0;
+}
+
+
+/* Bytes of arena space needed by kmeans_workspace_carve for N points and K clusters */
+size_t kmeans_workspace_bytes(size_t N, int K, int dim, const struct kmeans_options *opts) {
+    size_t groups, nodes, candidates;
+    size_t bytes = 2 * arena_block_size((size_t)K * (size_t)dim * sizeof(double))
+                 + arena_block_size((size_t)K * sizeof(int))
+                 + arena_block_size(N * sizeof(int));
+
+    if (opts->n_threads > 1) {
+        bytes += arena_block_size((size_t)opts->n_threads * sizeof(struct kmeans_workspace))
+               + (size_t)opts->n_threads * (arena_block_size((size_t)K * (size_t)dim * sizeof(double))
+                                            + arena_block_size((size_t)K * sizeof(int)));
+    }
+
+    if (opts->algorithm == KMEANS_BLOCKED) {
+        bytes += arena_block_size(N * sizeof(double))
+               + arena_block_size((size_t)K * sizeof(double));
+    }
+
+    if (opts->algorithm == KMEANS_ELKAN || opts->algorithm == KMEANS_HAMERLY) {
+        bytes += arena_block_size(N * sizeof(double))
+               + 2 * arena_block_size((size_t)K * sizeof(double))
+               + arena_block_size((size_t)K * (size_t)dim * sizeof(double));
+    }
+    if (opts->algorithm == KMEANS_ELKAN) {
+        bytes += arena_block_size(N * (size_t)K * sizeof(double))
+               + arena_block_size((size_t)K * (size_t)K * sizeof(double));
+    }
+    if (opts->algorithm == KMEANS_HAMERLY) {
+        bytes += arena_block_size(N * sizeof(double));
+    }
+    if (opts->algorithm == KMEANS_YINYANG) {
+        groups = (size_t)kmeans_yinyang_groups(K);
+        bytes += arena_block_size(N * sizeof(double))
+               + arena_block_size(N * groups * sizeof(double))
+               + arena_block_size((size_t)K * sizeof(double))
+               + 2 * arena_block_size((size_t)K * (size_t)dim * sizeof(double))
+               + 2 * arena_block_size((size_t)K * sizeof(int))
+               + arena_block_size((groups + 1) * sizeof(int))
+               + arena_block_size(groups * sizeof(double))
+               + arena_block_size(groups * (size_t)dim * sizeof(double));
+    }
+    if (opts->algorithm == KMEANS_KDTREE) {
+        nodes = kmeans_kdtree_nodes(N);
+        candidates = ((size_t)kmeans_kdtree_depth(N) + 2) * (size_t)K * sizeof(int);
+        bytes += arena_block_size(nodes * sizeof(struct kd_node))
+               + arena_block_size(N * sizeof(size_t))
+               + arena_block_size(N * (size_t)dim * sizeof(double))
+               + 3 * arena_block_size(nodes * (size_t)dim * sizeof(double))
+               + 2 * arena_block_size(nodes * sizeof(int))
+               + arena_block_size(candidates);
+        if (opts->n_threads > 1) {
+            bytes += (size_t)opts->n_threads * arena_block_size(candidates);
+        }
+    }
+    return bytes;
+}
+
+/*
+ * Carves the Update Step accumulators (sums and counts), the labels, the SoA
+ * centroid mirror and any engine-specific scratch out of the arena.
+ * Returns 0 on success, -1 if the arena has no room left.
+ */
+int kmeans_workspace_carve(struct kmeans_workspace *ws, struct arena *a, size_t N, int K, int dim,
+                           const struct kmeans_options *opts) {
+    int t;
+
+    if (matrix_carve(&ws->sums, a, (size_t)K, dim) != 0) {
+        return -1;
+    }
+    ws->counts = arena_alloc(a, (size_t)K * sizeof(int));
+    ws->labels = arena_alloc(a, N * sizeof(int));
+    ws->centroids_soa = arena_alloc(a, (size_t)K * (size_t)dim * sizeof(double));
+    ws->centroids_soa_f32 = NULL;
+    if (ws->counts == NULL || ws->labels == NULL || ws->centroids_soa == NULL) {
+        return -1;
+    }
+
+    ws->point_norms = NULL;
+    ws->centroid_norms = NULL;
+    ws->point_norms_ready = 0;
+    if (opts->algorithm == KMEANS_BLOCKED) {
+        ws->point_norms = arena_alloc(a, N * sizeof(double));
+        ws->centroid_norms = arena_alloc(a, (size_t)K * sizeof(double));
+        if (ws->point_norms == NULL || ws->centroid_norms == NULL) {
+            return -1;
+        }
+    }
+
+    ws->upper = NULL;
+    ws->lower = NULL;
+    ws->centroid_half = NULL;
+    ws->nearest_half = NULL;
+    ws->drift = NULL;
+    ws->previous.data = NULL;
+    ws->bounds_ready = 0;
+    ws->distance_evals = 0;
+    if (opts->algorithm == KMEANS_ELKAN || opts->algorithm == KMEANS_HAMERLY) {
+        ws->upper = arena_alloc(a, N * sizeof(double));
+        ws->nearest_half = arena_alloc(a, (size_t)K * sizeof(double));
+        ws->drift = arena_alloc(a, (size_t)K * sizeof(double));
+        if (opts->algorithm == KMEANS_ELKAN) {
+            ws->lower = arena_alloc(a, N * (size_t)K * sizeof(double));
+            ws->centroid_half = arena_alloc(a, (size_t)K * (size_t)K * sizeof(double));
+            if (ws->centroid_half == NULL) {
+                return -1;
+            }
+        }
+        else {
+            ws->lower = arena_alloc(a, N * sizeof(double));
+        }
+        if (ws->upper == NULL || ws->lower == NULL || ws->nearest_half == NULL || ws->drift == NULL
+            || matrix_carve(&ws->previous, a, (size_t)K, dim) != 0) {
+            return -1;
+        }
+    }
+
+    ws->n_groups = 0;
+    ws->group_of = NULL;
+    ws->group_members = NULL;
+    ws->group_start = NULL;
+    ws->group_drift = NULL;
+    ws->group_soa = NULL;
+    ws->group_centers.data = NULL;
+    if (opts->algorithm == KMEANS_YINYANG) {
+        ws->n_groups = kmeans_yinyang_groups(K);
+        ws->upper = arena_alloc(a, N * sizeof(double));
+        ws->lower = arena_alloc(a, N * (size_t)ws->n_groups * sizeof(double));
+        ws->drift = arena_alloc(a, (size_t)K * sizeof(double));
+        ws->group_of = arena_alloc(a, (size_t)K * sizeof(int));
+        ws->group_members = arena_alloc(a, (size_t)K * sizeof(int));
+        ws->group_start = arena_alloc(a, ((size_t)ws->n_groups + 1) * sizeof(int));
+        ws->group_drift = arena_alloc(a, (size_t)ws->n_groups * sizeof(double));
+        ws->group_soa = arena_alloc(a, (size_t)K * (size_t)dim * sizeof(double));
+        if (ws->upper == NULL || ws->lower == NULL || ws->drift == NULL || ws->group_of == NULL
+            || ws->group_members == NULL || ws->group_start == NULL || ws->group_drift == NULL
+            || ws->group_soa == NULL
+            || matrix_carve(&ws->previous, a, (size_t)K, dim) != 0
+            || matrix_carve(&ws->group_centers, a, (size_t)ws->n_groups, dim) != 0) {
+            return -1;
+        }
+    }
+
+    ws->kd_nodes = NULL;
+    ws->kd_n_nodes = 0;
+    ws->kd_depth = 0;
+    ws->kd_points = NULL;
+    ws->kd_data.data = NULL;
+    ws->kd_low = NULL;
+    ws->kd_high = NULL;
+    ws->kd_sums = NULL;
+    ws->kd_owner = NULL;
+    ws->kd_pass = NULL;
+    ws->kd_passes = 0;
+    ws->kd_candidates = NULL;
+    if (opts->algorithm == KMEANS_KDTREE) {
+        ws->kd_n_nodes = kmeans_kdtree_nodes(N);
+        ws->kd_depth = kmeans_kdtree_depth(N);
+        ws->kd_nodes = arena_alloc(a, ws->kd_n_nodes * sizeof(struct kd_node));
+        ws->kd_points = arena_alloc(a, N * sizeof(size_t));
+        ws->kd_low = arena_alloc(a, ws->kd_n_nodes * (size_t)dim * sizeof(double));
+        ws->kd_high = arena_alloc(a, ws->kd_n_nodes * (size_t)dim * sizeof(double));
+        ws->kd_sums = arena_alloc(a, ws->kd_n_nodes * (size_t)dim * sizeof(double));
+        ws->kd_owner = arena_alloc(a, ws->kd_n_nodes * sizeof(int));
+        ws->kd_pass = arena_alloc(a, ws->kd_n_nodes * sizeof(int));
+        ws->kd_candidates = arena_alloc(a, ((size_t)ws->kd_depth + 2) * (size_t)K * sizeof(int));
+        if (ws->kd_nodes == NULL || ws->kd_points == NULL || ws->kd_low == NULL || ws->kd_high == NULL
+            || ws->kd_sums == NULL || ws->kd_owner == NULL || ws->kd_pass == NULL
+            || ws->kd_candidates == NULL || matrix_carve(&ws->kd_data, a, N, dim) != 0) {
+            return -1;
+        }
+    }
+
+    ws->batch.data = NULL;
+    ws->seen = NULL;
+    ws->fallback = NULL;
+    ws->inertia = 0.0;
+    ws->telemetry = NULL;
+
+    ws->partials = NULL;
+    if (opts->n_threads > 1) {
+        ws->partials = arena_alloc(a, (size_t)opts->n_threads * sizeof(struct kmeans_workspace));
+        if (ws->partials == NULL) {
+            return -1;
+        }
+        /* Each thread shares everything but the accumulators, which get their own cache lines */
+        for (t = 0; t < opts->n_threads; t++) {
+            ws->partials[t] = *ws;
+            ws->partials[t].partials = NULL;
+            if (matrix_carve(&ws->partials[t].sums, a, (size_t)K, dim) != 0) {
+                return -1;
+            }
+            ws->partials[t].counts = arena_alloc(a, (size_t)K * sizeof(int));
+            if (ws->partials[t].counts == NULL) {
+                return -1;
+            }
+            if (ws->kd_candidates != NULL) {
+                ws->partials[t].kd_candidates = arena_alloc(a, ((size_t)ws->kd_depth + 2) * (size_t)K * sizeof(int));
+                if (ws->partials[t].kd_candidates == NULL) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+ * Calculates the squared Euclidean distance between two vectors (points):
+ * the sum of the squared coordinate differences.
+ */
+double squared_distance(const double *v1, const double *v2, int dim) {
+    double diff;
+    double sum_dist = 0.0;
+    int i;
+
+    for (i = 0; i < dim; i++) {
+        diff = v1[i] - v2[i];
+        sum_dist += diff * diff;
+    }
+    return sum_dist;
+}
+
+/* Sum of the coordinate-wise products of two vectors */
+double dot_product(const double *v1, const double *v2, int dim) {
+    double sum = 0.0;
+    int i;
+
+    for (i = 0; i < dim; i++) {
+        sum += v1[i] * v2[i];
+    }
+    return sum;
+}
+
+/* Calculates the Euclidean distance between two vectors (points) */
+double compute_distance(const double *v1, const double *v2, int dim) {
+    return sqrt(squared_distance(v1, v2, dim));
+}
+
+/*
+ * Iterates through all centroids (row-major) to find the one closest to vectorX.
+ * Squared distances are compared, since sqrt does not change their order.
+ * Returns the index (0 to K-1) of the closest centroid.
+ */
+int find_closest_centroid(const struct matrix *centroids, const double *vectorX) {
+    int min_index = 0;
+    int i;
+    int K = (int)centroids->rows;
+    int dim = centroids->dim;
+    double distance, min_distance;
+
+    min_distance = squared_distance(centroids->data, vectorX, dim);
+    for (i = 1; i < K; i++) {
+        distance = squared_distance(MATRIX_ROW(centroids, i), vectorX, dim);
+        if (distance < min_distance) {
+            min_distance = distance;
+            min_index = i;
+        }
+    }
+    return min_index;
+}
+
+/*
+ * Adds the coordinate values of vector v2 to vector v1.
+ * v1 is modified in place (accumulating the sum), while v2 remains unchanged.
+ */
+void add_coordinates_from_other_vector(double *v1, const double *v2, int dim) {
+    int i;
+    for (i = 0; i < dim; i++) {
+        v1[i] += v2[i];
+    }
+}
+
+/*
+ * Divides every coordinate in vector v by a scalar integer.
+ * This is used in the Update Step to calculate the average (mean) of a cluster.
+ */
+void divide_vector_by_scalar(double *v, int dim, int scalar) {
+    int i;
+    for (i = 0; i < dim; i++) {
+        v[i] /= scalar;
+    }
+}
+
+/* Resets all coordinates of a given vector to 0.0*/
+void zero_out_vector(double *v, int dim) {
+    memset(v, 0, (size_t)dim * sizeof(double));
+}
+
+/*
+ * Writes a transposed (structure-of-arrays) copy of m into soa:
+ * coordinate j of row i lands at soa[j * rows + i].
+ * Handy for kernels that scan one coordinate across many vectors at once.
+ */
+void matrix_to_soa(const struct matrix *m, double *soa) {
+    size_t i;
+    int j;
+    for (i = 0; i < m->rows; i++) {
+        for (j = 0; j < m->dim; j++) {
+            soa[(size_t)j * m->rows + i] = MATRIX_ROW(m, i)[j];
+        }
+    }
+}
+
+
+/*
+ * Adds the points first..last-1 to the sums and counts of the clusters given
+ * by labels. Points are added in index order, which fixes the rounding of
+ * the sums no matter which engine chose the labels.
+ */
+void accumulate_range(const struct matrix *data, size_t first, size_t last,
+                      const int *labels, struct kmeans_workspace *ws) {
+    size_t i;
+    int dim = data->dim;
+
+    for (i = first; i < last; i++) {
+        ws->counts[labels[i]]++;
+        /* Add current point's coordinates to the cluster sum */
+        add_coordinates_from_other_vector(MATRIX_ROW(&ws->sums, labels[i]),
+                                          MATRIX_ROW(data, i), dim);
+    }
+}
+
+/* Assignment Step, one point at a time through the dispatched SIMD kernel */
+static void assign_range(const struct matrix *data, const struct matrix *centroids,
+                         size_t first, size_t last, struct kmeans_workspace *ws) {
+    size_t i;
+    int K = (int)centroids->rows;
+    closest_centroid_fn closest = kmeans_simd_kernel(K, centroids->dim);
+
+    for (i = first; i < last; i++) {
+        ws->labels[i] = closest(ws->centroids_soa, K, centroids->dim, MATRIX_ROW(data, i), NULL);
+    }
+    ws->distance_evals += (unsigned long long)(last - first) * (unsigned long long)K;
+    accumulate_range(data, first, last, ws->labels, ws);
+}
+
+/* Assignment Step for the points first..last-1 with the engine chosen in opts */
+static void assign_points(const struct matrix *data, const struct matrix *centroids,
+                          size_t first, size_t last, struct kmeans_workspace *ws,
+                          const struct kmeans_options *opts) {
+    switch (opts->algorithm) {
+    case KMEANS_BLOCKED:
+        kmeans_assign_blocked(data, centroids, first, last, ws);
+        break;
+    case KMEANS_ELKAN:
+        kmeans_assign_elkan(data, centroids, first, last, ws);
+        break;
+    case KMEANS_HAMERLY:
+        kmeans_assign_hamerly(data, centroids, first, last, ws);
+        break;
+    case KMEANS_YINYANG:
+        kmeans_assign_yinyang(data, centroids, first, last, ws);
+        break;
+    case KMEANS_KDTREE:
+        /* first..last are positions in tree order here, which slices the data just as well */
+        kmeans_assign_kdtree(data, centroids, first, last, ws);
+        break;
+    default:
+        assign_range(data, centroids, first, last, ws);
+        break;
+    }
+}
+
+/* Everything the threaded Assignment Step jobs need */
+struct lloyd_job
+{
+    const struct matrix *data;
+    const struct matrix *centroids;
+    struct kmeans_workspace *ws;
+    const struct kmeans_options *opts;
+    int accumulate;  /* Add to ws->sums and ws->counts instead of overwriting them */
+};
+
+/* Thread t assigns the t-th contiguous slice of the points into its private accumulators */
+static void assign_job(void *arg, int t, int n_threads) {
+    struct lloyd_job *job = arg;
+    struct kmeans_workspace *mine = &job->ws->partials[t];
+    struct matrix sums = mine->sums;
+    int *counts = mine->counts;
+    int *kd_candidates = mine->kd_candidates;
+    size_t N = job->data->rows;
+    int K = (int)job->centroids->rows;
+    double started = kmeans_trace_on ? kmeans_telemetry_clock() : 0.0;
+
+    /* Pick up whatever the serial refresh changed (norms, flags), keeping the own accumulators */
+    *mine = *job->ws;
+    mine->sums = sums;
+    mine->counts = counts;
+    mine->kd_candidates = kd_candidates;
+    mine->partials = NULL;
+    mine->distance_evals = 0;
+
+    zero_out_vector(mine->sums.data, K * job->centroids->dim);
+    memset(mine->counts, 0, (size_t)K * sizeof(int));
+    assign_points(job->data, job->centroids, N * (size_t)t / (size_t)n_threads,
+                  N * (size_t)(t + 1) / (size_t)n_threads, mine, job->opts);
+    if (kmeans_trace_on) {
+        kmeans_trace_span("assign slice", started, -1);
+    }
+}
+
+/*
+ * Sums the private accumulators of the clusters first..last-1 of the first
+ * n_partials threads into ws->sums and ws->counts, or adds them to what
+ * those already hold with accumulate. Partials are added in thread order,
+ * so for a given thread count the result does not depend on scheduling.
+ */
+void kmeans_reduce_partials(struct kmeans_workspace *ws, int n_partials, size_t first, size_t last,
+                            int accumulate) {
+    int dim = ws->sums.dim;
+    int p;
+    size_t j;
+
+    for (j = first; j < last; j++) {
+        if (!accumulate) {
+            zero_out_vector(MATRIX_ROW(&ws->sums, j), dim);
+            ws->counts[j] = 0;
+        }
+        for (p = 0; p < n_partials; p++) {
+            add_coordinates_from_other_vector(MATRIX_ROW(&ws->sums, j),
+                                              MATRIX_ROW(&ws->partials[p].sums, j), dim);
+            ws->counts[j] += ws->partials[p].counts[j];
+        }
+    }
+}
+
+/* Thread t sums the private accumulators of its slice of the clusters */
+static void reduce_job(void *arg, int t, int n_threads) {
+    struct lloyd_job *job = arg;
+    size_t K = job->centroids->rows;
+    double started = kmeans_trace_on ? kmeans_telemetry_clock() : 0.0;
+
+    kmeans_reduce_partials(job->ws, job->opts->n_threads, K * (size_t)t / (size_t)n_threads,
+                           K * (size_t)(t + 1) / (size_t)n_threads, job->accumulate);
+    if (kmeans_trace_on) {
+        kmeans_trace_span("reduce slice", started, -1);
+    }
+}
+
+/*
+ * Assignment Step over all the points of data, split across the pool's
+ * threads when opts->n_threads > 1 (it must then be the pool's size).
+ * The points are added to ws->sums and ws->counts, which start from zero
+ * unless accumulate is set; ws->distance_evals grows by the distances computed.
+ */
+void kmeans_assign_step(const struct matrix *data, const struct matrix *centroids,
+                        struct kmeans_workspace *ws, const struct kmeans_options *opts,
+                        struct thread_pool *pool, int accumulate) {
+    struct lloyd_job job;
+    int t;
+
+    if (opts->n_threads > 1) {
+        job.data = data;
+        job.centroids = centroids;
+        job.ws = ws;
+        job.opts = opts;
+        job.accumulate = accumulate;
+        pool_run(pool, assign_job, &job);
+        pool_run(pool, reduce_job, &job);
+        for (t = 0; t < opts->n_threads; t++) {
+            ws->distance_evals += ws->partials[t].distance_evals;
+        }
+        return;
+    }
+
+    if (!accumulate) {
+        /* Reset accumulators and counts for the new iteration */
+        zero_out_vector(ws->sums.data, (int)centroids->rows * centroids->dim);
+        memset(ws->counts, 0, centroids->rows * sizeof(int));
+    }
+    assign_points(data, centroids, 0, data->rows, ws, opts);
+}
+
+/*
+ * Update Step: moves every centroid to the mean of its points, from
+ * ws->sums (which it overwrites) and ws->counts. An empty cluster takes the
+ * coordinates of `fallback` instead. Returns 1 if no centroid moved by
+ * epsilon or more and none was empty, 0 otherwise.
+ */
+int kmeans_update_step(struct matrix *centroids, struct kmeans_workspace *ws, const double *fallback,
+                       double epsilon) {
+    int K = (int)centroids->rows;
+    int dim = centroids->dim;
+    int converged = 1;
+    int idx;
+    double *cent;
+    double *sum;
+
+    for (idx = 0; idx < K; idx++) {
+        cent = MATRIX_ROW(centroids, idx);
+        sum = MATRIX_ROW(&ws->sums, idx);
+
+        /* HANDLING EMPTY CLUSTERS */
+        if (ws->counts[idx] == 0) {
+            /* If a cluster is empty, copy coordinates from the fallback (the FIRST data point) */
+            memcpy(cent, fallback, (size_t)dim * sizeof(double));
+            /* If we forced a centroid move, convergence is not reached */
+            converged = 0;
+        }
+        else {
+            /* Normal case: calculate the mean (sum / count) */
+            divide_vector_by_scalar(sum, dim, ws->counts[idx]);
+
+            /* Check convergence: distance between old and new position */
+            if (compute_distance(cent, sum, dim) >= epsilon) {
+                converged = 0;
+            }
+
+            /* Update centroid coordinates */
+            memcpy(cent, sum, (size_t)dim * sizeof(double));
+        }
+    }
+    return converged;
+}
+
+/*
+ * Lloyd iterations over a dense data block.
+ * centroids holds the initial centroids on entry and the final ones on exit.
+ * Stops after opts->iter iterations or once no centroid moved by opts->epsilon or more.
+ * If labels is not NULL, it receives (for every point) the cluster chosen by
+ * the last Assignment Step, i.e. the one that produced the final centroids.
+ * With opts->n_threads > 1 the Assignment Step is split across a thread pool;
+ * the sums are then added up in a different order, so the centroids may differ
+ * from the single-threaded ones in the last bits.
+ * If stats is not NULL, it receives the iteration and distance counts, and
+ * if ws->telemetry is not NULL, a record of every iteration. With tracing
+ * on, every iteration and its two steps are recorded as spans.
+ * Returns the number of iterations performed.
+ */
+int kmeans_lloyd(const struct matrix *data, struct matrix *centroids, struct kmeans_workspace *ws,
+                 const struct kmeans_options *opts, int *labels, struct kmeans_stats *stats) {
+    int K = (int)centroids->rows;
+    int dim = centroids->dim;
+    int iteration = 0;
+    int converged = 0;
+    size_t i;
+    struct thread_pool *pool = NULL;
+    struct kmeans_options run_opts = *opts;
+    closest_centroid_fn closest;
+    double iteration_started = 0.0, step_started = 0.0;
+
+    if (opts->algorithm == KMEANS_BLOCKED && !ws->point_norms_ready) {
+        kmeans_blocked_prepare(data, ws);
+    }
+    else if (opts->algorithm == KMEANS_KDTREE) {
+        kmeans_kdtree_build(data, ws);
+    }
+    ws->bounds_ready = 0;
+    ws->distance_evals = 0;
+
+    if (opts->n_threads > 1) {
+        /* The pool may come up smaller than asked; the extra partials then stay unused */
+        pool = pool_create(opts->n_threads);
+        run_opts.n_threads = pool_size(pool);
+    }
+
+    /* MAIN K-MEANS LOOP */
+    while (iteration < opts->iter && !converged) {
+        if (ws->telemetry != NULL) {
+            ws->telemetry->started = kmeans_telemetry_clock();
+        }
+        if (kmeans_trace_on) {
+            iteration_started = step_started = kmeans_telemetry_clock();
+        }
+
+        /* The SIMD kernels scan one coordinate of many centroids at a time */
+        matrix_to_soa(centroids, ws->centroids_soa);
+        if (opts->algorithm == KMEANS_BLOCKED) {
+            kmeans_blocked_refresh(centroids, ws);
+        }
+        else if (opts->algorithm == KMEANS_ELKAN || opts->algorithm == KMEANS_HAMERLY
+                 || opts->algorithm == KMEANS_YINYANG) {
+            kmeans_bounds_refresh(centroids, ws);
+        }
+        else if (opts->algorithm == KMEANS_KDTREE) {
+            kmeans_kdtree_refresh(ws);
+        }
+
+        /* Assignment Step: assign each point to the closest centroid */
+        kmeans_assign_step(data, centroids, ws, &run_opts, pool, 0);
+        ws->bounds_ready = 1;
+        if (kmeans_trace_on) {
+            kmeans_trace_span("assign", step_started, iteration);
+        }
+        if (ws->telemetry != NULL) {
+            kmeans_telemetry_assigned(ws->telemetry, data, NULL, centroids, ws, opts->algorithm);
+        }
+
+        /* Update Step: calculate new centroids */
+        if (kmeans_trace_on) {
+            step_started = kmeans_telemetry_clock();
+        }
+        converged = kmeans_update_step(centroids, ws, data->data, opts->epsilon);
+        if (kmeans_trace_on) {
+            kmeans_trace_span("update", step_started, iteration);
+        }
+        if (ws->telemetry != NULL) {
+            kmeans_telemetry_updated(ws->telemetry, centroids);
+        }
+        if (kmeans_trace_on) {
+            kmeans_trace_span("iteration", iteration_started, iteration);
+        }
+        iteration++;
+    }
+
+    if (labels != NULL) {
+        if (iteration == 0) {
+            /* No Assignment Step ran: label the points against the initial centroids */
+            matrix_to_soa(centroids, ws->centroids_soa);
+            closest = kmeans_simd_kernel(K, dim);
+            for (i = 0; i < data->rows; i++) {
+                ws->labels[i] = closest(ws->centroids_soa, K, dim, MATRIX_ROW(data, i), NULL);
+            }
+        }
+        else if (opts->algorithm == KMEANS_KDTREE) {
+            /* Cells assigned as a whole only recorded their owner */
+            kmeans_kdtree_labels(ws);
+        }
+        memcpy(labels, ws->labels, data->rows * sizeof(int));
+    }
+
+    if (stats != NULL) {
+        stats->iterations = iteration;
+        stats->distance_evals = ws->distance_evals;
+        stats->distance_evals_avoided = (unsigned long long)data->rows * (unsigned long long)K
+                                        * (unsigned long long)iteration - ws->distance_evals;
+    }
+
+    pool_destroy(pool);
+    return iteration;
+}
@@ -0,0 +1,580 @@
+#ifndef KMEANS_H
+#define KMEANS_H
+
+#include <stddef.h>
+
+/*
+ * Native K-means engine shared by the Python extension (kmeansmodule.c).
+ * Nothing in here knows about Python: all storage is plain C memory.
+ *
+ * Every vector lives in a dense row-major block (struct matrix), and all the
+ * blocks used by one run are carved out of a single allocation (struct arena),
+ * so the hot loops walk contiguous memory instead of chasing pointers.
+ */
+
+/* Alignment (in bytes) of every block handed out by the arena - one cache line */
+#define KMEANS_ALIGNMENT 64
+
+/*declaration of structs*/
+struct thread_pool; /* Opaque, see kmeans_threads.c */
+struct kmeans_csv_chunk; /* Private to kmeans_csv.c */
+struct kmeans_telemetry;
+
+/* A bump allocator: one malloc up front, sliced into aligned blocks, freed at once */
+struct arena
+{
+    unsigned char *base; /* Start of the single underlying allocation */
+    size_t capacity;     /* Total number of bytes available */
+    size_t used;         /* Number of bytes already handed out */
+};
+
+/* A dense row-major block of `rows` vectors, each of them `dim` doubles long */
+struct matrix
+{
+    double *data; /* Row i starts at data + i * dim */
+    size_t rows;
+    int dim;
+};
+
+/* The same for float vectors: the data of float32 runs (kmeans_f32.c) */
+struct matrix_f32
+{
+    float *data; /* Row i starts at data + i * dim */
+    size_t rows;
+    int dim;
+};
+
+/* Engines that can run the Assignment Step; all of them choose the same centroids */
+enum kmeans_algorithm
+{
+    KMEANS_LLOYD,   /* One point at a time through kmeans_closest_centroid */
+    KMEANS_BLOCKED, /* Tiles of ||x||^2 - 2x.c + ||c||^2 (kmeans_blocked.c), for large K */
+    KMEANS_ELKAN,   /* Triangle-inequality bounds that skip most distances (kmeans_bounds.c) */
+    KMEANS_HAMERLY, /* Like KMEANS_ELKAN with one lower bound per point: O(N) extra memory */
+    KMEANS_YINYANG, /* One lower bound per point and group of centroids, for K in the thousands */
+    KMEANS_KDTREE   /* Kanungo filtering over a kd-tree of the data (kmeans_kdtree.c), for low dim */
+};
+
+/* How to run the Lloyd iterations */
+struct kmeans_options
+{
+    int iter;                        /* Maximum number of iterations */
+    double epsilon;                  /* Convergence threshold on the centroid moves */
+    enum kmeans_algorithm algorithm;
+    int n_threads;                   /* Threads for the Assignment Step (1 = run on the caller) */
+};
+
+/* How to run mini-batch k-means (kmeans_minibatch.c) */
+struct kmeans_minibatch_options
+{
+    size_t batch_size;        /* Points sampled (with replacement) per step */
+    int max_steps;            /* Maximum number of steps */
+    double tol;               /* Relative drop of the smoothed inertia that counts as progress */
+    int max_no_improvement;   /* Stop after this many steps without progress (0 = never) */
+    unsigned long long seed;  /* Seed of the batch sampler */
+    int final_pass;           /* Assign every point to the final centroids at the end */
+    int n_threads;            /* Threads for the assignments (1 = run on the caller) */
+};
+
+/* What a mini-batch run did */
+struct kmeans_minibatch_stats
+{
+    int steps;                       /* Batches processed */
+    unsigned long long points_seen;  /* Sampled points assigned, steps * batch_size */
+    double smoothed_inertia;         /* Moving average of the mean squared distance per batch point */
+    double inertia;                  /* Sum of squared distances over all points (final pass only) */
+    double seconds;                  /* Wall time of the steps, without the final pass */
+    double points_per_second;        /* points_seen / seconds */
+    unsigned long long distance_evals; /* Point-to-centroid distances computed, final pass included */
+};
+
+/* A flat binary file of row-major float64 or float32 points, read chunk by chunk (kmeans_stream.c) */
+struct kmeans_source
+{
+    size_t rows;
+    int dim;
+    int is_float32;
+    size_t offset;              /* Bytes before the first row */
+    const unsigned char *map;   /* The whole file mapped read-only, or NULL when read with stdio */
+    size_t map_bytes;
+    void *file;                 /* The FILE * read from when the file is not mapped */
+};
+
+/* One CSV file of numbers, mapped and parsed into a table (kmeans_csv.c) */
+struct kmeans_csv
+{
+    const char *text;                /* The whole file, mapped read-only */
+    size_t bytes;
+    int mapped;                      /* Whether text has to be unmapped */
+    struct kmeans_csv_chunk *chunks; /* One slice of whole lines per thread */
+    int n_chunks;
+    size_t rows;                     /* Non-blank lines */
+    int fields;                      /* Fields per row, the key included: those of the first row */
+    double *keys;                    /* rows: the first field of every row */
+    struct matrix values;            /* rows x (fields - 1): the other ones */
+};
+
+/* A row of the left file that has matches in the right one */
+struct kmeans_join_entry
+{
+    double key;
+    size_t row;    /* In the left file */
+    size_t match;  /* 1 + its first match in the right file */
+    size_t first;  /* Its first output row */
+};
+
+/* Two CSV files joined on their keys (kmeans_csv.c) */
+struct kmeans_csv_join
+{
+    struct kmeans_csv left;
+    struct kmeans_csv right;
+    struct thread_pool *pool;
+    struct arena arena;              /* Both tables and the hash table */
+    size_t capacity;                 /* Slots of the hash table, a power of two */
+    size_t *slots;                   /* capacity: 1 + the first right row with a key, 0 = free */
+    size_t *next;                    /* right rows: 1 + the next right row with the same key, 0 = none */
+    struct kmeans_join_entry *order; /* The left rows with matches, by key then row */
+    size_t n_order;
+    size_t rows;                     /* Rows of the output */
+    int dim;                         /* Its columns: those of both files but the keys */
+    int error_file;                  /* What went wrong: 0 = left, 1 = right ... */
+    size_t error_line;               /* ... at which line (1-based, 0 = the file has no rows) ... */
+    int error_fields;                /* ... with how many fields (0 = a field is not a number) */
+};
+
+/* The header of a .kmc file (kmeans_cache.c): every field 8 bytes, in native byte order */
+struct kmeans_cache_header
+{
+    unsigned long long magic;              /* KMEANS_CACHE_MAGIC, which also tells the byte order */
+    unsigned long long version;            /* KMEANS_CACHE_VERSION */
+    unsigned long long dtype;              /* KMEANS_CACHE_FLOAT64 */
+    unsigned long long rows;
+    unsigned long long dim;
+    unsigned long long keys_offset;        /* Where the rows keys start, in ascending order */
+    unsigned long long data_offset;        /* Where the rows x dim coordinates start: the rest of the file */
+    unsigned long long file_bytes;         /* Size of the whole file */
+    unsigned long long source_bytes[2];    /* Size of the two CSV files it was built from ... */
+    long long source_mtime_ns[2];          /* ... and their modification times, in ns since the epoch */
+};
+
+/* A .kmc file, mapped read-only */
+struct kmeans_cache
+{
+    struct kmeans_cache_header header;
+    const unsigned char *map;              /* The whole file */
+    size_t map_bytes;
+    const double *keys;                    /* header.rows keys */
+    const double *data;                    /* header.rows x header.dim coordinates */
+};
+
+/* How to pick the initial centroids with k-means++ or k-means|| (kmeans_seed.c) */
+struct kmeans_seed_options
+{
+    unsigned long long seed; /* Seed of numpy's legacy generator (np.random.seed), 0 .. 2^32-1 */
+    int n_threads;           /* Threads for the distance passes (1 = run on the caller) */
+    int n_local_trials;      /* Candidates drawn per centroid, the best one kept (1 = plain k-means++) */
+    int numpy_sampling;      /* Draw with numpy's exact arithmetic (serial) instead of block prefix sums */
+    int rounds;              /* k-means||: oversampling rounds */
+    double oversampling;     /* k-means||: points sampled per round, on average (<= 0 means 2K) */
+};
+
+/* Scratch of kmeans_pp_seed */
+struct kmeans_seed_workspace
+{
+    double *dist;            /* N: distance of every point to the closest centroid chosen so far */
+    double *block_sums;      /* One sum of dist per block of points */
+    double *trial_sums;      /* n_threads x n_local_trials: every thread's share of the candidates' potentials */
+    size_t *candidates;      /* n_local_trials: the points drawn for the current step */
+    double *squares;         /* n_threads x dim: per-thread scratch for numpy's pairwise sums */
+
+    /* k-means|| only (kmeans_parallel_seed_carve), sized for `capacity` candidates */
+    size_t capacity;
+    size_t *pool;            /* capacity: the candidate points, in the order they were sampled */
+    int *owner;              /* N: the candidate closest to every point */
+    double *pool_soa;        /* dim x capacity: column-major copy of the candidates of one round */
+    double *weights;         /* n_threads x capacity: points per candidate, counted per thread */
+    double *pool_dist;       /* capacity: squared distance of every candidate to the seeds picked so far */
+    size_t *thread_counts;   /* n_threads: points every thread sampled in the current round */
+};
+
+/* A kd-tree cell: the points kd_points[first..last-1] and their two halves (-1 for a leaf) */
+struct kd_node
+{
+    size_t first;
+    size_t last;
+    int left;
+    int right;
+};
+
+/* What a run did, for callers that want to know */
+struct kmeans_stats
+{
+    int iterations;                          /* Assignment + Update Steps performed */
+    unsigned long long distance_evals;       /* Point-to-centroid distances computed */
+    unsigned long long distance_evals_avoided; /* Of the N * K per iteration a full scan computes */
+};
+
+/* What one Lloyd iteration did (kmeans_telemetry.c) */
+struct kmeans_iteration_record
+{
+    double assign_seconds;   /* Wall time of the Assignment Step, the engine's refresh included */
+    double update_seconds;   /* Wall time of the Update Step */
+    double inertia;          /* Sum of squared distances of the points to the centroid they were assigned to */
+    double max_shift;        /* Largest distance a centroid moved in the Update Step ... */
+    double mean_shift;       /* ... and the mean over all of them */
+    size_t reassigned;       /* Points whose cluster changed (all of them in the first iteration) */
+    int empty_clusters;      /* Clusters that got no point and took the fallback point instead */
+};
+
+/* Per-iteration telemetry of kmeans_lloyd and kmeans_lloyd_f32, collected when ws->telemetry points at one */
+struct kmeans_telemetry
+{
+    struct kmeans_iteration_record *records; /* One per iteration, for up to capacity of them */
+    int capacity;
+    int count;               /* Iterations recorded */
+    int *previous;           /* N: the labels of the previous iteration (-1 before the first one) */
+    struct matrix before;    /* K x dim: the centroids before the Update Step */
+    double started;          /* When the step being timed started */
+};
+
+/* Per-run state for the Assignment and Update Steps */
+struct kmeans_workspace
+{
+    struct matrix sums;     /* K x dim: sum of the points assigned to each cluster */
+    int *counts;            /* K: number of points assigned to each cluster */
+    int *labels;            /* N: cluster chosen for every point by the last Assignment Step */
+    double *centroids_soa;  /* dim x K: column-major mirror of the centroids for the SIMD kernels */
+    float *centroids_soa_f32; /* dim x K: the same rounded to float (float32 runs only, NULL otherwise) */
+
+    /* n_threads > 1 only (NULL otherwise): per-thread copies of this workspace
+       with private sums and counts, summed up after every Assignment Step */
+    struct kmeans_workspace *partials;
+
+    /* KMEANS_BLOCKED only (NULL otherwise) */
+    double *point_norms;    /* N: ||x||^2 of every point, computed once per run ... */
+    int point_norms_ready;  /* ... unless this is set (norms shared by the runs of kmeans_sweep_run) */
+    double *centroid_norms; /* K: ||c||^2 of every centroid, refreshed every iteration */
+    double centroid_norm_max;
+
+    /* KMEANS_ELKAN, KMEANS_HAMERLY and KMEANS_YINYANG only (NULL otherwise) */
+    double *upper;          /* N: upper bound on the distance of every point to its centroid */
+    double *lower;          /* Elkan: N x K lower bounds, one per point and centroid;
+                               Hamerly: N lower bounds, one per point for all other centroids;
+                               Yinyang: N x n_groups lower bounds, one per point and group */
+    double *centroid_half;  /* K x K: lower bound on half the distance between two centroids (Elkan only) */
+    double *nearest_half;   /* K: lower bound on half the distance to the nearest other centroid
+                               (Elkan and Hamerly only) */
+    double *drift;          /* K: upper bound on how far every centroid moved since the last pass */
+    double drift_max;       /* Largest drift ... */
+    double drift_second;    /* ... and the largest one among the other centroids */
+    int drift_max_index;    /* Centroid with the largest drift */
+    struct matrix previous; /* K x dim: the centroids the bounds were last brought up to date with */
+    int bounds_ready;       /* 0 until the first Assignment Step has filled in the bounds */
+
+    /* KMEANS_YINYANG only (NULL otherwise): the centroids split into n_groups fixed groups */
+    int n_groups;
+    int *group_of;          /* K: group of every centroid */
+    int *group_members;     /* K: centroid indices ordered by group */
+    int *group_start;       /* n_groups + 1: group g is group_members[group_start[g] .. group_start[g+1]-1] */
+    double *group_drift;    /* n_groups: largest drift in every group */
+    double *group_soa;      /* dim x K: column-major centroids in group_members order */
+    struct matrix group_centers; /* n_groups x dim: scratch for grouping the initial centroids */
+
+    /* KMEANS_KDTREE only (NULL otherwise): a kd-tree over the data, built once per run */
+    struct kd_node *kd_nodes; /* kd_n_nodes, root first, every parent before its children */
+    size_t kd_n_nodes;
+    int kd_depth;             /* Depth of the deepest leaf (the root is at depth 0) */
+    size_t *kd_points;        /* N: point indices in tree order */
+    struct matrix kd_data;    /* N x dim: the points themselves in tree order */
+    double *kd_low;           /* kd_n_nodes x dim: bounding box of every cell ... */
+    double *kd_high;
+    double *kd_sums;          /* kd_n_nodes x dim: ... and the sum of its points */
+    int *kd_owner;            /* kd_n_nodes: centroid a whole cell went to ... */
+    int *kd_pass;             /* kd_n_nodes: ... and in which Assignment Step */
+    int kd_passes;            /* Assignment Steps so far */
+    int *kd_candidates;       /* (kd_depth + 2) x K: candidate lists, private to every thread */
+
+    /* kmeans_minibatch, kmeans_lloyd_stream and kmeans_refit only (NULL otherwise), see their carve functions */
+    struct matrix batch;    /* Scratch rows: the points sampled for the current step, the current
+                               chunk of a file that cannot be used in place, or a mean (refit) */
+    double *seen;           /* K: points every centroid has absorbed over all steps (mini-batch) */
+    double *fallback;       /* dim: first point of a streamed file, float32 data or a refit, taken by empty clusters */
+    double inertia;         /* Sum of squared distances of the points assigned (this thread's share) */
+
+    struct kmeans_telemetry *telemetry; /* Filled in every iteration by kmeans_lloyd when not NULL */
+
+    unsigned long long distance_evals; /* Point-to-centroid distances computed (this thread's share) */
+};
+
+/* A fitted model kept between calls (kmeans_model.c): the centroids and what the kernels derive from them */
+struct kmeans_model
+{
+    struct matrix centroids;  /* K x dim */
+    double *centroids_soa;    /* dim x K: column-major mirror for kmeans_closest_centroid */
+    float *centroids_soa_f32; /* dim x K: the same rounded to float, for kmeans_closest_centroid_f32 */
+    double *norms;            /* K: ||c||^2 of every centroid */
+    int n_threads;            /* Threads every call runs on (1 = the caller alone) */
+    double *thread_inertia;   /* n_threads: every thread's share of the squared distances */
+};
+
+/* One worker of kmeans_restarts: the scratch of a k-means++ + Lloyd run, and its best run so far */
+struct kmeans_restart_slot
+{
+    struct kmeans_workspace ws;
+    struct kmeans_seed_workspace seed_ws;
+    struct matrix centroids;      /* K x dim: the run in progress */
+    struct matrix best_centroids; /* K x dim: the lowest-inertia run of this worker */
+    int *labels;                  /* N */
+    int *best_labels;             /* N */
+    size_t *chosen;               /* K: the seeds of the run in progress */
+    int best_run;                 /* -1 until a run finished */
+    int best_iterations;
+    unsigned long long distance_evals; /* Over all the runs of this worker */
+    unsigned long long distance_evals_avoided;
+};
+
+/* Scratch of kmeans_restarts */
+struct kmeans_restarts
+{
+    struct kmeans_restart_slot *slots; /* n_slots: one per thread */
+    int n_slots;
+    double *inertias;                  /* n_init: sum of squared distances of every run */
+    int *iterations;                   /* n_init: Lloyd iterations of every run */
+};
+
+/* One worker of kmeans_sweep_run: the scratch of a Lloyd run for any K up to k_max */
+struct kmeans_sweep_slot
+{
+    struct kmeans_workspace ws;
+    struct matrix centroids; /* k_max x dim, of which the first K rows are used */
+    int *labels;             /* N */
+    unsigned long long distance_evals; /* Over all the runs of this worker */
+};
+
+/* Scratch of kmeans_sweep_run */
+struct kmeans_sweep
+{
+    struct kmeans_sweep_slot *slots;   /* n_slots: one per thread */
+    int n_slots;
+    struct kmeans_seed_workspace seed_ws;
+    size_t *chosen;                    /* k_max: the k-means++ seeds, in the order drawn */
+    double *point_norms;               /* N: ||x||^2 shared by all the runs (KMEANS_BLOCKED only) */
+    double *inertias;                  /* k_max - k_min + 1: the inertia for every K ... */
+    int *iterations;                   /* ... and the Lloyd iterations it took */
+};
+
+/*
+ * What one kmeans_refit hands to the next (kmeans_refit.c), all owned by the
+ * caller: the per-cluster sums and counts behind the centroids, the label of
+ * every point (-1 for points not clustered yet) and, optionally, its
+ * Hamerly bounds for the centroids the state goes with.
+ */
+struct kmeans_refit_state
+{
+    struct matrix sums; /* K x dim: sum of the points labelled with each cluster */
+    int *counts;        /* K: number of points labelled with each cluster */
+    int *labels;        /* N */
+    double *upper;      /* N: upper bound on the distance to the own centroid (< 0: unknown), or NULL ... */
+    double *lower;      /* N: ... and lower bound on the distance to any other one (NULL
+                           with upper: the workspace keeps its own, computed by a full scan) */
+};
+
+/* A job for pool_run: called once on every thread, with its index and the thread count */
+typedef void (*pool_job_fn)(void *arg, int thread_index, int n_threads);
+
+/*
+ * Assignment Step kernel: index of the centroid closest to x, with the centroids
+ * given column-major (dim x K, see matrix_to_soa). If min_dist is not NULL it
+ * receives the squared distance to that centroid. Ties go to the smallest index.
+ */
+typedef int (*closest_centroid_fn)(const double *centroids_soa, int K, int dim,
+                                   const double *x, double *min_dist);
+
+/* The same over float centroids and points, with float distances */
+typedef int (*closest_centroid_f32_fn)(const float *centroids_soa, int K, int dim,
+                                       const float *x, float *min_dist);
+
+/* Let GCC build AVX-512/AVX2 copies of a hot loop and pick one at load time */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define KMEANS_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define KMEANS_TARGET_CLONES
+#endif
+
+/* Address of row i of a matrix */
+#define MATRIX_ROW(m, i) ((m)->data + (size_t)(i) * (size_t)(m)->dim)
+
+/*declaration of functions*/
+size_t arena_block_size(size_t bytes);
+int arena_init(struct arena *a, size_t capacity);
+void *arena_alloc(struct arena *a, size_t bytes);
+void arena_free(struct arena *a);
+int matrix_carve(struct matrix *m, struct arena *a, size_t rows, int dim);
+
+size_t kmeans_workspace_bytes(size_t N, int K, int dim, const struct kmeans_options *opts);
+int kmeans_workspace_carve(struct kmeans_workspace *ws, struct arena *a, size_t N, int K, int dim,
+                           const struct kmeans_options *opts);
+
+double squared_distance(const double *v1, const double *v2, int dim);
+double dot_product(const double *v1, const double *v2, int dim);
+double compute_distance(const double *v1, const double *v2, int dim);
+int find_closest_centroid(const struct matrix *centroids, const double *vectorX);
+void add_coordinates_from_other_vector(double *v1, const double *v2, int dim);
+void divide_vector_by_scalar(double *v, int dim, int scalar);
+void zero_out_vector(double *v, int dim);
+void matrix_to_soa(const struct matrix *m, double *soa);
+void accumulate_range(const struct matrix *data, size_t first, size_t last,
+                      const int *labels, struct kmeans_workspace *ws);
+
+/* kmeans_simd.c: runtime-dispatched Assignment Step kernels */
+extern closest_centroid_fn kmeans_closest_centroid;
+extern closest_centroid_f32_fn kmeans_closest_centroid_f32;
+int kmeans_simd_select(const char *name);
+closest_centroid_fn kmeans_simd_kernel(int K, int dim);
+closest_centroid_f32_fn kmeans_simd_kernel_f32(int K, int dim);
+const char *kmeans_simd_name(void);
+
+/* kmeans_threads.c: fork-join thread pool */
+struct thread_pool *pool_create(int n_threads);
+int pool_size(const struct thread_pool *pool);
+void pool_run(struct thread_pool *pool, pool_job_fn job, void *arg);
+void pool_destroy(struct thread_pool *pool);
+int kmeans_cpu_count(void);
+
+/* kmeans_blocked.c: GEMM-style Assignment Step */
+void kmeans_blocked_prepare(const struct matrix *data, struct kmeans_workspace *ws);
+void kmeans_blocked_refresh(const struct matrix *centroids, struct kmeans_workspace *ws);
+void kmeans_assign_blocked(const struct matrix *data, const struct matrix *centroids,
+                           size_t first, size_t last, struct kmeans_workspace *ws);
+
+/* kmeans_bounds.c: Assignment Steps that skip distances ruled out by the triangle inequality */
+void kmeans_bounds_refresh(const struct matrix *centroids, struct kmeans_workspace *ws);
+void kmeans_assign_elkan(const struct matrix *data, const struct matrix *centroids,
+                         size_t first, size_t last, struct kmeans_workspace *ws);
+void kmeans_assign_hamerly(const struct matrix *data, const struct matrix *centroids,
+                           size_t first, size_t last, struct kmeans_workspace *ws);
+void kmeans_reassign_hamerly(const struct matrix *data, const struct matrix *centroids,
+                             size_t first, size_t last, struct kmeans_workspace *ws);
+void kmeans_loosen_hamerly(size_t first, size_t last, struct kmeans_workspace *ws);
+int kmeans_yinyang_groups(int K);
+void kmeans_assign_yinyang(const struct matrix *data, const struct matrix *centroids,
+                           size_t first, size_t last, struct kmeans_workspace *ws);
+
+/* kmeans_kdtree.c: kd-tree filtering Assignment Step */
+size_t kmeans_kdtree_nodes(size_t N);
+int kmeans_kdtree_depth(size_t N);
+void kmeans_kdtree_build(const struct matrix *data, struct kmeans_workspace *ws);
+void kmeans_kdtree_refresh(struct kmeans_workspace *ws);
+void kmeans_assign_kdtree(const struct matrix *data, const struct matrix *centroids,
+                          size_t first, size_t last, struct kmeans_workspace *ws);
+void kmeans_kdtree_labels(struct kmeans_workspace *ws);
+
+void kmeans_reduce_partials(struct kmeans_workspace *ws, int n_partials, size_t first, size_t last,
+                            int accumulate);
+void kmeans_assign_step(const struct matrix *data, const struct matrix *centroids,
+                        struct kmeans_workspace *ws, const struct kmeans_options *opts,
+                        struct thread_pool *pool, int accumulate);
+int kmeans_update_step(struct matrix *centroids, struct kmeans_workspace *ws, const double *fallback,
+                       double epsilon);
+int kmeans_lloyd(const struct matrix *data, struct matrix *centroids, struct kmeans_workspace *ws,
+                 const struct kmeans_options *opts, int *labels, struct kmeans_stats *stats);
+
+/* kmeans_f32.c: Lloyd iterations over float data with double accumulators */
+int matrix_f32_carve(struct matrix_f32 *m, struct arena *a, size_t rows, int dim);
+size_t kmeans_f32_bytes(size_t N, int K, int dim, const struct kmeans_options *opts);
+int kmeans_f32_carve(struct kmeans_workspace *ws, struct arena *a, size_t N, int K, int dim,
+                     const struct kmeans_options *opts);
+int kmeans_lloyd_f32(const struct matrix_f32 *data, struct matrix *centroids, struct kmeans_workspace *ws,
+                     const struct kmeans_options *opts, int *labels, struct kmeans_stats *stats);
+
+/* kmeans_model.c: scoring new points against a fitted model */
+size_t kmeans_model_bytes(int K, int dim, int n_threads);
+int kmeans_model_carve(struct kmeans_model *model, struct arena *a, int K, int dim, int n_threads);
+void kmeans_model_refresh(struct kmeans_model *model);
+double kmeans_model_predict(struct kmeans_model *model, const struct matrix *data, int *labels);
+double kmeans_model_predict_f32(struct kmeans_model *model, const struct matrix_f32 *data, int *labels);
+void kmeans_model_transform(struct kmeans_model *model, const struct matrix *data, double *distances);
+
+/* kmeans_minibatch.c: mini-batch k-means over samples of the data */
+size_t kmeans_minibatch_bytes(int K, int dim, const struct kmeans_minibatch_options *opts);
+int kmeans_minibatch_carve(struct kmeans_workspace *ws, struct arena *a, int K, int dim,
+                           const struct kmeans_minibatch_options *opts);
+int kmeans_minibatch(const struct matrix *data, struct matrix *centroids, struct kmeans_workspace *ws,
+                     const struct kmeans_minibatch_options *opts, int *labels,
+                     struct kmeans_minibatch_stats *stats);
+
+/* kmeans_seed.c: k-means++ and k-means|| seeding */
+size_t kmeans_seed_bytes(size_t N, int dim, const struct kmeans_seed_options *opts);
+int kmeans_seed_carve(struct kmeans_seed_workspace *ws, struct arena *a, size_t N, int dim,
+                      const struct kmeans_seed_options *opts);
+void kmeans_pp_seed(const struct matrix *data, int K, struct kmeans_seed_workspace *ws,
+                    const struct kmeans_seed_options *opts, size_t *chosen);
+size_t kmeans_parallel_seed_bytes(size_t N, int K, int dim, const struct kmeans_seed_options *opts);
+int kmeans_parallel_seed_carve(struct kmeans_seed_workspace *ws, struct arena *a, size_t N, int K, int dim,
+                               const struct kmeans_seed_options *opts);
+int kmeans_parallel_seed(const struct matrix *data, int K, struct kmeans_seed_workspace *ws,
+                         const struct kmeans_seed_options *opts, size_t *chosen);
+
+/* kmeans_restarts.c: several seed + Lloyd runs at once, keeping the best */
+size_t kmeans_restarts_bytes(size_t N, int K, int dim, const struct kmeans_options *opts, int n_init);
+int kmeans_restarts_carve(struct kmeans_restarts *r, struct arena *a, size_t N, int K, int dim,
+                          const struct kmeans_options *opts, int n_init);
+int kmeans_restarts_run(const struct matrix *data, struct kmeans_restarts *r, const struct kmeans_options *opts,
+                        int n_init, unsigned long long seed, struct matrix *centroids, int *labels,
+                        struct kmeans_stats *stats);
+
+/* kmeans_sweep.c: one Lloyd run for every K of a range, for elbow curves */
+size_t kmeans_sweep_bytes(size_t N, int k_min, int k_max, int dim, const struct kmeans_options *opts);
+int kmeans_sweep_carve(struct kmeans_sweep *sw, struct arena *a, size_t N, int k_min, int k_max, int dim,
+                       const struct kmeans_options *opts);
+void kmeans_sweep_run(const struct matrix *data, struct kmeans_sweep *sw, const struct kmeans_options *opts,
+                      int k_min, int k_max, unsigned long long seed, struct kmeans_stats *stats);
+
+/* kmeans_refit.c: Lloyd iterations resumed from a previous solution after points came and went */
+size_t kmeans_refit_bytes(size_t N, int K, int dim, const struct kmeans_options *opts);
+int kmeans_refit_carve(struct kmeans_workspace *ws, struct arena *a, size_t N, int K, int dim,
+                       const struct kmeans_options *opts);
+void kmeans_refit_rebuild(const struct matrix *data, struct kmeans_refit_state *state);
+int kmeans_refit(const struct matrix *data, struct matrix *centroids, struct kmeans_refit_state *state,
+                 const struct matrix *deleted, const int *deleted_labels, struct kmeans_workspace *ws,
+                 const struct kmeans_options *opts, struct kmeans_stats *stats);
+
+/* kmeans_csv.c: the two CSV inputs, parsed and joined on their keys */
+int kmeans_csv_join_open(struct kmeans_csv_join *j, const char *left_path, const char *right_path, int n_threads);
+void kmeans_csv_join_gather(struct kmeans_csv_join *j, double *keys, double *data);
+void kmeans_csv_join_close(struct kmeans_csv_join *j);
+
+/* kmeans_telemetry.c: what every Lloyd iteration did, for callers that ask */
+size_t kmeans_telemetry_bytes(size_t N, int K, int dim, int iter);
+int kmeans_telemetry_carve(struct kmeans_telemetry *tel, struct arena *a, size_t N, int K, int dim, int iter);
+double kmeans_telemetry_clock(void);
+void kmeans_telemetry_assigned(struct kmeans_telemetry *tel, const struct matrix *data,
+                               const struct matrix_f32 *data_f32, const struct matrix *centroids,
+                               struct kmeans_workspace *ws, enum kmeans_algorithm algorithm);
+void kmeans_telemetry_updated(struct kmeans_telemetry *tel, const struct matrix *centroids);
+
+/* kmeans_trace.c: opt-in Chrome trace of the spans of a run, one lane per thread */
+extern int kmeans_trace_on;
+void kmeans_trace_start(void);
+void kmeans_trace_span(const char *name, double start, int iteration);
+int kmeans_trace_write(const char *path);
+
+/* kmeans_cache.c: the joined inputs saved in a binary file, mapped back on later runs */
+int kmeans_cache_stat(const char *path, unsigned long long *bytes, long long *mtime_ns);
+int kmeans_cache_write(const char *path, const double *keys, const double *data, size_t rows, int dim,
+                       const unsigned long long source_bytes[2], const long long source_mtime_ns[2]);
+int kmeans_cache_open(struct kmeans_cache *c, const char *path, const char *left_path, const char *right_path);
+void kmeans_cache_close(struct kmeans_cache *c);
+
+/* kmeans_stream.c: Lloyd iterations streamed from a binary file */
+int kmeans_source_open(struct kmeans_source *src, const char *path, int dim, int is_float32, size_t offset);
+const double *kmeans_source_rows(struct kmeans_source *src, size_t first, size_t count, double *scratch);
+void kmeans_source_release(struct kmeans_source *src, size_t first, size_t count);
+void kmeans_source_close(struct kmeans_source *src);
+size_t kmeans_stream_bytes(size_t chunk_rows, int K, int dim, const struct kmeans_options *opts);
+int kmeans_stream_carve(struct kmeans_workspace *ws, struct arena *a, size_t chunk_rows, int K, int dim,
+                        const struct kmeans_options *opts);
+int kmeans_lloyd_stream(struct kmeans_source *src, struct matrix *centroids, struct kmeans_workspace *ws,
+                        const struct kmeans_options *opts, int *labels, struct kmeans_stats *stats);
+
+#endif /* KMEANS_H */
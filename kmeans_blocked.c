@@ -0,0 +1,248 @@
+#include "kmeans.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+/*
+ * Blocked Assignment Step for large K.
+ *
+ * Squared distances are expanded as ||x||^2 - 2 x.c + ||c||^2. The norms are
+ * computed once (points) or once per iteration (centroids), so the bulk of
+ * the work is the cross term: a matrix product between a block of points and
+ * a block of centroids, done tile by tile so both blocks stay in cache. The
+ * argmin is folded in right after each tile is produced.
+ *
+ * The expansion rounds differently from summing (c - x)^2, so on its own it
+ * could pick a different centroid on near-ties. For every point we therefore
+ * keep the best and second-best approximate distances: if they are further
+ * apart than twice a bound on the rounding error, the winner is certain;
+ * otherwise the point is re-scanned exactly with kmeans_closest_centroid.
+ * The labels are thus identical to the plain Lloyd path.
+ *
+ * The micro-kernel relies on the GCC/Clang vector extensions; other compilers
+ * fall back to the exact per-point scan.
+ */
+
+/* Points per block (tile rows) and centroids per block (tile columns) */
+#define BLOCK_POINTS 64
+#define BLOCK_CENTROIDS 256
+
+/* Register tile of the micro-kernel: MR points x NR centroids */
+#define MR 4
+#define NR 8
+
+#if defined(__GNUC__)
+#define KMEANS_VECTOR_EXT 1
+
+/* NR centroids side by side: one row of the register tile */
+typedef double lanes __attribute__((vector_size(NR * sizeof(double))));
+/* Result of comparing two `lanes`: all ones where true, zero where false */
+typedef long long lane_mask __attribute__((vector_size(NR * sizeof(double))));
+
+/* Lane-wise m ? a : b (a macro, so no vector is ever passed by value) */
+#define SELECT_LANES(m, a, b) ((lanes)(((lane_mask)(a) & (m)) | ((lane_mask)(b) & ~(m))))
+
+/*declaration of functions*/
+static void tile_argmin(const double *x, int dim, int rows, const double *soa, int K,
+                        const double *centroid_norms, int col0, int cols,
+                        lanes *best, lanes *second, lanes *best_idx);
+static int reduce_point(const lanes *best, const lanes *second, const lanes *best_idx,
+                        double *best_dist, double *second_dist);
+#endif
+
+
+/* Computes ||x||^2 for every point; the data never changes during a run */
+void kmeans_blocked_prepare(const struct matrix *data, struct kmeans_workspace *ws) {
+    size_t i;
+    for (i = 0; i < data->rows; i++) {
+        ws->point_norms[i] = dot_product(MATRIX_ROW(data, i), MATRIX_ROW(data, i), data->dim);
+    }
+}
+
+/* Computes ||c||^2 for every centroid (and their maximum) after an Update Step */
+void kmeans_blocked_refresh(const struct matrix *centroids, struct kmeans_workspace *ws) {
+    size_t j;
+    double norm;
+
+    ws->centroid_norm_max = 0.0;
+    for (j = 0; j < centroids->rows; j++) {
+        norm = dot_product(MATRIX_ROW(centroids, j), MATRIX_ROW(centroids, j), centroids->dim);
+        ws->centroid_norms[j] = norm;
+        if (norm > ws->centroid_norm_max) {
+            ws->centroid_norm_max = norm;
+        }
+    }
+}
+
+
+#ifdef KMEANS_VECTOR_EXT
+
+/*
+ * Scores the points x_0..x_(rows-1) against the centroids col0..col0+cols-1
+ * and folds the result into the per-point lane state (best, second-best and
+ * index of the best, one candidate per lane).
+ * The score is ||c||^2 - 2 x.c: ||x||^2 is the same for every centroid, so
+ * it is left out. x is row-major; the centroids come column-major (dim x K),
+ * so each step of the inner loop reads NR consecutive centroids.
+ */
+KMEANS_TARGET_CLONES
+static void tile_argmin(const double *x, int dim, int rows, const double *soa, int K,
+                        const double *centroid_norms, int col0, int cols,
+                        lanes *best, lanes *second, lanes *best_idx) {
+    static const double iota[NR] = {0, 1, 2, 3, 4, 5, 6, 7};
+    lanes acc[MR], cv, ncv, kv, score;
+    lane_mask lt, lt2;
+    const double *xr[MR];
+    double cbuf[NR];
+    int r0, c0, r, j, d, nr;
+
+    for (r0 = 0; r0 < rows; r0 += MR) {
+        /* A short last block repeats its last point; the extra rows are dropped below */
+        for (r = 0; r < MR; r++) {
+            xr[r] = x + (size_t)(r0 + r < rows ? r0 + r : rows - 1) * dim;
+        }
+
+        for (c0 = 0; c0 < cols; c0 += NR) {
+            nr = cols - c0 < NR ? cols - c0 : NR;
+            for (r = 0; r < MR; r++) {
+                acc[r] = (lanes){0};
+            }
+
+            if (nr == NR) {
+                for (d = 0; d < dim; d++) {
+                    memcpy(&cv, soa + (size_t)d * K + col0 + c0, sizeof(cv));
+                    for (r = 0; r < MR; r++) {
+                        acc[r] += xr[r][d] * cv;
+                    }
+                }
+                memcpy(&ncv, centroid_norms + col0 + c0, sizeof(ncv));
+            }
+            else {
+                /* Ragged last columns: missing centroids get zero coordinates and an infinite norm */
+                for (j = nr; j < NR; j++) {
+                    cbuf[j] = 0.0;
+                }
+                for (d = 0; d < dim; d++) {
+                    memcpy(cbuf, soa + (size_t)d * K + col0 + c0, (size_t)nr * sizeof(double));
+                    memcpy(&cv, cbuf, sizeof(cv));
+                    for (r = 0; r < MR; r++) {
+                        acc[r] += xr[r][d] * cv;
+                    }
+                }
+                memcpy(cbuf, centroid_norms + col0 + c0, (size_t)nr * sizeof(double));
+                for (j = nr; j < NR; j++) {
+                    cbuf[j] = HUGE_VAL;
+                }
+                memcpy(&ncv, cbuf, sizeof(ncv));
+            }
+
+            memcpy(&kv, iota, sizeof(kv));
+            kv += (double)(col0 + c0);
+            for (r = 0; r < MR && r0 + r < rows; r++) {
+                score = ncv - 2.0 * acc[r];
+                lt = score < best[r0 + r];
+                lt2 = score < second[r0 + r];
+                second[r0 + r] = SELECT_LANES(lt, best[r0 + r], SELECT_LANES(lt2, score, second[r0 + r]));
+                best_idx[r0 + r] = SELECT_LANES(lt, kv, best_idx[r0 + r]);
+                best[r0 + r] = SELECT_LANES(lt, score, best[r0 + r]);
+            }
+        }
+    }
+}
+
+/*
+ * Reduces one point's lane state: returns the index of the best candidate and
+ * stores its score and the runner-up score (over all lanes).
+ */
+static int reduce_point(const lanes *best, const lanes *second, const lanes *best_idx,
+                        double *best_dist, double *second_dist) {
+    double b[NR], s[NR], idx[NR];
+    int j, lane = 0;
+
+    memcpy(b, best, sizeof(b));
+    memcpy(s, second, sizeof(s));
+    memcpy(idx, best_idx, sizeof(idx));
+
+    for (j = 1; j < NR; j++) {
+        if (b[j] < b[lane]) {
+            lane = j;
+        }
+    }
+    *second_dist = HUGE_VAL;
+    for (j = 0; j < NR; j++) {
+        if (s[j] < *second_dist) {
+            *second_dist = s[j];
+        }
+        if (j != lane && b[j] < *second_dist) {
+            *second_dist = b[j];
+        }
+    }
+    *best_dist = b[lane];
+    return (int)idx[lane];
+}
+
+#endif /* KMEANS_VECTOR_EXT */
+
+/*
+ * Assignment Step for the points first..last-1: writes ws->labels and adds the
+ * points to the cluster sums. kmeans_blocked_prepare must have run once for
+ * the data, and kmeans_blocked_refresh (plus matrix_to_soa) after every
+ * Update Step.
+ */
+void kmeans_assign_blocked(const struct matrix *data, const struct matrix *centroids,
+                           size_t first, size_t last, struct kmeans_workspace *ws) {
+    size_t p0;
+    int K = (int)centroids->rows;
+    int dim = data->dim;
+    int rows, r;
+    closest_centroid_fn closest = kmeans_simd_kernel(K, dim);
+#ifdef KMEANS_VECTOR_EXT
+    lanes best[BLOCK_POINTS], second[BLOCK_POINTS], best_idx[BLOCK_POINTS];
+    double best_dist, second_dist, slack, bound;
+    int col0, cols, idx;
+
+    /*
+     * Rounding error of the expansion plus that of the exact sum, relative to
+     * ||x||^2 + ||c||^2, with a generous margin: overestimating it only sends
+     * a few more points through the exact re-scan.
+     */
+    slack = (4.0 * dim + 16.0) * DBL_EPSILON;
+#endif
+
+    for (p0 = first; p0 < last; p0 += BLOCK_POINTS) {
+        rows = last - p0 < BLOCK_POINTS ? (int)(last - p0) : BLOCK_POINTS;
+
+#ifdef KMEANS_VECTOR_EXT
+        for (r = 0; r < rows; r++) {
+            best[r] = (lanes){0} + HUGE_VAL;
+            second[r] = best[r];
+            best_idx[r] = (lanes){0};
+        }
+
+        for (col0 = 0; col0 < K; col0 += BLOCK_CENTROIDS) {
+            cols = K - col0 < BLOCK_CENTROIDS ? K - col0 : BLOCK_CENTROIDS;
+            tile_argmin(MATRIX_ROW(data, p0), dim, rows, ws->centroids_soa, K,
+                        ws->centroid_norms, col0, cols, best, second, best_idx);
+        }
+
+        for (r = 0; r < rows; r++) {
+            idx = reduce_point(&best[r], &second[r], &best_idx[r], &best_dist, &second_dist);
+            bound = slack * (ws->point_norms[p0 + r] + ws->centroid_norm_max);
+            /* Written so that NaN also lands in the exact branch */
+            if (K > 1 && !(second_dist - best_dist > 2.0 * bound)) {
+                idx = closest(ws->centroids_soa, K, dim, MATRIX_ROW(data, p0 + r), NULL);
+            }
+            ws->labels[p0 + r] = idx;
+        }
+#else
+        for (r = 0; r < rows; r++) {
+            ws->labels[p0 + r] = closest(ws->centroids_soa, K, dim, MATRIX_ROW(data, p0 + r), NULL);
+        }
+#endif
+
+        accumulate_range(data, p0, p0 + (size_t)rows, ws->labels, ws);
+    }
+    /* Every point is scored against every centroid, re-scans aside */
+    ws->distance_evals += (unsigned long long)(last - first) * (unsigned long long)K;
+}
@@ -0,0 +1,664 @@
+#include "kmeans.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+/*
+ * Assignment Steps that skip distances ruled out by the triangle inequality.
+ *
+ * Once the centroids settle, most points keep their cluster. These engines
+ * carry bounds on the point-to-centroid distances from one iteration to the
+ * next, loosen them by how far each centroid moved, and only compute a
+ * distance when the bounds cannot prove that the current centroid still wins.
+ *
+ * Elkan keeps, for every point, an upper bound on the distance to its own
+ * centroid and a lower bound on the distance to every other one, together
+ * with half the distances between all pairs of centroids: if the point is
+ * closer to its centroid a than half of d(a, c), then c cannot beat a.
+ *
+ * Hamerly keeps a single lower bound per point, on the distance to the
+ * nearest centroid other than its own, loosened by the largest drift. It
+ * skips fewer distances than Elkan but needs only O(N) extra memory; when the
+ * bounds fail it falls back to a full scan of the point.
+ *
+ * Yinyang splits the initial centroids into groups (by clustering them) and
+ * keeps one lower bound per point and group, loosened by the largest drift in
+ * the group. The smallest of them filters the whole point at once (global
+ * filter); otherwise only the groups whose bound the point could beat are
+ * scanned (group filter). Both memory and refresh cost stay small for large K.
+ *
+ * The labels must match the plain Lloyd scan exactly, including on near-ties,
+ * so every bound is kept valid for the *exact* distances: computed distances
+ * are widened by a relative margin that covers their rounding error, and a
+ * centroid is only skipped when its lower bound beats the upper bound by that
+ * margin again. Whatever survives is settled on the squared distances computed
+ * exactly like kmeans_closest_centroid does, ties going to the smallest index.
+ */
+
+/* Centroids scored at once by block_distances */
+#define SCAN_BLOCK 256
+
+/* Yinyang: at most this many groups (so N x groups bounds), about ten centroids each */
+#define YINYANG_MAX_GROUPS 256
+#define YINYANG_GROUP_SIZE 10
+/* Lloyd iterations used to group the initial centroids */
+#define YINYANG_GROUPING_ITERATIONS 5
+
+/*declaration of functions*/
+static double bound_pad(int dim);
+static double widen(double distance, double pad);
+static double narrow(double distance, double pad);
+static void elkan_first_pass(const struct matrix *data, const struct matrix *centroids,
+                             size_t i, struct kmeans_workspace *ws, double pad);
+static void block_distances(const double *soa, int K, int dim, const double *x,
+                            int k0, int n, double *dist);
+static int hamerly_scan(const double *soa, int K, int dim, const double *x,
+                        double *best_dist, double *second_dist);
+static void move_point(struct kmeans_workspace *ws, const double *x, int dim, int from, int to);
+static void yinyang_group_centroids(const struct matrix *centroids, struct kmeans_workspace *ws);
+static void yinyang_scan_groups(const double *x, int g_first, int g_last, double *lower, int K, int dim,
+                                const struct kmeans_workspace *ws, double pad, int known,
+                                int *best, double *best_dist);
+
+
+/*
+ * Relative rounding error allowed for a distance computed over dim
+ * coordinates (the differences, squares and sum each round once per
+ * coordinate, sqrt once more), with a generous safety factor.
+ */
+static double bound_pad(int dim) {
+    return (4.0 * dim + 16.0) * DBL_EPSILON;
+}
+
+/* Turns a computed distance into an upper bound on the exact one */
+static double widen(double distance, double pad) {
+    return distance * (1.0 + pad);
+}
+
+/* Turns a computed distance into a lower bound on the exact one (never negative) */
+static double narrow(double distance, double pad) {
+    distance *= 1.0 - pad;
+    return distance > 0.0 ? distance : 0.0;
+}
+
+/*
+ * Serial part of an Elkan, Hamerly or Yinyang iteration, run after every
+ * Update Step: measures how far every centroid moved since the bounds were
+ * last updated and how far apart the centroids are (all pairs for Elkan, only
+ * the nearest other one for Hamerly). For Yinyang it groups the centroids on
+ * the first call and then tracks the largest drift of every group.
+ */
+void kmeans_bounds_refresh(const struct matrix *centroids, struct kmeans_workspace *ws) {
+    size_t K = centroids->rows;
+    int dim = centroids->dim;
+    double pad = bound_pad(dim);
+    double half;
+    size_t a, c, j;
+    int g, d;
+
+    ws->drift_max = 0.0;
+    ws->drift_second = 0.0;
+    ws->drift_max_index = 0;
+    for (c = 0; c < K; c++) {
+        ws->drift[c] = ws->bounds_ready
+                     ? widen(compute_distance(MATRIX_ROW(&ws->previous, c), MATRIX_ROW(centroids, c), dim), pad)
+                     : 0.0;
+        if (ws->drift[c] > ws->drift_max) {
+            ws->drift_second = ws->drift_max;
+            ws->drift_max = ws->drift[c];
+            ws->drift_max_index = (int)c;
+        }
+        else if (ws->drift[c] > ws->drift_second) {
+            ws->drift_second = ws->drift[c];
+        }
+    }
+    memcpy(ws->previous.data, centroids->data, K * (size_t)dim * sizeof(double));
+
+    if (ws->group_of != NULL) {
+        if (!ws->bounds_ready) {
+            yinyang_group_centroids(centroids, ws);
+        }
+        for (g = 0; g < ws->n_groups; g++) {
+            ws->group_drift[g] = 0.0;
+        }
+        for (c = 0; c < K; c++) {
+            g = ws->group_of[c];
+            if (ws->drift[c] > ws->group_drift[g]) {
+                ws->group_drift[g] = ws->drift[c];
+            }
+        }
+        /* Column-major copy in group order, so every group is a run of columns */
+        for (j = 0; j < K; j++) {
+            c = (size_t)ws->group_members[j];
+            for (d = 0; d < dim; d++) {
+                ws->group_soa[(size_t)d * K + j] = MATRIX_ROW(centroids, c)[d];
+            }
+        }
+    }
+
+    /* Yinyang has no use for the O(K^2) separations */
+    if (ws->nearest_half == NULL) {
+        return;
+    }
+    for (a = 0; a < K; a++) {
+        ws->nearest_half[a] = HUGE_VAL;
+        if (ws->centroid_half != NULL) {
+            ws->centroid_half[a * K + a] = 0.0;
+        }
+    }
+    for (a = 0; a < K; a++) {
+        for (c = a + 1; c < K; c++) {
+            half = 0.5 * narrow(compute_distance(MATRIX_ROW(centroids, a), MATRIX_ROW(centroids, c), dim), pad);
+            if (ws->centroid_half != NULL) {
+                ws->centroid_half[a * K + c] = half;
+                ws->centroid_half[c * K + a] = half;
+            }
+            if (half < ws->nearest_half[a]) {
+                ws->nearest_half[a] = half;
+            }
+            if (half < ws->nearest_half[c]) {
+                ws->nearest_half[c] = half;
+            }
+        }
+    }
+}
+
+/* First Assignment Step for point i: a full scan that also fills in all its bounds */
+static void elkan_first_pass(const struct matrix *data, const struct matrix *centroids,
+                             size_t i, struct kmeans_workspace *ws, double pad) {
+    size_t K = centroids->rows;
+    const double *x = MATRIX_ROW(data, i);
+    double *lower = ws->lower + i * K;
+    double dist, best_dist = HUGE_VAL;
+    size_t c;
+    int best = 0;
+
+    for (c = 0; c < K; c++) {
+        dist = squared_distance(MATRIX_ROW(centroids, c), x, data->dim);
+        lower[c] = narrow(sqrt(dist), pad);
+        if (dist < best_dist) {
+            best_dist = dist;
+            best = (int)c;
+        }
+    }
+    ws->labels[i] = best;
+    ws->upper[i] = widen(sqrt(best_dist), pad);
+    ws->distance_evals += K;
+}
+
+/*
+ * Elkan Assignment Step for the points first..last-1: writes ws->labels and
+ * adds the points to the cluster sums. kmeans_bounds_refresh (and nothing
+ * else) must have run since the last Update Step.
+ */
+void kmeans_assign_elkan(const struct matrix *data, const struct matrix *centroids,
+                         size_t first, size_t last, struct kmeans_workspace *ws) {
+    size_t K = centroids->rows;
+    int dim = data->dim;
+    double pad = bound_pad(dim);
+    double slack = 1.0 + 2.0 * pad;
+    const double *x;
+    const double *half;
+    const double *drift = ws->drift;
+    double *lower;
+    double upper, reach, dist, best_dist = 0.0;
+    size_t i, c;
+    int best, exact;
+
+    for (i = first; i < last; i++) {
+        if (!ws->bounds_ready) {
+            elkan_first_pass(data, centroids, i, ws, pad);
+            continue;
+        }
+
+        x = MATRIX_ROW(data, i);
+        lower = ws->lower + i * K;
+        best = ws->labels[i];
+
+        /* Loosen the bounds by how far the centroids moved */
+        upper = widen(ws->upper[i] + drift[best], pad);
+        for (c = 0; c < K; c++) {
+            lower[c] = narrow(lower[c] - drift[c], pad);
+        }
+
+        /* Closer to its centroid than half the way to any other one: nothing can change */
+        reach = upper * slack;
+        if (reach < ws->nearest_half[best]) {
+            ws->upper[i] = upper;
+            continue;
+        }
+
+        half = ws->centroid_half + (size_t)best * K;
+        exact = 0;
+        for (c = 0; c < K; c++) {
+            if ((int)c == best || reach < lower[c] || reach < half[c]) {
+                continue;
+            }
+            /* The bounds are not enough: tighten the upper one to the exact distance first */
+            if (!exact) {
+                best_dist = squared_distance(MATRIX_ROW(centroids, best), x, dim);
+                ws->distance_evals++;
+                upper = widen(sqrt(best_dist), pad);
+                reach = upper * slack;
+                lower[best] = narrow(sqrt(best_dist), pad);
+                exact = 1;
+                if (reach < lower[c] || reach < half[c]) {
+                    continue;
+                }
+            }
+            dist = squared_distance(MATRIX_ROW(centroids, c), x, dim);
+            ws->distance_evals++;
+            lower[c] = narrow(sqrt(dist), pad);
+            /* Same winner as a strict '<' scan in index order */
+            if (dist < best_dist || (dist == best_dist && (int)c < best)) {
+                best_dist = dist;
+                best = (int)c;
+                upper = widen(sqrt(dist), pad);
+                reach = upper * slack;
+                half = ws->centroid_half + (size_t)best * K;
+            }
+        }
+        ws->labels[i] = best;
+        ws->upper[i] = upper;
+    }
+    accumulate_range(data, first, last, ws->labels, ws);
+}
+
+
+/*
+ * Squared distances from x to the n <= SCAN_BLOCK centroids in columns
+ * k0..k0+n-1 of a column-major (dim x K) mirror, one coordinate for the whole
+ * block per step. This vectorizes while keeping every sum in coordinate order,
+ * so the distances are the ones kmeans_closest_centroid computes.
+ */
+KMEANS_TARGET_CLONES
+static void block_distances(const double *soa, int K, int dim, const double *x,
+                            int k0, int n, double *dist) {
+    double diff;
+    int k, d;
+
+    for (k = 0; k < n; k++) {
+        dist[k] = 0.0;
+    }
+    for (d = 0; d < dim; d++) {
+        for (k = 0; k < n; k++) {
+            diff = soa[(size_t)d * K + k0 + k] - x[d];
+            dist[k] += diff * diff;
+        }
+    }
+}
+
+/*
+ * Full scan of x over all centroids, with the same winner as
+ * kmeans_closest_centroid. Returns the closest centroid and stores its squared
+ * distance and that of the runner-up (HUGE_VAL if K == 1).
+ */
+static int hamerly_scan(const double *soa, int K, int dim, const double *x,
+                        double *best_dist, double *second_dist) {
+    double dist[SCAN_BLOCK];
+    int k0, k, n, best = 0;
+
+    *best_dist = HUGE_VAL;
+    *second_dist = HUGE_VAL;
+    for (k0 = 0; k0 < K; k0 += SCAN_BLOCK) {
+        n = K - k0 < SCAN_BLOCK ? K - k0 : SCAN_BLOCK;
+        block_distances(soa, K, dim, x, k0, n, dist);
+        for (k = 0; k < n; k++) {
+            if (dist[k] < *best_dist) {
+                *second_dist = *best_dist;
+                *best_dist = dist[k];
+                best = k0 + k;
+            }
+            else if (dist[k] < *second_dist) {
+                *second_dist = dist[k];
+            }
+        }
+    }
+    return best;
+}
+
+/*
+ * Hamerly Assignment Step for the points first..last-1: writes ws->labels and
+ * adds the points to the cluster sums. kmeans_bounds_refresh (and nothing
+ * else) must have run since the last Update Step.
+ */
+void kmeans_assign_hamerly(const struct matrix *data, const struct matrix *centroids,
+                           size_t first, size_t last, struct kmeans_workspace *ws) {
+    size_t K = centroids->rows;
+    int dim = data->dim;
+    double pad = bound_pad(dim);
+    double slack = 1.0 + 2.0 * pad;
+    const double *x;
+    double upper, lower, reach, best_dist, second_dist;
+    size_t i;
+    int best;
+
+    for (i = first; i < last; i++) {
+        x = MATRIX_ROW(data, i);
+        best = ws->labels[i];
+
+        if (ws->bounds_ready) {
+            /* Loosen the bounds: the other centroids moved by at most the largest drift among them */
+            upper = widen(ws->upper[i] + ws->drift[best], pad);
+            lower = narrow(ws->lower[i] - (best == ws->drift_max_index ? ws->drift_second : ws->drift_max), pad);
+
+            /* No other centroid can be that close, or the own one is past half the way to any other */
+            reach = upper * slack;
+            if (reach < lower || reach < ws->nearest_half[best]) {
+                ws->upper[i] = upper;
+                ws->lower[i] = lower;
+                continue;
+            }
+
+            /* Try again with the exact distance to the own centroid */
+            best_dist = squared_distance(MATRIX_ROW(centroids, best), x, dim);
+            ws->distance_evals++;
+            upper = widen(sqrt(best_dist), pad);
+            reach = upper * slack;
+            if (reach < lower || reach < ws->nearest_half[best]) {
+                ws->upper[i] = upper;
+                ws->lower[i] = lower;
+                continue;
+            }
+        }
+
+        best = hamerly_scan(ws->centroids_soa, (int)K, dim, x, &best_dist, &second_dist);
+        ws->distance_evals += K;
+        ws->labels[i] = best;
+        ws->upper[i] = widen(sqrt(best_dist), pad);
+        ws->lower[i] = narrow(sqrt(second_dist), pad);
+    }
+    accumulate_range(data, first, last, ws->labels, ws);
+}
+
+/* Takes x out of the sums of cluster `from` (unless it is -1) and adds it to those of `to` */
+static void move_point(struct kmeans_workspace *ws, const double *x, int dim, int from, int to) {
+    double *sum;
+    int d;
+
+    if (from >= 0) {
+        sum = MATRIX_ROW(&ws->sums, from);
+        for (d = 0; d < dim; d++) {
+            sum[d] -= x[d];
+        }
+        ws->counts[from]--;
+    }
+    add_coordinates_from_other_vector(MATRIX_ROW(&ws->sums, to), x, dim);
+    ws->counts[to]++;
+}
+
+/*
+ * Hamerly Assignment Step for kmeans_refit over the points first..last-1.
+ * Instead of adding every point to sums rebuilt from zero, it only moves the
+ * points that change cluster out of the sums and counts of the old one and
+ * into the new one's, so ws->sums holds running totals (or, on a thread,
+ * the changes to them). Points labelled -1 have not been counted anywhere
+ * yet; they, points whose upper bound is negative (unknown), and every point
+ * while !ws->bounds_ready get a full scan.
+ */
+void kmeans_reassign_hamerly(const struct matrix *data, const struct matrix *centroids,
+                             size_t first, size_t last, struct kmeans_workspace *ws) {
+    size_t K = centroids->rows;
+    int dim = data->dim;
+    double pad = bound_pad(dim);
+    double slack = 1.0 + 2.0 * pad;
+    const double *x;
+    double upper, lower, reach, best_dist, second_dist;
+    size_t i;
+    int old, best;
+
+    for (i = first; i < last; i++) {
+        x = MATRIX_ROW(data, i);
+        old = ws->labels[i];
+
+        if (ws->bounds_ready && old >= 0 && ws->upper[i] >= 0.0) {
+            /* Same tests as kmeans_assign_hamerly */
+            upper = widen(ws->upper[i] + ws->drift[old], pad);
+            lower = narrow(ws->lower[i] - (old == ws->drift_max_index ? ws->drift_second : ws->drift_max), pad);
+            reach = upper * slack;
+            if (reach < lower || reach < ws->nearest_half[old]) {
+                ws->upper[i] = upper;
+                ws->lower[i] = lower;
+                continue;
+            }
+
+            best_dist = squared_distance(MATRIX_ROW(centroids, old), x, dim);
+            ws->distance_evals++;
+            upper = widen(sqrt(best_dist), pad);
+            reach = upper * slack;
+            if (reach < lower || reach < ws->nearest_half[old]) {
+                ws->upper[i] = upper;
+                ws->lower[i] = lower;
+                continue;
+            }
+        }
+
+        best = hamerly_scan(ws->centroids_soa, (int)K, dim, x, &best_dist, &second_dist);
+        ws->distance_evals += K;
+        ws->upper[i] = widen(sqrt(best_dist), pad);
+        ws->lower[i] = narrow(sqrt(second_dist), pad);
+        if (best != old) {
+            ws->labels[i] = best;
+            move_point(ws, x, dim, old, best);
+        }
+    }
+}
+
+/*
+ * Loosens the Hamerly bounds of the points first..last-1 by the drift found
+ * by kmeans_bounds_refresh, without computing any distance, so they hold for
+ * the current centroids (kmeans_refit hands them back that way).
+ */
+void kmeans_loosen_hamerly(size_t first, size_t last, struct kmeans_workspace *ws) {
+    double pad = bound_pad(ws->previous.dim);
+    size_t i;
+    int label;
+
+    for (i = first; i < last; i++) {
+        label = ws->labels[i];
+        ws->upper[i] = widen(ws->upper[i] + ws->drift[label], pad);
+        ws->lower[i] = narrow(ws->lower[i] - (label == ws->drift_max_index ? ws->drift_second : ws->drift_max),
+                              pad);
+    }
+}
+
+
+/* Number of Yinyang groups for K centroids */
+int kmeans_yinyang_groups(int K) {
+    int groups = (K + YINYANG_GROUP_SIZE - 1) / YINYANG_GROUP_SIZE;
+    if (groups < 1) {
+        return 1;
+    }
+    return groups < YINYANG_MAX_GROUPS ? groups : YINYANG_MAX_GROUPS;
+}
+
+/*
+ * Splits the (initial) centroids into ws->n_groups groups with a few Lloyd
+ * iterations over the centroids themselves, seeded with evenly spaced ones,
+ * then lists the members of every group in index order.
+ */
+static void yinyang_group_centroids(const struct matrix *centroids, struct kmeans_workspace *ws) {
+    size_t K = centroids->rows;
+    int G = ws->n_groups;
+    int dim = centroids->dim;
+    struct matrix *centers = &ws->group_centers;
+    double *sums = ws->group_soa; /* K x dim scratch, only G x dim of it needed here */
+    int *sizes = ws->group_start;
+    size_t c;
+    int g, it, pos;
+
+    for (g = 0; g < G; g++) {
+        memcpy(MATRIX_ROW(centers, g), MATRIX_ROW(centroids, (size_t)g * K / (size_t)G),
+               (size_t)dim * sizeof(double));
+    }
+    for (it = 0; it < YINYANG_GROUPING_ITERATIONS; it++) {
+        zero_out_vector(sums, G * dim);
+        memset(sizes, 0, (size_t)G * sizeof(int));
+        for (c = 0; c < K; c++) {
+            g = find_closest_centroid(centers, MATRIX_ROW(centroids, c));
+            ws->group_of[c] = g;
+            sizes[g]++;
+            add_coordinates_from_other_vector(sums + (size_t)g * dim, MATRIX_ROW(centroids, c), dim);
+        }
+        /* An empty group keeps its center (and simply stays empty) */
+        for (g = 0; g < G; g++) {
+            if (sizes[g] > 0) {
+                divide_vector_by_scalar(sums + (size_t)g * dim, dim, sizes[g]);
+                memcpy(MATRIX_ROW(centers, g), sums + (size_t)g * dim, (size_t)dim * sizeof(double));
+            }
+        }
+    }
+
+    /* Counting sort of the centroids by group */
+    memset(sizes, 0, ((size_t)G + 1) * sizeof(int));
+    for (c = 0; c < K; c++) {
+        sizes[ws->group_of[c] + 1]++;
+    }
+    for (g = 0; g < G; g++) {
+        ws->group_start[g + 1] += ws->group_start[g];
+    }
+    for (c = 0; c < K; c++) {
+        g = ws->group_of[c];
+        pos = ws->group_start[g]++;
+        ws->group_members[pos] = (int)c;
+    }
+    /* The placement loop advanced every start to the next group's: shift them back */
+    for (g = G; g > 0; g--) {
+        ws->group_start[g] = ws->group_start[g - 1];
+    }
+    ws->group_start[0] = 0;
+}
+
+/*
+ * Scans every centroid of the groups g_first..g_last-1 (a run of columns of
+ * ws->group_soa) for point x and rebuilds those groups' lower bounds.
+ * best / best_dist are updated with the same winner as a strict '<' scan in
+ * index order; known says whether best_dist is the exact distance to best
+ * (then best is not scored again). When best is taken over, the old one joins
+ * the "other centroids" of its group, whose bound is lowered to match.
+ * An unknown best only ever shows up in the first pass, as the HUGE_VAL
+ * placeholder: scoring it then is exactly what the Lloyd scan does.
+ */
+static void yinyang_scan_groups(const double *x, int g_first, int g_last, double *lower, int K, int dim,
+                                const struct kmeans_workspace *ws, double pad, int known,
+                                int *best, double *best_dist) {
+    double dist[SCAN_BLOCK];
+    int start = ws->group_start[g_first];
+    int end = ws->group_start[g_last];
+    int k0, k, n, c, g, h;
+
+    /* While scanning, the bounds of the scanned groups hold squared minima */
+    for (g = g_first; g < g_last; g++) {
+        lower[g] = HUGE_VAL;
+    }
+    for (k0 = start; k0 < end; k0 += SCAN_BLOCK) {
+        n = end - k0 < SCAN_BLOCK ? end - k0 : SCAN_BLOCK;
+        block_distances(ws->group_soa, K, dim, x, k0, n, dist);
+        for (k = 0; k < n; k++) {
+            c = ws->group_members[k0 + k];
+            if (c == *best && known) {
+                continue;
+            }
+            if (dist[k] < *best_dist || (dist[k] == *best_dist && c < *best)) {
+                h = ws->group_of[*best];
+                if (h >= g_first && h < g_last) {
+                    lower[h] = *best_dist < lower[h] ? *best_dist : lower[h];
+                }
+                else if (narrow(sqrt(*best_dist), pad) < lower[h]) {
+                    lower[h] = narrow(sqrt(*best_dist), pad);
+                }
+                *best = c;
+                *best_dist = dist[k];
+            }
+            else {
+                g = ws->group_of[c];
+                lower[g] = dist[k] < lower[g] ? dist[k] : lower[g];
+            }
+        }
+    }
+    for (g = g_first; g < g_last; g++) {
+        lower[g] = narrow(sqrt(lower[g]), pad);
+    }
+}
+
+/*
+ * Yinyang Assignment Step for the points first..last-1: writes ws->labels and
+ * adds the points to the cluster sums. kmeans_bounds_refresh (and nothing
+ * else) must have run since the last Update Step.
+ */
+void kmeans_assign_yinyang(const struct matrix *data, const struct matrix *centroids,
+                           size_t first, size_t last, struct kmeans_workspace *ws) {
+    size_t K = centroids->rows;
+    int G = ws->n_groups;
+    int dim = data->dim;
+    double pad = bound_pad(dim);
+    double slack = 1.0 + 2.0 * pad;
+    const double *x;
+    double *lower;
+    double upper, reach, nearest, best_dist;
+    size_t i;
+    int g, run_end, best;
+
+    for (i = first; i < last; i++) {
+        x = MATRIX_ROW(data, i);
+        lower = ws->lower + i * (size_t)G;
+
+        if (!ws->bounds_ready) {
+            /* First pass: score every group, starting from the same "centroid 0 at infinity" as Lloyd */
+            best = 0;
+            best_dist = HUGE_VAL;
+            yinyang_scan_groups(x, 0, G, lower, (int)K, dim, ws, pad, 0, &best, &best_dist);
+            ws->distance_evals += K;
+            ws->labels[i] = best;
+            ws->upper[i] = widen(sqrt(best_dist), pad);
+            continue;
+        }
+
+        /* Loosen the bounds by how far the centroids moved */
+        best = ws->labels[i];
+        upper = widen(ws->upper[i] + ws->drift[best], pad);
+        nearest = HUGE_VAL;
+        for (g = 0; g < G; g++) {
+            lower[g] = narrow(lower[g] - ws->group_drift[g], pad);
+            nearest = lower[g] < nearest ? lower[g] : nearest;
+        }
+
+        /* Global filter: no group can hold anything closer */
+        reach = upper * slack;
+        if (reach < nearest) {
+            ws->upper[i] = upper;
+            continue;
+        }
+
+        /* Try again with the exact distance to the own centroid */
+        best_dist = squared_distance(MATRIX_ROW(centroids, best), x, dim);
+        ws->distance_evals++;
+        upper = widen(sqrt(best_dist), pad);
+        reach = upper * slack;
+        if (reach < nearest) {
+            ws->upper[i] = upper;
+            continue;
+        }
+
+        /* Group filter: only scan the groups the point could still move to, a run at a time */
+        g = 0;
+        while (g < G) {
+            if (reach < lower[g]) {
+                g++;
+                continue;
+            }
+            run_end = g + 1;
+            while (run_end < G && !(reach < lower[run_end])) {
+                run_end++;
+            }
+            yinyang_scan_groups(x, g, run_end, lower, (int)K, dim, ws, pad, 1, &best, &best_dist);
+            ws->distance_evals += (unsigned long long)(ws->group_start[run_end] - ws->group_start[g]);
+            reach = widen(sqrt(best_dist), pad) * slack;
+            g = run_end;
+        }
+        ws->labels[i] = best;
+        ws->upper[i] = widen(sqrt(best_dist), pad);
+    }
+    accumulate_range(data, first, last, ws->labels, ws);
+}
@@ -0,0 +1,308 @@
+#include "kmeans.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A .kmc file: the result of joining the two CSV inputs (kmeans_csv.c) in
+ * a binary layout that can be mapped and used as it is, so later runs on
+ * the same inputs skip the parsing and the join altogether:
+ *
+ *     header     struct kmeans_cache_header (fields of 8 bytes)
+ *     keys       rows float64, in ascending order (NaN last)
+ *     padding    up to a multiple of KMEANS_ALIGNMENT bytes
+ *     data       rows x dim float64, row-major, to the end of the file
+ *
+ * Everything is in native byte order; a file written on a machine of the
+ * other order has a byte-swapped magic and is rejected like any other
+ * invalid file. Since the coordinates end the file, data_offset is also the
+ * offset to hand to kmeans_source_open to stream them from disk.
+ *
+ * The header records the size and modification time of both CSV files, as
+ * they were before they were read: if either has changed since (or is gone),
+ * the cache is stale. The file is written under a temporary name and renamed
+ * into place, so a reader never maps a half-written one.
+ */
+
+#if defined(_WIN32)
+#include <process.h>
+#include <sys/stat.h>
+#define KMEANS_NO_MMAP 1
+#define cache_getpid() ((unsigned long)_getpid())
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define cache_getpid() ((unsigned long)getpid())
+#endif
+
+/* The bytes "KMCACHE\0" as a little-endian integer */
+#define KMEANS_CACHE_MAGIC 0x0045484341434d4bULL
+#define KMEANS_CACHE_VERSION 1
+
+/* Values of the dtype field */
+#define KMEANS_CACHE_FLOAT64 1
+
+/*declaration of functions*/
+static int cache_write_all(FILE *file, const void *bytes, size_t count);
+static int cache_map(struct kmeans_cache *c, const char *path);
+
+
+/*
+ * Size and modification time (in ns since the epoch, or in whole seconds
+ * where the platform keeps no more) of the file at path.
+ * Returns 0 on success, -1 with errno set otherwise.
+ */
+int kmeans_cache_stat(const char *path, unsigned long long *bytes, long long *mtime_ns) {
+#if defined(_WIN32)
+    struct _stat64 info;
+
+    if (_stat64(path, &info) != 0) {
+        return -1;
+    }
+    *mtime_ns = (long long)info.st_mtime * 1000000000LL;
+#else
+    struct stat info;
+
+    if (stat(path, &info) != 0) {
+        return -1;
+    }
+#if defined(__APPLE__)
+    *mtime_ns = (long long)info.st_mtimespec.tv_sec * 1000000000LL + (long long)info.st_mtimespec.tv_nsec;
+#else
+    *mtime_ns = (long long)info.st_mtim.tv_sec * 1000000000LL + (long long)info.st_mtim.tv_nsec;
+#endif
+#endif
+    *bytes = (unsigned long long)info.st_size;
+    return 0;
+}
+
+/* fwrite that reports a short write. Returns 0, or -1 with errno set */
+static int cache_write_all(FILE *file, const void *bytes, size_t count) {
+    errno = 0;
+    if (count > 0 && fwrite(bytes, 1, count, file) != count) {
+        if (errno == 0) {
+            errno = EIO;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Writes rows keys and the rows x dim coordinates to a .kmc file at path,
+ * replacing any file there, with the sizes and modification times of the
+ * two CSV files they come from (taken with kmeans_cache_stat before they
+ * were read). Returns 0 on success, -1 with errno set otherwise (nothing is
+ * left behind then).
+ */
+int kmeans_cache_write(const char *path, const double *keys, const double *data, size_t rows, int dim,
+                       const unsigned long long source_bytes[2], const long long source_mtime_ns[2]) {
+    static const unsigned char zeros[KMEANS_ALIGNMENT] = {0};
+    struct kmeans_cache_header header;
+    unsigned long long keys_end;
+    FILE *file;
+    char *temp;
+    size_t temp_length;
+    int saved;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = KMEANS_CACHE_MAGIC;
+    header.version = KMEANS_CACHE_VERSION;
+    header.dtype = KMEANS_CACHE_FLOAT64;
+    header.rows = rows;
+    header.dim = (unsigned long long)dim;
+    header.keys_offset = sizeof(header);
+    keys_end = header.keys_offset + rows * sizeof(double);
+    header.data_offset = (keys_end + KMEANS_ALIGNMENT - 1) / KMEANS_ALIGNMENT * KMEANS_ALIGNMENT;
+    header.file_bytes = header.data_offset + rows * (size_t)dim * sizeof(double);
+    header.source_bytes[0] = source_bytes[0];
+    header.source_bytes[1] = source_bytes[1];
+    header.source_mtime_ns[0] = source_mtime_ns[0];
+    header.source_mtime_ns[1] = source_mtime_ns[1];
+
+    /* path.<pid>.tmp: writers of the same cache do not step on each other */
+    temp_length = strlen(path) + 32;
+    temp = malloc(temp_length);
+    if (temp == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    sprintf(temp, "%s.%lu.tmp", path, cache_getpid());
+
+    file = fopen(temp, "wb");
+    if (file == NULL) {
+        free(temp);
+        return -1;
+    }
+    if (cache_write_all(file, &header, sizeof(header)) != 0
+        || cache_write_all(file, keys, rows * sizeof(double)) != 0
+        || cache_write_all(file, zeros, (size_t)(header.data_offset - keys_end)) != 0
+        || cache_write_all(file, data, rows * (size_t)dim * sizeof(double)) != 0) {
+        saved = errno;
+        fclose(file);
+        remove(temp);
+        free(temp);
+        errno = saved;
+        return -1;
+    }
+    if (fclose(file) != 0) {
+        saved = errno;
+        remove(temp);
+        free(temp);
+        errno = saved;
+        return -1;
+    }
+
+#if defined(_WIN32)
+    remove(path); /* rename does not replace there */
+#endif
+    if (rename(temp, path) != 0) {
+        saved = errno;
+        remove(temp);
+        free(temp);
+        errno = saved;
+        return -1;
+    }
+    free(temp);
+    return 0;
+}
+
+/*
+ * Maps the whole file (or reads it, where there is no mmap) into c->map.
+ * Returns 0 on success, -1 with errno set otherwise.
+ */
+static int cache_map(struct kmeans_cache *c, const char *path) {
+#if !defined(KMEANS_NO_MMAP)
+    struct stat info;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)info.st_size < sizeof(struct kmeans_cache_header)) {
+        close(fd);
+        c->map_bytes = (size_t)info.st_size;
+        return 0;
+    }
+    map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* The mapping keeps the file open */
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    c->map = map;
+    c->map_bytes = (size_t)info.st_size;
+    return 0;
+#else
+    FILE *file;
+    unsigned char *bytes;
+    long size;
+
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return -1;
+    }
+    if ((size_t)size < sizeof(struct kmeans_cache_header)) {
+        fclose(file);
+        c->map_bytes = (size_t)size;
+        return 0;
+    }
+    bytes = malloc((size_t)size);
+    if (bytes == NULL) {
+        fclose(file);
+        errno = ENOMEM;
+        return -1;
+    }
+    if (fread(bytes, 1, (size_t)size, file) != (size_t)size) {
+        free(bytes);
+        fclose(file);
+        errno = EIO;
+        return -1;
+    }
+    fclose(file);
+    c->map = bytes;
+    c->map_bytes = (size_t)size;
+    return 0;
+#endif
+}
+
+/*
+ * Maps the .kmc file at path, if it is still up to date with the CSV files
+ * at left_path and right_path. Returns 0 on success (c->keys and c->data
+ * then point into the mapping until kmeans_cache_close), -1 if the file
+ * cannot be opened or mapped (errno tells why, ENOENT when there is none
+ * yet), -2 if it is not a valid .kmc file, -3 if it is stale: a CSV file
+ * changed since, or cannot be found. c needs kmeans_cache_close in every case.
+ */
+int kmeans_cache_open(struct kmeans_cache *c, const char *path, const char *left_path, const char *right_path) {
+    const struct kmeans_cache_header *h = &c->header;
+    const char *sources[2];
+    unsigned long long bytes;
+    long long mtime_ns;
+    int s;
+
+    c->map = NULL;
+    c->map_bytes = 0;
+    c->keys = NULL;
+    c->data = NULL;
+    if (cache_map(c, path) != 0) {
+        return -1;
+    }
+    if (c->map == NULL) {
+        return -2;
+    }
+
+    /* Checked field by field, so a corrupt header cannot point outside the file */
+    memcpy(&c->header, c->map, sizeof(c->header));
+    if (h->magic != KMEANS_CACHE_MAGIC || h->version != KMEANS_CACHE_VERSION
+        || h->dtype != KMEANS_CACHE_FLOAT64 || h->file_bytes != c->map_bytes
+        || h->dim == 0 || h->dim > 0x7fffffffULL || h->keys_offset != sizeof(c->header)
+        || h->data_offset % KMEANS_ALIGNMENT != 0
+        || h->rows > (h->file_bytes - h->keys_offset) / sizeof(double)
+        || h->data_offset < h->keys_offset + h->rows * sizeof(double)
+        || h->data_offset > h->file_bytes
+        || h->rows > (h->file_bytes - h->data_offset) / sizeof(double) / h->dim
+        || h->data_offset + h->rows * h->dim * sizeof(double) != h->file_bytes) {
+        return -2;
+    }
+
+    sources[0] = left_path;
+    sources[1] = right_path;
+    for (s = 0; s < 2; s++) {
+        if (kmeans_cache_stat(sources[s], &bytes, &mtime_ns) != 0
+            || bytes != h->source_bytes[s] || mtime_ns != h->source_mtime_ns[s]) {
+            return -3;
+        }
+    }
+
+    c->keys = (const double *)(c->map + h->keys_offset);
+    c->data = (const double *)(c->map + h->data_offset);
+    return 0;
+}
+
+/* Unmaps (or frees) the file */
+void kmeans_cache_close(struct kmeans_cache *c) {
+    if (c->map != NULL) {
+#if !defined(KMEANS_NO_MMAP)
+        munmap((void *)c->map, c->map_bytes);
+#else
+        free((void *)c->map);
+#endif
+    }
+    c->map = NULL;
+    c->keys = NULL;
+    c->data = NULL;
+}
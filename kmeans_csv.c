@@ -0,0 +1,756 @@
+#include "kmeans.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The input files of kmeans_pp.py: two CSV files of numbers without a
+ * header, joined on their first column (the key) like
+ *
+ *     pd.merge(df1, df2, on="key", how="inner").sort_values("key")
+ *
+ * and turned into one dense matrix - the other columns of the first file,
+ * then those of the second - with the keys beside it.
+ *
+ * Both files are mapped read-only and parsed by several threads at once,
+ * each taking a slice of whole lines: a first pass counts the rows of every
+ * slice, so the second one knows where its rows go and parses them straight
+ * into their table. Numbers go through a short exact path (at most 19
+ * digits and a power of ten up to 1e22, so a single rounding) and strtod
+ * otherwise, so every value is the correctly rounded one.
+ *
+ * The join hashes the keys of the second file into an open-addressing table
+ * and probes it with every key of the first one. The rows of the first file
+ * that found a match are then sorted by key (a stable radix sort), and each of them brings its
+ * matches in the order of the second file, which is the order of the output.
+ *
+ * It follows pandas (header=None) where that matters for numeric files:
+ * blank lines are skipped, the first row fixes the number of fields, a row
+ * with more is an error and one with fewer gets NaN in the missing ones, as
+ * do empty fields and pandas' NA strings; NaN keys match each other and sort
+ * last. Rows with equal keys keep the merge order (left file first, then
+ * right file), where pandas' unstable sort leaves their order unspecified.
+ */
+
+#if defined(_WIN32)
+#define KMEANS_NO_MMAP 1
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Significant digits the exact path keeps in a 64-bit integer */
+#define CSV_MAX_DIGITS 19
+
+/* Bits per pass of the radix sort of the keys */
+#define CSV_RADIX_BITS 16
+
+/* Longest field strtod gets from a stack copy; longer ones are copied to the heap */
+#define CSV_FIELD_BUFFER 128
+
+/*declaration of structs*/
+struct kmeans_csv_chunk;
+struct csv_job;
+
+/*declaration of functions*/
+static int csv_map(struct kmeans_csv *csv, const char *path);
+static void csv_unmap(struct kmeans_csv *csv);
+static const char *line_end(const char *p, const char *end);
+static int line_is_blank(const char *p, const char *eol);
+static int count_fields(const char *p, const char *eol);
+static int parse_slow(const char *s, const char *end, double *out);
+static int parse_number(const char *s, const char *end, double *out);
+static int csv_split(struct kmeans_csv *csv, int n_threads);
+static void count_job(void *arg, int t, int n_threads);
+static void parse_job(void *arg, int t, int n_threads);
+static int csv_check(struct kmeans_csv_join *j, struct kmeans_csv *csv, int file);
+static unsigned long long key_hash(double key);
+static int keys_equal(double a, double b);
+static unsigned long long sort_bits(double key);
+static void sort_entries(struct kmeans_join_entry *entries, struct kmeans_join_entry *scratch, size_t n,
+                         size_t *counts);
+static void gather_job(void *arg, int t, int n_threads);
+
+
+/*implementations of structs*/
+
+/* One thread's slice of a file: whole lines, and what was found in them */
+struct kmeans_csv_chunk
+{
+    const char *begin;
+    const char *end;
+    size_t first_line;  /* 0-based number of the first line in the file */
+    size_t first_row;   /* Index of the first (non-blank) row of the slice */
+    size_t lines;
+    size_t rows;
+    size_t error_line;  /* 1-based line of the first bad row of the slice, 0 if none */
+    int error_fields;   /* Its number of fields when there are too many, 0 for a bad number */
+};
+
+/* What the threaded passes work on */
+struct csv_job
+{
+    struct kmeans_csv *csv;     /* count_job and parse_job */
+    struct kmeans_csv_join *j;  /* gather_job ... */
+    double *keys;               /* ... and its outputs */
+    double *data;
+};
+
+/* Exact powers of ten: every one of them up to 1e22 is a double */
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* The strings pandas reads as NaN by default (besides the empty field) */
+static const char *const na_strings[] = {
+    "#N/A", "#N/A N/A", "#NA", "-1.#IND", "-1.#QNAN", "-NaN", "-nan", "1.#IND", "1.#QNAN",
+    "<NA>", "N/A", "NA", "NULL", "NaN", "None", "n/a", "nan", "null"
+};
+
+
+/*
+ * Maps the file (or reads it, where there is no mmap) into csv->text.
+ * Returns 0 on success, -1 with errno set otherwise.
+ */
+static int csv_map(struct kmeans_csv *csv, const char *path) {
+#if !defined(KMEANS_NO_MMAP)
+    struct stat info;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return -1;
+    }
+    csv->bytes = (size_t)info.st_size;
+    if (csv->bytes == 0) {
+        close(fd);
+        csv->text = "";
+        return 0;
+    }
+    map = mmap(NULL, csv->bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* The mapping keeps the file open */
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    /* Two passes front to back */
+    madvise(map, csv->bytes, MADV_SEQUENTIAL);
+    csv->text = map;
+    csv->mapped = 1;
+    return 0;
+#else
+    FILE *file;
+    char *text;
+    long size;
+
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return -1;
+    }
+    text = malloc((size_t)size + 1);
+    if (text == NULL) {
+        fclose(file);
+        errno = ENOMEM;
+        return -1;
+    }
+    if (fread(text, 1, (size_t)size, file) != (size_t)size) {
+        free(text);
+        fclose(file);
+        errno = EIO;
+        return -1;
+    }
+    fclose(file);
+    csv->text = text;
+    csv->bytes = (size_t)size;
+    csv->mapped = 1;
+    return 0;
+#endif
+}
+
+/* Unmaps (or frees) what csv_map got */
+static void csv_unmap(struct kmeans_csv *csv) {
+    if (csv->mapped) {
+#if !defined(KMEANS_NO_MMAP)
+        munmap((void *)csv->text, csv->bytes);
+#else
+        free((void *)csv->text);
+#endif
+    }
+    csv->text = NULL;
+    csv->mapped = 0;
+    free(csv->chunks);
+    csv->chunks = NULL;
+}
+
+/* End of the line starting at p: its '\n', or end */
+static const char *line_end(const char *p, const char *end) {
+    const char *nl = memchr(p, '\n', (size_t)(end - p));
+    return nl != NULL ? nl : end;
+}
+
+/* Whether the line p..eol (without its '\n') is empty, a lone '\r' aside */
+static int line_is_blank(const char *p, const char *eol) {
+    return p == eol || (eol - p == 1 && *p == '\r');
+}
+
+/* Number of comma-separated fields of a line */
+static int count_fields(const char *p, const char *eol) {
+    int fields = 1;
+
+    for (; p < eol; p++) {
+        fields += *p == ',';
+    }
+    return fields;
+}
+
+/*
+ * Parses s..end (already trimmed, not empty) with strtod, or as one of
+ * pandas' NA strings. Returns 0 on success, -1 if it is not a number.
+ */
+static int parse_slow(const char *s, const char *end, double *out) {
+    char buffer[CSV_FIELD_BUFFER];
+    size_t length = (size_t)(end - s);
+    size_t i;
+    char *copy = buffer;
+    char *stop;
+    int rc = 0;
+
+    for (i = 0; i < sizeof(na_strings) / sizeof(na_strings[0]); i++) {
+        if (strlen(na_strings[i]) == length && memcmp(na_strings[i], s, length) == 0) {
+            *out = NAN;
+            return 0;
+        }
+    }
+    if (length >= sizeof(buffer)) {
+        copy = malloc(length + 1);
+        if (copy == NULL) {
+            return -1;
+        }
+    }
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+    *out = strtod(copy, &stop);
+    if (stop != copy + length || length == 0) {
+        rc = -1;
+    }
+    if (copy != buffer) {
+        free(copy);
+    }
+    return rc;
+}
+
+/*
+ * Parses one field s..end into *out: surrounding blanks and double quotes
+ * are dropped, and an empty field is NaN. Decimal numbers of up to 19
+ * significant digits with a small enough exponent are converted exactly
+ * here; everything else goes to parse_slow.
+ * Returns 0 on success, -1 if the field is not a number.
+ */
+static int parse_number(const char *s, const char *end, double *out) {
+    const char *p;
+    unsigned long long mantissa = 0;
+    int digits = 0, seen_digit = 0, truncated = 0;
+    int exp10 = 0, exp_value = 0, exp_negative = 0;
+    int after_point = 0;
+    int negative = 0;
+    int d;
+    double value;
+
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+    if (end - s >= 2 && *s == '"' && end[-1] == '"') {
+        s++;
+        end--;
+    }
+    if (s == end) {
+        *out = NAN;
+        return 0;
+    }
+
+    p = s;
+    if (*p == '+' || *p == '-') {
+        negative = *p == '-';
+        p++;
+    }
+    for (; p < end; p++) {
+        if (*p == '.' && !after_point) {
+            after_point = 1;
+            continue;
+        }
+        if (*p < '0' || *p > '9') {
+            break;
+        }
+        d = *p - '0';
+        seen_digit = 1;
+        if (digits < CSV_MAX_DIGITS) {
+            /* Leading zeros are not significant, but still move the point */
+            mantissa = mantissa * 10 + (unsigned long long)d;
+            digits += mantissa != 0;
+            exp10 -= after_point;
+        }
+        else {
+            truncated |= d != 0;
+            exp10 += !after_point;
+        }
+    }
+    if (p < end && seen_digit && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            exp_negative = *p == '-';
+            p++;
+        }
+        if (p == end || *p < '0' || *p > '9') {
+            return parse_slow(s, end, out);
+        }
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (exp_value < 100000) {
+                exp_value = exp_value * 10 + (*p - '0');
+            }
+        }
+        exp10 += exp_negative ? -exp_value : exp_value;
+    }
+
+    /* inf, nan, hex, NA strings, trailing garbage: let strtod and the NA list decide */
+    if (p != end || !seen_digit || truncated || mantissa > (1ULL << 53) || exp10 < -22 || exp10 > 22) {
+        if (p == end && seen_digit && mantissa == 0) {
+            *out = negative ? -0.0 : 0.0;
+            return 0;
+        }
+        return parse_slow(s, end, out);
+    }
+    /* Both operands are exact, so this is the one correctly rounded result */
+    value = (double)mantissa;
+    value = exp10 < 0 ? value / powers_of_ten[-exp10] : value * powers_of_ten[exp10];
+    *out = negative ? -value : value;
+    return 0;
+}
+
+/*
+ * Cuts the text into one slice of whole lines per thread (after a UTF-8 byte
+ * order mark, if any) and finds the number of fields of the first row.
+ * Returns 0 on success, -1 if the chunks could not be allocated.
+ */
+static int csv_split(struct kmeans_csv *csv, int n_threads) {
+    const char *text = csv->text;
+    const char *end = csv->text + csv->bytes;
+    const char *p, *eol;
+    int t;
+
+    if (csv->bytes >= 3 && memcmp(text, "\xEF\xBB\xBF", 3) == 0) {
+        text += 3;
+    }
+    csv->chunks = calloc((size_t)n_threads, sizeof(struct kmeans_csv_chunk));
+    if (csv->chunks == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    csv->n_chunks = n_threads;
+    for (t = 0; t < n_threads; t++) {
+        p = text + (size_t)(end - text) * (size_t)t / (size_t)n_threads;
+        /* A slice starts after the first '\n' of its share, so no line is split */
+        if (t > 0 && p > text && p[-1] != '\n') {
+            p = line_end(p, end);
+            p += p < end;
+        }
+        csv->chunks[t].begin = p;
+        if (t > 0) {
+            csv->chunks[t - 1].end = p;
+        }
+    }
+    csv->chunks[n_threads - 1].end = end;
+
+    csv->fields = 0;
+    for (p = text; p < end; p = eol + 1) {
+        eol = line_end(p, end);
+        if (!line_is_blank(p, eol)) {
+            csv->fields = count_fields(p, eol);
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Thread t counts the lines and the rows of its slice */
+static void count_job(void *arg, int t, int n_threads) {
+    struct csv_job *job = arg;
+    struct kmeans_csv_chunk *chunk = &job->csv->chunks[t];
+    const char *p, *eol;
+
+    (void)n_threads;
+    chunk->lines = 0;
+    chunk->rows = 0;
+    for (p = chunk->begin; p < chunk->end; p = eol + 1) {
+        eol = line_end(p, chunk->end);
+        chunk->lines++;
+        chunk->rows += !line_is_blank(p, eol);
+    }
+}
+
+/* Thread t parses the rows of its slice into their place in the table */
+static void parse_job(void *arg, int t, int n_threads) {
+    struct csv_job *job = arg;
+    struct kmeans_csv *csv = job->csv;
+    struct kmeans_csv_chunk *chunk = &csv->chunks[t];
+    int fields = csv->fields;
+    size_t row = chunk->first_row;
+    size_t line = chunk->first_line;
+    const char *p, *eol, *field, *comma;
+    double *values;
+    int f;
+    double started = kmeans_trace_on ? kmeans_telemetry_clock() : 0.0;
+
+    (void)n_threads;
+    chunk->error_line = 0;
+    for (p = chunk->begin; p < chunk->end; p = eol + 1) {
+        eol = line_end(p, chunk->end);
+        line++;
+        if (line_is_blank(p, eol)) {
+            continue;
+        }
+        values = MATRIX_ROW(&csv->values, row);
+        field = p;
+        for (f = 0; f < fields; f++) {
+            if (field > eol) {
+                /* The row ran out of fields: the rest are missing */
+                if (f == 0) {
+                    csv->keys[row] = NAN;
+                }
+                else {
+                    values[f - 1] = NAN;
+                }
+                continue;
+            }
+            comma = memchr(field, ',', (size_t)(eol - field));
+            if (comma == NULL) {
+                comma = eol;
+            }
+            if (parse_number(field, comma, f == 0 ? &csv->keys[row] : &values[f - 1]) != 0) {
+                chunk->error_line = line;
+                chunk->error_fields = 0;
+                return;
+            }
+            field = comma + 1;
+        }
+        if (field <= eol) {
+            chunk->error_line = line;
+            chunk->error_fields = count_fields(p, eol);
+            return;
+        }
+        row++;
+    }
+    /* A slice that stopped at a bad row leaves no span: the run fails anyway */
+    if (kmeans_trace_on) {
+        kmeans_trace_span("parse slice", started, -1);
+    }
+}
+
+/*
+ * Records the first bad row of a parsed file in the join.
+ * Returns 0 if there is none, -2 otherwise.
+ */
+static int csv_check(struct kmeans_csv_join *j, struct kmeans_csv *csv, int file) {
+    int t;
+
+    for (t = 0; t < csv->n_chunks; t++) {
+        if (csv->chunks[t].error_line != 0) {
+            j->error_file = file;
+            j->error_line = csv->chunks[t].error_line;
+            j->error_fields = csv->chunks[t].error_fields;
+            return -2;
+        }
+    }
+    return 0;
+}
+
+/* Hash of a key; keys that compare equal (0.0 and -0.0, any two NaNs) hash the same */
+static unsigned long long key_hash(double key) {
+    unsigned long long h;
+
+    if (key == 0.0) {
+        key = 0.0;
+    }
+    else if (key != key) {
+        key = NAN;
+    }
+    memcpy(&h, &key, sizeof(h));
+    /* splitmix64's finalizer, so nearby keys spread over the table */
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/* Key equality as in pandas' merge: NaN matches NaN */
+static int keys_equal(double a, double b) {
+    return a == b || (a != a && b != b);
+}
+
+/*
+ * The key as an unsigned integer in the same order as the doubles: NaN
+ * (any of them) after +inf, and 0.0 and -0.0 the same
+ */
+static unsigned long long sort_bits(double key) {
+    unsigned long long bits;
+
+    if (key == 0.0) {
+        key = 0.0;
+    }
+    else if (key != key) {
+        key = NAN;
+    }
+    memcpy(&bits, &key, sizeof(bits));
+    /* Negative: flip everything, so larger magnitudes come first; positive: set the sign */
+    return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+}
+
+/*
+ * Sorts the entries by key (NaN last) with a stable LSD radix sort over
+ * CSV_RADIX_BITS-bit digits of sort_bits, so equal keys stay in row order.
+ * Digits that are the same in every key are skipped. scratch holds n
+ * entries, counts 2^CSV_RADIX_BITS.
+ */
+static void sort_entries(struct kmeans_join_entry *entries, struct kmeans_join_entry *scratch, size_t n,
+                         size_t *counts) {
+    struct kmeans_join_entry *from = entries, *to = scratch, *swap;
+    size_t buckets = (size_t)1 << CSV_RADIX_BITS;
+    size_t i, b, total, count;
+    int shift;
+
+    for (shift = 0; shift < 64; shift += CSV_RADIX_BITS) {
+        memset(counts, 0, buckets * sizeof(size_t));
+        for (i = 0; i < n; i++) {
+            counts[(sort_bits(from[i].key) >> shift) & (buckets - 1)]++;
+        }
+        if (n == 0 || counts[(sort_bits(from[0].key) >> shift) & (buckets - 1)] == n) {
+            continue;
+        }
+        total = 0;
+        for (b = 0; b < buckets; b++) {
+            count = counts[b];
+            counts[b] = total;
+            total += count;
+        }
+        for (i = 0; i < n; i++) {
+            to[counts[(sort_bits(from[i].key) >> shift) & (buckets - 1)]++] = from[i];
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != entries) {
+        memcpy(entries, from, n * sizeof(struct kmeans_join_entry));
+    }
+}
+
+/*
+ * Maps, counts and parses both files, joins them and sorts the result, on
+ * n_threads threads. On success j->rows and j->dim give the shape of the
+ * output, and kmeans_csv_join_gather fills it in; call kmeans_csv_join_close
+ * in any case. Returns 0 on success,
+ *   -1 if a file could not be read (errno says why, j->error_file which),
+ *   -2 if a file has no rows, or a row with too many fields (j->error_fields
+ *      of them) or a field that is not a number (j->error_fields = 0) at
+ *      line j->error_line (0: no rows at all) of file j->error_file,
+ *   -3 if memory ran out.
+ */
+int kmeans_csv_join_open(struct kmeans_csv_join *j, const char *left_path, const char *right_path, int n_threads) {
+    struct kmeans_csv *files[2];
+    struct kmeans_csv *left = &j->left, *right = &j->right;
+    struct csv_job job;
+    struct kmeans_join_entry *scratch;
+    size_t bytes, i, slot, match, rows, line;
+    size_t *counts;
+    int file, t, dims[2];
+    double started = kmeans_trace_on ? kmeans_telemetry_clock() : 0.0;
+
+    memset(j, 0, sizeof(*j));
+    files[0] = left;
+    files[1] = right;
+    if (n_threads > 1) {
+        j->pool = pool_create(n_threads);
+    }
+    n_threads = pool_size(j->pool);
+
+    /* Slices, and where every one of them starts in lines and rows */
+    for (file = 0; file < 2; file++) {
+        j->error_file = file;
+        if (csv_map(files[file], file == 0 ? left_path : right_path) != 0) {
+            return -1;
+        }
+        if (csv_split(files[file], n_threads) != 0) {
+            return -3;
+        }
+        job.csv = files[file];
+        pool_run(j->pool, count_job, &job);
+        rows = 0;
+        line = 0;
+        for (t = 0; t < n_threads; t++) {
+            files[file]->chunks[t].first_row = rows;
+            files[file]->chunks[t].first_line = line;
+            rows += files[file]->chunks[t].rows;
+            line += files[file]->chunks[t].lines;
+        }
+        files[file]->rows = rows;
+        if (rows == 0) {
+            j->error_line = 0;
+            return -2;
+        }
+        dims[file] = files[file]->fields - 1;
+    }
+    j->dim = dims[0] + dims[1];
+    if (kmeans_trace_on) {
+        kmeans_trace_span("csv count", started, -1);
+        started = kmeans_telemetry_clock();
+    }
+
+    /* One block for both tables and the join */
+    j->capacity = 16;
+    while (j->capacity < 2 * right->rows) {
+        j->capacity *= 2;
+    }
+    bytes = arena_block_size(left->rows * sizeof(double))
+          + arena_block_size(left->rows * (size_t)dims[0] * sizeof(double))
+          + arena_block_size(right->rows * sizeof(double))
+          + arena_block_size(right->rows * (size_t)dims[1] * sizeof(double))
+          + arena_block_size(j->capacity * sizeof(size_t))
+          + arena_block_size(right->rows * sizeof(size_t))
+          + 2 * arena_block_size(left->rows * sizeof(struct kmeans_join_entry))
+          + arena_block_size(((size_t)1 << CSV_RADIX_BITS) * sizeof(size_t));
+    if (arena_init(&j->arena, bytes) != 0) {
+        return -3;
+    }
+    for (file = 0; file < 2; file++) {
+        files[file]->keys = arena_alloc(&j->arena, files[file]->rows * sizeof(double));
+        if (files[file]->keys == NULL
+            || matrix_carve(&files[file]->values, &j->arena, files[file]->rows, dims[file]) != 0) {
+            return -3;
+        }
+    }
+    j->slots = arena_alloc(&j->arena, j->capacity * sizeof(size_t));
+    j->next = arena_alloc(&j->arena, right->rows * sizeof(size_t));
+    j->order = arena_alloc(&j->arena, left->rows * sizeof(struct kmeans_join_entry));
+    scratch = arena_alloc(&j->arena, left->rows * sizeof(struct kmeans_join_entry));
+    counts = arena_alloc(&j->arena, ((size_t)1 << CSV_RADIX_BITS) * sizeof(size_t));
+    if (j->slots == NULL || j->next == NULL || j->order == NULL || scratch == NULL || counts == NULL) {
+        return -3;
+    }
+
+    /* Parse both files, each thread straight into its rows */
+    for (file = 0; file < 2; file++) {
+        job.csv = files[file];
+        pool_run(j->pool, parse_job, &job);
+        if (csv_check(j, files[file], file) != 0) {
+            return -2;
+        }
+    }
+    if (kmeans_trace_on) {
+        kmeans_trace_span("csv parse", started, -1);
+        started = kmeans_telemetry_clock();
+    }
+
+    /*
+     * Hash the right keys: a slot holds 1 + the first right row with its key
+     * and next[] chains the others in file order (0 ends a chain). Inserting
+     * back to front puts every new row at the head of its chain.
+     */
+    memset(j->slots, 0, j->capacity * sizeof(size_t));
+    for (i = right->rows; i-- > 0;) {
+        slot = (size_t)key_hash(right->keys[i]) & (j->capacity - 1);
+        while (j->slots[slot] != 0 && !keys_equal(right->keys[j->slots[slot] - 1], right->keys[i])) {
+            slot = (slot + 1) & (j->capacity - 1);
+        }
+        j->next[i] = j->slots[slot];
+        j->slots[slot] = i + 1;
+    }
+
+    /* Probe with the left keys and keep the rows that found a match */
+    j->n_order = 0;
+    for (i = 0; i < left->rows; i++) {
+        slot = (size_t)key_hash(left->keys[i]) & (j->capacity - 1);
+        while (j->slots[slot] != 0 && !keys_equal(right->keys[j->slots[slot] - 1], left->keys[i])) {
+            slot = (slot + 1) & (j->capacity - 1);
+        }
+        if (j->slots[slot] != 0) {
+            j->order[j->n_order].key = left->keys[i];
+            j->order[j->n_order].row = i;
+            j->order[j->n_order].match = j->slots[slot];
+            j->n_order++;
+        }
+    }
+    /* They were found in row order, and the sort keeps that order among equal keys */
+    sort_entries(j->order, scratch, j->n_order, counts);
+
+    /* Every matched left row gives one output row per match, from its first one on */
+    j->rows = 0;
+    for (i = 0; i < j->n_order; i++) {
+        j->order[i].first = j->rows;
+        for (match = j->order[i].match; match != 0; match = j->next[match - 1]) {
+            j->rows++;
+        }
+    }
+    if (kmeans_trace_on) {
+        kmeans_trace_span("csv join", started, -1);
+    }
+    return 0;
+}
+
+/* Thread t writes the output rows of its share of the matched left rows */
+static void gather_job(void *arg, int t, int n_threads) {
+    struct csv_job *job = arg;
+    struct kmeans_csv_join *j = job->j;
+    size_t last = j->n_order * (size_t)(t + 1) / (size_t)n_threads;
+    int left_dim = j->left.values.dim;
+    int right_dim = j->right.values.dim;
+    size_t i, out, match;
+    double *row;
+    double started = kmeans_trace_on ? kmeans_telemetry_clock() : 0.0;
+
+    for (i = j->n_order * (size_t)t / (size_t)n_threads; i < last; i++) {
+        out = j->order[i].first;
+        for (match = j->order[i].match; match != 0; match = j->next[match - 1]) {
+            row = job->data + out * (size_t)j->dim;
+            job->keys[out] = j->order[i].key;
+            memcpy(row, MATRIX_ROW(&j->left.values, j->order[i].row), (size_t)left_dim * sizeof(double));
+            memcpy(row + left_dim, MATRIX_ROW(&j->right.values, match - 1), (size_t)right_dim * sizeof(double));
+            out++;
+        }
+    }
+    if (kmeans_trace_on) {
+        kmeans_trace_span("gather slice", started, -1);
+    }
+}
+
+/* Fills keys (j->rows) and data (j->rows x j->dim, row-major) with the joined rows, in key order */
+void kmeans_csv_join_gather(struct kmeans_csv_join *j, double *keys, double *data) {
+    struct csv_job job;
+
+    job.j = j;
+    job.keys = keys;
+    job.data = data;
+    pool_run(j->pool, gather_job, &job);
+}
+
+/* Unmaps the files and frees everything kmeans_csv_join_open got */
+void kmeans_csv_join_close(struct kmeans_csv_join *j) {
+    csv_unmap(&j->left);
+    csv_unmap(&j->right);
+    arena_free(&j->arena);
+    pool_destroy(j->pool);
+    j->pool = NULL;
+}
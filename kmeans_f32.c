@@ -0,0 +1,241 @@
+#include "kmeans.h"
+
+#include <string.h>
+
+/*
+ * Lloyd iterations over float32 data: the points stay floats (half the
+ * memory and half the bytes every Assignment Step streams through), and the
+ * distances are computed in float by kmeans_closest_centroid_f32 against a
+ * float copy of the centroids, twice as many per SIMD vector.
+ *
+ * Everything that adds many values up stays double: the per-cluster sums
+ * widen every float coordinate before adding it, and the centroids
+ * themselves are kept (and returned) as doubles and only rounded to float
+ * for the distance kernel, so the means do not drift with N. Labels can
+ * still differ from a float64 run on points within float rounding of the
+ * boundary between two clusters.
+ */
+
+/*declaration of structs*/
+struct f32_job;
+
+/*declaration of functions*/
+static void accumulate_range_f32(const struct matrix_f32 *data, size_t first, size_t last,
+                                 const int *labels, struct kmeans_workspace *ws);
+static void centroids_to_soa_f32(const struct matrix *centroids, float *soa);
+static void assign_f32_job(void *arg, int t, int n_threads);
+static void reduce_f32_job(void *arg, int t, int n_threads);
+
+
+/*implementations of structs*/
+
+/* Everything the threaded Assignment Step jobs need */
+struct f32_job
+{
+    const struct matrix_f32 *data;
+    const struct matrix *centroids;
+    struct kmeans_workspace *ws;
+    int n_threads;
+};
+
+
+/*
+ * Carves a rows x dim float matrix out of the arena.
+ * Returns 0 on success, -1 if the arena has no room left.
+ */
+int matrix_f32_carve(struct matrix_f32 *m, struct arena *a, size_t rows, int dim) {
+    m->rows = rows;
+    m->dim = dim;
+    m->data = arena_alloc(a, rows * (size_t)dim * sizeof(float));
+    return m->data == NULL ? -1 : 0;
+}
+
+/* Bytes of arena space needed by kmeans_f32_carve */
+size_t kmeans_f32_bytes(size_t N, int K, int dim, const struct kmeans_options *opts) {
+    return kmeans_workspace_bytes(N, K, dim, opts)
+         + arena_block_size((size_t)K * (size_t)dim * sizeof(float))
+         + arena_block_size((size_t)dim * sizeof(double));
+}
+
+/*
+ * Carves a workspace for float32 runs: the usual one (opts->algorithm must
+ * be KMEANS_LLOYD), plus the float centroids and the first point.
+ * Returns 0 on success, -1 if the arena has no room left.
+ */
+int kmeans_f32_carve(struct kmeans_workspace *ws, struct arena *a, size_t N, int K, int dim,
+                     const struct kmeans_options *opts) {
+    if (kmeans_workspace_carve(ws, a, N, K, dim, opts) != 0) {
+        return -1;
+    }
+    ws->centroids_soa_f32 = arena_alloc(a, (size_t)K * (size_t)dim * sizeof(float));
+    ws->fallback = arena_alloc(a, (size_t)dim * sizeof(double));
+    return ws->centroids_soa_f32 == NULL || ws->fallback == NULL ? -1 : 0;
+}
+
+/* accumulate_range for float points: every coordinate is widened before it is added */
+static void accumulate_range_f32(const struct matrix_f32 *data, size_t first, size_t last,
+                                 const int *labels, struct kmeans_workspace *ws) {
+    const float *x;
+    double *sum;
+    size_t i;
+    int d;
+
+    for (i = first; i < last; i++) {
+        ws->counts[labels[i]]++;
+        x = MATRIX_ROW(data, i);
+        sum = MATRIX_ROW(&ws->sums, labels[i]);
+        for (d = 0; d < data->dim; d++) {
+            sum[d] += (double)x[d];
+        }
+    }
+}
+
+/* matrix_to_soa, rounding every coordinate to float */
+static void centroids_to_soa_f32(const struct matrix *centroids, float *soa) {
+    size_t i;
+    int j;
+
+    for (i = 0; i < centroids->rows; i++) {
+        for (j = 0; j < centroids->dim; j++) {
+            soa[(size_t)j * centroids->rows + i] = (float)MATRIX_ROW(centroids, i)[j];
+        }
+    }
+}
+
+/* Thread t assigns the t-th contiguous slice of the points into its own accumulators */
+static void assign_f32_job(void *arg, int t, int n_threads) {
+    struct f32_job *job = arg;
+    struct kmeans_workspace *mine = job->n_threads > 1 ? &job->ws->partials[t] : job->ws;
+    size_t N = job->data->rows;
+    size_t first = N * (size_t)t / (size_t)n_threads;
+    size_t last = N * (size_t)(t + 1) / (size_t)n_threads;
+    int K = (int)job->centroids->rows;
+    int dim = job->centroids->dim;
+    closest_centroid_f32_fn closest = kmeans_simd_kernel_f32(K, dim);
+    size_t i;
+    double started = kmeans_trace_on ? kmeans_telemetry_clock() : 0.0;
+
+    zero_out_vector(mine->sums.data, K * dim);
+    memset(mine->counts, 0, (size_t)K * sizeof(int));
+    for (i = first; i < last; i++) {
+        job->ws->labels[i] = closest(job->ws->centroids_soa_f32, K, dim, MATRIX_ROW(job->data, i), NULL);
+    }
+    mine->distance_evals = (unsigned long long)(last - first) * (unsigned long long)K;
+    accumulate_range_f32(job->data, first, last, job->ws->labels, mine);
+    if (kmeans_trace_on) {
+        kmeans_trace_span("assign slice", started, -1);
+    }
+}
+
+/* Thread t sums the private accumulators of its slice of the clusters */
+static void reduce_f32_job(void *arg, int t, int n_threads) {
+    struct f32_job *job = arg;
+    size_t K = job->centroids->rows;
+    double started = kmeans_trace_on ? kmeans_telemetry_clock() : 0.0;
+
+    kmeans_reduce_partials(job->ws, job->n_threads, K * (size_t)t / (size_t)n_threads,
+                           K * (size_t)(t + 1) / (size_t)n_threads, 0);
+    if (kmeans_trace_on) {
+        kmeans_trace_span("reduce slice", started, -1);
+    }
+}
+
+/*
+ * Lloyd iterations over float data, with a workspace from kmeans_f32_carve.
+ * centroids (double) holds the initial centroids on entry and the final ones
+ * on exit; labels and stats work as in kmeans_lloyd, and so does the
+ * stopping rule. Returns the number of iterations performed.
+ */
+int kmeans_lloyd_f32(const struct matrix_f32 *data, struct matrix *centroids, struct kmeans_workspace *ws,
+                     const struct kmeans_options *opts, int *labels, struct kmeans_stats *stats) {
+    int K = (int)centroids->rows;
+    int dim = centroids->dim;
+    int iteration = 0;
+    int converged = 0;
+    unsigned long long distance_evals = 0;
+    size_t i;
+    int d, t;
+    struct thread_pool *pool = NULL;
+    struct f32_job job;
+    closest_centroid_f32_fn closest;
+    double iteration_started = 0.0, step_started = 0.0;
+
+    /* Empty clusters take the first point, as in kmeans_lloyd */
+    for (d = 0; d < dim; d++) {
+        ws->fallback[d] = (double)data->data[d];
+    }
+
+    if (opts->n_threads > 1) {
+        pool = pool_create(opts->n_threads);
+    }
+    job.data = data;
+    job.centroids = centroids;
+    job.ws = ws;
+    job.n_threads = pool_size(pool);
+
+    /* MAIN K-MEANS LOOP */
+    while (iteration < opts->iter && !converged) {
+        if (ws->telemetry != NULL) {
+            ws->telemetry->started = kmeans_telemetry_clock();
+        }
+        if (kmeans_trace_on) {
+            iteration_started = step_started = kmeans_telemetry_clock();
+        }
+        centroids_to_soa_f32(centroids, ws->centroids_soa_f32);
+
+        /* Assignment Step: float distances, double sums */
+        pool_run(pool, assign_f32_job, &job);
+        if (job.n_threads > 1) {
+            pool_run(pool, reduce_f32_job, &job);
+            for (t = 0; t < job.n_threads; t++) {
+                distance_evals += ws->partials[t].distance_evals;
+            }
+        }
+        else {
+            distance_evals += ws->distance_evals;
+        }
+        if (kmeans_trace_on) {
+            kmeans_trace_span("assign", step_started, iteration);
+        }
+        if (ws->telemetry != NULL) {
+            kmeans_telemetry_assigned(ws->telemetry, NULL, data, centroids, ws, KMEANS_LLOYD);
+        }
+
+        /* Update Step: calculate new centroids */
+        if (kmeans_trace_on) {
+            step_started = kmeans_telemetry_clock();
+        }
+        converged = kmeans_update_step(centroids, ws, ws->fallback, opts->epsilon);
+        if (kmeans_trace_on) {
+            kmeans_trace_span("update", step_started, iteration);
+        }
+        if (ws->telemetry != NULL) {
+            kmeans_telemetry_updated(ws->telemetry, centroids);
+        }
+        if (kmeans_trace_on) {
+            kmeans_trace_span("iteration", iteration_started, iteration);
+        }
+        iteration++;
+    }
+
+    if (labels != NULL) {
+        if (iteration == 0) {
+            /* No Assignment Step ran: label the points against the initial centroids */
+            centroids_to_soa_f32(centroids, ws->centroids_soa_f32);
+            closest = kmeans_simd_kernel_f32(K, dim);
+            for (i = 0; i < data->rows; i++) {
+                ws->labels[i] = closest(ws->centroids_soa_f32, K, dim, MATRIX_ROW(data, i), NULL);
+            }
+        }
+        memcpy(labels, ws->labels, data->rows * sizeof(int));
+    }
+
+    if (stats != NULL) {
+        stats->iterations = iteration;
+        stats->distance_evals = distance_evals;
+        stats->distance_evals_avoided = 0;
+    }
+
+    pool_destroy(pool);
+    return iteration;
+}
@@ -0,0 +1,388 @@
+#include "kmeans.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+/*
+ * kd-tree filtering Assignment Step (Kanungo et al.), for low-dimensional
+ * data with many points.
+ *
+ * The tree is built once per run: every cell knows the bounding box and the
+ * sum of its points, and the nodes are laid out in a flat array (parents
+ * before children). The points are copied in tree order, so every cell is a
+ * contiguous run of rows of kd_data, with kd_points mapping them back.
+ *
+ * Each Assignment Step walks the tree with a list of candidate centroids: at
+ * every cell, the candidate closest to the cell's midpoint knocks out each
+ * other candidate that is farther from every corner of the box. Once a
+ * single candidate is left the whole cell goes to it - its sum and count are
+ * added in one step - and only the points of leaves that still have several
+ * candidates are scored one by one.
+ *
+ * A candidate is only knocked out when it loses by more than the rounding
+ * error of the comparison, and leaf points are scored exactly like the Lloyd
+ * scan, so every point gets the centroid Lloyd would give it for the same
+ * centroids. The sums are added cell by cell, though, not point by point in
+ * index order, so the centroids may differ from Lloyd's in the last bits.
+ *
+ * Cells assigned as a whole only record their owner; kmeans_kdtree_labels
+ * writes the labels of their points once the run is over.
+ */
+
+/* Cells with at most this many points are not split */
+#define KD_LEAF_SIZE 16
+
+/*declaration of functions*/
+static void node_counts(size_t m, size_t *count_m, size_t *count_next);
+static void swap_points(struct kmeans_workspace *ws, size_t i, size_t j);
+static void select_nth(struct kmeans_workspace *ws, size_t first, size_t last, size_t nth, int d);
+static int build_node(struct kmeans_workspace *ws, size_t first, size_t last, size_t *next);
+static int dominated(const double *winner, const double *loser, const double *low,
+                     const double *high, int dim, double pad);
+static void filter_node(const struct matrix *centroids, int node,
+                        const int *candidates, int n_candidates, int depth,
+                        size_t first, size_t last, struct kmeans_workspace *ws, double pad);
+static void label_node(struct kmeans_workspace *ws, int node);
+
+
+/*
+ * Number of nodes for m and for m + 1 points. A cell of n points is split
+ * into n / 2 and n - n / 2, so both only depend on the counts for m / 2 and
+ * m / 2 + 1: O(log N) work instead of walking the whole tree.
+ */
+static void node_counts(size_t m, size_t *count_m, size_t *count_next) {
+    size_t half, next_half;
+
+    if (m + 1 <= KD_LEAF_SIZE) {
+        *count_m = 1;
+        *count_next = 1;
+        return;
+    }
+    node_counts(m / 2, &half, &next_half);
+    if (m % 2 == 0) {
+        *count_m = 1 + 2 * half;
+        *count_next = 1 + half + next_half;
+    }
+    else {
+        *count_m = 1 + half + next_half;
+        *count_next = 1 + 2 * next_half;
+    }
+    if (m <= KD_LEAF_SIZE) {
+        *count_m = 1;
+    }
+}
+
+/* Number of kd-tree nodes for N points */
+size_t kmeans_kdtree_nodes(size_t N) {
+    size_t count, next;
+    node_counts(N, &count, &next);
+    return count;
+}
+
+/* Depth of the deepest kd-tree leaf for N points (the larger half is the deeper one) */
+int kmeans_kdtree_depth(size_t N) {
+    int depth = 0;
+    while (N > KD_LEAF_SIZE) {
+        N -= N / 2;
+        depth++;
+    }
+    return depth;
+}
+
+/* Swaps the points at tree positions i and j */
+static void swap_points(struct kmeans_workspace *ws, size_t i, size_t j) {
+    double *a = MATRIX_ROW(&ws->kd_data, i);
+    double *b = MATRIX_ROW(&ws->kd_data, j);
+    size_t index = ws->kd_points[i];
+    double value;
+    int d;
+
+    for (d = 0; d < ws->kd_data.dim; d++) {
+        value = a[d];
+        a[d] = b[d];
+        b[d] = value;
+    }
+    ws->kd_points[i] = ws->kd_points[j];
+    ws->kd_points[j] = index;
+}
+
+/*
+ * Reorders tree positions first..last-1 so that the point at nth has
+ * coordinate d no smaller than any before it and no larger than any after
+ * it (Hoare partitioning around a median of three).
+ */
+static void select_nth(struct kmeans_workspace *ws, size_t first, size_t last, size_t nth, int d) {
+    const struct matrix *data = &ws->kd_data;
+    ptrdiff_t lo = (ptrdiff_t)first;
+    ptrdiff_t hi = (ptrdiff_t)last - 1;
+    ptrdiff_t i, j;
+    double a, b, c, pivot;
+
+    while (lo < hi) {
+        a = MATRIX_ROW(data, lo)[d];
+        b = MATRIX_ROW(data, lo + (hi - lo) / 2)[d];
+        c = MATRIX_ROW(data, hi)[d];
+        pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+
+        i = lo;
+        j = hi;
+        while (i <= j) {
+            while (MATRIX_ROW(data, i)[d] < pivot) {
+                i++;
+            }
+            while (MATRIX_ROW(data, j)[d] > pivot) {
+                j--;
+            }
+            if (i <= j) {
+                swap_points(ws, (size_t)i, (size_t)j);
+                i++;
+                j--;
+            }
+        }
+        /* Now lo..j <= pivot <= i..hi, with anything between equal to the pivot */
+        if ((ptrdiff_t)nth <= j) {
+            hi = j;
+        }
+        else if ((ptrdiff_t)nth >= i) {
+            lo = i;
+        }
+        else {
+            return;
+        }
+    }
+}
+
+/*
+ * Builds the cell holding tree positions first..last-1 and everything below it.
+ * Nodes are numbered in the order they are created (*next), so a parent
+ * always comes before its children. Returns the index of the new node.
+ */
+static int build_node(struct kmeans_workspace *ws, size_t first, size_t last, size_t *next) {
+    const struct matrix *data = &ws->kd_data;
+    int node = (int)(*next)++;
+    int dim = data->dim;
+    double *low = ws->kd_low + (size_t)node * dim;
+    double *high = ws->kd_high + (size_t)node * dim;
+    double *sum = ws->kd_sums + (size_t)node * dim;
+    const double *x;
+    size_t i, mid;
+    int d, split = 0;
+
+    ws->kd_nodes[node].first = first;
+    ws->kd_nodes[node].last = last;
+    ws->kd_nodes[node].left = -1;
+    ws->kd_nodes[node].right = -1;
+    ws->kd_pass[node] = 0;
+
+    x = MATRIX_ROW(data, first);
+    memcpy(low, x, (size_t)dim * sizeof(double));
+    memcpy(high, x, (size_t)dim * sizeof(double));
+    for (i = first + 1; i < last; i++) {
+        x = MATRIX_ROW(data, i);
+        for (d = 0; d < dim; d++) {
+            low[d] = x[d] < low[d] ? x[d] : low[d];
+            high[d] = x[d] > high[d] ? x[d] : high[d];
+        }
+    }
+
+    if (last - first <= KD_LEAF_SIZE) {
+        zero_out_vector(sum, dim);
+        for (i = first; i < last; i++) {
+            add_coordinates_from_other_vector(sum, MATRIX_ROW(data, i), dim);
+        }
+        return node;
+    }
+
+    /* Split the widest side at the median */
+    for (d = 1; d < dim; d++) {
+        if (high[d] - low[d] > high[split] - low[split]) {
+            split = d;
+        }
+    }
+    mid = first + (last - first) / 2;
+    select_nth(ws, first, last, mid, split);
+
+    ws->kd_nodes[node].left = build_node(ws, first, mid, next);
+    ws->kd_nodes[node].right = build_node(ws, mid, last, next);
+    memcpy(sum, ws->kd_sums + (size_t)ws->kd_nodes[node].left * dim, (size_t)dim * sizeof(double));
+    add_coordinates_from_other_vector(sum, ws->kd_sums + (size_t)ws->kd_nodes[node].right * dim, dim);
+    return node;
+}
+
+/* Builds the kd-tree over the data; run once, before the first Assignment Step */
+void kmeans_kdtree_build(const struct matrix *data, struct kmeans_workspace *ws) {
+    size_t i, next = 0;
+
+    for (i = 0; i < data->rows; i++) {
+        ws->kd_points[i] = i;
+    }
+    memcpy(ws->kd_data.data, data->data, data->rows * (size_t)data->dim * sizeof(double));
+    build_node(ws, 0, data->rows, &next);
+    ws->kd_passes = 0;
+}
+
+/* Serial part of a kd-tree iteration: opens a new Assignment Step */
+void kmeans_kdtree_refresh(struct kmeans_workspace *ws) {
+    ws->kd_passes++;
+}
+
+/*
+ * Whether every point of the box [low, high] is closer to winner than to
+ * loser, by more than the rounding error of the squared distances.
+ * ||p - loser||^2 - ||p - winner||^2 is linear in p, so its minimum over
+ * the box sits at the corner furthest in the direction loser - winner.
+ */
+static int dominated(const double *winner, const double *loser, const double *low,
+                     const double *high, int dim, double pad) {
+    double gap = 0.0, magnitude = 0.0, reach = 0.0;
+    double u, term, far_w, far_l;
+    int d;
+
+    for (d = 0; d < dim; d++) {
+        u = loser[d] - winner[d];
+        term = u * (loser[d] + winner[d] - 2.0 * (u > 0.0 ? high[d] : low[d]));
+        gap += term;
+        magnitude += fabs(term);
+
+        /* Largest squared distance from the box to either centroid, to bound the per-point rounding */
+        far_w = fabs(winner[d] - low[d]) > fabs(winner[d] - high[d]) ? winner[d] - low[d] : winner[d] - high[d];
+        far_l = fabs(loser[d] - low[d]) > fabs(loser[d] - high[d]) ? loser[d] - low[d] : loser[d] - high[d];
+        reach += far_w * far_w + far_l * far_l;
+    }
+    /* Written so that NaN never knocks anything out */
+    return gap > pad * (magnitude + reach);
+}
+
+/*
+ * Filters the candidates of one cell and assigns what can be assigned.
+ * Only the points at tree positions first..last-1 are touched: a cell that
+ * lies entirely inside that range goes to its last candidate as a whole, a
+ * cell straddling its edge is handled point by point.
+ */
+static void filter_node(const struct matrix *centroids, int node,
+                        const int *candidates, int n_candidates, int depth,
+                        size_t first, size_t last, struct kmeans_workspace *ws, double pad) {
+    const struct kd_node *cell = &ws->kd_nodes[node];
+    int dim = centroids->dim;
+    int K = (int)centroids->rows;
+    const double *low = ws->kd_low + (size_t)node * dim;
+    const double *high = ws->kd_high + (size_t)node * dim;
+    int *kept;
+    const double *x;
+    double dist, best_dist, diff;
+    size_t pos, from, to;
+    int j, d, c, star, n_kept;
+
+    if (cell->last <= first || cell->first >= last) {
+        return;
+    }
+
+    if (n_candidates > 1) {
+        /* The candidate closest to the middle of the box does the knocking out */
+        star = candidates[0];
+        best_dist = HUGE_VAL;
+        for (j = 0; j < n_candidates; j++) {
+            dist = 0.0;
+            for (d = 0; d < dim; d++) {
+                diff = MATRIX_ROW(centroids, candidates[j])[d] - 0.5 * (low[d] + high[d]);
+                dist += diff * diff;
+            }
+            if (dist < best_dist) {
+                best_dist = dist;
+                star = candidates[j];
+            }
+        }
+
+        /* Survivors keep their (increasing) index order */
+        kept = ws->kd_candidates + (size_t)(depth + 1) * K;
+        n_kept = 0;
+        for (j = 0; j < n_candidates; j++) {
+            c = candidates[j];
+            if (c == star || !dominated(MATRIX_ROW(centroids, star), MATRIX_ROW(centroids, c),
+                                        low, high, dim, pad)) {
+                kept[n_kept++] = c;
+            }
+        }
+        candidates = kept;
+        n_candidates = n_kept;
+    }
+
+    if (n_candidates == 1 && cell->first >= first && cell->last <= last) {
+        c = candidates[0];
+        add_coordinates_from_other_vector(MATRIX_ROW(&ws->sums, c), ws->kd_sums + (size_t)node * dim, dim);
+        ws->counts[c] += (int)(cell->last - cell->first);
+        ws->kd_owner[node] = c;
+        ws->kd_pass[node] = ws->kd_passes;
+        return;
+    }
+
+    if (cell->left < 0 || n_candidates == 1) {
+        from = cell->first > first ? cell->first : first;
+        to = cell->last < last ? cell->last : last;
+        for (pos = from; pos < to; pos++) {
+            x = MATRIX_ROW(&ws->kd_data, pos);
+            c = candidates[0];
+            if (n_candidates > 1) {
+                /* Same distances and winner as the Lloyd scan, over the survivors only */
+                best_dist = HUGE_VAL;
+                for (j = 0; j < n_candidates; j++) {
+                    dist = squared_distance(MATRIX_ROW(centroids, candidates[j]), x, dim);
+                    if (dist < best_dist) {
+                        best_dist = dist;
+                        c = candidates[j];
+                    }
+                }
+                ws->distance_evals += (unsigned long long)n_candidates;
+            }
+            ws->labels[ws->kd_points[pos]] = c;
+            ws->counts[c]++;
+            add_coordinates_from_other_vector(MATRIX_ROW(&ws->sums, c), x, dim);
+        }
+        return;
+    }
+
+    filter_node(centroids, cell->left, candidates, n_candidates, depth + 1, first, last, ws, pad);
+    filter_node(centroids, cell->right, candidates, n_candidates, depth + 1, first, last, ws, pad);
+}
+
+/*
+ * kd-tree Assignment Step for the points at tree positions first..last-1:
+ * adds them to the cluster sums and labels those not assigned as part of a
+ * whole cell. kmeans_kdtree_build must have run once for the data, and
+ * kmeans_kdtree_refresh after every Update Step.
+ */
+void kmeans_assign_kdtree(const struct matrix *data, const struct matrix *centroids,
+                          size_t first, size_t last, struct kmeans_workspace *ws) {
+    int K = (int)centroids->rows;
+    int c;
+
+    for (c = 0; c < K; c++) {
+        ws->kd_candidates[c] = c;
+    }
+    filter_node(centroids, 0, ws->kd_candidates, K, 0, first, last, ws,
+                (4.0 * data->dim + 16.0) * DBL_EPSILON);
+}
+
+/* Labels the points of the cells assigned as a whole by the last Assignment Step */
+static void label_node(struct kmeans_workspace *ws, int node) {
+    const struct kd_node *cell = &ws->kd_nodes[node];
+    size_t pos;
+
+    if (ws->kd_pass[node] == ws->kd_passes) {
+        for (pos = cell->first; pos < cell->last; pos++) {
+            ws->labels[ws->kd_points[pos]] = ws->kd_owner[node];
+        }
+        return;
+    }
+    /* Below a cell that was not assigned whole, leaves were labelled point by point */
+    if (cell->left >= 0) {
+        label_node(ws, cell->left);
+        label_node(ws, cell->right);
+    }
+}
+
+/* Completes ws->labels after the last kd-tree Assignment Step */
+void kmeans_kdtree_labels(struct kmeans_workspace *ws) {
+    label_node(ws, 0);
+}
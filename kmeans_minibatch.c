@@ -0,0 +1,276 @@
+#include "kmeans.h"
+
+#include <string.h>
+#include <time.h>
+
+/*
+ * Mini-batch k-means (Sculley, "Web-scale k-means clustering").
+ *
+ * Every step samples batch_size points with replacement, assigns them to
+ * their closest centroids with the usual accumulators (sums and counts, per
+ * thread when there are several), and moves every centroid that got points
+ * towards their mean with its own learning rate: 1 / (points it absorbed
+ * over all steps so far). A centroid absorbing b new points out of n seen
+ * thus becomes the running mean c + (sum - b c) / n. Centroids no batch
+ * reaches stay where they are.
+ *
+ * The mean squared distance of every batch is smoothed with an exponential
+ * moving average (weight 2 batch_size / (N + 1), as in scikit-learn), and the
+ * run stops once it has not dropped by a factor (1 - tol) for
+ * max_no_improvement steps in a row.
+ */
+
+/*declaration of structs*/
+struct minibatch_job;
+
+/*declaration of functions*/
+static unsigned long long sampler_next(unsigned long long *state);
+static double wall_seconds(void);
+static void batch_job(void *arg, int t, int n_threads);
+static void reduce_batch_job(void *arg, int t, int n_threads);
+static void final_job(void *arg, int t, int n_threads);
+
+
+/*implementations of structs*/
+
+/* Everything the threaded jobs need */
+struct minibatch_job
+{
+    const struct matrix *data;  /* The full data (final pass) */
+    const struct matrix *centroids;
+    struct kmeans_workspace *ws;
+    int n_threads;
+    int *labels;                /* N: final pass output, may be NULL */
+};
+
+
+/* splitmix64: a tiny, well-mixed 64-bit generator, plenty for picking rows */
+static unsigned long long sampler_next(unsigned long long *state) {
+    unsigned long long z;
+
+    *state += 0x9E3779B97F4A7C15ULL;
+    z = *state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Monotonic wall-clock time in seconds */
+static double wall_seconds(void) {
+    struct timespec now;
+
+#if defined(_WIN32)
+    timespec_get(&now, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/* Bytes of arena space needed by kmeans_minibatch_carve */
+size_t kmeans_minibatch_bytes(int K, int dim, const struct kmeans_minibatch_options *opts) {
+    struct kmeans_options lloyd;
+
+    lloyd.iter = 0;
+    lloyd.epsilon = 0.0;
+    lloyd.algorithm = KMEANS_LLOYD;
+    lloyd.n_threads = opts->n_threads;
+    return kmeans_workspace_bytes(opts->batch_size, K, dim, &lloyd)
+         + arena_block_size(opts->batch_size * (size_t)dim * sizeof(double))
+         + arena_block_size((size_t)K * sizeof(double));
+}
+
+/*
+ * Carves a workspace for mini-batch runs: the Lloyd accumulators sized for
+ * one batch, plus the batch itself and the per-centroid counts.
+ * Returns 0 on success, -1 if the arena has no room left.
+ */
+int kmeans_minibatch_carve(struct kmeans_workspace *ws, struct arena *a, int K, int dim,
+                           const struct kmeans_minibatch_options *opts) {
+    struct kmeans_options lloyd;
+
+    lloyd.iter = 0;
+    lloyd.epsilon = 0.0;
+    lloyd.algorithm = KMEANS_LLOYD;
+    lloyd.n_threads = opts->n_threads;
+    if (kmeans_workspace_carve(ws, a, opts->batch_size, K, dim, &lloyd) != 0
+        || matrix_carve(&ws->batch, a, opts->batch_size, dim) != 0) {
+        return -1;
+    }
+    ws->seen = arena_alloc(a, (size_t)K * sizeof(double));
+    return ws->seen == NULL ? -1 : 0;
+}
+
+/* Thread t assigns its slice of the batch into its own accumulators */
+static void batch_job(void *arg, int t, int n_threads) {
+    struct minibatch_job *job = arg;
+    struct kmeans_workspace *mine = job->n_threads > 1 ? &job->ws->partials[t] : job->ws;
+    const struct matrix *batch = &job->ws->batch;
+    int K = (int)job->centroids->rows;
+    int dim = job->centroids->dim;
+    size_t first = batch->rows * (size_t)t / (size_t)n_threads;
+    size_t last = batch->rows * (size_t)(t + 1) / (size_t)n_threads;
+    closest_centroid_fn closest = kmeans_simd_kernel(K, dim);
+    double dist;
+    size_t i;
+
+    zero_out_vector(mine->sums.data, K * dim);
+    memset(mine->counts, 0, (size_t)K * sizeof(int));
+    mine->inertia = 0.0;
+    for (i = first; i < last; i++) {
+        job->ws->labels[i] = closest(job->ws->centroids_soa, K, dim, MATRIX_ROW(batch, i), &dist);
+        mine->inertia += dist;
+    }
+    accumulate_range(batch, first, last, job->ws->labels, mine);
+}
+
+/* Thread t sums the private accumulators of its slice of the clusters */
+static void reduce_batch_job(void *arg, int t, int n_threads) {
+    struct minibatch_job *job = arg;
+    size_t K = job->centroids->rows;
+
+    kmeans_reduce_partials(job->ws, job->n_threads, K * (size_t)t / (size_t)n_threads,
+                           K * (size_t)(t + 1) / (size_t)n_threads, 0);
+}
+
+/* Thread t labels its slice of the full data against the final centroids */
+static void final_job(void *arg, int t, int n_threads) {
+    struct minibatch_job *job = arg;
+    struct kmeans_workspace *mine = job->n_threads > 1 ? &job->ws->partials[t] : job->ws;
+    int K = (int)job->centroids->rows;
+    int dim = job->centroids->dim;
+    size_t N = job->data->rows;
+    size_t last = N * (size_t)(t + 1) / (size_t)n_threads;
+    closest_centroid_fn closest = kmeans_simd_kernel(K, dim);
+    double dist;
+    size_t i;
+    int c;
+
+    mine->inertia = 0.0;
+    for (i = N * (size_t)t / (size_t)n_threads; i < last; i++) {
+        c = closest(job->ws->centroids_soa, K, dim, MATRIX_ROW(job->data, i), &dist);
+        if (job->labels != NULL) {
+            job->labels[i] = c;
+        }
+        mine->inertia += dist;
+    }
+}
+
+/*
+ * Mini-batch k-means over a dense data block, with a workspace from
+ * kmeans_minibatch_carve. centroids holds the initial centroids on entry
+ * and the final ones on exit. With opts->final_pass, labels (if not NULL)
+ * receives the closest final centroid of every point and stats->inertia
+ * the total squared distance; labels must be NULL otherwise.
+ * If stats is not NULL, it receives the step counts and the throughput.
+ * Returns the number of steps performed.
+ */
+int kmeans_minibatch(const struct matrix *data, struct matrix *centroids, struct kmeans_workspace *ws,
+                     const struct kmeans_minibatch_options *opts, int *labels,
+                     struct kmeans_minibatch_stats *stats) {
+    int K = (int)centroids->rows;
+    int dim = centroids->dim;
+    size_t N = data->rows;
+    size_t B = opts->batch_size;
+    unsigned long long state = opts->seed;
+    double alpha = 2.0 * (double)B / ((double)N + 1.0);
+    double smoothed = 0.0, best = 0.0, inertia, started;
+    double *cent, *sum;
+    int step = 0, stale = 0;
+    int idx, d, t, n_threads;
+    size_t i;
+    struct thread_pool *pool = NULL;
+    struct minibatch_job job;
+
+    if (alpha > 1.0) {
+        alpha = 1.0;
+    }
+    for (idx = 0; idx < K; idx++) {
+        ws->seen[idx] = 0.0;
+    }
+
+    if (opts->n_threads > 1) {
+        pool = pool_create(opts->n_threads);
+    }
+    n_threads = pool_size(pool);
+    job.data = data;
+    job.centroids = centroids;
+    job.ws = ws;
+    job.n_threads = n_threads;
+    job.labels = labels;
+
+    started = wall_seconds();
+    while (step < opts->max_steps) {
+        /* Sample the batch */
+        for (i = 0; i < B; i++) {
+            memcpy(MATRIX_ROW(&ws->batch, i), MATRIX_ROW(data, sampler_next(&state) % N),
+                   (size_t)dim * sizeof(double));
+        }
+
+        /* Assignment Step on the batch, against the centroids before this step */
+        matrix_to_soa(centroids, ws->centroids_soa);
+        pool_run(pool, batch_job, &job);
+        inertia = ws->inertia;
+        if (n_threads > 1) {
+            pool_run(pool, reduce_batch_job, &job);
+            inertia = 0.0;
+            for (t = 0; t < n_threads; t++) {
+                inertia += ws->partials[t].inertia;
+            }
+        }
+
+        /* Update Step: every centroid moves to the running mean of the points it absorbed */
+        for (idx = 0; idx < K; idx++) {
+            if (ws->counts[idx] == 0) {
+                continue;
+            }
+            cent = MATRIX_ROW(centroids, idx);
+            sum = MATRIX_ROW(&ws->sums, idx);
+            ws->seen[idx] += ws->counts[idx];
+            for (d = 0; d < dim; d++) {
+                cent[d] += (sum[d] - ws->counts[idx] * cent[d]) / ws->seen[idx];
+            }
+        }
+        step++;
+
+        /* Convergence: no real drop of the smoothed inertia for a while */
+        inertia /= (double)B;
+        smoothed = step == 1 ? inertia : smoothed * (1.0 - alpha) + inertia * alpha;
+        if (step == 1 || smoothed < best * (1.0 - opts->tol)) {
+            best = smoothed;
+            stale = 0;
+        }
+        else if (++stale >= opts->max_no_improvement && opts->max_no_improvement > 0) {
+            break;
+        }
+    }
+
+    if (stats != NULL) {
+        stats->steps = step;
+        stats->points_seen = (unsigned long long)step * (unsigned long long)B;
+        stats->smoothed_inertia = smoothed;
+        stats->seconds = wall_seconds() - started;
+        stats->points_per_second = stats->seconds > 0.0 ? (double)stats->points_seen / stats->seconds : 0.0;
+        stats->inertia = 0.0;
+        stats->distance_evals = stats->points_seen * (unsigned long long)K;
+    }
+
+    if (opts->final_pass) {
+        matrix_to_soa(centroids, ws->centroids_soa);
+        pool_run(pool, final_job, &job);
+        inertia = ws->inertia;
+        if (n_threads > 1) {
+            inertia = 0.0;
+            for (t = 0; t < n_threads; t++) {
+                inertia += ws->partials[t].inertia;
+            }
+        }
+        if (stats != NULL) {
+            stats->inertia = inertia;
+            stats->distance_evals += (unsigned long long)N * (unsigned long long)K;
+        }
+    }
+
+    pool_destroy(pool);
+    return step;
+}
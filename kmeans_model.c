@@ -0,0 +1,218 @@
+#include "kmeans.h"
+
+#include <math.h>
+
+/*
+ * A fitted model kept in native memory between calls (the KMeans type of
+ * kmeansmodule.c): the centroids plus everything the kernels want derived
+ * from them - the column-major copies for the double and float Assignment
+ * Step kernels, and ||c||^2 for the distance expansion of transform - so
+ * scoring new points costs nothing but the scan itself.
+ *
+ * predict assigns through the same kernels as the Lloyd engines, so a point
+ * gets the label an Assignment Step against these centroids would give it;
+ * transform returns the distances to every centroid, expanded as
+ * ||x||^2 - 2 x.c + ||c||^2.
+ */
+
+/*declaration of structs*/
+struct model_job;
+
+/*declaration of functions*/
+static void predict_job(void *arg, int t, int n_threads);
+static void predict_f32_job(void *arg, int t, int n_threads);
+static void transform_job(void *arg, int t, int n_threads);
+static void transform_row(const double *x, const struct kmeans_model *model, double *out);
+static double run_model_job(struct kmeans_model *model, pool_job_fn job_fn, struct model_job *job);
+
+
+/*implementations of structs*/
+
+/* Everything the threaded jobs need */
+struct model_job
+{
+    struct kmeans_model *model;
+    const struct matrix *data;        /* predict and transform ... */
+    const struct matrix_f32 *data_f32; /* ... or predict_f32 */
+    int *labels;                      /* N, or NULL: inertia only */
+    double *distances;                /* N x K: transform output */
+};
+
+
+/* Bytes of arena space needed by kmeans_model_carve */
+size_t kmeans_model_bytes(int K, int dim, int n_threads) {
+    return 2 * arena_block_size((size_t)K * (size_t)dim * sizeof(double))
+         + arena_block_size((size_t)K * (size_t)dim * sizeof(float))
+         + arena_block_size((size_t)K * sizeof(double))
+         + arena_block_size((size_t)n_threads * sizeof(double));
+}
+
+/*
+ * Carves a model for K centroids of dim coordinates, scored with n_threads
+ * threads, out of the arena. Fill model->centroids, then call
+ * kmeans_model_refresh. Returns 0 on success, -1 if the arena has no room left.
+ */
+int kmeans_model_carve(struct kmeans_model *model, struct arena *a, int K, int dim, int n_threads) {
+    if (matrix_carve(&model->centroids, a, (size_t)K, dim) != 0) {
+        return -1;
+    }
+    model->centroids_soa = arena_alloc(a, (size_t)K * (size_t)dim * sizeof(double));
+    model->centroids_soa_f32 = arena_alloc(a, (size_t)K * (size_t)dim * sizeof(float));
+    model->norms = arena_alloc(a, (size_t)K * sizeof(double));
+    model->thread_inertia = arena_alloc(a, (size_t)n_threads * sizeof(double));
+    model->n_threads = n_threads;
+    if (model->centroids_soa == NULL || model->centroids_soa_f32 == NULL || model->norms == NULL
+        || model->thread_inertia == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Brings the derived copies up to date after model->centroids changed */
+void kmeans_model_refresh(struct kmeans_model *model) {
+    const struct matrix *c = &model->centroids;
+    size_t K = c->rows;
+    size_t i;
+    int j;
+
+    matrix_to_soa(c, model->centroids_soa);
+    for (i = 0; i < K; i++) {
+        for (j = 0; j < c->dim; j++) {
+            model->centroids_soa_f32[(size_t)j * K + i] = (float)MATRIX_ROW(c, i)[j];
+        }
+        model->norms[i] = dot_product(MATRIX_ROW(c, i), MATRIX_ROW(c, i), c->dim);
+    }
+}
+
+/* Thread t labels its slice of the points and sums their squared distances */
+static void predict_job(void *arg, int t, int n_threads) {
+    struct model_job *job = arg;
+    struct kmeans_model *model = job->model;
+    int K = (int)model->centroids.rows;
+    int dim = model->centroids.dim;
+    size_t N = job->data->rows;
+    size_t last = N * (size_t)(t + 1) / (size_t)n_threads;
+    closest_centroid_fn closest = kmeans_simd_kernel(K, dim);
+    double dist, inertia = 0.0;
+    size_t i;
+    int c;
+
+    for (i = N * (size_t)t / (size_t)n_threads; i < last; i++) {
+        c = closest(model->centroids_soa, K, dim, MATRIX_ROW(job->data, i), &dist);
+        if (job->labels != NULL) {
+            job->labels[i] = c;
+        }
+        inertia += dist;
+    }
+    model->thread_inertia[t] = inertia;
+}
+
+/* predict_job for float points, against the float copy of the centroids */
+static void predict_f32_job(void *arg, int t, int n_threads) {
+    struct model_job *job = arg;
+    struct kmeans_model *model = job->model;
+    int K = (int)model->centroids.rows;
+    int dim = model->centroids.dim;
+    size_t N = job->data_f32->rows;
+    size_t last = N * (size_t)(t + 1) / (size_t)n_threads;
+    closest_centroid_f32_fn closest = kmeans_simd_kernel_f32(K, dim);
+    double inertia = 0.0;
+    float dist;
+    size_t i;
+    int c;
+
+    for (i = N * (size_t)t / (size_t)n_threads; i < last; i++) {
+        c = closest(model->centroids_soa_f32, K, dim, MATRIX_ROW(job->data_f32, i), &dist);
+        if (job->labels != NULL) {
+            job->labels[i] = c;
+        }
+        inertia += (double)dist;
+    }
+    model->thread_inertia[t] = inertia;
+}
+
+/* Distances from x to every centroid, through the cached norms */
+KMEANS_TARGET_CLONES
+static void transform_row(const double *x, const struct kmeans_model *model, double *out) {
+    const struct matrix *c = &model->centroids;
+    double xx = dot_product(x, x, c->dim);
+    double d2;
+    size_t k;
+
+    for (k = 0; k < c->rows; k++) {
+        d2 = xx - 2.0 * dot_product(x, MATRIX_ROW(c, k), c->dim) + model->norms[k];
+        /* Cancellation can leave a tiny negative for points right on a centroid */
+        out[k] = d2 > 0.0 ? sqrt(d2) : 0.0;
+    }
+}
+
+/* Thread t fills in the distances of its slice of the points */
+static void transform_job(void *arg, int t, int n_threads) {
+    struct model_job *job = arg;
+    size_t N = job->data->rows;
+    size_t K = job->model->centroids.rows;
+    size_t last = N * (size_t)(t + 1) / (size_t)n_threads;
+    size_t i;
+
+    for (i = N * (size_t)t / (size_t)n_threads; i < last; i++) {
+        transform_row(MATRIX_ROW(job->data, i), job->model, job->distances + i * K);
+    }
+    job->model->thread_inertia[t] = 0.0;
+}
+
+/* Runs a job on model->n_threads threads and returns the sum of their inertia, in thread order */
+static double run_model_job(struct kmeans_model *model, pool_job_fn job_fn, struct model_job *job) {
+    struct thread_pool *pool = NULL;
+    double inertia = 0.0;
+    int t, n_threads;
+
+    if (model->n_threads > 1) {
+        pool = pool_create(model->n_threads);
+    }
+    n_threads = pool_size(pool);
+    pool_run(pool, job_fn, job);
+    for (t = 0; t < n_threads; t++) {
+        inertia += model->thread_inertia[t];
+    }
+    pool_destroy(pool);
+    return inertia;
+}
+
+/*
+ * Labels every point of data with its closest centroid (labels may be NULL)
+ * and returns the sum of the squared distances to them.
+ */
+double kmeans_model_predict(struct kmeans_model *model, const struct matrix *data, int *labels) {
+    struct model_job job;
+
+    job.model = model;
+    job.data = data;
+    job.data_f32 = NULL;
+    job.labels = labels;
+    job.distances = NULL;
+    return run_model_job(model, predict_job, &job);
+}
+
+/* kmeans_model_predict for float points, with float distances (as kmeans_lloyd_f32 computes them) */
+double kmeans_model_predict_f32(struct kmeans_model *model, const struct matrix_f32 *data, int *labels) {
+    struct model_job job;
+
+    job.model = model;
+    job.data = NULL;
+    job.data_f32 = data;
+    job.labels = labels;
+    job.distances = NULL;
+    return run_model_job(model, predict_f32_job, &job);
+}
+
+/* Fills distances (N x K, row-major) with the distance of every point to every centroid */
+void kmeans_model_transform(struct kmeans_model *model, const struct matrix *data, double *distances) {
+    struct model_job job;
+
+    job.model = model;
+    job.data = data;
+    job.data_f32 = NULL;
+    job.labels = NULL;
+    job.distances = distances;
+    run_model_job(model, transform_job, &job);
+}
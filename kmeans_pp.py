@@ -1,6 +1,8 @@
+import contextlib
+import hashlib
+import os
 import sys
 import numpy as np
-import pandas as pd
 import mykmeanssp
 
 
@@ -11,6 +13,11 @@ ERROR_EPS = "Incorrect epsilon!"
 ERROR_OCCURRED = "An Error Has Occurred"
 
 MAX_ITER_DEFAULT = 300
+INIT_DEFAULT = "k-means++"
+INIT_MODES = ("k-means++", "k-means||")
+
+# Directory for the .kmc caches of the joined inputs (unset = no cache)
+CACHE_DIR_ENV = "MYKMEANSSP_CACHE"
 
 def print_error(msg):
     """
@@ -28,14 +35,44 @@ def format_row(row):
     return ",".join(f"{x:.4f}" for x in row)
 
 
+@contextlib.contextmanager
+def traced(name):
+    """
+    Records the block as a span called name in the trace of the C module
+    (on the same clock and lane as its own spans), when $MYKMEANSSP_TRACE
+    is set. Also when the block exits through print_error.
+    """
+    if not mykmeanssp.TRACE:
+        yield
+        return
+    start = mykmeanssp.trace_clock()
+    try:
+        yield
+    finally:
+        mykmeanssp.trace_span(name, start)
+
+
 def parse_args(argv):
 
     """
     Read the args from the command line of terminal
     And validates all the value if they are correct or not
     Throws error in case it's incorrect
+    An optional --init=k-means|| (anywhere on the line) picks the seeding mode
     """
 
+    # Pull out the optional --init=<mode> flag, the rest is positional
+    init = INIT_DEFAULT
+    positional = []
+    for arg in argv:
+        if arg.startswith("--init="):
+            init = arg[len("--init="):]
+            if init not in INIT_MODES:
+                print_error(ERROR_OCCURRED)
+        else:
+            positional.append(arg)
+    argv = positional
+
     # Check if we received the correct number of arguments (filename + 4 or 5 args
     if len(argv) not in (5, 6):
         print_error(ERROR_OCCURRED)
@@ -81,91 +118,71 @@ def parse_args(argv):
     if eps < 0:
         print_error(ERROR_EPS)
 
-    return K, max_iter, eps, file1, file2
+    return K, max_iter, eps, file1, file2, init
 
 
 
+def cache_path(file1: str, file2: str):
+    """
+    Where the .kmc cache of the join of file1 and file2 lives: a file named
+    after their absolute paths in the $MYKMEANSSP_CACHE directory, or None
+    when the variable is not set.
+    """
+    cache_dir = os.environ.get(CACHE_DIR_ENV)
+    if not cache_dir:
+        return None
+    names = os.path.abspath(file1) + "\0" + os.path.abspath(file2)
+    return os.path.join(cache_dir, hashlib.sha1(names.encode()).hexdigest()[:16] + ".kmc")
+
+
 def load_and_merge(file1: str, file2: str):
     """
-    Reads two input files using Pandas.
-    Performs an inner join on the first column (Key) and sorts the result.
+    Reads the two input files with the C module.
+    Performs an inner join on the first column (Key) and sorts the result,
+    exactly like pd.merge(df1, df2, on='key', how="inner").sort_values('key')
+    on the two CSV files would, but parsing both files on all the CPUs and
+    without the intermediate DataFrames.
+    With $MYKMEANSSP_CACHE set, the result is also saved there as a .kmc file,
+    and later runs on the same (unchanged) files map it instead of parsing
+    them again.
     Returns:
       keys: A numpy array of the IDs.
       data_points: A numpy array of the coordinates (without the IDs).
     """
 
     try:
-        # Read files as CSVs without a header row
-        df1 = pd.read_csv(file1, header=None)
-        df2 = pd.read_csv(file2, header=None)
-    except Exception:
-        print_error(ERROR_OCCURRED)  
-      
-
-
-    try: 
-        # Rename the first column to 'key' to allow merging
-        df1.rename(columns = {0: 'key'}, inplace = True)
-        df2.rename(columns = {0: 'key'}, inplace = True)
-
-        # Perform an inner join: keep only keys present in BOTH files
-        merged = pd.merge(df1, df2, on = 'key', how="inner")
-        # Sort the data by key (ascending) to ensure consistent order
-        merged = merged.sort_values('key', ascending=True)
+        # Both come back as float64 buffers, which numpy wraps without copying
+        keys, data_points = mykmeanssp.load_and_merge(file1, file2, n_threads=0,
+                                                      cache=cache_path(file1, file2))
+        keys = np.asarray(keys)
+        data_points = np.asarray(data_points)
     except Exception:
         print_error(ERROR_OCCURRED)
 
-
-    try:
-        # Separate the Keys from the Data
-        keys = merged["key"].to_numpy(dtype=float)
-        # Drop the key column to keep only coordinates
-        data_points = merged.drop(columns=["key"]).to_numpy(dtype=float)
-    except Exception:
-        print_error(ERROR_OCCURRED)   
-
     return keys, data_points
 
 
-def kmeans_pp_init(data_points: np.ndarray, K: int, seed: int = 1234):
+def kmeans_pp_init(data_points: np.ndarray, K: int, seed: int = 1234, init: str = INIT_DEFAULT):
     """
     Implements the K-Means++ initialization algorithm.
     This selects the initial centroids in a smart way to speed up convergence.
-    """
-
-    # Set the seed for reproducibility (so we always get the same result for the same input)
-    np.random.seed(seed)
-    N = data_points.shape[0]
 
-    chose_idxs = []
+    The seeding itself runs in the C module: it draws from the same generator
+    np.random.seed(seed) sets up, and sampling="numpy" replays numpy's own
+    arithmetic for the draws (np.random.choice(N, p=D / D.sum())), so the
+    chosen indices are exactly those the plain numpy version picked.
 
-    # Choose the first centroid completely at random
-    first_idx = np.random.choice(N)
-    chose_idxs.append(first_idx)
-
-    # Calculate initial distances from all points to the first centroid
-    D = np.sqrt(np.sum((data_points - data_points[first_idx]) ** 2, axis=1))
-
-    # Choose the remaining K-1 centroids
-    for i in range(1,K):
-        total = D.sum()
-
-        # Calculate probability for each point:
-        # Points further away (larger D) have a higher chance of being picked
-        if total == 0.0:
-            next_idx = np.random.choice(N)
-        else:
-            probs = D / total
-            next_idx = np.random.choice(N, p=probs)
+    With init="k-means||" the centroids are picked by k-means|| instead: a few
+    oversampling passes over the data, then K of the sampled points. They are
+    still data points, so their keys can be reported the same way.
+    """
 
-        chose_idxs.append(next_idx)
+    data_points = np.ascontiguousarray(data_points, dtype=np.float64)
+    if init == "k-means||":
+        chose_idxs = mykmeanssp.kmeanspp_init(data_points, K, seed=seed, init=init)
+    else:
+        chose_idxs = mykmeanssp.kmeanspp_init(data_points, K, seed=seed, sampling="numpy")
 
-        # Update distances:
-        # For every point, check if the NEW centroid is closer than the previous ones.
-        # Keep the minimum distance.
-        newD = np.sqrt(np.sum((data_points - data_points[next_idx]) ** 2, axis=1))
-        D = np.minimum(D, newD)
-        
     # Get the actual coordinates of the chosen points
     init_centroids = data_points[chose_idxs].copy()
     
@@ -181,14 +198,16 @@ def main():
     4. Print the keys of the initial centroids.
     5. Run the C extension for the heavy calculations.
     6. Print the final centroids.
+    With $MYKMEANSSP_TRACE set, every step is also a span of the trace.
     """
 
 
     # Get arguments from command line
-    K, max_iter, eps, file1, file2 = parse_args(sys.argv)
+    K, max_iter, eps, file1, file2, init = parse_args(sys.argv)
 
     # Load data from files
-    keys, data_points = load_and_merge(file1, file2)
+    with traced("load_and_merge"):
+        keys, data_points = load_and_merge(file1, file2)
     N = len(data_points)
 
     # Validation: K cannot be larger than the number of data points
@@ -196,30 +215,40 @@ def main():
         print_error(ERROR_NUM_CLUSTERS)
 
     # Run K-Means++ Initialization
-    chose_idxs, init_centroids = kmeans_pp_init(data_points, K)
+    with traced("kmeans_pp_init"):
+        chose_idxs, init_centroids = kmeans_pp_init(data_points, K, init=init)
     
     # Print the keys (IDs) of the chosen initial centroids
-    print(",".join(str(int(keys[i])) for i in chose_idxs))
+    with traced("print keys"):
+        print(",".join(str(int(keys[i])) for i in chose_idxs))
 
     # Call the C module
-    # We convert numpy arrays to Python lists because our C module expects lists.
+    # The C module reads C-contiguous float64 arrays in place through the buffer
+    # protocol, so there is no need to convert them to Python lists first.
+    # With output="buffer" the centroids come back as a float64 buffer (plus the
+    # int32 labels of every point), which numpy wraps without copying.
     try:
-        final_centroids = mykmeanssp.fit(
-            K, max_iter, eps,
-            data_points.tolist(),
-            init_centroids.tolist()
-        )
+        with traced("fit"):
+            final_centroids, labels = mykmeanssp.fit(
+                K, max_iter, eps,
+                np.ascontiguousarray(data_points, dtype=np.float64),
+                np.ascontiguousarray(init_centroids, dtype=np.float64),
+                output="buffer"
+            )
+            final_centroids = np.asarray(final_centroids)
     except Exception:
         print_error(ERROR_OCCURRED)
 
 
     # Print the final results
     # Format each coordinate to 4 decimal places
-    for row in final_centroids:
-        print(format_row(row))
+    with traced("print centroids"):
+        for row in final_centroids:
+            print(format_row(row))
 
         
 
 
 if __name__ == "__main__":
-    main()
\ No newline at end of file
+    with traced("kmeans_pp.py"):
+        main()
\ No newline at end of file
@@ -0,0 +1,296 @@
+#include "kmeans.h"
+
+#include <string.h>
+
+/*
+ * Lloyd iterations resumed from a previous solution, for data sets that
+ * change a little between runs. The caller keeps the state of the last run
+ * (struct kmeans_refit_state): the per-cluster sums and counts behind the
+ * centroids, the label of every point and its Hamerly bounds. A refit then
+ *
+ *  - takes the deleted points out of the sums of the clusters they were in,
+ *  - scans the new points (labelled -1) and adds them to their closest cluster,
+ *  - and iterates: centroids from the sums, then a Hamerly Assignment Step in
+ *    which only the points whose cluster changes move from one cluster's sums
+ *    to another's, until no centroid moves by epsilon or more.
+ *
+ * Nothing is rebuilt from zero, so the distances computed, and the sums
+ * touched, scale with the points added, deleted or moved rather than with N;
+ * what every point still costs is a check of its two bounds per iteration.
+ * Points without bounds (all of them when the state keeps none) are scanned
+ * once, like in one Lloyd iteration.
+ *
+ * The sums are running totals, so after many refits they can drift from a
+ * fresh sum of the same points by rounding; rebuilding them from the labels
+ * (kmeans_refit_rebuild) now and then resets that.
+ */
+
+/*declaration of structs*/
+struct refit_job;
+
+/*declaration of functions*/
+static void reassign_job(void *arg, int t, int n_threads);
+static void reduce_refit_job(void *arg, int t, int n_threads);
+static void loosen_job(void *arg, int t, int n_threads);
+static void refit_pass(struct refit_job *job, struct thread_pool *pool);
+static int refit_update(struct matrix *centroids, const struct kmeans_workspace *ws, double *mean,
+                        double epsilon);
+
+
+/*implementations of structs*/
+
+/* Everything the threaded passes need */
+struct refit_job
+{
+    const struct matrix *data;
+    const struct matrix *centroids;
+    struct kmeans_workspace *ws;
+    int n_threads;
+};
+
+
+/* Bytes of arena space needed by kmeans_refit_carve */
+size_t kmeans_refit_bytes(size_t N, int K, int dim, const struct kmeans_options *opts) {
+    struct kmeans_options hamerly = *opts;
+
+    hamerly.algorithm = KMEANS_HAMERLY;
+    return kmeans_workspace_bytes(N, K, dim, &hamerly)
+         + arena_block_size((size_t)dim * sizeof(double));
+}
+
+/*
+ * Carves a workspace for kmeans_refit: a Hamerly one (whatever
+ * opts->algorithm says), with labels and bounds for N points - pass 0 when
+ * the state brings its own bounds, the number of points otherwise - plus a
+ * scratch row. Returns 0 on success, -1 if the arena has no room left.
+ */
+int kmeans_refit_carve(struct kmeans_workspace *ws, struct arena *a, size_t N, int K, int dim,
+                       const struct kmeans_options *opts) {
+    struct kmeans_options hamerly = *opts;
+
+    hamerly.algorithm = KMEANS_HAMERLY;
+    if (kmeans_workspace_carve(ws, a, N, K, dim, &hamerly) != 0
+        || matrix_carve(&ws->batch, a, 1, dim) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Recomputes state->sums and state->counts from the labels, skipping points labelled -1 */
+void kmeans_refit_rebuild(const struct matrix *data, struct kmeans_refit_state *state) {
+    size_t i;
+
+    zero_out_vector(state->sums.data, (int)(state->sums.rows * (size_t)state->sums.dim));
+    memset(state->counts, 0, state->sums.rows * sizeof(int));
+    for (i = 0; i < data->rows; i++) {
+        if (state->labels[i] >= 0) {
+            add_coordinates_from_other_vector(MATRIX_ROW(&state->sums, state->labels[i]),
+                                              MATRIX_ROW(data, i), data->dim);
+            state->counts[state->labels[i]]++;
+        }
+    }
+}
+
+/* Thread t reassigns its slice of the points, moving them between private change sums */
+static void reassign_job(void *arg, int t, int n_threads) {
+    struct refit_job *job = arg;
+    struct kmeans_workspace *mine = &job->ws->partials[t];
+    struct matrix sums = mine->sums;
+    int *counts = mine->counts;
+    size_t N = job->data->rows;
+    int K = (int)job->centroids->rows;
+
+    /* Share the labels, bounds and drift; keep the own accumulators */
+    *mine = *job->ws;
+    mine->sums = sums;
+    mine->counts = counts;
+    mine->partials = NULL;
+    mine->distance_evals = 0;
+
+    zero_out_vector(mine->sums.data, K * job->centroids->dim);
+    memset(mine->counts, 0, (size_t)K * sizeof(int));
+    kmeans_reassign_hamerly(job->data, job->centroids, N * (size_t)t / (size_t)n_threads,
+                            N * (size_t)(t + 1) / (size_t)n_threads, mine);
+}
+
+/* Thread t adds the changes of every thread to its slice of the clusters */
+static void reduce_refit_job(void *arg, int t, int n_threads) {
+    struct refit_job *job = arg;
+    size_t K = job->centroids->rows;
+
+    kmeans_reduce_partials(job->ws, job->n_threads, K * (size_t)t / (size_t)n_threads,
+                           K * (size_t)(t + 1) / (size_t)n_threads, 1);
+}
+
+/* Thread t loosens the bounds of its slice of the points */
+static void loosen_job(void *arg, int t, int n_threads) {
+    struct refit_job *job = arg;
+    size_t N = job->data->rows;
+
+    kmeans_loosen_hamerly(N * (size_t)t / (size_t)n_threads, N * (size_t)(t + 1) / (size_t)n_threads, job->ws);
+}
+
+/* One Assignment Step over all the points, on the caller's sums */
+static void refit_pass(struct refit_job *job, struct thread_pool *pool) {
+    int t;
+
+    if (job->n_threads == 1) {
+        kmeans_reassign_hamerly(job->data, job->centroids, 0, job->data->rows, job->ws);
+        return;
+    }
+    pool_run(pool, reassign_job, job);
+    pool_run(pool, reduce_refit_job, job);
+    for (t = 0; t < job->n_threads; t++) {
+        job->ws->distance_evals += job->ws->partials[t].distance_evals;
+    }
+}
+
+/*
+ * kmeans_update_step on running sums: every centroid becomes the mean of
+ * its cluster, computed into `mean` (dim scratch) so the sums stay as they
+ * are. Empty clusters take ws->fallback. Same return value.
+ */
+static int refit_update(struct matrix *centroids, const struct kmeans_workspace *ws, double *mean,
+                        double epsilon) {
+    int dim = centroids->dim;
+    int converged = 1;
+    size_t idx;
+    double *cent;
+
+    for (idx = 0; idx < centroids->rows; idx++) {
+        cent = MATRIX_ROW(centroids, idx);
+        if (ws->counts[idx] == 0) {
+            memcpy(cent, ws->fallback, (size_t)dim * sizeof(double));
+            converged = 0;
+            continue;
+        }
+        memcpy(mean, MATRIX_ROW(&ws->sums, idx), (size_t)dim * sizeof(double));
+        divide_vector_by_scalar(mean, dim, ws->counts[idx]);
+        if (compute_distance(cent, mean, dim) >= epsilon) {
+            converged = 0;
+        }
+        memcpy(cent, mean, (size_t)dim * sizeof(double));
+    }
+    return converged;
+}
+
+/*
+ * Resumes Lloyd iterations after points came and went, with a workspace from
+ * kmeans_refit_carve. On entry, centroids and state are those a previous fit
+ * or refit left, except that data is the new set of points: the labels of
+ * the points kept carried over, -1 for new ones. state->upper may be NULL,
+ * and negative bounds in it mean unknown; the others must hold for these
+ * centroids. The deleted rows (may be NULL) are the points dropped since,
+ * with the labels they had.
+ *
+ * The sums are brought up to date, and iterations run until no centroid moves
+ * by opts->epsilon or more (an empty cluster, which takes the first point,
+ * counts as a move), at most opts->iter of them. On exit the centroids are the
+ * means of the clusters the labels describe, and state (bounds included)
+ * matches them, ready for the next refit. Threads work as in kmeans_lloyd.
+ *
+ * stats counts the iterations after the first pass (the one that places the
+ * new points); "avoided" is out of N * K for every pass, that one included.
+ * Returns the number of iterations, or -1 (with nothing changed) if a
+ * deleted point's label names a cluster with no points left to take it from.
+ */
+int kmeans_refit(const struct matrix *data, struct matrix *centroids, struct kmeans_refit_state *state,
+                 const struct matrix *deleted, const int *deleted_labels, struct kmeans_workspace *ws,
+                 const struct kmeans_options *opts, struct kmeans_stats *stats) {
+    size_t K = centroids->rows;
+    int dim = centroids->dim;
+    int iteration = 0;
+    int converged;
+    int invalid = 0;
+    size_t i;
+    int d;
+    double *sum;
+    const double *x;
+    struct thread_pool *pool = NULL;
+    struct refit_job job;
+
+    /* Check the deletions against the counts first, so a bad request changes nothing */
+    if (deleted != NULL) {
+        for (i = 0; i < deleted->rows; i++) {
+            if (--state->counts[deleted_labels[i]] < 0) {
+                invalid = 1;
+            }
+        }
+        if (invalid) {
+            for (i = 0; i < deleted->rows; i++) {
+                state->counts[deleted_labels[i]]++;
+            }
+            return -1;
+        }
+        /* Deleted points leave the sums of their clusters */
+        for (i = 0; i < deleted->rows; i++) {
+            x = MATRIX_ROW(deleted, i);
+            sum = MATRIX_ROW(&state->sums, deleted_labels[i]);
+            for (d = 0; d < dim; d++) {
+                sum[d] -= x[d];
+            }
+        }
+    }
+
+    /* The workspace runs on the caller's state */
+    ws->sums = state->sums;
+    ws->counts = state->counts;
+    ws->labels = state->labels;
+    if (state->upper != NULL) {
+        ws->upper = state->upper;
+        ws->lower = state->lower;
+    }
+    ws->fallback = data->data; /* Empty clusters take the first point, as in kmeans_lloyd */
+    ws->distance_evals = 0;
+
+    if (opts->n_threads > 1) {
+        pool = pool_create(opts->n_threads);
+    }
+    job.data = data;
+    job.centroids = centroids;
+    job.ws = ws;
+    job.n_threads = pool_size(pool);
+
+    /* The bounds hold for the centroids as they are: no drift yet */
+    ws->bounds_ready = 0;
+    kmeans_bounds_refresh(centroids, ws);
+    matrix_to_soa(centroids, ws->centroids_soa);
+
+    /* New points join their closest cluster (every point does without bounds) */
+    ws->bounds_ready = state->upper != NULL;
+    refit_pass(&job, pool);
+    ws->bounds_ready = 1;
+
+    /* MAIN K-MEANS LOOP: Update Step first, since the sums already changed */
+    for (;;) {
+        converged = refit_update(centroids, ws, ws->batch.data, opts->epsilon);
+        if (converged || iteration >= opts->iter) {
+            break;
+        }
+        kmeans_bounds_refresh(centroids, ws);
+        matrix_to_soa(centroids, ws->centroids_soa);
+        refit_pass(&job, pool);
+        iteration++;
+    }
+
+    /* Hand the bounds back valid for the final centroids */
+    if (state->upper != NULL) {
+        kmeans_bounds_refresh(centroids, ws);
+        if (job.n_threads > 1) {
+            pool_run(pool, loosen_job, &job);
+        }
+        else {
+            kmeans_loosen_hamerly(0, data->rows, ws);
+        }
+    }
+
+    if (stats != NULL) {
+        stats->iterations = iteration;
+        stats->distance_evals = ws->distance_evals;
+        stats->distance_evals_avoided = (unsigned long long)data->rows * (unsigned long long)K
+                                        * (unsigned long long)(iteration + 1) - ws->distance_evals;
+    }
+
+    pool_destroy(pool);
+    return iteration;
+}
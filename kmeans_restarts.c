@@ -0,0 +1,217 @@
+#include "kmeans.h"
+
+#include <string.h>
+
+/*
+ * Several independent k-means++ + Lloyd runs over one shared, read-only copy
+ * of the data, the one with the lowest inertia kept (n_init of fit).
+ *
+ * Run r seeds with np.random.seed(seed + r) exactly like kmeans_pp_init in
+ * kmeans_pp.py (numpy sampling) and then runs kmeans_lloyd on one thread, so
+ * it gives what that seeding followed by a single-threaded fit gives. The
+ * parallelism is across the runs instead: each thread owns a slot with the
+ * scratch of one run and takes runs t, t + n_threads, ... in turn, keeping
+ * the best of its own. The best of the slots wins, ties going to the earlier
+ * run, so the result does not depend on the thread count either.
+ *
+ * The inertia of a run is the sum of the squared distances of the points to
+ * the final centroid of their cluster (the labels of the last Assignment Step).
+ */
+
+/*declaration of structs*/
+struct restart_job;
+
+/*declaration of functions*/
+static double run_inertia(const struct matrix *data, const struct matrix *centroids, const int *labels);
+static void restart_job(void *arg, int t, int n_threads);
+
+
+/*implementations of structs*/
+
+/* Everything the threaded runs need */
+struct restart_job
+{
+    const struct matrix *data;
+    struct kmeans_restarts *r;
+    const struct kmeans_options *opts; /* n_threads = 1 */
+    int n_init;
+    unsigned long long seed;
+};
+
+
+/* Bytes of arena space needed by kmeans_restarts_carve */
+size_t kmeans_restarts_bytes(size_t N, int K, int dim, const struct kmeans_options *opts, int n_init) {
+    struct kmeans_options run_opts = *opts;
+    struct kmeans_seed_options seed_opts;
+    size_t n_slots = (size_t)(opts->n_threads < n_init ? opts->n_threads : n_init);
+
+    run_opts.n_threads = 1;
+    seed_opts.n_threads = 1;
+    seed_opts.n_local_trials = 1;
+    return arena_block_size(n_slots * sizeof(struct kmeans_restart_slot))
+         + arena_block_size((size_t)n_init * sizeof(double))
+         + arena_block_size((size_t)n_init * sizeof(int))
+         + n_slots * (kmeans_workspace_bytes(N, K, dim, &run_opts)
+                      + kmeans_seed_bytes(N, dim, &seed_opts)
+                      + 2 * arena_block_size((size_t)K * (size_t)dim * sizeof(double))
+                      + 2 * arena_block_size(N * sizeof(int))
+                      + arena_block_size((size_t)K * sizeof(size_t)));
+}
+
+/*
+ * Carves the scratch of kmeans_restarts_run for n_init runs of K clusters
+ * over N points: one slot per thread (opts->n_threads of them, at most
+ * n_init), each with its own Lloyd workspace for opts->algorithm.
+ * Returns 0 on success, -1 if the arena has no room left.
+ */
+int kmeans_restarts_carve(struct kmeans_restarts *r, struct arena *a, size_t N, int K, int dim,
+                          const struct kmeans_options *opts, int n_init) {
+    struct kmeans_options run_opts = *opts;
+    struct kmeans_seed_options seed_opts;
+    struct kmeans_restart_slot *slot;
+    int s;
+
+    run_opts.n_threads = 1;
+    seed_opts.n_threads = 1;
+    seed_opts.n_local_trials = 1;
+    r->n_slots = opts->n_threads < n_init ? opts->n_threads : n_init;
+    r->slots = arena_alloc(a, (size_t)r->n_slots * sizeof(struct kmeans_restart_slot));
+    r->inertias = arena_alloc(a, (size_t)n_init * sizeof(double));
+    r->iterations = arena_alloc(a, (size_t)n_init * sizeof(int));
+    if (r->slots == NULL || r->inertias == NULL || r->iterations == NULL) {
+        return -1;
+    }
+    for (s = 0; s < r->n_slots; s++) {
+        slot = &r->slots[s];
+        if (kmeans_workspace_carve(&slot->ws, a, N, K, dim, &run_opts) != 0
+            || kmeans_seed_carve(&slot->seed_ws, a, N, dim, &seed_opts) != 0
+            || matrix_carve(&slot->centroids, a, (size_t)K, dim) != 0
+            || matrix_carve(&slot->best_centroids, a, (size_t)K, dim) != 0) {
+            return -1;
+        }
+        slot->labels = arena_alloc(a, N * sizeof(int));
+        slot->best_labels = arena_alloc(a, N * sizeof(int));
+        slot->chosen = arena_alloc(a, (size_t)K * sizeof(size_t));
+        if (slot->labels == NULL || slot->best_labels == NULL || slot->chosen == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Sum of the squared distances of the points to the centroid of their label */
+static double run_inertia(const struct matrix *data, const struct matrix *centroids, const int *labels) {
+    double inertia = 0.0;
+    size_t i;
+
+    for (i = 0; i < data->rows; i++) {
+        inertia += squared_distance(MATRIX_ROW(data, i), MATRIX_ROW(centroids, labels[i]), data->dim);
+    }
+    return inertia;
+}
+
+/* Thread t does the runs t, t + n_threads, ... in its own slot */
+static void restart_job(void *arg, int t, int n_threads) {
+    struct restart_job *job = arg;
+    struct kmeans_restart_slot *slot = &job->r->slots[t];
+    const struct matrix *data = job->data;
+    size_t K = slot->centroids.rows;
+    struct kmeans_seed_options seed_opts;
+    struct kmeans_stats stats;
+    double inertia;
+    size_t k;
+    int run;
+
+    seed_opts.n_threads = 1;
+    seed_opts.n_local_trials = 1;
+    seed_opts.numpy_sampling = 1;
+    seed_opts.rounds = 0;
+    seed_opts.oversampling = 0.0;
+
+    slot->best_run = -1;
+    slot->distance_evals = 0;
+    slot->distance_evals_avoided = 0;
+    for (run = t; run < job->n_init; run += n_threads) {
+        seed_opts.seed = job->seed + (unsigned long long)run;
+        kmeans_pp_seed(data, (int)K, &slot->seed_ws, &seed_opts, slot->chosen);
+        for (k = 0; k < K; k++) {
+            memcpy(MATRIX_ROW(&slot->centroids, k), MATRIX_ROW(data, slot->chosen[k]),
+                   (size_t)data->dim * sizeof(double));
+        }
+        kmeans_lloyd(data, &slot->centroids, &slot->ws, job->opts, slot->labels, &stats);
+
+        inertia = run_inertia(data, &slot->centroids, slot->labels);
+        job->r->inertias[run] = inertia;
+        job->r->iterations[run] = stats.iterations;
+        slot->distance_evals += stats.distance_evals;
+        slot->distance_evals_avoided += stats.distance_evals_avoided;
+        /* Runs come in increasing order, so a tie keeps the earlier one */
+        if (slot->best_run < 0 || inertia < job->r->inertias[slot->best_run]) {
+            slot->best_run = run;
+            slot->best_iterations = stats.iterations;
+            memcpy(slot->best_centroids.data, slot->centroids.data, K * (size_t)data->dim * sizeof(double));
+            memcpy(slot->best_labels, slot->labels, data->rows * sizeof(int));
+        }
+    }
+}
+
+/*
+ * Runs n_init seed + Lloyd runs of centroids->rows clusters over data, with
+ * scratch from kmeans_restarts_carve; run r is seeded with seed + r, and opts
+ * (all but n_threads) applies to every run. centroids receives the final
+ * centroids of the run with the lowest inertia, labels (if not NULL) its
+ * labels, and stats (if not NULL) its iteration count along with the distance
+ * counts of all the runs. r->inertias and r->iterations keep every run's.
+ * Returns the index of the best run.
+ */
+int kmeans_restarts_run(const struct matrix *data, struct kmeans_restarts *r, const struct kmeans_options *opts,
+                        int n_init, unsigned long long seed, struct matrix *centroids, int *labels,
+                        struct kmeans_stats *stats) {
+    struct kmeans_options run_opts = *opts;
+    struct thread_pool *pool = NULL;
+    struct restart_job job;
+    struct kmeans_restart_slot *best = NULL;
+    int s, n_threads;
+
+    run_opts.n_threads = 1;
+    job.data = data;
+    job.r = r;
+    job.opts = &run_opts;
+    job.n_init = n_init;
+    job.seed = seed;
+
+    if (r->n_slots > 1) {
+        pool = pool_create(r->n_slots);
+    }
+    n_threads = pool_size(pool);
+    pool_run(pool, restart_job, &job);
+    pool_destroy(pool);
+
+    if (stats != NULL) {
+        stats->distance_evals = 0;
+        stats->distance_evals_avoided = 0;
+    }
+    for (s = 0; s < n_threads; s++) {
+        if (stats != NULL) {
+            stats->distance_evals += r->slots[s].distance_evals;
+            stats->distance_evals_avoided += r->slots[s].distance_evals_avoided;
+        }
+        if (r->slots[s].best_run < 0) {
+            continue;
+        }
+        if (best == NULL || r->inertias[r->slots[s].best_run] < r->inertias[best->best_run]
+            || (r->inertias[r->slots[s].best_run] == r->inertias[best->best_run]
+                && r->slots[s].best_run < best->best_run)) {
+            best = &r->slots[s];
+        }
+    }
+
+    memcpy(centroids->data, best->best_centroids.data, centroids->rows * (size_t)centroids->dim * sizeof(double));
+    if (labels != NULL) {
+        memcpy(labels, best->best_labels, data->rows * sizeof(int));
+    }
+    if (stats != NULL) {
+        stats->iterations = best->best_iterations;
+    }
+    return best->best_run;
+}
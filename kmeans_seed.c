@@ -0,0 +1,764 @@
+#include "kmeans.h"
+
+#include <math.h>
+#include <stdint.h>
+
+/*
+ * k-means++ seeding, as kmeans_pp.py did it with numpy: the first centroid
+ * is a uniformly random point, every next one a point drawn with probability
+ * proportional to its distance (not squared) to the closest centroid chosen
+ * so far.
+ *
+ * The random numbers come from the same generator numpy's np.random.seed
+ * sets up (MT19937 with its legacy seeding, randint and random_sample), and
+ * the distances are summed in numpy's (pairwise) order, so the same seed
+ * draws the same uniform numbers and sees the same distances. The distances
+ * live in one array updated in place, one parallel pass per centroid, which
+ * also sums them over blocks of SEED_BLOCK points: a draw then walks the
+ * block sums (a prefix sum) and a single block instead of all N points.
+ *
+ * That walk adds the distances in another order than numpy's cumsum, so a
+ * draw landing within rounding error of the boundary between two points may
+ * pick the other one. numpy_sampling replays numpy's arithmetic exactly
+ * (a serial cumsum per draw) for callers that need its very indices.
+ *
+ * With n_local_trials > 1, every step draws that many candidates and keeps
+ * the one that lowers the sum of the distances the most (greedy k-means++).
+ *
+ * k-means|| (Bahmani et al., "Scalable k-means++") needs far fewer passes
+ * over the data: after a uniformly random first point, every round samples
+ * each point independently with probability min(1, l d^2 / phi), where d is
+ * its distance to the closest point sampled so far, phi the sum of the d^2
+ * and l the oversampling factor, so a round adds about l candidates. A few
+ * rounds leave O(l rounds) candidates; each one is weighted by the points
+ * closest to it, and a weighted k-means++ (d^2 weighting, as in the paper)
+ * over the candidates alone picks the K seeds, which are thus data points.
+ * Every point's coin flip comes from a hash of its index and the round, so
+ * the seeds do not depend on the number of threads.
+ */
+
+/* Points per block of the prefix sums */
+#define SEED_BLOCK 4096
+
+/* MT19937 parameters */
+#define MT_N 624
+#define MT_M 397
+
+/*declaration of structs*/
+struct mt19937;
+struct seed_job;
+
+/*declaration of functions*/
+static void mt_seed(struct mt19937 *mt, uint32_t seed);
+static uint32_t mt_next(struct mt19937 *mt);
+static double mt_double(struct mt19937 *mt);
+static size_t mt_below(struct mt19937 *mt, size_t n);
+static double numpy_sum(const double *a, size_t n);
+static double point_distance(const double *x, const double *c, int dim, double *scratch);
+static void update_job(void *arg, int t, int n_threads);
+static void trial_job(void *arg, int t, int n_threads);
+static size_t draw_blocks(const struct kmeans_seed_workspace *ws, size_t N, double total, double u);
+static size_t draw_numpy(const struct kmeans_seed_workspace *ws, size_t N, double total, double u);
+static double point_uniform(unsigned long long key, unsigned long long counter);
+static size_t parallel_capacity(size_t N, int K, const struct kmeans_seed_options *opts);
+static double parallel_update(struct thread_pool *pool, struct seed_job *job, size_t first, size_t count);
+static void parallel_update_job(void *arg, int t, int n_threads);
+static void sample_count_job(void *arg, int t, int n_threads);
+static void sample_fill_job(void *arg, int t, int n_threads);
+static void weight_job(void *arg, int t, int n_threads);
+static void reduce_candidates(const struct matrix *data, int K, struct kmeans_seed_workspace *ws,
+                              size_t n_candidates, struct mt19937 *mt, size_t *chosen);
+
+
+/*implementations of structs*/
+
+/* numpy's legacy bit generator */
+struct mt19937
+{
+    uint32_t key[MT_N];
+    int pos;
+};
+
+/* Everything the threaded passes need */
+struct seed_job
+{
+    const struct matrix *data;
+    struct kmeans_seed_workspace *ws;
+    const double *centroid;   /* update_job: the centroid just chosen ... */
+    int first;                /* ... and whether it is the first one (set the distances, do not lower them) */
+    int n_trials;             /* trial_job: candidates in ws->candidates */
+    size_t from;              /* parallel_update_job: the candidates pool[from..from+count-1] ... */
+    size_t count;             /* ... sampled in the last round (from == 0: the very first one) */
+    double phi;               /* sample_*_job: sum of the squared distances ... */
+    double oversampling;      /* ... the oversampling factor l ... */
+    unsigned long long key;   /* ... and the hash key of this round's coin flips */
+    size_t n_candidates;      /* sample_fill_job: candidates before this round; weight_job: all of them */
+};
+
+
+/* np.random.seed(seed) for an integer seed */
+static void mt_seed(struct mt19937 *mt, uint32_t seed) {
+    int pos;
+
+    for (pos = 0; pos < MT_N; pos++) {
+        mt->key[pos] = seed;
+        seed = (uint32_t)(1812433253UL * (seed ^ (seed >> 30)) + (uint32_t)pos + 1);
+    }
+    mt->pos = MT_N;
+}
+
+/* Next 32 random bits */
+static uint32_t mt_next(struct mt19937 *mt) {
+    uint32_t y;
+    int i;
+
+    if (mt->pos == MT_N) {
+        for (i = 0; i < MT_N; i++) {
+            y = (mt->key[i] & 0x80000000UL) | (mt->key[(i + 1) % MT_N] & 0x7fffffffUL);
+            mt->key[i] = mt->key[(i + MT_M) % MT_N] ^ (y >> 1) ^ (y & 1 ? 0x9908b0dfUL : 0);
+        }
+        mt->pos = 0;
+    }
+    y = mt->key[mt->pos++];
+    y ^= y >> 11;
+    y ^= (y << 7) & 0x9d2c5680UL;
+    y ^= (y << 15) & 0xefc60000UL;
+    y ^= y >> 18;
+    return y;
+}
+
+/* np.random.random_sample(): a double in [0, 1) from 53 random bits */
+static double mt_double(struct mt19937 *mt) {
+    uint32_t a = mt_next(mt) >> 5;
+    uint32_t b = mt_next(mt) >> 6;
+    return ((double)a * 67108864.0 + (double)b) / 9007199254740992.0;
+}
+
+/* np.random.randint(0, n) (and np.random.choice(n)): masked rejection sampling */
+static size_t mt_below(struct mt19937 *mt, size_t n) {
+    unsigned long long range = (unsigned long long)n - 1;
+    unsigned long long mask = range;
+    unsigned long long value;
+
+    if (range == 0) {
+        return 0;
+    }
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+    mask |= mask >> 32;
+    do {
+        if (range <= 0xffffffffULL) {
+            value = mt_next(mt) & mask;
+        }
+        else {
+            value = (unsigned long long)mt_next(mt) << 32;
+            value = (value | mt_next(mt)) & mask;
+        }
+    } while (value > range);
+    return (size_t)value;
+}
+
+/* np.sum of a contiguous float64 array: numpy's pairwise sum (blocks of 8, split in halves above 128) */
+static double numpy_sum(const double *a, size_t n) {
+    double r[8], res;
+    size_t i, half;
+    int j;
+
+    if (n < 8) {
+        res = 0.0;
+        for (i = 0; i < n; i++) {
+            res += a[i];
+        }
+        return res;
+    }
+    if (n <= 128) {
+        for (j = 0; j < 8; j++) {
+            r[j] = a[j];
+        }
+        for (i = 8; i < n - (n % 8); i += 8) {
+            for (j = 0; j < 8; j++) {
+                r[j] += a[i + j];
+            }
+        }
+        res = ((r[0] + r[1]) + (r[2] + r[3])) + ((r[4] + r[5]) + (r[6] + r[7]));
+        for (; i < n; i++) {
+            res += a[i];
+        }
+        return res;
+    }
+    half = n / 2;
+    half -= half % 8;
+    return numpy_sum(a, half) + numpy_sum(a + half, n - half);
+}
+
+/* np.sqrt(np.sum((x - c) ** 2)); scratch holds dim doubles */
+static double point_distance(const double *x, const double *c, int dim, double *scratch) {
+    double diff, sum = 0.0;
+    int j;
+
+    if (dim < 8) {
+        /* numpy_sum's short case, without the scratch */
+        for (j = 0; j < dim; j++) {
+            diff = x[j] - c[j];
+            sum += diff * diff;
+        }
+        return sqrt(sum);
+    }
+    for (j = 0; j < dim; j++) {
+        diff = x[j] - c[j];
+        scratch[j] = diff * diff;
+    }
+    return sqrt(numpy_sum(scratch, (size_t)dim));
+}
+
+/* Bytes of arena space needed by kmeans_seed_carve */
+size_t kmeans_seed_bytes(size_t N, int dim, const struct kmeans_seed_options *opts) {
+    size_t blocks = (N + SEED_BLOCK - 1) / SEED_BLOCK;
+
+    return arena_block_size(N * sizeof(double))
+         + arena_block_size(blocks * sizeof(double))
+         + arena_block_size((size_t)opts->n_threads * (size_t)opts->n_local_trials * sizeof(double))
+         + arena_block_size((size_t)opts->n_local_trials * sizeof(size_t))
+         + arena_block_size((size_t)opts->n_threads * (size_t)dim * sizeof(double));
+}
+
+/*
+ * Carves the scratch of kmeans_pp_seed out of the arena.
+ * Returns 0 on success, -1 if the arena has no room left.
+ */
+int kmeans_seed_carve(struct kmeans_seed_workspace *ws, struct arena *a, size_t N, int dim,
+                      const struct kmeans_seed_options *opts) {
+    ws->dist = arena_alloc(a, N * sizeof(double));
+    ws->block_sums = arena_alloc(a, (N + SEED_BLOCK - 1) / SEED_BLOCK * sizeof(double));
+    ws->trial_sums = arena_alloc(a, (size_t)opts->n_threads * (size_t)opts->n_local_trials * sizeof(double));
+    ws->candidates = arena_alloc(a, (size_t)opts->n_local_trials * sizeof(size_t));
+    ws->squares = arena_alloc(a, (size_t)opts->n_threads * (size_t)dim * sizeof(double));
+    if (ws->dist == NULL || ws->block_sums == NULL || ws->trial_sums == NULL || ws->candidates == NULL
+        || ws->squares == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Thread t brings the distances of its blocks of points up to date with the
+ * centroid just chosen (or sets them, for the first one) and sums every block.
+ */
+static void update_job(void *arg, int t, int n_threads) {
+    struct seed_job *job = arg;
+    struct kmeans_seed_workspace *ws = job->ws;
+    size_t N = job->data->rows;
+    int dim = job->data->dim;
+    size_t blocks = (N + SEED_BLOCK - 1) / SEED_BLOCK;
+    size_t last = blocks * (size_t)(t + 1) / (size_t)n_threads;
+    double *scratch = ws->squares + (size_t)t * (size_t)dim;
+    double d, sum;
+    size_t b, i, end;
+
+    for (b = blocks * (size_t)t / (size_t)n_threads; b < last; b++) {
+        end = (b + 1) * SEED_BLOCK < N ? (b + 1) * SEED_BLOCK : N;
+        sum = 0.0;
+        for (i = b * SEED_BLOCK; i < end; i++) {
+            d = point_distance(MATRIX_ROW(job->data, i), job->centroid, dim, scratch);
+            /* np.minimum: a NaN on either side wins */
+            if (job->first || d < ws->dist[i] || d != d) {
+                ws->dist[i] = d;
+            }
+            sum += ws->dist[i];
+        }
+        ws->block_sums[b] = sum;
+    }
+}
+
+/* Thread t sums, for every candidate, the distances its blocks would have with it chosen */
+static void trial_job(void *arg, int t, int n_threads) {
+    struct seed_job *job = arg;
+    struct kmeans_seed_workspace *ws = job->ws;
+    size_t N = job->data->rows;
+    int dim = job->data->dim;
+    int L = job->n_trials;
+    size_t blocks = (N + SEED_BLOCK - 1) / SEED_BLOCK;
+    size_t first = blocks * (size_t)t / (size_t)n_threads * SEED_BLOCK;
+    size_t last = blocks * (size_t)(t + 1) / (size_t)n_threads * SEED_BLOCK;
+    double *sums = ws->trial_sums + (size_t)t * (size_t)L;
+    double *scratch = ws->squares + (size_t)t * (size_t)dim;
+    const double *x;
+    double d;
+    size_t i;
+    int l;
+
+    if (last > N) {
+        last = N;
+    }
+    for (l = 0; l < L; l++) {
+        sums[l] = 0.0;
+    }
+    for (i = first; i < last; i++) {
+        x = MATRIX_ROW(job->data, i);
+        for (l = 0; l < L; l++) {
+            d = point_distance(x, MATRIX_ROW(job->data, ws->candidates[l]), dim, scratch);
+            sums[l] += d < ws->dist[i] ? d : ws->dist[i];
+        }
+    }
+}
+
+/*
+ * Draws a point with probability dist / total for a uniform u in [0, 1):
+ * the first point where the running sum of the distances exceeds u * total,
+ * found through the block sums.
+ */
+static size_t draw_blocks(const struct kmeans_seed_workspace *ws, size_t N, double total, double u) {
+    double target = u * total;
+    double running = 0.0;
+    size_t b, i, end;
+    size_t blocks = (N + SEED_BLOCK - 1) / SEED_BLOCK;
+
+    for (b = 0; b < blocks; b++) {
+        if (running + ws->block_sums[b] > target) {
+            end = (b + 1) * SEED_BLOCK < N ? (b + 1) * SEED_BLOCK : N;
+            for (i = b * SEED_BLOCK; i < end; i++) {
+                running += ws->dist[i];
+                if (running > target) {
+                    return i;
+                }
+            }
+            /* Rounding kept the block just short: carry on from where the scan stopped */
+            continue;
+        }
+        running += ws->block_sums[b];
+    }
+    /* u * total rounded up to (or past) the total: the last point that can be drawn */
+    for (i = N; i > 1 && !(ws->dist[i - 1] > 0.0); i--) {
+    }
+    return i - 1;
+}
+
+/*
+ * The same draw with numpy's arithmetic, as in np.random.choice(N, p=dist / total):
+ * a cumsum of the probabilities, normalised by its last element, searched for u.
+ */
+static size_t draw_numpy(const struct kmeans_seed_workspace *ws, size_t N, double total, double u) {
+    double cdf = 0.0, last = 0.0;
+    size_t i;
+
+    for (i = 0; i < N; i++) {
+        last += ws->dist[i] / total;
+    }
+    for (i = 0; i < N; i++) {
+        cdf += ws->dist[i] / total;
+        if (cdf / last > u) {
+            return i;
+        }
+    }
+    return N - 1;
+}
+
+/*
+ * Picks K initial centroids among the points of data with k-means++, with
+ * scratch from kmeans_seed_carve. chosen receives the K row indices in the
+ * order they were drawn.
+ */
+void kmeans_pp_seed(const struct matrix *data, int K, struct kmeans_seed_workspace *ws,
+                    const struct kmeans_seed_options *opts, size_t *chosen) {
+    struct mt19937 mt;
+    struct thread_pool *pool = NULL;
+    struct seed_job job;
+    size_t N = data->rows;
+    size_t blocks = (N + SEED_BLOCK - 1) / SEED_BLOCK;
+    double total, best_sum, sum;
+    size_t b;
+    int k, l, t, n_threads, best;
+    double started = kmeans_trace_on ? kmeans_telemetry_clock() : 0.0;
+
+    mt_seed(&mt, (uint32_t)opts->seed);
+    if (opts->n_threads > 1) {
+        pool = pool_create(opts->n_threads);
+    }
+    n_threads = pool_size(pool);
+    job.data = data;
+    job.ws = ws;
+    job.n_trials = opts->n_local_trials;
+
+    chosen[0] = mt_below(&mt, N);
+    job.centroid = MATRIX_ROW(data, chosen[0]);
+    job.first = 1;
+    if (K > 1) {
+        pool_run(pool, update_job, &job);
+    }
+    job.first = 0;
+
+    for (k = 1; k < K; k++) {
+        if (opts->numpy_sampling) {
+            total = numpy_sum(ws->dist, N);
+        }
+        else {
+            total = 0.0;
+            for (b = 0; b < blocks; b++) {
+                total += ws->block_sums[b];
+            }
+        }
+
+        if (total == 0.0) {
+            /* Every point is a centroid already: np.random.choice(N) */
+            chosen[k] = mt_below(&mt, N);
+        }
+        else {
+            for (l = 0; l < opts->n_local_trials; l++) {
+                ws->candidates[l] = opts->numpy_sampling ? draw_numpy(ws, N, total, mt_double(&mt))
+                                                         : draw_blocks(ws, N, total, mt_double(&mt));
+            }
+            best = 0;
+            if (opts->n_local_trials > 1) {
+                /* Greedy: keep the candidate leaving the smallest sum of distances */
+                pool_run(pool, trial_job, &job);
+                best_sum = HUGE_VAL;
+                for (l = 0; l < opts->n_local_trials; l++) {
+                    sum = 0.0;
+                    for (t = 0; t < n_threads; t++) {
+                        sum += ws->trial_sums[(size_t)t * (size_t)opts->n_local_trials + (size_t)l];
+                    }
+                    if (sum < best_sum) {
+                        best_sum = sum;
+                        best = l;
+                    }
+                }
+            }
+            chosen[k] = ws->candidates[best];
+        }
+
+        if (k + 1 < K) {
+            job.centroid = MATRIX_ROW(data, chosen[k]);
+            pool_run(pool, update_job, &job);
+        }
+    }
+    pool_destroy(pool);
+    if (kmeans_trace_on) {
+        kmeans_trace_span("k-means++ seeding", started, -1);
+    }
+}
+
+/* A uniform double in [0, 1) from the splitmix64 finalizer of key + counter */
+static double point_uniform(unsigned long long key, unsigned long long counter) {
+    unsigned long long z = key + counter * 0x9E3779B97F4A7C15ULL;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (double)(z >> 11) / 9007199254740992.0;
+}
+
+/* Room for the first point, twice the expected samples of every round and K more (never past N) */
+static size_t parallel_capacity(size_t N, int K, const struct kmeans_seed_options *opts) {
+    double l = opts->oversampling > 0.0 ? opts->oversampling : 2.0 * K;
+    double capacity = 1.0 + (double)opts->rounds * ceil(2.0 * l) + (double)K;
+
+    return capacity < (double)N ? (size_t)capacity : N;
+}
+
+/* Bytes of arena space needed by kmeans_parallel_seed_carve */
+size_t kmeans_parallel_seed_bytes(size_t N, int K, int dim, const struct kmeans_seed_options *opts) {
+    size_t capacity = parallel_capacity(N, K, opts);
+
+    return kmeans_seed_bytes(N, dim, opts)
+         + arena_block_size(capacity * sizeof(size_t))
+         + arena_block_size(N * sizeof(int))
+         + arena_block_size((size_t)dim * capacity * sizeof(double))
+         + arena_block_size((size_t)opts->n_threads * capacity * sizeof(double))
+         + arena_block_size(capacity * sizeof(double))
+         + arena_block_size((size_t)opts->n_threads * sizeof(size_t));
+}
+
+/*
+ * Carves the scratch of kmeans_parallel_seed out of the arena.
+ * Returns 0 on success, -1 if the arena has no room left.
+ */
+int kmeans_parallel_seed_carve(struct kmeans_seed_workspace *ws, struct arena *a, size_t N, int K, int dim,
+                               const struct kmeans_seed_options *opts) {
+    if (kmeans_seed_carve(ws, a, N, dim, opts) != 0) {
+        return -1;
+    }
+    ws->capacity = parallel_capacity(N, K, opts);
+    ws->pool = arena_alloc(a, ws->capacity * sizeof(size_t));
+    ws->owner = arena_alloc(a, N * sizeof(int));
+    ws->pool_soa = arena_alloc(a, (size_t)dim * ws->capacity * sizeof(double));
+    ws->weights = arena_alloc(a, (size_t)opts->n_threads * ws->capacity * sizeof(double));
+    ws->pool_dist = arena_alloc(a, ws->capacity * sizeof(double));
+    ws->thread_counts = arena_alloc(a, (size_t)opts->n_threads * sizeof(size_t));
+    if (ws->pool == NULL || ws->owner == NULL || ws->pool_soa == NULL || ws->weights == NULL
+        || ws->pool_dist == NULL || ws->thread_counts == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Thread t brings the squared distances (and closest candidates) of its
+ * blocks of points up to date with the candidates of the last round, and
+ * sums every block.
+ */
+static void parallel_update_job(void *arg, int t, int n_threads) {
+    struct seed_job *job = arg;
+    struct kmeans_seed_workspace *ws = job->ws;
+    size_t N = job->data->rows;
+    int dim = job->data->dim;
+    size_t blocks = (N + SEED_BLOCK - 1) / SEED_BLOCK;
+    size_t last = blocks * (size_t)(t + 1) / (size_t)n_threads;
+    closest_centroid_fn closest = kmeans_simd_kernel((int)job->count, dim);
+    double d, sum;
+    size_t b, i, end;
+    int c;
+
+    for (b = blocks * (size_t)t / (size_t)n_threads; b < last; b++) {
+        end = (b + 1) * SEED_BLOCK < N ? (b + 1) * SEED_BLOCK : N;
+        sum = 0.0;
+        for (i = b * SEED_BLOCK; i < end; i++) {
+            c = closest(ws->pool_soa, (int)job->count, dim, MATRIX_ROW(job->data, i), &d);
+            /* Ties go to the earlier candidate */
+            if (job->from == 0 || d < ws->dist[i]) {
+                ws->dist[i] = d;
+                ws->owner[i] = (int)job->from + c;
+            }
+            sum += ws->dist[i];
+        }
+        ws->block_sums[b] = sum;
+    }
+}
+
+/*
+ * Takes the candidates pool[first..first+count-1] into account and returns
+ * phi, the new sum of the squared distances (added in block order, so it
+ * does not depend on the number of threads).
+ */
+static double parallel_update(struct thread_pool *pool, struct seed_job *job, size_t first, size_t count) {
+    struct kmeans_seed_workspace *ws = job->ws;
+    size_t N = job->data->rows;
+    size_t blocks = (N + SEED_BLOCK - 1) / SEED_BLOCK;
+    int dim = job->data->dim;
+    double phi = 0.0;
+    size_t b, c;
+    int j;
+
+    for (c = 0; c < count; c++) {
+        for (j = 0; j < dim; j++) {
+            ws->pool_soa[(size_t)j * count + c] = MATRIX_ROW(job->data, ws->pool[first + c])[j];
+        }
+    }
+    job->from = first;
+    job->count = count;
+    pool_run(pool, parallel_update_job, job);
+    for (b = 0; b < blocks; b++) {
+        phi += ws->block_sums[b];
+    }
+    return phi;
+}
+
+/* Thread t counts the points of its blocks this round samples */
+static void sample_count_job(void *arg, int t, int n_threads) {
+    struct seed_job *job = arg;
+    struct kmeans_seed_workspace *ws = job->ws;
+    size_t N = job->data->rows;
+    size_t blocks = (N + SEED_BLOCK - 1) / SEED_BLOCK;
+    size_t first = blocks * (size_t)t / (size_t)n_threads * SEED_BLOCK;
+    size_t last = blocks * (size_t)(t + 1) / (size_t)n_threads * SEED_BLOCK;
+    size_t i, count = 0;
+
+    if (last > N) {
+        last = N;
+    }
+    for (i = first; i < last; i++) {
+        /* Probability min(1, l d^2 / phi); points already sampled have d = 0 */
+        if (point_uniform(job->key, i) * job->phi < job->oversampling * ws->dist[i]) {
+            count++;
+        }
+    }
+    ws->thread_counts[t] = count;
+}
+
+/* Thread t appends the points of its blocks this round samples, after those of the threads before it */
+static void sample_fill_job(void *arg, int t, int n_threads) {
+    struct seed_job *job = arg;
+    struct kmeans_seed_workspace *ws = job->ws;
+    size_t N = job->data->rows;
+    size_t blocks = (N + SEED_BLOCK - 1) / SEED_BLOCK;
+    size_t first = blocks * (size_t)t / (size_t)n_threads * SEED_BLOCK;
+    size_t last = blocks * (size_t)(t + 1) / (size_t)n_threads * SEED_BLOCK;
+    size_t pos = job->n_candidates;
+    size_t i;
+    int u;
+
+    if (last > N) {
+        last = N;
+    }
+    for (u = 0; u < t; u++) {
+        pos += ws->thread_counts[u];
+    }
+    for (i = first; i < last && pos < ws->capacity; i++) {
+        if (point_uniform(job->key, i) * job->phi < job->oversampling * ws->dist[i]) {
+            ws->pool[pos++] = i;
+        }
+    }
+}
+
+/* Thread t counts, for every candidate, the points of its slice closest to it */
+static void weight_job(void *arg, int t, int n_threads) {
+    struct seed_job *job = arg;
+    struct kmeans_seed_workspace *ws = job->ws;
+    size_t N = job->data->rows;
+    size_t last = N * (size_t)(t + 1) / (size_t)n_threads;
+    double *weights = ws->weights + (size_t)t * ws->capacity;
+    size_t i;
+
+    for (i = 0; i < job->n_candidates; i++) {
+        weights[i] = 0.0;
+    }
+    for (i = N * (size_t)t / (size_t)n_threads; i < last; i++) {
+        weights[ws->owner[i]] += 1.0;
+    }
+}
+
+/*
+ * Weighted k-means++ over the candidates pool[0..n_candidates-1], whose
+ * weights are in ws->weights: chosen receives K of them (as data rows).
+ */
+static void reduce_candidates(const struct matrix *data, int K, struct kmeans_seed_workspace *ws,
+                              size_t n_candidates, struct mt19937 *mt, size_t *chosen) {
+    int dim = data->dim;
+    double total, target, running, d;
+    size_t c, pick = 0;
+    int k, j, taken;
+
+    for (k = 0; k < K; k++) {
+        total = 0.0;
+        for (c = 0; c < n_candidates; c++) {
+            total += ws->weights[c] * (k == 0 ? 1.0 : ws->pool_dist[c]);
+        }
+
+        if (total > 0.0) {
+            target = mt_double(mt) * total;
+            running = 0.0;
+            for (c = 0; c < n_candidates; c++) {
+                d = ws->weights[c] * (k == 0 ? 1.0 : ws->pool_dist[c]);
+                if (d > 0.0) {
+                    /* Rounding may leave target just past the last running sum: keep the last one possible */
+                    pick = c;
+                    running += d;
+                    if (running > target) {
+                        break;
+                    }
+                }
+            }
+        }
+        else {
+            /* The seeds so far cover every candidate: take any one not taken yet */
+            pick = mt_below(mt, n_candidates);
+            do {
+                taken = 0;
+                for (j = 0; j < k; j++) {
+                    if (chosen[j] == ws->pool[pick]) {
+                        taken = 1;
+                        pick = (pick + 1) % n_candidates;
+                        break;
+                    }
+                }
+            } while (taken);
+        }
+        chosen[k] = ws->pool[pick];
+
+        for (c = 0; c < n_candidates; c++) {
+            d = squared_distance(MATRIX_ROW(data, ws->pool[c]), MATRIX_ROW(data, chosen[k]), dim);
+            if (k == 0 || d < ws->pool_dist[c]) {
+                ws->pool_dist[c] = d;
+            }
+        }
+    }
+}
+
+/*
+ * Picks K initial centroids (K <= N) among the points of data with k-means||,
+ * with scratch from kmeans_parallel_seed_carve. chosen receives the K row
+ * indices of the seeds, distinct points of data.
+ * Returns the number of sampling rounds performed.
+ */
+int kmeans_parallel_seed(const struct matrix *data, int K, struct kmeans_seed_workspace *ws,
+                         const struct kmeans_seed_options *opts, size_t *chosen) {
+    struct mt19937 mt;
+    struct thread_pool *pool = NULL;
+    struct seed_job job;
+    size_t N = data->rows;
+    size_t n_candidates, added, c, i;
+    double phi;
+    int round, t, n_threads;
+    double started = kmeans_trace_on ? kmeans_telemetry_clock() : 0.0;
+
+    mt_seed(&mt, (uint32_t)opts->seed);
+    if (opts->n_threads > 1) {
+        pool = pool_create(opts->n_threads);
+    }
+    n_threads = pool_size(pool);
+    job.data = data;
+    job.ws = ws;
+    job.oversampling = opts->oversampling > 0.0 ? opts->oversampling : 2.0 * K;
+
+    ws->pool[0] = mt_below(&mt, N);
+    n_candidates = 1;
+    phi = parallel_update(pool, &job, 0, 1);
+
+    /* Oversampling rounds: one pass to count (and place) the samples, one to take them in */
+    for (round = 0; round < opts->rounds && phi > 0.0 && n_candidates < ws->capacity; round++) {
+        job.phi = phi;
+        job.key = ((unsigned long long)mt_next(&mt) << 32) | mt_next(&mt);
+        job.n_candidates = n_candidates;
+        pool_run(pool, sample_count_job, &job);
+        pool_run(pool, sample_fill_job, &job);
+        added = 0;
+        for (t = 0; t < n_threads; t++) {
+            added += ws->thread_counts[t];
+        }
+        if (added > ws->capacity - n_candidates) {
+            added = ws->capacity - n_candidates;
+        }
+        if (added > 0) {
+            phi = parallel_update(pool, &job, n_candidates, added);
+            n_candidates += added;
+        }
+    }
+
+    /* Too few candidates for K seeds: top up with plain k-means++ draws */
+    while (n_candidates < (size_t)K) {
+        if (phi > 0.0) {
+            ws->pool[n_candidates] = draw_blocks(ws, N, phi, mt_double(&mt));
+        }
+        else {
+            /* Every point coincides with a candidate: take the next point that is not one */
+            i = mt_below(&mt, N);
+            for (c = 0; c < n_candidates; c++) {
+                if (ws->pool[c] == i) {
+                    i = (i + 1) % N;
+                    c = (size_t)-1;
+                }
+            }
+            ws->pool[n_candidates] = i;
+        }
+        phi = parallel_update(pool, &job, n_candidates, 1);
+        n_candidates++;
+    }
+
+    /* Weight every candidate by the points closest to it, then pick K of them */
+    job.n_candidates = n_candidates;
+    pool_run(pool, weight_job, &job);
+    for (t = 1; t < n_threads; t++) {
+        for (c = 0; c < n_candidates; c++) {
+            ws->weights[c] += ws->weights[(size_t)t * ws->capacity + c];
+        }
+    }
+    reduce_candidates(data, K, ws, n_candidates, &mt, chosen);
+
+    pool_destroy(pool);
+    if (kmeans_trace_on) {
+        kmeans_trace_span("k-means|| seeding", started, -1);
+    }
+    return round;
+}
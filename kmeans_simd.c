@@ -0,0 +1,583 @@
+#include "kmeans.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Vectorized Assignment Step kernels, chosen at runtime by kmeans_simd_select.
+ *
+ * Every kernel scans the centroids in structure-of-arrays layout (dim x K,
+ * see matrix_to_soa) and computes W squared distances at once, one centroid
+ * per SIMD lane. Each lane sums its coordinates in the same order as the
+ * scalar loop, so the distances - and therefore the chosen centroid - are
+ * bit-identical to closest_centroid_scalar (setup.py builds with
+ * -ffp-contract=off so no path fuses the multiply and the add).
+ *
+ * The argmin is kept per lane (value + index) and reduced at the end; on
+ * equal distances the smallest index wins, just like the scalar strict '<'.
+ * Centroids left over after the last full vector go through the scalar loop.
+ *
+ * Every call also pays for storing the lanes and reducing them, which only
+ * pays off once there is enough to scan: below KMEANS_SIMD_MIN_WORK
+ * coordinates (K x dim) the scalar loop is faster, and a wide kernel whose
+ * full vectors cover little of K hands over to the next narrower one. The
+ * thresholds come from bench_kernels (closest_simd) on an AVX-512 machine;
+ * they only pick a kernel, and every kernel gives the same result.
+ *
+ * The float kernels (kmeans_closest_centroid_f32, for float32 runs) do the
+ * same over float centroids and points, twice as many lanes per vector, and
+ * are bit-identical to their own scalar loop in the same way. Their lane
+ * indices are floats too, exact for any K below 2^24.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KMEANS_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define KMEANS_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*declaration of functions*/
+static int closest_centroid_scalar(const double *soa, int K, int dim, const double *x, double *min_dist);
+static int scan_tail(const double *soa, int K, int dim, const double *x, int first,
+                     int best, double *best_dist);
+static int closest_centroid_f32_scalar(const float *soa, int K, int dim, const float *x, float *min_dist);
+static int scan_tail_f32(const float *soa, int K, int dim, const float *x, int first,
+                         int best, float *best_dist);
+static int reduce_lanes_f32(const float *dist, const float *idx, int width, float *best_dist);
+
+
+/* The active kernel: the scalar one until kmeans_simd_select picks another */
+closest_centroid_fn kmeans_closest_centroid = closest_centroid_scalar;
+closest_centroid_f32_fn kmeans_closest_centroid_f32 = closest_centroid_f32_scalar;
+static const char *active_name = "scalar";
+
+/* Fewest K x dim coordinates per point worth a vector kernel (K=8, dim=4: scalar 20 ns, avx2 26 ns) */
+#define KMEANS_SIMD_MIN_WORK 64
+
+/* Fewest centroids for the AVX-512 kernels (double K=16, dim=8: avx2 52 ns, avx512 63 ns; float K=24: 62 vs 119 ns) */
+#define KMEANS_AVX512_MIN_K 24
+#define KMEANS_AVX512_F32_MIN_K 32
+
+/* Fewest centroids for the float AVX2 kernel; below it 8 lanes leave a long scalar tail (K=12, dim=8: sse2 46 ns, avx2 69 ns) */
+#define KMEANS_AVX2_F32_MIN_K 16
+
+
+/*
+ * Squared distance from x to the centroids first..K-1, merged into the
+ * running best (index, distance). Scalar; also used for vector tails.
+ */
+static int scan_tail(const double *soa, int K, int dim, const double *x, int first,
+                     int best, double *best_dist) {
+    double diff, sum;
+    int k, d;
+
+    for (k = first; k < K; k++) {
+        sum = 0.0;
+        for (d = 0; d < dim; d++) {
+            diff = soa[(size_t)d * K + k] - x[d];
+            sum += diff * diff;
+        }
+        if (sum < *best_dist) {
+            *best_dist = sum;
+            best = k;
+        }
+    }
+    return best;
+}
+
+/* Reference kernel: one centroid at a time */
+static int closest_centroid_scalar(const double *soa, int K, int dim, const double *x, double *min_dist) {
+    double best_dist = HUGE_VAL;
+    int best;
+
+    best = scan_tail(soa, K, dim, x, 0, 0, &best_dist);
+    if (min_dist != NULL) {
+        *min_dist = best_dist;
+    }
+    return best;
+}
+
+/*
+ * Reduces W lanes of (distance, index) to the lane with the smallest distance,
+ * breaking ties on the smallest index.
+ */
+static int reduce_lanes(const double *dist, const double *idx, int width, double *best_dist) {
+    int lane, best = 0;
+    for (lane = 1; lane < width; lane++) {
+        if (dist[lane] < dist[best] || (dist[lane] == dist[best] && idx[lane] < idx[best])) {
+            best = lane;
+        }
+    }
+    *best_dist = dist[best];
+    return (int)idx[best];
+}
+
+/* scan_tail for float centroids */
+static int scan_tail_f32(const float *soa, int K, int dim, const float *x, int first,
+                         int best, float *best_dist) {
+    float diff, sum;
+    int k, d;
+
+    for (k = first; k < K; k++) {
+        sum = 0.0f;
+        for (d = 0; d < dim; d++) {
+            diff = soa[(size_t)d * K + k] - x[d];
+            sum += diff * diff;
+        }
+        if (sum < *best_dist) {
+            *best_dist = sum;
+            best = k;
+        }
+    }
+    return best;
+}
+
+/* Reference float kernel: one centroid at a time */
+static int closest_centroid_f32_scalar(const float *soa, int K, int dim, const float *x, float *min_dist) {
+    float best_dist = HUGE_VALF;
+    int best;
+
+    best = scan_tail_f32(soa, K, dim, x, 0, 0, &best_dist);
+    if (min_dist != NULL) {
+        *min_dist = best_dist;
+    }
+    return best;
+}
+
+/* reduce_lanes for float lanes */
+static int reduce_lanes_f32(const float *dist, const float *idx, int width, float *best_dist) {
+    int lane, best = 0;
+    for (lane = 1; lane < width; lane++) {
+        if (dist[lane] < dist[best] || (dist[lane] == dist[best] && idx[lane] < idx[best])) {
+            best = lane;
+        }
+    }
+    *best_dist = dist[best];
+    return (int)idx[best];
+}
+
+
+#ifdef KMEANS_X86
+
+/* SSE2: two centroids per step (baseline on every x86-64 CPU) */
+__attribute__((target("sse2")))
+static int closest_centroid_sse2(const double *soa, int K, int dim, const double *x, double *min_dist) {
+    double lane_dist[2], lane_idx[2];
+    double best_dist;
+    __m128d vmin, vidx, vk, acc, diff, mask;
+    const __m128d step = _mm_set1_pd(2.0);
+    int k, d, best;
+
+    if (K < 2 || (long)K * dim < KMEANS_SIMD_MIN_WORK) {
+        return closest_centroid_scalar(soa, K, dim, x, min_dist);
+    }
+
+    vmin = _mm_set1_pd(HUGE_VAL);
+    vidx = _mm_setzero_pd();
+    vk = _mm_set_pd(1.0, 0.0);
+    for (k = 0; k + 2 <= K; k += 2) {
+        acc = _mm_setzero_pd();
+        for (d = 0; d < dim; d++) {
+            diff = _mm_sub_pd(_mm_loadu_pd(soa + (size_t)d * K + k), _mm_set1_pd(x[d]));
+            acc = _mm_add_pd(acc, _mm_mul_pd(diff, diff));
+        }
+        mask = _mm_cmplt_pd(acc, vmin);
+        vmin = _mm_or_pd(_mm_and_pd(mask, acc), _mm_andnot_pd(mask, vmin));
+        vidx = _mm_or_pd(_mm_and_pd(mask, vk), _mm_andnot_pd(mask, vidx));
+        vk = _mm_add_pd(vk, step);
+    }
+    _mm_storeu_pd(lane_dist, vmin);
+    _mm_storeu_pd(lane_idx, vidx);
+
+    best = reduce_lanes(lane_dist, lane_idx, 2, &best_dist);
+    best = scan_tail(soa, K, dim, x, k, best, &best_dist);
+    if (min_dist != NULL) {
+        *min_dist = best_dist;
+    }
+    return best;
+}
+
+/* AVX2: four centroids per step */
+__attribute__((target("avx2")))
+static int closest_centroid_avx2(const double *soa, int K, int dim, const double *x, double *min_dist) {
+    double lane_dist[4], lane_idx[4];
+    double best_dist;
+    __m256d vmin, vidx, vk, acc, diff, mask;
+    const __m256d step = _mm256_set1_pd(4.0);
+    int k, d, best;
+
+    if (K < 4 || (long)K * dim < KMEANS_SIMD_MIN_WORK) {
+        return closest_centroid_scalar(soa, K, dim, x, min_dist);
+    }
+
+    vmin = _mm256_set1_pd(HUGE_VAL);
+    vidx = _mm256_setzero_pd();
+    vk = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+    for (k = 0; k + 4 <= K; k += 4) {
+        acc = _mm256_setzero_pd();
+        for (d = 0; d < dim; d++) {
+            diff = _mm256_sub_pd(_mm256_loadu_pd(soa + (size_t)d * K + k), _mm256_set1_pd(x[d]));
+            acc = _mm256_add_pd(acc, _mm256_mul_pd(diff, diff));
+        }
+        mask = _mm256_cmp_pd(acc, vmin, _CMP_LT_OQ);
+        vmin = _mm256_blendv_pd(vmin, acc, mask);
+        vidx = _mm256_blendv_pd(vidx, vk, mask);
+        vk = _mm256_add_pd(vk, step);
+    }
+    _mm256_storeu_pd(lane_dist, vmin);
+    _mm256_storeu_pd(lane_idx, vidx);
+
+    best = reduce_lanes(lane_dist, lane_idx, 4, &best_dist);
+    best = scan_tail(soa, K, dim, x, k, best, &best_dist);
+    if (min_dist != NULL) {
+        *min_dist = best_dist;
+    }
+    return best;
+}
+
+/* AVX-512: eight centroids per step */
+__attribute__((target("avx512f")))
+static int closest_centroid_avx512(const double *soa, int K, int dim, const double *x, double *min_dist) {
+    double lane_dist[8], lane_idx[8];
+    double best_dist;
+    __m512d vmin, vidx, vk, acc, diff;
+    __mmask8 mask;
+    const __m512d step = _mm512_set1_pd(8.0);
+    int k, d, best;
+
+    if ((long)K * dim < KMEANS_SIMD_MIN_WORK) {
+        return closest_centroid_scalar(soa, K, dim, x, min_dist);
+    }
+    if (K < KMEANS_AVX512_MIN_K) {
+        return closest_centroid_avx2(soa, K, dim, x, min_dist);
+    }
+
+    vmin = _mm512_set1_pd(HUGE_VAL);
+    vidx = _mm512_setzero_pd();
+    vk = _mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0);
+    for (k = 0; k + 8 <= K; k += 8) {
+        acc = _mm512_setzero_pd();
+        for (d = 0; d < dim; d++) {
+            diff = _mm512_sub_pd(_mm512_loadu_pd(soa + (size_t)d * K + k), _mm512_set1_pd(x[d]));
+            acc = _mm512_add_pd(acc, _mm512_mul_pd(diff, diff));
+        }
+        mask = _mm512_cmp_pd_mask(acc, vmin, _CMP_LT_OQ);
+        vmin = _mm512_mask_blend_pd(mask, vmin, acc);
+        vidx = _mm512_mask_blend_pd(mask, vidx, vk);
+        vk = _mm512_add_pd(vk, step);
+    }
+    _mm512_storeu_pd(lane_dist, vmin);
+    _mm512_storeu_pd(lane_idx, vidx);
+
+    best = reduce_lanes(lane_dist, lane_idx, 8, &best_dist);
+    best = scan_tail(soa, K, dim, x, k, best, &best_dist);
+    if (min_dist != NULL) {
+        *min_dist = best_dist;
+    }
+    return best;
+}
+
+/* SSE2, float: four centroids per step */
+__attribute__((target("sse2")))
+static int closest_centroid_f32_sse2(const float *soa, int K, int dim, const float *x, float *min_dist) {
+    float lane_dist[4], lane_idx[4];
+    float best_dist;
+    __m128 vmin, vidx, vk, acc, diff, mask;
+    const __m128 step = _mm_set1_ps(4.0f);
+    int k, d, best;
+
+    if (K < 4 || K >= (1 << 24) || (long)K * dim < KMEANS_SIMD_MIN_WORK) {
+        return closest_centroid_f32_scalar(soa, K, dim, x, min_dist);
+    }
+
+    vmin = _mm_set1_ps(HUGE_VALF);
+    vidx = _mm_setzero_ps();
+    vk = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    for (k = 0; k + 4 <= K; k += 4) {
+        acc = _mm_setzero_ps();
+        for (d = 0; d < dim; d++) {
+            diff = _mm_sub_ps(_mm_loadu_ps(soa + (size_t)d * K + k), _mm_set1_ps(x[d]));
+            acc = _mm_add_ps(acc, _mm_mul_ps(diff, diff));
+        }
+        mask = _mm_cmplt_ps(acc, vmin);
+        vmin = _mm_or_ps(_mm_and_ps(mask, acc), _mm_andnot_ps(mask, vmin));
+        vidx = _mm_or_ps(_mm_and_ps(mask, vk), _mm_andnot_ps(mask, vidx));
+        vk = _mm_add_ps(vk, step);
+    }
+    _mm_storeu_ps(lane_dist, vmin);
+    _mm_storeu_ps(lane_idx, vidx);
+
+    best = reduce_lanes_f32(lane_dist, lane_idx, 4, &best_dist);
+    best = scan_tail_f32(soa, K, dim, x, k, best, &best_dist);
+    if (min_dist != NULL) {
+        *min_dist = best_dist;
+    }
+    return best;
+}
+
+/* AVX2, float: eight centroids per step */
+__attribute__((target("avx2")))
+static int closest_centroid_f32_avx2(const float *soa, int K, int dim, const float *x, float *min_dist) {
+    float lane_dist[8], lane_idx[8];
+    float best_dist;
+    __m256 vmin, vidx, vk, acc, diff, mask;
+    const __m256 step = _mm256_set1_ps(8.0f);
+    int k, d, best;
+
+    if (K < KMEANS_AVX2_F32_MIN_K || K >= (1 << 24)) {
+        return closest_centroid_f32_sse2(soa, K, dim, x, min_dist);
+    }
+
+    vmin = _mm256_set1_ps(HUGE_VALF);
+    vidx = _mm256_setzero_ps();
+    vk = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    for (k = 0; k + 8 <= K; k += 8) {
+        acc = _mm256_setzero_ps();
+        for (d = 0; d < dim; d++) {
+            diff = _mm256_sub_ps(_mm256_loadu_ps(soa + (size_t)d * K + k), _mm256_set1_ps(x[d]));
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(diff, diff));
+        }
+        mask = _mm256_cmp_ps(acc, vmin, _CMP_LT_OQ);
+        vmin = _mm256_blendv_ps(vmin, acc, mask);
+        vidx = _mm256_blendv_ps(vidx, vk, mask);
+        vk = _mm256_add_ps(vk, step);
+    }
+    _mm256_storeu_ps(lane_dist, vmin);
+    _mm256_storeu_ps(lane_idx, vidx);
+
+    best = reduce_lanes_f32(lane_dist, lane_idx, 8, &best_dist);
+    best = scan_tail_f32(soa, K, dim, x, k, best, &best_dist);
+    if (min_dist != NULL) {
+        *min_dist = best_dist;
+    }
+    return best;
+}
+
+/* AVX-512, float: sixteen centroids per step */
+__attribute__((target("avx512f")))
+static int closest_centroid_f32_avx512(const float *soa, int K, int dim, const float *x, float *min_dist) {
+    float lane_dist[16], lane_idx[16];
+    float best_dist;
+    __m512 vmin, vidx, vk, acc, diff;
+    __mmask16 mask;
+    const __m512 step = _mm512_set1_ps(16.0f);
+    int k, d, best;
+
+    if ((long)K * dim < KMEANS_SIMD_MIN_WORK) {
+        return closest_centroid_f32_scalar(soa, K, dim, x, min_dist);
+    }
+    if (K < KMEANS_AVX512_F32_MIN_K || K >= (1 << 24)) {
+        return closest_centroid_f32_avx2(soa, K, dim, x, min_dist);
+    }
+
+    vmin = _mm512_set1_ps(HUGE_VALF);
+    vidx = _mm512_setzero_ps();
+    vk = _mm512_set_ps(15.0f, 14.0f, 13.0f, 12.0f, 11.0f, 10.0f, 9.0f, 8.0f,
+                       7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    for (k = 0; k + 16 <= K; k += 16) {
+        acc = _mm512_setzero_ps();
+        for (d = 0; d < dim; d++) {
+            diff = _mm512_sub_ps(_mm512_loadu_ps(soa + (size_t)d * K + k), _mm512_set1_ps(x[d]));
+            acc = _mm512_add_ps(acc, _mm512_mul_ps(diff, diff));
+        }
+        mask = _mm512_cmp_ps_mask(acc, vmin, _CMP_LT_OQ);
+        vmin = _mm512_mask_blend_ps(mask, vmin, acc);
+        vidx = _mm512_mask_blend_ps(mask, vidx, vk);
+        vk = _mm512_add_ps(vk, step);
+    }
+    _mm512_storeu_ps(lane_dist, vmin);
+    _mm512_storeu_ps(lane_idx, vidx);
+
+    best = reduce_lanes_f32(lane_dist, lane_idx, 16, &best_dist);
+    best = scan_tail_f32(soa, K, dim, x, k, best, &best_dist);
+    if (min_dist != NULL) {
+        *min_dist = best_dist;
+    }
+    return best;
+}
+
+#endif /* KMEANS_X86 */
+
+
+#ifdef KMEANS_NEON
+
+/* NEON: two centroids per step (ASIMD is mandatory on aarch64) */
+static int closest_centroid_neon(const double *soa, int K, int dim, const double *x, double *min_dist) {
+    static const double first_lanes[2] = {0.0, 1.0};
+    double lane_dist[2], lane_idx[2];
+    double best_dist;
+    float64x2_t vmin, vidx, vk, acc, diff;
+    uint64x2_t mask;
+    const float64x2_t step = vdupq_n_f64(2.0);
+    int k, d, best;
+
+    if (K < 2) {
+        return closest_centroid_scalar(soa, K, dim, x, min_dist);
+    }
+
+    vmin = vdupq_n_f64(HUGE_VAL);
+    vidx = vdupq_n_f64(0.0);
+    vk = vld1q_f64(first_lanes);
+    for (k = 0; k + 2 <= K; k += 2) {
+        acc = vdupq_n_f64(0.0);
+        for (d = 0; d < dim; d++) {
+            diff = vsubq_f64(vld1q_f64(soa + (size_t)d * K + k), vdupq_n_f64(x[d]));
+            acc = vaddq_f64(acc, vmulq_f64(diff, diff));
+        }
+        mask = vcltq_f64(acc, vmin);
+        vmin = vbslq_f64(mask, acc, vmin);
+        vidx = vbslq_f64(mask, vk, vidx);
+        vk = vaddq_f64(vk, step);
+    }
+    vst1q_f64(lane_dist, vmin);
+    vst1q_f64(lane_idx, vidx);
+
+    best = reduce_lanes(lane_dist, lane_idx, 2, &best_dist);
+    best = scan_tail(soa, K, dim, x, k, best, &best_dist);
+    if (min_dist != NULL) {
+        *min_dist = best_dist;
+    }
+    return best;
+}
+
+/* NEON, float: four centroids per step */
+static int closest_centroid_f32_neon(const float *soa, int K, int dim, const float *x, float *min_dist) {
+    static const float first_lanes[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    float lane_dist[4], lane_idx[4];
+    float best_dist;
+    float32x4_t vmin, vidx, vk, acc, diff;
+    uint32x4_t mask;
+    const float32x4_t step = vdupq_n_f32(4.0f);
+    int k, d, best;
+
+    if (K < 4 || K >= (1 << 24)) {
+        return closest_centroid_f32_scalar(soa, K, dim, x, min_dist);
+    }
+
+    vmin = vdupq_n_f32(HUGE_VALF);
+    vidx = vdupq_n_f32(0.0f);
+    vk = vld1q_f32(first_lanes);
+    for (k = 0; k + 4 <= K; k += 4) {
+        acc = vdupq_n_f32(0.0f);
+        for (d = 0; d < dim; d++) {
+            diff = vsubq_f32(vld1q_f32(soa + (size_t)d * K + k), vdupq_n_f32(x[d]));
+            acc = vaddq_f32(acc, vmulq_f32(diff, diff));
+        }
+        mask = vcltq_f32(acc, vmin);
+        vmin = vbslq_f32(mask, acc, vmin);
+        vidx = vbslq_f32(mask, vk, vidx);
+        vk = vaddq_f32(vk, step);
+    }
+    vst1q_f32(lane_dist, vmin);
+    vst1q_f32(lane_idx, vidx);
+
+    best = reduce_lanes_f32(lane_dist, lane_idx, 4, &best_dist);
+    best = scan_tail_f32(soa, K, dim, x, k, best, &best_dist);
+    if (min_dist != NULL) {
+        *min_dist = best_dist;
+    }
+    return best;
+}
+
+#endif /* KMEANS_NEON */
+
+
+/*
+ * Picks the Assignment Step kernel (and its float counterpart).
+ * name is "auto" (best one the CPU supports), "scalar", "sse2", "avx2",
+ * "avx512" or "neon". Returns 0 on success, -1 if the requested kernel is
+ * unknown or unsupported here (the active kernel is then left unchanged).
+ */
+int kmeans_simd_select(const char *name) {
+    int is_auto = name == NULL || strcmp(name, "auto") == 0;
+
+#ifdef KMEANS_X86
+    __builtin_cpu_init();
+    if ((is_auto || strcmp(name, "avx512") == 0) && __builtin_cpu_supports("avx512f")) {
+        kmeans_closest_centroid = closest_centroid_avx512;
+        kmeans_closest_centroid_f32 = closest_centroid_f32_avx512;
+        active_name = "avx512";
+        return 0;
+    }
+    if ((is_auto || strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        kmeans_closest_centroid = closest_centroid_avx2;
+        kmeans_closest_centroid_f32 = closest_centroid_f32_avx2;
+        active_name = "avx2";
+        return 0;
+    }
+    if ((is_auto || strcmp(name, "sse2") == 0) && __builtin_cpu_supports("sse2")) {
+        kmeans_closest_centroid = closest_centroid_sse2;
+        kmeans_closest_centroid_f32 = closest_centroid_f32_sse2;
+        active_name = "sse2";
+        return 0;
+    }
+#endif
+
+#ifdef KMEANS_NEON
+    if (is_auto || strcmp(name, "neon") == 0) {
+        kmeans_closest_centroid = closest_centroid_neon;
+        kmeans_closest_centroid_f32 = closest_centroid_f32_neon;
+        active_name = "neon";
+        return 0;
+    }
+#endif
+
+    if (is_auto || strcmp(name, "scalar") == 0) {
+        kmeans_closest_centroid = closest_centroid_scalar;
+        kmeans_closest_centroid_f32 = closest_centroid_f32_scalar;
+        active_name = "scalar";
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * The kernel to scan K centroids of dim coordinates with: the active one, or
+ * the narrower one (down to the scalar loop) that the active one would hand
+ * over to for this K and dim. Loops over many points against the same
+ * centroids fetch it once, so a small K does not pay for the hand-over on
+ * every point.
+ */
+closest_centroid_fn kmeans_simd_kernel(int K, int dim) {
+#ifdef KMEANS_X86
+    if (kmeans_closest_centroid == closest_centroid_avx512 && K < KMEANS_AVX512_MIN_K) {
+        return (long)K * dim < KMEANS_SIMD_MIN_WORK ? closest_centroid_scalar : closest_centroid_avx2;
+    }
+    if ((kmeans_closest_centroid == closest_centroid_avx2 || kmeans_closest_centroid == closest_centroid_sse2)
+        && (long)K * dim < KMEANS_SIMD_MIN_WORK) {
+        return closest_centroid_scalar;
+    }
+#endif
+    (void)K;
+    (void)dim;
+    return kmeans_closest_centroid;
+}
+
+/* kmeans_simd_kernel for the float kernels */
+closest_centroid_f32_fn kmeans_simd_kernel_f32(int K, int dim) {
+    closest_centroid_f32_fn kernel = kmeans_closest_centroid_f32;
+
+#ifdef KMEANS_X86
+    if (kernel != closest_centroid_f32_scalar && (long)K * dim < KMEANS_SIMD_MIN_WORK) {
+        return closest_centroid_f32_scalar;
+    }
+    if (kernel == closest_centroid_f32_avx512 && K < KMEANS_AVX512_F32_MIN_K) {
+        kernel = closest_centroid_f32_avx2;
+    }
+    if (kernel == closest_centroid_f32_avx2 && K < KMEANS_AVX2_F32_MIN_K) {
+        kernel = closest_centroid_f32_sse2;
+    }
+#endif
+    (void)K;
+    (void)dim;
+    return kernel;
+}
+
+/* Name of the active Assignment Step kernel */
+const char *kmeans_simd_name(void) {
+    return active_name;
+}
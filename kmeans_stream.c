@@ -0,0 +1,321 @@
+#include "kmeans.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Lloyd iterations over a data set that stays on disk: a flat binary file
+ * of row-major float64 (or float32) points, optionally after a header of
+ * `offset` bytes. Every iteration is one sequential scan of the file in
+ * chunks of chunk_rows points, each assigned and added to the sums like a
+ * small in-memory data block, so only the K x dim state and one chunk of
+ * scratch have to stay resident.
+ *
+ * The file is mapped read-only with a sequential access hint, and the pages
+ * of every chunk are dropped from the mapping once it has been scanned
+ * (they stay in the page cache if there is room). float64 rows are used
+ * right in the mapping; float32 ones are widened into the scratch. Where
+ * mmap is not available the file is read with stdio instead.
+ */
+
+#if defined(_WIN32)
+#include <sys/stat.h>
+#define source_seek(f, pos) _fseeki64((FILE *)(f), (__int64)(pos), SEEK_SET)
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define KMEANS_HAVE_MMAP 1
+#define source_seek(f, pos) fseeko((FILE *)(f), (off_t)(pos), SEEK_SET)
+#endif
+
+/*declaration of functions*/
+static size_t source_row_bytes(const struct kmeans_source *src);
+static int source_open_file(struct kmeans_source *src, const char *path);
+
+
+/* Bytes per row of the file */
+static size_t source_row_bytes(const struct kmeans_source *src) {
+    return (size_t)src->dim * (src->is_float32 ? sizeof(float) : sizeof(double));
+}
+
+/* Falls back to reading through stdio. Returns 0 on success, -1 with errno set */
+static int source_open_file(struct kmeans_source *src, const char *path) {
+    src->file = fopen(path, "rb");
+    return src->file == NULL ? -1 : 0;
+}
+
+/*
+ * Opens a binary file of dim-dimensional points starting at byte offset.
+ * Returns 0 on success, -1 if the file could not be opened or mapped (errno
+ * tells why), -2 if what follows offset is not a whole, non-zero number of
+ * rows.
+ */
+int kmeans_source_open(struct kmeans_source *src, const char *path, int dim, int is_float32, size_t offset) {
+    unsigned long long size;
+#if defined(KMEANS_HAVE_MMAP)
+    struct stat info;
+    void *map;
+    int fd;
+#else
+    struct _stat64 info;
+#endif
+
+    src->dim = dim;
+    src->is_float32 = is_float32;
+    src->offset = offset;
+    src->map = NULL;
+    src->map_bytes = 0;
+    src->file = NULL;
+
+#if defined(KMEANS_HAVE_MMAP)
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return -1;
+    }
+    size = (unsigned long long)info.st_size;
+#else
+    if (_stat64(path, &info) != 0) {
+        return -1;
+    }
+    size = (unsigned long long)info.st_size;
+#endif
+
+    if (size <= offset || (size - offset) % source_row_bytes(src) != 0) {
+#if defined(KMEANS_HAVE_MMAP)
+        close(fd);
+#endif
+        return -2;
+    }
+    src->rows = (size_t)((size - offset) / source_row_bytes(src));
+
+#if defined(KMEANS_HAVE_MMAP)
+    map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* The mapping keeps the file open */
+    if (map != MAP_FAILED) {
+        src->map = map;
+        src->map_bytes = (size_t)size;
+        /* Every iteration walks the file front to back once: read ahead, drop behind */
+        madvise(map, (size_t)size, MADV_SEQUENTIAL);
+        return 0;
+    }
+#endif
+    return source_open_file(src, path);
+}
+
+/*
+ * Returns rows first..first+count-1 as doubles: right in the mapping for
+ * aligned float64 files, otherwise converted or read into scratch (which
+ * must hold count x dim doubles). Returns NULL with errno set if reading failed.
+ */
+const double *kmeans_source_rows(struct kmeans_source *src, size_t first, size_t count, double *scratch) {
+    size_t row_bytes = source_row_bytes(src);
+    size_t n = count * (size_t)src->dim;
+    size_t start = src->offset + first * row_bytes;
+    const unsigned char *bytes;
+    float value;
+    size_t i;
+
+    if (src->map != NULL) {
+        bytes = src->map + start;
+        if (!src->is_float32) {
+            if (src->offset % sizeof(double) == 0) {
+                return (const double *)bytes;
+            }
+            memcpy(scratch, bytes, n * sizeof(double));
+            return scratch;
+        }
+    }
+    else {
+        /* float32 rows are read into the back half of the scratch and widened front to back */
+        bytes = (const unsigned char *)scratch + (src->is_float32 ? n * sizeof(float) : 0);
+        errno = 0;
+        if (source_seek(src->file, start) != 0
+            || fread((void *)bytes, row_bytes, count, (FILE *)src->file) != count) {
+            if (errno == 0) {
+                errno = EIO;
+            }
+            return NULL;
+        }
+        if (!src->is_float32) {
+            return scratch;
+        }
+    }
+
+    /* Double i never overwrites a float that is still to be read */
+    for (i = 0; i < n; i++) {
+        memcpy(&value, bytes + i * sizeof(float), sizeof(float));
+        scratch[i] = (double)value;
+    }
+    return scratch;
+}
+
+/* Lets go of the pages of rows first..first+count-1, once they have been scanned */
+void kmeans_source_release(struct kmeans_source *src, size_t first, size_t count) {
+#if defined(KMEANS_HAVE_MMAP)
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = src->offset + first * source_row_bytes(src);
+    size_t end = start + count * source_row_bytes(src);
+
+    if (src->map == NULL) {
+        return;
+    }
+    /* Only whole pages: the partial ones at the edges belong to the next chunk too */
+    start = (start + page - 1) / page * page;
+    end = end / page * page;
+    if (end > start) {
+        madvise((void *)(src->map + start), end - start, MADV_DONTNEED);
+    }
+#else
+    (void)src;
+    (void)first;
+    (void)count;
+#endif
+}
+
+/* Unmaps or closes the file */
+void kmeans_source_close(struct kmeans_source *src) {
+#if defined(KMEANS_HAVE_MMAP)
+    if (src->map != NULL) {
+        munmap((void *)src->map, src->map_bytes);
+        src->map = NULL;
+    }
+#endif
+    if (src->file != NULL) {
+        fclose((FILE *)src->file);
+        src->file = NULL;
+    }
+}
+
+/* Bytes of arena space needed by kmeans_stream_carve */
+size_t kmeans_stream_bytes(size_t chunk_rows, int K, int dim, const struct kmeans_options *opts) {
+    return kmeans_workspace_bytes(chunk_rows, K, dim, opts)
+         + arena_block_size(chunk_rows * (size_t)dim * sizeof(double))
+         + arena_block_size((size_t)dim * sizeof(double));
+}
+
+/*
+ * Carves a workspace for streamed runs: the usual one sized for a single
+ * chunk (opts->algorithm must be KMEANS_LLOYD or KMEANS_BLOCKED, the others
+ * keep state for every point), plus the chunk scratch and the first point.
+ * Returns 0 on success, -1 if the arena has no room left.
+ */
+int kmeans_stream_carve(struct kmeans_workspace *ws, struct arena *a, size_t chunk_rows, int K, int dim,
+                        const struct kmeans_options *opts) {
+    if (kmeans_workspace_carve(ws, a, chunk_rows, K, dim, opts) != 0
+        || matrix_carve(&ws->batch, a, chunk_rows, dim) != 0) {
+        return -1;
+    }
+    ws->fallback = arena_alloc(a, (size_t)dim * sizeof(double));
+    return ws->fallback == NULL ? -1 : 0;
+}
+
+/*
+ * Lloyd iterations over an opened file, with a workspace from
+ * kmeans_stream_carve: the same centroids as kmeans_lloyd on the data in
+ * memory (bit for bit with a single thread, since the points are still
+ * added in file order). labels, if not NULL, holds a label for every row.
+ * Returns the number of iterations performed, or -1 with errno set if the
+ * file could not be read.
+ */
+int kmeans_lloyd_stream(struct kmeans_source *src, struct matrix *centroids, struct kmeans_workspace *ws,
+                        const struct kmeans_options *opts, int *labels, struct kmeans_stats *stats) {
+    int K = (int)centroids->rows;
+    int dim = centroids->dim;
+    size_t chunk_rows = ws->batch.rows;
+    int iteration = 0;
+    int converged = 0;
+    int failed = 0;
+    int error = 0;
+    size_t first, i;
+    struct matrix chunk;
+    struct thread_pool *pool = NULL;
+    struct kmeans_options run_opts = *opts;
+    closest_centroid_fn closest;
+
+    chunk.dim = dim;
+    chunk.data = (double *)kmeans_source_rows(src, 0, 1, ws->batch.data);
+    if (chunk.data == NULL) {
+        return -1;
+    }
+    memcpy(ws->fallback, chunk.data, (size_t)dim * sizeof(double));
+    ws->distance_evals = 0;
+
+    if (opts->n_threads > 1) {
+        pool = pool_create(opts->n_threads);
+        run_opts.n_threads = pool_size(pool);
+    }
+
+    /* MAIN K-MEANS LOOP: one pass over the file per iteration */
+    while (iteration < opts->iter && !converged && !failed) {
+        matrix_to_soa(centroids, ws->centroids_soa);
+        if (opts->algorithm == KMEANS_BLOCKED) {
+            kmeans_blocked_refresh(centroids, ws);
+        }
+
+        for (first = 0; first < src->rows; first += chunk.rows) {
+            chunk.rows = src->rows - first < chunk_rows ? src->rows - first : chunk_rows;
+            chunk.data = (double *)kmeans_source_rows(src, first, chunk.rows, ws->batch.data);
+            if (chunk.data == NULL) {
+                failed = 1;
+                error = errno;
+                break;
+            }
+            if (opts->algorithm == KMEANS_BLOCKED) {
+                kmeans_blocked_prepare(&chunk, ws);
+            }
+
+            /* Assignment Step for this chunk, on top of the earlier chunks */
+            kmeans_assign_step(&chunk, centroids, ws, &run_opts, pool, first > 0);
+            if (labels != NULL) {
+                memcpy(labels + first, ws->labels, chunk.rows * sizeof(int));
+            }
+            kmeans_source_release(src, first, chunk.rows);
+        }
+        if (failed) {
+            break;
+        }
+
+        converged = kmeans_update_step(centroids, ws, ws->fallback, opts->epsilon);
+        iteration++;
+    }
+
+    if (labels != NULL && iteration == 0 && !failed) {
+        /* No Assignment Step ran: label the points against the initial centroids */
+        matrix_to_soa(centroids, ws->centroids_soa);
+        closest = kmeans_simd_kernel(K, dim);
+        for (first = 0; first < src->rows; first += chunk.rows) {
+            chunk.rows = src->rows - first < chunk_rows ? src->rows - first : chunk_rows;
+            chunk.data = (double *)kmeans_source_rows(src, first, chunk.rows, ws->batch.data);
+            if (chunk.data == NULL) {
+                failed = 1;
+                error = errno;
+                break;
+            }
+            for (i = 0; i < chunk.rows; i++) {
+                labels[first + i] = closest(ws->centroids_soa, K, dim, MATRIX_ROW(&chunk, i), NULL);
+            }
+            kmeans_source_release(src, first, chunk.rows);
+        }
+    }
+
+    if (stats != NULL) {
+        stats->iterations = iteration;
+        stats->distance_evals = ws->distance_evals;
+        stats->distance_evals_avoided = (unsigned long long)src->rows * (unsigned long long)K
+                                        * (unsigned long long)iteration - ws->distance_evals;
+    }
+
+    pool_destroy(pool);
+    if (failed) {
+        errno = error;
+        return -1;
+    }
+    return iteration;
+}
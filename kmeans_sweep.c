@@ -0,0 +1,233 @@
+#include "kmeans.h"
+
+#include <string.h>
+
+/*
+ * One Lloyd run for every K of k_min..k_max over the same data, for elbow
+ * curves: the inertia each K reaches.
+ *
+ * k-means++ draws its seeds one after the other, each depending only on the
+ * ones before, so the first K seeds of a run for k_max are the seeds a run
+ * for K would draw. A single seeding pass for k_max therefore seeds every K
+ * (each is the k-1 seeding plus one more draw), with numpy sampling, so K
+ * gets the seeds kmeans_pp_init(data, K, seed) picks.
+ *
+ * The runs then go to the threads: each thread owns a slot with a workspace
+ * sized for k_max and takes the K values in turn, largest first, so the
+ * expensive ones are spread out. Every run is single-threaded, so its result
+ * does not depend on the thread count. They all read the same copy of the
+ * data and, for KMEANS_BLOCKED, the same ||x||^2, computed once.
+ *
+ * The inertia of a run is the sum of the squared distances of the points to
+ * the final centroid of their cluster, as in kmeans_restarts.c.
+ */
+
+/*declaration of structs*/
+struct sweep_job;
+
+/*declaration of functions*/
+static size_t sweep_slot_bytes(size_t N, int k_max, int dim, const struct kmeans_options *opts);
+static void sweep_job(void *arg, int t, int n_threads);
+
+
+/*implementations of structs*/
+
+/* Everything the threaded runs need */
+struct sweep_job
+{
+    const struct matrix *data;
+    struct kmeans_sweep *sw;
+    const struct kmeans_options *opts; /* n_threads = 1 */
+    int k_min;
+    int k_max;
+};
+
+
+/* Bytes of one slot: a Lloyd workspace for k_max without point norms of its own */
+static size_t sweep_slot_bytes(size_t N, int k_max, int dim, const struct kmeans_options *opts) {
+    struct kmeans_options run_opts = *opts;
+    size_t bytes;
+
+    run_opts.n_threads = 1;
+    if (opts->algorithm == KMEANS_BLOCKED) {
+        run_opts.algorithm = KMEANS_LLOYD;
+    }
+    bytes = kmeans_workspace_bytes(N, k_max, dim, &run_opts)
+          + arena_block_size((size_t)k_max * (size_t)dim * sizeof(double))
+          + arena_block_size(N * sizeof(int));
+    if (opts->algorithm == KMEANS_BLOCKED) {
+        bytes += arena_block_size((size_t)k_max * sizeof(double));
+    }
+    return bytes;
+}
+
+/* Bytes of arena space needed by kmeans_sweep_carve */
+size_t kmeans_sweep_bytes(size_t N, int k_min, int k_max, int dim, const struct kmeans_options *opts) {
+    struct kmeans_seed_options seed_opts;
+    int n_k = k_max - k_min + 1;
+    size_t n_slots = (size_t)(opts->n_threads < n_k ? opts->n_threads : n_k);
+    size_t bytes;
+
+    seed_opts.n_threads = opts->n_threads;
+    seed_opts.n_local_trials = 1;
+    bytes = arena_block_size(n_slots * sizeof(struct kmeans_sweep_slot))
+          + kmeans_seed_bytes(N, dim, &seed_opts)
+          + arena_block_size((size_t)k_max * sizeof(size_t))
+          + arena_block_size((size_t)n_k * sizeof(double))
+          + arena_block_size((size_t)n_k * sizeof(int))
+          + n_slots * sweep_slot_bytes(N, k_max, dim, opts);
+    if (opts->algorithm == KMEANS_BLOCKED) {
+        bytes += arena_block_size(N * sizeof(double));
+    }
+    return bytes;
+}
+
+/*
+ * Carves the scratch of kmeans_sweep_run for the K values k_min..k_max over
+ * N points: the seeding scratch, and one slot per thread (opts->n_threads of
+ * them, at most one per K) for opts->algorithm, which must not be
+ * KMEANS_YINYANG (its groups are sized for a single K).
+ * Returns 0 on success, -1 if the arena has no room left.
+ */
+int kmeans_sweep_carve(struct kmeans_sweep *sw, struct arena *a, size_t N, int k_min, int k_max, int dim,
+                       const struct kmeans_options *opts) {
+    struct kmeans_options run_opts = *opts;
+    struct kmeans_seed_options seed_opts;
+    struct kmeans_sweep_slot *slot;
+    int n_k = k_max - k_min + 1;
+    int s;
+
+    run_opts.n_threads = 1;
+    if (opts->algorithm == KMEANS_BLOCKED) {
+        run_opts.algorithm = KMEANS_LLOYD;
+    }
+    seed_opts.n_threads = opts->n_threads;
+    seed_opts.n_local_trials = 1;
+    sw->n_slots = opts->n_threads < n_k ? opts->n_threads : n_k;
+    sw->slots = arena_alloc(a, (size_t)sw->n_slots * sizeof(struct kmeans_sweep_slot));
+    sw->chosen = arena_alloc(a, (size_t)k_max * sizeof(size_t));
+    sw->inertias = arena_alloc(a, (size_t)n_k * sizeof(double));
+    sw->iterations = arena_alloc(a, (size_t)n_k * sizeof(int));
+    sw->point_norms = NULL;
+    if (sw->slots == NULL || sw->chosen == NULL || sw->inertias == NULL || sw->iterations == NULL
+        || kmeans_seed_carve(&sw->seed_ws, a, N, dim, &seed_opts) != 0) {
+        return -1;
+    }
+    if (opts->algorithm == KMEANS_BLOCKED) {
+        sw->point_norms = arena_alloc(a, N * sizeof(double));
+        if (sw->point_norms == NULL) {
+            return -1;
+        }
+    }
+
+    for (s = 0; s < sw->n_slots; s++) {
+        slot = &sw->slots[s];
+        if (kmeans_workspace_carve(&slot->ws, a, N, k_max, dim, &run_opts) != 0
+            || matrix_carve(&slot->centroids, a, (size_t)k_max, dim) != 0) {
+            return -1;
+        }
+        slot->labels = arena_alloc(a, N * sizeof(int));
+        if (slot->labels == NULL) {
+            return -1;
+        }
+        /* The blocked engine's own state, reading the shared norms */
+        if (opts->algorithm == KMEANS_BLOCKED) {
+            slot->ws.centroid_norms = arena_alloc(a, (size_t)k_max * sizeof(double));
+            if (slot->ws.centroid_norms == NULL) {
+                return -1;
+            }
+            slot->ws.point_norms = sw->point_norms;
+            slot->ws.point_norms_ready = 1;
+        }
+    }
+    return 0;
+}
+
+/* Thread t runs every n_threads-th K, counting down from k_max */
+static void sweep_job(void *arg, int t, int n_threads) {
+    struct sweep_job *job = arg;
+    struct kmeans_sweep_slot *slot = &job->sw->slots[t];
+    const struct matrix *data = job->data;
+    struct matrix centroids;
+    struct kmeans_stats stats;
+    double inertia;
+    size_t i;
+    int K, k;
+
+    slot->distance_evals = 0;
+    for (K = job->k_max - t; K >= job->k_min; K -= n_threads) {
+        centroids.data = slot->centroids.data;
+        centroids.rows = (size_t)K;
+        centroids.dim = data->dim;
+        for (k = 0; k < K; k++) {
+            memcpy(MATRIX_ROW(&centroids, k), MATRIX_ROW(data, job->sw->chosen[k]),
+                   (size_t)data->dim * sizeof(double));
+        }
+        kmeans_lloyd(data, &centroids, &slot->ws, job->opts, slot->labels, &stats);
+
+        inertia = 0.0;
+        for (i = 0; i < data->rows; i++) {
+            inertia += squared_distance(MATRIX_ROW(data, i), MATRIX_ROW(&centroids, slot->labels[i]), data->dim);
+        }
+        job->sw->inertias[K - job->k_min] = inertia;
+        job->sw->iterations[K - job->k_min] = stats.iterations;
+        slot->distance_evals += stats.distance_evals;
+    }
+}
+
+/*
+ * Seeds k_max centroids with k-means++ (from seed) and runs Lloyd for every
+ * K of k_min..k_max from the first K of them, opts (but n_threads) applying
+ * to every run, with scratch from kmeans_sweep_carve. sw->inertias and
+ * sw->iterations receive the results, K = k_min first. stats, if not NULL,
+ * receives the distances computed over all runs (iterations: the most any
+ * run took).
+ */
+void kmeans_sweep_run(const struct matrix *data, struct kmeans_sweep *sw, const struct kmeans_options *opts,
+                      int k_min, int k_max, unsigned long long seed, struct kmeans_stats *stats) {
+    struct kmeans_options run_opts = *opts;
+    struct kmeans_seed_options seed_opts;
+    struct thread_pool *pool = NULL;
+    struct sweep_job job;
+    int s, n_threads;
+
+    seed_opts.seed = seed;
+    seed_opts.n_threads = opts->n_threads;
+    seed_opts.n_local_trials = 1;
+    seed_opts.numpy_sampling = 1;
+    seed_opts.rounds = 0;
+    seed_opts.oversampling = 0.0;
+    kmeans_pp_seed(data, k_max, &sw->seed_ws, &seed_opts, sw->chosen);
+
+    /* ||x||^2 once for every run: the slots all point at sw->point_norms */
+    if (sw->point_norms != NULL) {
+        kmeans_blocked_prepare(data, &sw->slots[0].ws);
+    }
+
+    run_opts.n_threads = 1;
+    job.data = data;
+    job.sw = sw;
+    job.opts = &run_opts;
+    job.k_min = k_min;
+    job.k_max = k_max;
+    if (sw->n_slots > 1) {
+        pool = pool_create(sw->n_slots);
+    }
+    n_threads = pool_size(pool);
+    pool_run(pool, sweep_job, &job);
+    pool_destroy(pool);
+
+    if (stats != NULL) {
+        stats->iterations = 0;
+        stats->distance_evals = 0;
+        stats->distance_evals_avoided = 0;
+        for (s = 0; s < n_threads; s++) {
+            stats->distance_evals += sw->slots[s].distance_evals;
+        }
+        for (s = 0; s <= k_max - k_min; s++) {
+            if (sw->iterations[s] > stats->iterations) {
+                stats->iterations = sw->iterations[s];
+            }
+        }
+    }
+}
@@ -0,0 +1,152 @@
+#include "kmeans.h"
+
+#include <string.h>
+#include <time.h>
+
+/*
+ * Per-iteration telemetry of the Lloyd loops: how long the Assignment and
+ * Update Steps took, the inertia of every assignment, how far the centroids
+ * moved, how many points changed cluster and how many clusters came out
+ * empty. It answers "why was this fit slow" (700 iterations creeping under
+ * epsilon, clusters emptying over and over) after the fact.
+ *
+ * The loops only look at ws->telemetry, which kmeans_workspace_carve sets to
+ * NULL: a run without it pays one test per step. With it, every iteration
+ * adds one serial pass over the labels and the data (O(N x dim), against the
+ * O(N x K x dim) of a full Assignment Step), which is kept out of the timings.
+ */
+
+/*declaration of functions*/
+static double assigned_distance(const struct matrix *data, const struct matrix_f32 *data_f32,
+                                const struct matrix *centroids, size_t i, int label);
+
+
+/* Bytes of arena space needed by kmeans_telemetry_carve */
+size_t kmeans_telemetry_bytes(size_t N, int K, int dim, int iter) {
+    return arena_block_size((size_t)iter * sizeof(struct kmeans_iteration_record))
+         + arena_block_size(N * sizeof(int))
+         + arena_block_size((size_t)K * (size_t)dim * sizeof(double));
+}
+
+/*
+ * Carves the records of up to iter iterations of a run over N points and K
+ * centroids. Returns 0 on success, -1 if the arena has no room left.
+ */
+int kmeans_telemetry_carve(struct kmeans_telemetry *tel, struct arena *a, size_t N, int K, int dim, int iter) {
+    tel->records = arena_alloc(a, (size_t)iter * sizeof(struct kmeans_iteration_record));
+    tel->previous = arena_alloc(a, N * sizeof(int));
+    if ((iter > 0 && tel->records == NULL) || tel->previous == NULL
+        || matrix_carve(&tel->before, a, (size_t)K, dim) != 0) {
+        return -1;
+    }
+    tel->capacity = iter;
+    tel->count = 0;
+    /* No point had a cluster before the first iteration */
+    memset(tel->previous, 0xff, N * sizeof(int));
+    tel->started = 0.0;
+    return 0;
+}
+
+/* Monotonic wall-clock time in seconds, also the time base of the trace spans (kmeans_trace.c) */
+double kmeans_telemetry_clock(void) {
+    struct timespec now;
+
+#if defined(_WIN32)
+    timespec_get(&now, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/* Squared distance of point i (of whichever data is not NULL) to centroid label */
+static double assigned_distance(const struct matrix *data, const struct matrix_f32 *data_f32,
+                                const struct matrix *centroids, size_t i, int label) {
+    const double *c = MATRIX_ROW(centroids, label);
+    const float *x;
+    double diff, sum = 0.0;
+    int d;
+
+    if (data != NULL) {
+        return squared_distance(MATRIX_ROW(data, i), c, data->dim);
+    }
+    x = MATRIX_ROW(data_f32, i);
+    for (d = 0; d < data_f32->dim; d++) {
+        diff = (double)x[d] - c[d];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+/*
+ * Records the Assignment Step that just ran (timed from tel->started) over
+ * data, or data_f32 for float32 runs: the inertia of its labels against
+ * centroids, the points that changed cluster and the empty clusters. Keeps
+ * a copy of the centroids for kmeans_telemetry_updated, and restarts the
+ * clock for the Update Step.
+ */
+void kmeans_telemetry_assigned(struct kmeans_telemetry *tel, const struct matrix *data,
+                               const struct matrix_f32 *data_f32, const struct matrix *centroids,
+                               struct kmeans_workspace *ws, enum kmeans_algorithm algorithm) {
+    struct kmeans_iteration_record *record;
+    size_t N = data != NULL ? data->rows : data_f32->rows;
+    size_t i;
+    int k;
+
+    if (tel->count >= tel->capacity) {
+        return;
+    }
+    record = &tel->records[tel->count];
+    record->assign_seconds = kmeans_telemetry_clock() - tel->started;
+
+    /* Cells the kd-tree assigned as a whole only recorded their owner */
+    if (algorithm == KMEANS_KDTREE) {
+        kmeans_kdtree_labels(ws);
+    }
+    record->inertia = 0.0;
+    record->reassigned = 0;
+    for (i = 0; i < N; i++) {
+        record->inertia += assigned_distance(data, data_f32, centroids, i, ws->labels[i]);
+        if (ws->labels[i] != tel->previous[i]) {
+            record->reassigned++;
+            tel->previous[i] = ws->labels[i];
+        }
+    }
+    record->empty_clusters = 0;
+    for (k = 0; k < (int)centroids->rows; k++) {
+        if (ws->counts[k] == 0) {
+            record->empty_clusters++;
+        }
+    }
+    memcpy(tel->before.data, centroids->data, centroids->rows * (size_t)centroids->dim * sizeof(double));
+
+    tel->started = kmeans_telemetry_clock();
+}
+
+/*
+ * Records the Update Step that just ran (timed from tel->started): how far
+ * every centroid moved from the copy kmeans_telemetry_assigned kept.
+ */
+void kmeans_telemetry_updated(struct kmeans_telemetry *tel, const struct matrix *centroids) {
+    struct kmeans_iteration_record *record;
+    double shift, total = 0.0;
+    int K = (int)centroids->rows;
+    int k;
+
+    if (tel->count >= tel->capacity) {
+        return;
+    }
+    record = &tel->records[tel->count];
+    record->update_seconds = kmeans_telemetry_clock() - tel->started;
+
+    record->max_shift = 0.0;
+    for (k = 0; k < K; k++) {
+        shift = compute_distance(MATRIX_ROW(&tel->before, k), MATRIX_ROW(centroids, k), centroids->dim);
+        total += shift;
+        if (shift > record->max_shift) {
+            record->max_shift = shift;
+        }
+    }
+    record->mean_shift = K > 0 ? total / K : 0.0;
+    tel->count++;
+}
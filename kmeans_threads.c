@@ -0,0 +1,213 @@
+#include "kmeans.h"
+
+#include <stdlib.h>
+
+/*
+ * A minimal fork-join thread pool: pool_run hands the same job to every
+ * thread (the caller acts as thread 0) and returns once all of them are done.
+ * Built on pthreads; where those are missing every job simply runs on the
+ * calling thread alone.
+ */
+
+#if defined(_WIN32)
+#define KMEANS_NO_PTHREADS 1
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifndef KMEANS_NO_PTHREADS
+
+/*implementations of structs*/
+struct thread_pool
+{
+    pthread_t *threads;     /* Workers 1..n_threads-1 (the caller is worker 0) */
+    int n_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    /* Signalled when a new job (or shutdown) is posted */
+    pthread_cond_t done;    /* Signalled when the last worker finishes a job */
+    pool_job_fn job;
+    void *job_arg;
+    unsigned long generation; /* Bumped for every posted job */
+    int pending;              /* Workers still running the current job */
+    int shutdown;
+};
+
+/* Arguments of a worker thread: its pool and its index */
+struct pool_worker
+{
+    struct thread_pool *pool;
+    int index;
+};
+
+/*declaration of functions*/
+static void *pool_worker_main(void *arg);
+
+
+/* Worker loop: wait for a new generation, run the job, report back */
+static void *pool_worker_main(void *arg) {
+    struct pool_worker *self = arg;
+    struct thread_pool *pool = self->pool;
+    unsigned long seen = 0;
+    pool_job_fn job;
+    void *job_arg;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        job = pool->job;
+        job_arg = pool->job_arg;
+        pthread_mutex_unlock(&pool->lock);
+
+        job(job_arg, self->index, pool->n_threads);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    free(self);
+    return NULL;
+}
+
+/*
+ * Starts a pool of up to n_threads threads (counting the caller).
+ * Returns the pool, or NULL if n_threads <= 1 or nothing could be allocated;
+ * pool_run accepts NULL and then runs the job on the caller alone. If some
+ * threads fail to start the pool just runs with fewer of them.
+ */
+struct thread_pool *pool_create(int n_threads) {
+    struct thread_pool *pool;
+    struct pool_worker *worker;
+    int i;
+
+    if (n_threads <= 1) {
+        return NULL;
+    }
+    pool = calloc(1, sizeof(struct thread_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->threads = malloc((size_t)n_threads * sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    /* Worker 0 is the caller, so only n_threads - 1 threads are started */
+    pool->n_threads = 1;
+    for (i = 1; i < n_threads; i++) {
+        worker = malloc(sizeof(struct pool_worker));
+        if (worker == NULL) {
+            break;
+        }
+        worker->pool = pool;
+        worker->index = i;
+        if (pthread_create(&pool->threads[i], NULL, pool_worker_main, worker) != 0) {
+            free(worker);
+            break;
+        }
+        pool->n_threads++;
+    }
+
+    if (pool->n_threads == 1) {
+        pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/* Number of threads taking part in every job (1 for a NULL pool) */
+int pool_size(const struct thread_pool *pool) {
+    return pool == NULL ? 1 : pool->n_threads;
+}
+
+/* Runs job(arg, i, n) on every thread i = 0..n-1 and waits for all of them */
+void pool_run(struct thread_pool *pool, pool_job_fn job, void *arg) {
+    if (pool == NULL) {
+        job(arg, 0, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->job_arg = arg;
+    pool->pending = pool->n_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    job(arg, 0, pool->n_threads);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Stops and joins the workers, then frees the pool */
+void pool_destroy(struct thread_pool *pool) {
+    int i;
+
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 1; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+/* Number of online CPUs (at least 1) */
+int kmeans_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : (int)n;
+}
+
+#else /* KMEANS_NO_PTHREADS */
+
+struct thread_pool *pool_create(int n_threads) {
+    (void)n_threads;
+    return NULL;
+}
+
+int pool_size(const struct thread_pool *pool) {
+    (void)pool;
+    return 1;
+}
+
+void pool_run(struct thread_pool *pool, pool_job_fn job, void *arg) {
+    (void)pool;
+    job(arg, 0, 1);
+}
+
+void pool_destroy(struct thread_pool *pool) {
+    (void)pool;
+}
+
+int kmeans_cpu_count(void) {
+    return 1;
+}
+
+#endif /* KMEANS_NO_PTHREADS */
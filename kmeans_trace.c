@@ -0,0 +1,224 @@
+#include "kmeans.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * An opt-in trace of where a run spends its time, written as a Chrome
+ * trace-event JSON file (chrome://tracing, ui.perfetto.dev):
+ *
+ *     {"traceEvents": [
+ *       {"name": "assign", "ph": "X", "ts": 1234.5, "dur": 67.8, "pid": 1, "tid": 0},
+ *       ...,
+ *       {"name": "thread_name", "ph": "M", "pid": 1, "tid": 0, "args": {"name": "main"}}
+ *     ], "displayTimeUnit": "ms"}
+ *
+ * Every span is a complete ("X") event: its start is taken with
+ * kmeans_telemetry_clock and kmeans_trace_span records it when it ends, on the
+ * lane (tid) of the thread that ends it. The thread that called
+ * kmeans_trace_start is lane 0; every other thread gets the next free lane
+ * the first time it records something, so the workers of a thread pool show
+ * up as lanes of their own. Spans of one thread nest by their times, which is
+ * how the viewers draw sub-spans (the Assignment Step inside an iteration).
+ *
+ * Callers test kmeans_trace_on before reading the clock, so a run that is
+ * not traced pays one test per span. The events are kept in memory (up to
+ * KMEANS_TRACE_MAX_EVENTS, later ones are counted and dropped) and only
+ * written by kmeans_trace_write.
+ */
+
+#if defined(_WIN32)
+#define KMEANS_NO_PTHREADS 1
+#define KMEANS_THREAD_LOCAL __declspec(thread)
+#define trace_getpid() ((unsigned long)_getpid())
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#define KMEANS_THREAD_LOCAL __thread
+#define trace_getpid() ((unsigned long)getpid())
+#endif
+
+/* Most events kept in memory (about 48 bytes each) */
+#define KMEANS_TRACE_MAX_EVENTS (1 << 20)
+
+/* Longest span name kept, counting the terminating NUL */
+#define KMEANS_TRACE_NAME 32
+
+/*declaration of structs*/
+struct trace_event;
+
+/*declaration of functions*/
+static int trace_lane(void);
+static void trace_copy_name(char *dst, const char *src);
+
+/*implementations of structs*/
+
+/* One span, in seconds of kmeans_telemetry_clock */
+struct trace_event
+{
+    char name[KMEANS_TRACE_NAME];
+    double start;
+    double end;
+    int lane;
+    int iteration;   /* Lloyd iteration it belongs to, or -1 */
+};
+
+/* Set by kmeans_trace_start: spans are recorded */
+int kmeans_trace_on = 0;
+
+static struct trace_event *trace_events = NULL;
+static size_t trace_count = 0;
+static size_t trace_capacity = 0;
+static size_t trace_dropped = 0;
+static double trace_origin = 0.0;
+static int trace_lanes = 0;
+static int trace_generation = 0;  /* kmeans_trace_start calls so far */
+
+/* Lane of the calling thread, plus 1 (0: none yet), valid for the trace started as trace_my_generation */
+static KMEANS_THREAD_LOCAL int trace_my_lane = 0;
+static KMEANS_THREAD_LOCAL int trace_my_generation = 0;
+
+#ifndef KMEANS_NO_PTHREADS
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+#define trace_acquire() pthread_mutex_lock(&trace_lock)
+#define trace_release() pthread_mutex_unlock(&trace_lock)
+#else
+/* No thread pool there: only the caller's thread records spans */
+#define trace_acquire() ((void)0)
+#define trace_release() ((void)0)
+#endif
+
+
+/*
+ * Starts recording (again, dropping whatever was recorded before), with the
+ * calling thread as lane 0 and the time origin of the trace at now.
+ */
+void kmeans_trace_start(void) {
+    trace_acquire();
+    free(trace_events);
+    trace_events = NULL;
+    trace_count = 0;
+    trace_capacity = 0;
+    trace_dropped = 0;
+    trace_lanes = 1;
+    trace_generation++;
+    trace_my_lane = 1;
+    trace_my_generation = trace_generation;
+    trace_origin = kmeans_telemetry_clock();
+    kmeans_trace_on = 1;
+    trace_release();
+}
+
+/*
+ * Lane of the calling thread, handing out the next one on its first span of
+ * this trace (a lane from before the last kmeans_trace_start is stale). Call
+ * with the lock held.
+ */
+static int trace_lane(void) {
+    if (trace_my_lane == 0 || trace_my_generation != trace_generation) {
+        trace_my_lane = ++trace_lanes;
+        trace_my_generation = trace_generation;
+    }
+    return trace_my_lane - 1;
+}
+
+/* Copies a span name, cut to fit and with the characters JSON would need escaped replaced */
+static void trace_copy_name(char *dst, const char *src) {
+    int i;
+
+    for (i = 0; i < KMEANS_TRACE_NAME - 1 && src[i] != '\0'; i++) {
+        dst[i] = (src[i] == '"' || src[i] == '\\' || (unsigned char)src[i] < 0x20) ? '_' : src[i];
+    }
+    dst[i] = '\0';
+}
+
+/*
+ * Records the span name that ran from start (a kmeans_telemetry_clock time)
+ * until now on the calling thread's lane; iteration is the Lloyd iteration
+ * it belongs to, or -1. Does nothing unless tracing is on.
+ */
+void kmeans_trace_span(const char *name, double start, int iteration) {
+    struct trace_event *grown, *event;
+    double end = kmeans_telemetry_clock();
+    size_t capacity;
+
+    if (!kmeans_trace_on) {
+        return;
+    }
+    trace_acquire();
+    if (trace_count == trace_capacity) {
+        capacity = trace_capacity == 0 ? 1024 : 2 * trace_capacity;
+        grown = trace_capacity < KMEANS_TRACE_MAX_EVENTS
+              ? realloc(trace_events, capacity * sizeof(struct trace_event)) : NULL;
+        if (grown == NULL) {
+            trace_dropped++;
+            trace_release();
+            return;
+        }
+        trace_events = grown;
+        trace_capacity = capacity;
+    }
+    event = &trace_events[trace_count++];
+    trace_copy_name(event->name, name);
+    event->start = start;
+    event->end = end;
+    event->lane = trace_lane();
+    event->iteration = iteration;
+    trace_release();
+}
+
+/*
+ * Writes everything recorded so far to path as a Chrome trace-event file,
+ * with the lanes named ("main", "worker 1", ...) in order. Recording goes on.
+ * Returns 0 on success, -1 if the file could not be written.
+ */
+int kmeans_trace_write(const char *path) {
+    const struct trace_event *event;
+    unsigned long pid = trace_getpid();
+    FILE *file;
+    size_t i;
+    int lane, failed;
+
+    file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    trace_acquire();
+    fprintf(file, "{\"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %lu, \"tid\": 0, "
+                  "\"args\": {\"name\": \"mykmeanssp\"}}", pid);
+    for (lane = 0; lane < trace_lanes; lane++) {
+        if (lane == 0) {
+            fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %lu, \"tid\": 0, "
+                          "\"args\": {\"name\": \"main\"}}", pid);
+        }
+        else {
+            fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %lu, \"tid\": %d, "
+                          "\"args\": {\"name\": \"worker %d\"}}", pid, lane, lane);
+        }
+        fprintf(file, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": %lu, \"tid\": %d, "
+                      "\"args\": {\"sort_index\": %d}}", pid, lane, lane);
+    }
+    for (i = 0; i < trace_count; i++) {
+        event = &trace_events[i];
+        /* Microseconds since kmeans_trace_start */
+        fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %lu, \"tid\": %d",
+                event->name, (event->start - trace_origin) * 1e6, (event->end - event->start) * 1e6, pid,
+                event->lane);
+        if (event->iteration >= 0) {
+            fprintf(file, ", \"args\": {\"iteration\": %d}", event->iteration);
+        }
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n], \"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped_events\": %lu}}\n",
+            (unsigned long)trace_dropped);
+    trace_release();
+
+    failed = ferror(file);
+    if (fclose(file) != 0 || failed) {
+        return -1;
+    }
+    return 0;
+}
@@ -2,502 +2,2713 @@
 #include <Python.h>
 
 #include <stdlib.h>
-#include <math.h>
-#include <stdio.h>
+#include <string.h>
+
+#include "kmeans.h"
 
 /*declaration of structs*/
-struct vector;
-struct cord;
+struct py_matrix;
+struct py_kmeans;
+struct py_cache_mapping;
 
 /*declaration of functions*/
-double compute_distance(const struct vector *v1, const struct vector *v2, int dim); 
-int find_closest_centroid(const struct vector *centroids, const struct vector *vectorX, int K, int dim);
-struct vector *add_coordinates_from_other_vector(struct vector *v1, struct vector *v2, int dim);
-struct vector *initialize_sum_vectors(int K, int dim);
-void divide_vector_by_scalar(struct vector *v, int scalar);
-void free_vector_list(struct vector *head_vec); 
-void zero_out_vector(struct vector *v);
-
-void free_cords_list(struct cord *head_c);
-struct vector* python_to_c_list(PyObject *py_list, int *N, int *dim);
-static PyObject* fit(PyObject *self, PyObject *args);
+int python_list_shape(PyObject *py_list, Py_ssize_t *N, int *dim);
+int python_to_c_matrix(PyObject *py_list, struct matrix *m);
+static char buffer_format_char(const char *format);
+int python_matrix_open(PyObject *obj, struct py_matrix *src);
+int python_matrix_copy(const struct py_matrix *src, struct matrix *m);
+int python_matrix_copy_f32(const struct py_matrix *src, struct matrix_f32 *m);
+void python_matrix_close(struct py_matrix *src);
+int python_output_open(PyObject *obj, Py_buffer *view, char type, Py_ssize_t count, const char *name);
+PyObject* new_output_buffer(char type, Py_ssize_t rows, int dim, void **data);
+PyObject* c_matrix_to_python(const struct matrix *m);
+int parse_algorithm(const char *name, enum kmeans_algorithm *algorithm);
+int python_fill_stats(PyObject *dict, const struct kmeans_stats *stats);
+static int dict_set_new(PyObject *dict, const char *key, PyObject *value);
+int python_fill_minibatch_stats(PyObject *dict, const struct kmeans_minibatch_stats *stats, int final_pass);
+int python_fill_history(PyObject *list, const struct kmeans_telemetry *tel);
+int python_fill_restart_stats(PyObject *dict, const struct kmeans_restarts *r, int n_init, int best_run,
+                              long long seed);
+static PyObject* fit(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject* fit_minibatch(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject* fit_file(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject* kmeanspp_init(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject* refit(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject* sweep(PyObject *self, PyObject *args, PyObject *kwargs);
+static int py_cache_mapping_getbuffer(PyObject *obj, Py_buffer *view, int flags);
+static void py_cache_mapping_dealloc(PyObject *obj);
+static PyObject* mapped_output_buffer(PyObject *mapping, size_t offset, Py_ssize_t rows, int dim);
+static PyObject* load_and_merge(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject* trace_clock(PyObject *self, PyObject *args);
+static PyObject* trace_span(PyObject *self, PyObject *args, PyObject *kwargs);
+static void trace_at_exit(void);
+static PyObject* py_kmeans_new(PyTypeObject *type, PyObject *args, PyObject *kwargs);
+static int py_kmeans_init(PyObject *obj, PyObject *args, PyObject *kwargs);
+static void py_kmeans_dealloc(PyObject *obj);
+static void py_kmeans_lock(struct py_kmeans *self);
+static int py_kmeans_set_model(struct py_kmeans *self, const struct matrix *centroids);
+static int py_kmeans_points(struct py_kmeans *self, PyObject *obj, int as_float32, struct py_matrix *src,
+                            struct arena *arena, struct matrix *data, struct matrix_f32 *data_f32);
+static PyObject* py_kmeans_fit(PyObject *obj, PyObject *args, PyObject *kwargs);
+static PyObject* py_kmeans_predict(PyObject *obj, PyObject *args, PyObject *kwargs);
+static PyObject* py_kmeans_transform(PyObject *obj, PyObject *args, PyObject *kwargs);
+static PyObject* py_kmeans_score(PyObject *obj, PyObject *args, PyObject *kwargs);
+static PyObject* py_kmeans_get_centroids(PyObject *obj, void *closure);
+static int py_kmeans_set_centroids(PyObject *obj, PyObject *value, void *closure);
+static PyObject* py_kmeans_get_labels(PyObject *obj, void *closure);
+static PyObject* py_kmeans_get_n_clusters(PyObject *obj, void *closure);
+static PyObject* py_kmeans_get_n_iter(PyObject *obj, void *closure);
 PyMODINIT_FUNC PyInit_mykmeanssp(void);
 
 
+/*implementations of structs*/
+
+/* Element types a buffer-protocol input may hold */
+enum py_matrix_type
+{
+    PY_MATRIX_LIST,    /* Plain list of lists of floats, read element by element */
+    PY_MATRIX_FLOAT64, /* C-contiguous doubles: usable in place */
+    PY_MATRIX_FLOAT32  /* C-contiguous floats: widened to double on copy */
+};
+
+/* A 2-D Python input (list of lists or buffer) and its shape */
+struct py_matrix
+{
+    PyObject *obj;            /* The original Python object (borrowed) */
+    Py_buffer view;           /* Valid only when type != PY_MATRIX_LIST */
+    enum py_matrix_type type;
+    Py_ssize_t rows;
+    int dim;
+};
+
+
+/*
+ * Reads the shape of a Python list of lists (e.g., [[1.0, 2.0], ...]).
+ * All inner lists must have the same, non-zero length.
+ * * Args:
+ * py_list: Pointer to the Python list object.
+ * N: Pointer to store the number of vectors found.
+ * dim: Pointer to store the dimension of the vectors.
+ * * Returns:
+ * 0 on success, -1 with a Python exception set otherwise.
+ */
+int python_list_shape(PyObject *py_list, Py_ssize_t *N, int *dim) {
+    PyObject *item;
+    Py_ssize_t n, d, i;
+
+    if (!PyList_Check(py_list)) {
+        PyErr_SetString(PyExc_TypeError, "expected a list of lists of floats");
+        return -1;
+    }
+
+    n = PyList_Size(py_list);
+    if (n == 0) {
+        PyErr_SetString(PyExc_ValueError, "expected at least one vector");
+        return -1;
+    }
+
+    d = -1;
+    for (i = 0; i < n; i++) {
+        item = PyList_GetItem(py_list, i);
+        if (!PyList_Check(item)) {
+            PyErr_SetString(PyExc_TypeError, "expected a list of lists of floats");
+            return -1;
+        }
+        if (d == -1) {
+            d = PyList_Size(item);
+        }
+        /* Every row is written into a fixed-width block, so ragged input is an error */
+        if (PyList_Size(item) != d || d == 0) {
+            PyErr_SetString(PyExc_ValueError, "all vectors must have the same, non-zero dimension");
+            return -1;
+        }
+    }
+
+    *N = n;
+    *dim = (int)d;
+    return 0;
+}
+
+/*
+ * Copies a Python list of lists into a dense row-major matrix.
+ * The matrix must already be carved with the shape found by python_list_shape.
+ * Returns 0 on success, -1 with a Python exception set otherwise.
+ */
+int python_to_c_matrix(PyObject *py_list, struct matrix *m) {
+    PyObject *item;
+    double *row;
+    Py_ssize_t i;
+    int j;
+
+    for (i = 0; i < (Py_ssize_t)m->rows; i++) {
+        item = PyList_GetItem(py_list, i);  /* Get the inner list (vector) */
+        row = MATRIX_ROW(m, i);
+
+        /* Inner loop: Extract coordinates from Python list */
+        for (j = 0; j < m->dim; j++) {
+            /* Convert Python float to C double */
+            row[j] = PyFloat_AsDouble(PyList_GetItem(item, j));
+        }
+
+        /* Check if conversion failed (e.g., item was not a number) */
+        if (PyErr_Occurred()) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the single struct-module type character of a buffer format string,
+ * accepting an optional native byte-order prefix ("d", "@d", "=d", "<d" on
+ * little endian). Returns 0 for anything else.
+ */
+static char buffer_format_char(const char *format) {
+    if (format == NULL) {
+        return 'B'; /* Unsigned bytes */
+    }
+    if (*format == '@' || *format == '=' || *format == (PY_LITTLE_ENDIAN ? '<' : '>')) {
+        format++;
+    }
+    if (format[0] == '\0' || format[1] != '\0') {
+        return 0;
+    }
+    return format[0];
+}
+
+/*
+ * Inspects a 2-D input and fills src with its shape.
+ * Objects supporting the buffer protocol (numpy arrays, memoryviews, ...) must be
+ * C-contiguous float64 or float32 with 1 or 2 dimensions (1-D means dim = 1);
+ * they are held open until python_matrix_close. Lists of lists are the fallback.
+ * Returns 0 on success, -1 with a Python exception set otherwise.
+ */
+int python_matrix_open(PyObject *obj, struct py_matrix *src) {
+    char type;
+
+    src->obj = obj;
+    src->type = PY_MATRIX_LIST;
+
+    if (PyList_Check(obj) || !PyObject_CheckBuffer(obj)) {
+        return python_list_shape(obj, &src->rows, &src->dim);
+    }
+
+    if (PyObject_GetBuffer(obj, &src->view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) {
+        return -1;
+    }
+
+    type = buffer_format_char(src->view.format);
+    if ((type != 'd' && type != 'f') || src->view.ndim < 1 || src->view.ndim > 2) {
+        PyBuffer_Release(&src->view);
+        PyErr_SetString(PyExc_TypeError, "expected a 1-D or 2-D buffer of float64 or float32");
+        return -1;
+    }
+
+    src->type = type == 'd' ? PY_MATRIX_FLOAT64 : PY_MATRIX_FLOAT32;
+    src->rows = src->view.shape[0];
+    src->dim = src->view.ndim == 2 ? (int)src->view.shape[1] : 1;
+    if (src->rows == 0 || src->dim == 0) {
+        python_matrix_close(src);
+        PyErr_SetString(PyExc_ValueError, "expected a non-empty matrix");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Copies an opened input into a dense double matrix of the same shape.
+ * Returns 0 on success, -1 with a Python exception set otherwise.
+ */
+int python_matrix_copy(const struct py_matrix *src, struct matrix *m) {
+    const float *f32;
+    size_t i, count;
+
+    count = m->rows * (size_t)m->dim;
+    switch (src->type) {
+    case PY_MATRIX_FLOAT64:
+        memcpy(m->data, src->view.buf, count * sizeof(double));
+        return 0;
+    case PY_MATRIX_FLOAT32:
+        f32 = src->view.buf;
+        for (i = 0; i < count; i++) {
+            m->data[i] = (double)f32[i];
+        }
+        return 0;
+    default:
+        return python_to_c_matrix(src->obj, m);
+    }
+}
+
+/*
+ * Copies an opened input into a dense float matrix of the same shape,
+ * rounding float64 values to the nearest float.
+ * Returns 0 on success, -1 with a Python exception set otherwise.
+ */
+int python_matrix_copy_f32(const struct py_matrix *src, struct matrix_f32 *m) {
+    const double *f64;
+    PyObject *item;
+    float *row;
+    size_t i, count;
+    int j;
+
+    count = m->rows * (size_t)m->dim;
+    switch (src->type) {
+    case PY_MATRIX_FLOAT32:
+        memcpy(m->data, src->view.buf, count * sizeof(float));
+        return 0;
+    case PY_MATRIX_FLOAT64:
+        f64 = src->view.buf;
+        for (i = 0; i < count; i++) {
+            m->data[i] = (float)f64[i];
+        }
+        return 0;
+    default:
+        for (i = 0; i < m->rows; i++) {
+            item = PyList_GetItem(src->obj, (Py_ssize_t)i);
+            row = MATRIX_ROW(m, i);
+            for (j = 0; j < m->dim; j++) {
+                row[j] = (float)PyFloat_AsDouble(PyList_GetItem(item, j));
+            }
+            if (PyErr_Occurred()) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+}
+
+/* Releases the buffer held by python_matrix_open, if any */
+void python_matrix_close(struct py_matrix *src) {
+    if (src->type != PY_MATRIX_LIST) {
+        PyBuffer_Release(&src->view);
+        src->type = PY_MATRIX_LIST;
+    }
+}
+
+/*
+ * Opens a caller-provided output buffer: it must be writable, C-contiguous,
+ * hold elements of the given struct-module type ('d' or 'i') and have
+ * exactly `count` of them. `name` is the keyword used in error messages.
+ * Returns 0 on success, -1 with a Python exception set otherwise.
+ */
+int python_output_open(PyObject *obj, Py_buffer *view, char type, Py_ssize_t count, const char *name) {
+    size_t itemsize = type == 'd' ? sizeof(double) : sizeof(int);
+
+    if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | PyBUF_WRITABLE) != 0) {
+        return -1;
+    }
+    if (buffer_format_char(view->format) != type || (size_t)view->itemsize != itemsize) {
+        PyErr_Format(PyExc_TypeError, "%s must be a buffer of %s", name,
+                     type == 'd' ? "float64" : "int32");
+        PyBuffer_Release(view);
+        return -1;
+    }
+    if (view->len != count * view->itemsize) {
+        PyErr_Format(PyExc_ValueError, "%s must hold exactly %zd elements", name, count);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Allocates a new rows x dim output (or a 1-D one when dim is 0) of the given
+ * struct-module type ('d' or 'i'), returned as a memoryview over a bytearray.
+ * *data receives the address to write the elements to.
+ * Returns NULL with a Python exception set on failure.
+ */
+PyObject* new_output_buffer(char type, Py_ssize_t rows, int dim, void **data) {
+    PyObject *bytes, *view, *result;
+    Py_ssize_t count = dim > 0 ? rows * dim : rows;
+    char format[2];
+
+    format[0] = type;
+    format[1] = '\0';
+
+    bytes = PyByteArray_FromStringAndSize(NULL, count * (Py_ssize_t)(type == 'd' ? sizeof(double) : sizeof(int)));
+    if (bytes == NULL) {
+        return NULL;
+    }
+    view = PyMemoryView_FromObject(bytes);
+    Py_DECREF(bytes); /* The memoryview keeps the bytearray alive (and pinned) */
+    if (view == NULL) {
+        return NULL;
+    }
+
+    if (dim > 0) {
+        result = PyObject_CallMethod(view, "cast", "s(ni)", format, rows, dim);
+    }
+    else {
+        result = PyObject_CallMethod(view, "cast", "s", format);
+    }
+    Py_DECREF(view);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    *data = PyMemoryView_GET_BUFFER(result)->buf;
+    return result;
+}
+
+/* Builds a Python list of lists holding a copy of the matrix rows */
+PyObject* c_matrix_to_python(const struct matrix *m) {
+    PyObject *result_list;
+    PyObject *py_vec;
+    PyObject *py_val;
+    const double *row;
+    size_t i;
+    int j;
+
+    result_list = PyList_New((Py_ssize_t)m->rows);
+    if (result_list == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < m->rows; i++) {
+        py_vec = PyList_New(m->dim);
+        if (py_vec == NULL) {
+            Py_DECREF(result_list);
+            return NULL;
+        }
+        row = MATRIX_ROW(m, i);
+        for (j = 0; j < m->dim; j++) {
+            py_val = PyFloat_FromDouble(row[j]);
+            if (py_val == NULL) {
+                Py_DECREF(py_vec);
+                Py_DECREF(result_list);
+                return NULL;
+            }
+            PyList_SET_ITEM(py_vec, j, py_val);
+        }
+        PyList_SET_ITEM(result_list, (Py_ssize_t)i, py_vec);
+    }
+    return result_list;
+}
+
+/*
+ * Maps the `algorithm` keyword of fit to an engine.
+ * Returns 0 on success, -1 with a Python exception set otherwise.
+ */
+int parse_algorithm(const char *name, enum kmeans_algorithm *algorithm) {
+    if (strcmp(name, "lloyd") == 0) {
+        *algorithm = KMEANS_LLOYD;
+    }
+    else if (strcmp(name, "blocked") == 0) {
+        *algorithm = KMEANS_BLOCKED;
+    }
+    else if (strcmp(name, "elkan") == 0) {
+        *algorithm = KMEANS_ELKAN;
+    }
+    else if (strcmp(name, "hamerly") == 0) {
+        *algorithm = KMEANS_HAMERLY;
+    }
+    else if (strcmp(name, "yinyang") == 0) {
+        *algorithm = KMEANS_YINYANG;
+    }
+    else if (strcmp(name, "kdtree") == 0) {
+        *algorithm = KMEANS_KDTREE;
+    }
+    else {
+        PyErr_Format(PyExc_ValueError, "unknown algorithm \"%s\"", name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Stores the counters of a run in the caller's `stats` dict.
+ * Returns 0 on success, -1 with a Python exception set otherwise.
+ */
+int python_fill_stats(PyObject *dict, const struct kmeans_stats *stats) {
+    PyObject *value;
+    int rc;
+
+    value = PyLong_FromLong(stats->iterations);
+    rc = value == NULL ? -1 : PyDict_SetItemString(dict, "iterations", value);
+    Py_XDECREF(value);
+    if (rc != 0) return -1;
+
+    value = PyLong_FromUnsignedLongLong(stats->distance_evals);
+    rc = value == NULL ? -1 : PyDict_SetItemString(dict, "distance_evals", value);
+    Py_XDECREF(value);
+    if (rc != 0) return -1;
+
+    value = PyLong_FromUnsignedLongLong(stats->distance_evals_avoided);
+    rc = value == NULL ? -1 : PyDict_SetItemString(dict, "distance_evals_avoided", value);
+    Py_XDECREF(value);
+    return rc;
+}
+
+/* Stores a new reference under key and drops it; a NULL value means it could not be built */
+static int dict_set_new(PyObject *dict, const char *key, PyObject *value) {
+    int rc = value == NULL ? -1 : PyDict_SetItemString(dict, key, value);
+    Py_XDECREF(value);
+    return rc;
+}
+
+/*
+ * Stores what kmeans_restarts_run found in the caller's `stats` dict: the
+ * "inertia" and "seed" of the best run, and the "inertias" of all of them.
+ * Returns 0 on success, -1 with a Python exception set otherwise.
+ */
+int python_fill_restart_stats(PyObject *dict, const struct kmeans_restarts *r, int n_init, int best_run,
+                              long long seed) {
+    PyObject *inertias, *value;
+    int run;
+
+    inertias = PyList_New(n_init);
+    if (inertias == NULL) {
+        return -1;
+    }
+    for (run = 0; run < n_init; run++) {
+        value = PyFloat_FromDouble(r->inertias[run]);
+        if (value == NULL) {
+            Py_DECREF(inertias);
+            return -1;
+        }
+        PyList_SET_ITEM(inertias, run, value);
+    }
+    if (dict_set_new(dict, "inertias", inertias) != 0
+        || dict_set_new(dict, "inertia", PyFloat_FromDouble(r->inertias[best_run])) != 0
+        || dict_set_new(dict, "seed", PyLong_FromLongLong(seed + best_run)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Stores the counters of a mini-batch run in the caller's `stats` dict
+ * ("inertia" only when the final pass ran).
+ * Returns 0 on success, -1 with a Python exception set otherwise.
+ */
+int python_fill_minibatch_stats(PyObject *dict, const struct kmeans_minibatch_stats *stats, int final_pass) {
+    if (dict_set_new(dict, "steps", PyLong_FromLong(stats->steps)) != 0
+        || dict_set_new(dict, "points_seen", PyLong_FromUnsignedLongLong(stats->points_seen)) != 0
+        || dict_set_new(dict, "smoothed_inertia", PyFloat_FromDouble(stats->smoothed_inertia)) != 0
+        || dict_set_new(dict, "seconds", PyFloat_FromDouble(stats->seconds)) != 0
+        || dict_set_new(dict, "points_per_second", PyFloat_FromDouble(stats->points_per_second)) != 0
+        || dict_set_new(dict, "distance_evals", PyLong_FromUnsignedLongLong(stats->distance_evals)) != 0) {
+        return -1;
+    }
+    if (final_pass && dict_set_new(dict, "inertia", PyFloat_FromDouble(stats->inertia)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Appends one dict per recorded iteration to the caller's `history` list:
+ * "assign_seconds", "update_seconds", "inertia", "max_shift", "mean_shift",
+ * "reassigned" and "empty_clusters" (see struct kmeans_iteration_record).
+ * Returns 0 on success, -1 with a Python exception set otherwise.
+ */
+int python_fill_history(PyObject *list, const struct kmeans_telemetry *tel) {
+    const struct kmeans_iteration_record *record;
+    PyObject *dict;
+    int it, rc;
+
+    for (it = 0; it < tel->count; it++) {
+        record = &tel->records[it];
+        dict = PyDict_New();
+        if (dict == NULL) {
+            return -1;
+        }
+        rc = dict_set_new(dict, "assign_seconds", PyFloat_FromDouble(record->assign_seconds)) != 0
+          || dict_set_new(dict, "update_seconds", PyFloat_FromDouble(record->update_seconds)) != 0
+          || dict_set_new(dict, "inertia", PyFloat_FromDouble(record->inertia)) != 0
+          || dict_set_new(dict, "max_shift", PyFloat_FromDouble(record->max_shift)) != 0
+          || dict_set_new(dict, "mean_shift", PyFloat_FromDouble(record->mean_shift)) != 0
+          || dict_set_new(dict, "reassigned", PyLong_FromSize_t(record->reassigned)) != 0
+          || dict_set_new(dict, "empty_clusters", PyLong_FromLong(record->empty_clusters)) != 0
+          || PyList_Append(list, dict) != 0 ? -1 : 0;
+        Py_DECREF(dict);
+        if (rc != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Main K-means algorithm implementation callable from Python.
+ * Expected Python args: (K, iter, epsilon, data, centroids, *, out=None, labels=None,
+ *                        output="list", algorithm="lloyd", n_threads=1,
+ *                        stats=None, dtype="float64", n_init=1, seed=1234,
+ *                        history=None)
+ * data and centroids are lists of lists, or C-contiguous float64/float32
+ * buffers (e.g. numpy arrays). float64 data is read in place without a copy.
+ *
+ * Restarts:
+ * centroids=None seeds K centroids with k-means++ instead, as
+ * kmeans_pp_init(data, K, seed) in kmeans_pp.py does. With n_init > 1 it
+ * does n_init such runs, run r seeded with seed + r, and keeps the one with
+ * the lowest inertia (sum of squared distances of the points to their final
+ * centroid). The runs share one copy of the data and run concurrently on
+ * n_threads threads, one run per thread; each gives what a single-threaded
+ * fit from kmeans_pp_init(data, K, seed + r) gives, so the result does not
+ * depend on n_threads. Needs dtype="float64".
+ *
+ * Precision:
+ * dtype: "float64" (the default) computes everything in double. "float32"
+ *        stores the points as floats (float32 data is then the one read in
+ *        place, anything else is rounded into a float copy) and computes the
+ *        distances in float, with twice the SIMD lanes and half the memory
+ *        traffic; the cluster sums and the centroids stay double, and the
+ *        centroids still come back as float64. Labels may differ from a
+ *        float64 run on points within float rounding of a cluster boundary.
+ *        Only algorithm="lloyd" supports it.
+ *
+ * Output:
+ * out:    optional writable K x dim float64 buffer that receives the final centroids.
+ * labels: optional writable N-element int32 buffer that receives the cluster of
+ *         every point, as chosen by the last Assignment Step.
+ * output: "list" returns the centroids as a list of lists (the default);
+ *         "buffer" returns a (centroids, labels) tuple of buffers - `out` and
+ *         `labels` when given, otherwise new memoryviews (usable with np.asarray).
+ *
+ * Engine:
+ * algorithm: "lloyd" (the default) assigns one point at a time; "blocked" uses
+ *            the tiled ||x||^2 - 2x.c + ||c||^2 expansion, faster for large K;
+ *            "elkan" keeps triangle-inequality bounds (N x K of them) and skips
+ *            the distances they rule out, fast once the clusters settle;
+ *            "hamerly" does the same with a single lower bound per point, so
+ *            it needs O(N) rather than O(N * K) extra memory; "yinyang" keeps
+ *            one bound per group of about ten centroids and skips whole
+ *            groups at a time, meant for K in the thousands. These five give
+ *            exactly the same centroids and labels.
+ *            "kdtree" sorts the points into a kd-tree once, with the sum and
+ *            count of every cell, and adds a cell in one step once a single
+ *            centroid is left for it; meant for many points in few
+ *            dimensions (up to about 8). Its labels are the same as Lloyd's,
+ *            but the sums are added cell by cell, so the centroids may differ
+ *            in the last bits (as with n_threads > 1).
+ * n_threads: threads for the Assignment Step (0 = one per CPU). The GIL is
+ *            released while the engine runs. With more than one thread the
+ *            cluster sums are added in another order, so the centroids may
+ *            differ from the single-threaded ones in the last bits (but are
+ *            the same from run to run for a given n_threads).
+ * stats:     optional dict that receives "iterations", "distance_evals" and
+ *            "distance_evals_avoided" (out of N * K per iteration); without
+ *            centroids also "inertia", "seed" and "iterations" of the run
+ *            kept, and "inertias" of every run (distances over all of them).
+ * history:   optional list that receives one dict per iteration, in order:
+ *            "assign_seconds" and "update_seconds" (wall time of the two
+ *            steps), "inertia" (sum of the squared distances of the points
+ *            to the centroid the Assignment Step gave them), "max_shift" and
+ *            "mean_shift" (distances the centroids moved in the Update
+ *            Step), "reassigned" (points that changed cluster, all of them
+ *            in the first iteration) and "empty_clusters" (clusters that got
+ *            no point and were re-seeded with the first one). Collecting it
+ *            costs one extra pass over the data per iteration; without it,
+ *            nothing. Not with n_init > 1.
+ */
+
+static PyObject* fit(PyObject *self, PyObject *args, PyObject *kwargs) {
+    /* Variable Declarations (ANSI C style - all at top) */
+    static char *kwlist[] = {"K", "iter", "epsilon", "data", "centroids",
+                             "out", "labels", "output", "algorithm", "n_threads", "stats", "dtype",
+                             "n_init", "seed", "history", NULL};
+    struct arena arena;
+    struct matrix data;
+    struct matrix_f32 data_f32;
+    struct matrix centroids;
+    struct kmeans_workspace ws;
+    struct kmeans_restarts restarts;
+    struct kmeans_options opts;
+    struct kmeans_stats stats;
+    struct kmeans_telemetry telemetry;
+    struct py_matrix data_src, centroid_src;
+    Py_buffer out_view, labels_view;
+    int K, iter;
+    int n_threads = 1;
+    double epsilon;
+    PyObject *data_obj, *centroid_obj;
+    PyObject *out_obj = Py_None, *labels_obj = Py_None, *stats_obj = Py_None;
+    PyObject *history_obj = Py_None;
+    PyObject *new_out = NULL, *new_labels = NULL;
+    PyObject *result = NULL;
+    const char *output = "list";
+    const char *algorithm = "lloyd";
+    const char *dtype = "float64";
+    double *out_data = NULL;
+    int *labels_data = NULL;
+    int dim;
+    int as_buffers;
+    int is_float32;
+    int data_in_place;
+    int n_init = 1;
+    long long seed = 1234;
+    int seeding;
+    int best_run = 0;
+    size_t arena_bytes;
+    double started = kmeans_trace_on ? kmeans_telemetry_clock() : 0.0;
+
+    /*  Parse arguments from Python */
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "iidOO|$OOssiOsiLO", kwlist, &K, &iter, &epsilon,
+                                    &data_obj, &centroid_obj, &out_obj, &labels_obj, &output,
+                                    &algorithm, &n_threads, &stats_obj, &dtype, &n_init, &seed,
+                                    &history_obj)) {
+        return NULL;
+    }
+    seeding = centroid_obj == Py_None;
+    if (n_init < 1 || (n_init > 1 && !seeding)) {
+        PyErr_SetString(PyExc_ValueError, "n_init must be >= 1, and n_init > 1 needs centroids=None");
+        return NULL;
+    }
+    if (seeding && (seed < 0 || seed + n_init - 1 > 0xffffffffLL)) {
+        PyErr_SetString(PyExc_ValueError, "seed + n_init - 1 must be between 0 and 2**32 - 1");
+        return NULL;
+    }
+    if (stats_obj != Py_None && !PyDict_Check(stats_obj)) {
+        PyErr_SetString(PyExc_TypeError, "stats must be a dict");
+        return NULL;
+    }
+    if (history_obj != Py_None && !PyList_Check(history_obj)) {
+        PyErr_SetString(PyExc_TypeError, "history must be a list");
+        return NULL;
+    }
+    if (history_obj != Py_None && n_init > 1) {
+        PyErr_SetString(PyExc_ValueError, "history needs n_init=1");
+        return NULL;
+    }
+    if (n_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "n_threads must be >= 0");
+        return NULL;
+    }
+    opts.iter = iter;
+    opts.epsilon = epsilon;
+    opts.n_threads = n_threads == 0 ? kmeans_cpu_count() : n_threads;
+    if (parse_algorithm(algorithm, &opts.algorithm) != 0) {
+        return NULL;
+    }
+    if (strcmp(output, "list") == 0) {
+        as_buffers = 0;
+    }
+    else if (strcmp(output, "buffer") == 0) {
+        as_buffers = 1;
+    }
+    else {
+        PyErr_SetString(PyExc_ValueError, "output must be \"list\" or \"buffer\"");
+        return NULL;
+    }
+    if (strcmp(dtype, "float64") == 0) {
+        is_float32 = 0;
+    }
+    else if (strcmp(dtype, "float32") == 0) {
+        is_float32 = 1;
+    }
+    else {
+        PyErr_SetString(PyExc_ValueError, "dtype must be \"float64\" or \"float32\"");
+        return NULL;
+    }
+    if (is_float32 && opts.algorithm != KMEANS_LLOYD) {
+        PyErr_SetString(PyExc_ValueError, "dtype=\"float32\" only supports algorithm=\"lloyd\"");
+        return NULL;
+    }
+    if (is_float32 && seeding) {
+        PyErr_SetString(PyExc_ValueError, "centroids=None (seeding) needs dtype=\"float64\"");
+        return NULL;
+    }
+
+    /* Find the shapes first, so everything can live in one arena */
+    centroid_src.type = PY_MATRIX_LIST;
+    if (python_matrix_open(data_obj, &data_src) != 0) return NULL;
+    if (seeding) {
+        if (K < 1 || (Py_ssize_t)K > data_src.rows) {
+            PyErr_SetString(PyExc_ValueError, "fit without centroids needs 1 <= K <= the number of points");
+            goto done;
+        }
+    }
+    else {
+        if (python_matrix_open(centroid_obj, &centroid_src) != 0) {
+            python_matrix_close(&data_src);
+            return NULL;
+        }
+        if (centroid_src.dim != data_src.dim) {
+            PyErr_SetString(PyExc_ValueError, "centroids and data points must have the same dimension");
+            goto done;
+        }
+        /* As before, the number of clusters is the number of initial centroids */
+        K = (int)centroid_src.rows;
+    }
+    dim = data_src.dim;
+
+    /* Output buffers: the caller's when given, otherwise new ones in buffer mode */
+    if (out_obj != Py_None) {
+        if (python_output_open(out_obj, &out_view, 'd', (Py_ssize_t)K * dim, "out") != 0) goto done;
+        out_data = out_view.buf;
+    }
+    else if (as_buffers) {
+        new_out = new_output_buffer('d', K, dim, (void **)&out_data);
+        if (new_out == NULL) goto done;
+    }
+    if (labels_obj != Py_None) {
+        if (python_output_open(labels_obj, &labels_view, 'i', data_src.rows, "labels") != 0) goto done;
+        labels_data = labels_view.buf;
+    }
+    else if (as_buffers) {
+        new_labels = new_output_buffer('i', data_src.rows, 0, (void **)&labels_data);
+        if (new_labels == NULL) goto done;
+    }
+
+    /* Buffers of the working precision are used in place; centroids are always copied since fit moves them */
+    data_in_place = data_src.type == (is_float32 ? PY_MATRIX_FLOAT32 : PY_MATRIX_FLOAT64);
+
+    /* One allocation for the data (unless used in place), the centroids and the accumulators */
+    arena_bytes = arena_block_size((size_t)K * (size_t)dim * sizeof(double))
+                + (seeding ? kmeans_restarts_bytes((size_t)data_src.rows, K, dim, &opts, n_init)
+                 : is_float32 ? kmeans_f32_bytes((size_t)data_src.rows, K, dim, &opts)
+                              : kmeans_workspace_bytes((size_t)data_src.rows, K, dim, &opts));
+    if (!data_in_place) {
+        arena_bytes += arena_block_size((size_t)data_src.rows * (size_t)dim
+                                        * (is_float32 ? sizeof(float) : sizeof(double)));
+    }
+    if (history_obj != Py_None) {
+        arena_bytes += kmeans_telemetry_bytes((size_t)data_src.rows, K, dim, iter > 0 ? iter : 0);
+    }
+    if (arena_init(&arena, arena_bytes) != 0) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    if (data_in_place) {
+        data.data = data_src.view.buf;
+        data.rows = (size_t)data_src.rows;
+        data.dim = dim;
+        data_f32.data = data_src.view.buf;
+        data_f32.rows = (size_t)data_src.rows;
+        data_f32.dim = dim;
+    }
+    else if (is_float32 ? matrix_f32_carve(&data_f32, &arena, (size_t)data_src.rows, dim) != 0
+                        : matrix_carve(&data, &arena, (size_t)data_src.rows, dim) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (matrix_carve(&centroids, &arena, (size_t)K, dim) != 0
+        || (seeding ? kmeans_restarts_carve(&restarts, &arena, (size_t)data_src.rows, K, dim, &opts, n_init)
+            : is_float32 ? kmeans_f32_carve(&ws, &arena, (size_t)data_src.rows, K, dim, &opts)
+                         : kmeans_workspace_carve(&ws, &arena, (size_t)data_src.rows, K, dim, &opts)) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (history_obj != Py_None) {
+        if (kmeans_telemetry_carve(&telemetry, &arena, (size_t)data_src.rows, K, dim, iter > 0 ? iter : 0) != 0) {
+            PyErr_NoMemory();
+            goto cleanup;
+        }
+        /* The single run of a seeded fit happens in the first slot */
+        if (seeding) {
+            restarts.slots[0].ws.telemetry = &telemetry;
+        }
+        else {
+            ws.telemetry = &telemetry;
+        }
+    }
+
+    /*  Convert the inputs to dense C blocks */
+    if (!data_in_place && (is_float32 ? python_matrix_copy_f32(&data_src, &data_f32)
+                                      : python_matrix_copy(&data_src, &data)) != 0) {
+        goto cleanup;
+    }
+    if (!seeding && python_matrix_copy(&centroid_src, &centroids) != 0) {
+        goto cleanup;
+    }
+
+    if (kmeans_trace_on) {
+        kmeans_trace_span("fit marshal", started, -1);
+        started = kmeans_telemetry_clock();
+    }
+
+    /* The engine touches no Python objects, and the buffers stay exported until done */
+    Py_BEGIN_ALLOW_THREADS
+    if (seeding) {
+        best_run = kmeans_restarts_run(&data, &restarts, &opts, n_init, (unsigned long long)seed,
+                                       &centroids, labels_data, &stats);
+    }
+    else if (is_float32) {
+        kmeans_lloyd_f32(&data_f32, &centroids, &ws, &opts, labels_data, &stats);
+    }
+    else {
+        kmeans_lloyd(&data, &centroids, &ws, &opts, labels_data, &stats);
+    }
+    Py_END_ALLOW_THREADS
+    if (kmeans_trace_on) {
+        kmeans_trace_span("fit engine", started, -1);
+        started = kmeans_telemetry_clock();
+    }
+
+    if (stats_obj != Py_None && python_fill_stats(stats_obj, &stats) != 0) {
+        goto cleanup;
+    }
+    if (stats_obj != Py_None && seeding && python_fill_restart_stats(stats_obj, &restarts, n_init, best_run,
+                                                                    seed) != 0) {
+        goto cleanup;
+    }
+    if (history_obj != Py_None && python_fill_history(history_obj, &telemetry) != 0) {
+        goto cleanup;
+    }
+
+    if (out_data != NULL) {
+        memcpy(out_data, centroids.data, (size_t)K * (size_t)dim * sizeof(double));
+    }
+
+    if (as_buffers) {
+        /* Hand back the caller's buffers when given, the new ones otherwise */
+        result = PyTuple_Pack(2, new_out != NULL ? new_out : out_obj,
+                                 new_labels != NULL ? new_labels : labels_obj);
+    }
+    else {
+        /* Convert result back to Python list */
+        result = c_matrix_to_python(&centroids);
+    }
+    if (kmeans_trace_on) {
+        kmeans_trace_span("fit output", started, -1);
+    }
+
+    /* Memory Cleanup */
+cleanup:
+    arena_free(&arena);
+done:
+    if (out_data != NULL && new_out == NULL) PyBuffer_Release(&out_view);
+    if (labels_data != NULL && new_labels == NULL) PyBuffer_Release(&labels_view);
+    Py_XDECREF(new_out);
+    Py_XDECREF(new_labels);
+    python_matrix_close(&data_src);
+    python_matrix_close(&centroid_src);
+    return result;
+}
+
+/*
+ * Mini-batch K-means callable from Python, for data too large for full Lloyd passes.
+ * Expected Python args: (K, batch_size, max_steps, data, centroids, *, tol=0.0,
+ *                        max_no_improvement=10, seed=0, final_pass=True,
+ *                        out=None, labels=None, output="list", n_threads=1,
+ *                        stats=None)
+ * data, centroids, out and output work as in fit. Every step samples
+ * batch_size points (with replacement, reproducibly for a given seed) and
+ * moves each centroid towards the mean of the points it got, with a learning
+ * rate of 1 / (points it got so far).
+ *
+ * Stopping:
+ * max_steps:          maximum number of batches.
+ * tol, max_no_improvement: stop once the smoothed mean squared distance of
+ *                     the batches has not dropped by a factor (1 - tol) for
+ *                     max_no_improvement steps in a row (0 = never).
+ *
+ * Final pass:
+ * final_pass: assign every point to the final centroids once at the end;
+ *             labels then receives them (labels needs final_pass), and in
+ *             buffer mode the labels of the tuple are None without it.
+ *
+ * n_threads: threads for the assignments (0 = one per CPU), GIL released.
+ * stats:     optional dict that receives "steps", "points_seen",
+ *            "smoothed_inertia", "seconds" and "points_per_second" (of the
+ *            steps, without the final pass), "distance_evals", and "inertia"
+ *            (total squared distance, final pass only).
+ */
+static PyObject* fit_minibatch(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"K", "batch_size", "max_steps", "data", "centroids",
+                             "tol", "max_no_improvement", "seed", "final_pass",
+                             "out", "labels", "output", "n_threads", "stats", NULL};
+    struct arena arena;
+    struct matrix data;
+    struct matrix centroids;
+    struct kmeans_workspace ws;
+    struct kmeans_minibatch_options opts;
+    struct kmeans_minibatch_stats stats;
+    struct py_matrix data_src, centroid_src;
+    Py_buffer out_view, labels_view;
+    int K, max_steps;
+    Py_ssize_t batch_size;
+    double tol = 0.0;
+    int max_no_improvement = 10;
+    unsigned long long seed = 0;
+    int final_pass = 1;
+    int n_threads = 1;
+    PyObject *data_obj, *centroid_obj;
+    PyObject *out_obj = Py_None, *labels_obj = Py_None, *stats_obj = Py_None;
+    PyObject *new_out = NULL, *new_labels = NULL;
+    PyObject *result = NULL;
+    const char *output = "list";
+    double *out_data = NULL;
+    int *labels_data = NULL;
+    int dim;
+    int as_buffers;
+    int data_in_place;
+    size_t arena_bytes;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "iniOO|$diKpOOsiO", kwlist, &K, &batch_size,
+                                     &max_steps, &data_obj, &centroid_obj, &tol, &max_no_improvement,
+                                     &seed, &final_pass, &out_obj, &labels_obj, &output,
+                                     &n_threads, &stats_obj)) {
+        return NULL;
+    }
+    if (stats_obj != Py_None && !PyDict_Check(stats_obj)) {
+        PyErr_SetString(PyExc_TypeError, "stats must be a dict");
+        return NULL;
+    }
+    if (batch_size < 1 || max_steps < 0 || max_no_improvement < 0 || !(tol >= 0.0)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "batch_size must be >= 1, max_steps and max_no_improvement >= 0, tol >= 0");
+        return NULL;
+    }
+    if (n_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "n_threads must be >= 0");
+        return NULL;
+    }
+    if (labels_obj != Py_None && !final_pass) {
+        PyErr_SetString(PyExc_ValueError, "labels needs final_pass");
+        return NULL;
+    }
+    opts.batch_size = (size_t)batch_size;
+    opts.max_steps = max_steps;
+    opts.tol = tol;
+    opts.max_no_improvement = max_no_improvement;
+    opts.seed = seed;
+    opts.final_pass = final_pass;
+    opts.n_threads = n_threads == 0 ? kmeans_cpu_count() : n_threads;
+    if (strcmp(output, "list") == 0) {
+        as_buffers = 0;
+    }
+    else if (strcmp(output, "buffer") == 0) {
+        as_buffers = 1;
+    }
+    else {
+        PyErr_SetString(PyExc_ValueError, "output must be \"list\" or \"buffer\"");
+        return NULL;
+    }
+
+    if (python_matrix_open(data_obj, &data_src) != 0) return NULL;
+    if (python_matrix_open(centroid_obj, &centroid_src) != 0) {
+        python_matrix_close(&data_src);
+        return NULL;
+    }
+    if (centroid_src.dim != data_src.dim) {
+        PyErr_SetString(PyExc_ValueError, "centroids and data points must have the same dimension");
+        goto done;
+    }
+    K = (int)centroid_src.rows;
+    dim = data_src.dim;
+
+    if (out_obj != Py_None) {
+        if (python_output_open(out_obj, &out_view, 'd', (Py_ssize_t)K * dim, "out") != 0) goto done;
+        out_data = out_view.buf;
+    }
+    else if (as_buffers) {
+        new_out = new_output_buffer('d', K, dim, (void **)&out_data);
+        if (new_out == NULL) goto done;
+    }
+    if (labels_obj != Py_None) {
+        if (python_output_open(labels_obj, &labels_view, 'i', data_src.rows, "labels") != 0) goto done;
+        labels_data = labels_view.buf;
+    }
+    else if (as_buffers && final_pass) {
+        new_labels = new_output_buffer('i', data_src.rows, 0, (void **)&labels_data);
+        if (new_labels == NULL) goto done;
+    }
+
+    /* The workspace is sized for one batch; only the data itself is N rows */
+    data_in_place = data_src.type == PY_MATRIX_FLOAT64;
+    arena_bytes = arena_block_size((size_t)K * (size_t)dim * sizeof(double))
+                + kmeans_minibatch_bytes(K, dim, &opts);
+    if (!data_in_place) {
+        arena_bytes += arena_block_size((size_t)data_src.rows * (size_t)dim * sizeof(double));
+    }
+    if (arena_init(&arena, arena_bytes) != 0) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    if (data_in_place) {
+        data.data = data_src.view.buf;
+        data.rows = (size_t)data_src.rows;
+        data.dim = dim;
+    }
+    else if (matrix_carve(&data, &arena, (size_t)data_src.rows, dim) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (matrix_carve(&centroids, &arena, (size_t)K, dim) != 0
+        || kmeans_minibatch_carve(&ws, &arena, K, dim, &opts) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+
+    if ((!data_in_place && python_matrix_copy(&data_src, &data) != 0)
+        || python_matrix_copy(&centroid_src, &centroids) != 0) {
+        goto cleanup;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    kmeans_minibatch(&data, &centroids, &ws, &opts, labels_data, &stats);
+    Py_END_ALLOW_THREADS
+
+    if (stats_obj != Py_None && python_fill_minibatch_stats(stats_obj, &stats, final_pass) != 0) {
+        goto cleanup;
+    }
+
+    if (out_data != NULL) {
+        memcpy(out_data, centroids.data, (size_t)K * (size_t)dim * sizeof(double));
+    }
+
+    if (as_buffers) {
+        result = PyTuple_Pack(2, new_out != NULL ? new_out : out_obj,
+                                 new_labels != NULL ? new_labels : labels_obj);
+    }
+    else {
+        result = c_matrix_to_python(&centroids);
+    }
+
+cleanup:
+    arena_free(&arena);
+done:
+    if (out_data != NULL && new_out == NULL) PyBuffer_Release(&out_view);
+    if (labels_data != NULL && new_labels == NULL) PyBuffer_Release(&labels_view);
+    Py_XDECREF(new_out);
+    Py_XDECREF(new_labels);
+    python_matrix_close(&data_src);
+    python_matrix_close(&centroid_src);
+    return result;
+}
+
+/*
+ * K-means over a data set streamed from disk, for data larger than memory.
+ * Expected Python args: (path, K, iter, epsilon, centroids, *, dtype="float64",
+ *                        offset=0, chunk_rows=65536, out=None, labels=None,
+ *                        output="list", algorithm="lloyd", n_threads=1,
+ *                        stats=None)
+ * path names a flat binary file of row-major points: native-endian float64
+ * (or float32 with dtype="float32"), dim of them per row, dim being the
+ * dimension of the centroids, after `offset` bytes of header (e.g. the
+ * output of numpy's ndarray.tofile). The file is memory-mapped and every
+ * iteration scans it once, chunk_rows points at a time, so only the
+ * centroids and one chunk need to fit in memory.
+ *
+ * algorithm is "lloyd" or "blocked" (the other engines keep state for every
+ * point). With one thread the centroids are exactly those fit gives on the
+ * same data. The other keywords work as in fit; note that labels holds one
+ * int32 per point of the file.
+ */
+static PyObject* fit_file(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"path", "K", "iter", "epsilon", "centroids",
+                             "dtype", "offset", "chunk_rows", "out", "labels", "output",
+                             "algorithm", "n_threads", "stats", NULL};
+    struct arena arena;
+    struct matrix centroids;
+    struct kmeans_workspace ws;
+    struct kmeans_options opts;
+    struct kmeans_stats stats;
+    struct kmeans_source src;
+    struct py_matrix centroid_src;
+    Py_buffer out_view, labels_view;
+    PyObject *path_bytes = NULL;
+    int K, iter;
+    int n_threads = 1;
+    double epsilon;
+    Py_ssize_t offset = 0;
+    Py_ssize_t chunk_rows = 65536;
+    PyObject *centroid_obj;
+    PyObject *out_obj = Py_None, *labels_obj = Py_None, *stats_obj = Py_None;
+    PyObject *new_out = NULL, *new_labels = NULL;
+    PyObject *result = NULL;
+    const char *dtype = "float64";
+    const char *output = "list";
+    const char *algorithm = "lloyd";
+    double *out_data = NULL;
+    int *labels_data = NULL;
+    int is_float32;
+    int as_buffers;
+    int rc;
+    size_t chunk;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&iidO|$snnOOssiO", kwlist,
+                                     PyUnicode_FSConverter, &path_bytes, &K, &iter, &epsilon,
+                                     &centroid_obj, &dtype, &offset, &chunk_rows, &out_obj,
+                                     &labels_obj, &output, &algorithm, &n_threads, &stats_obj)) {
+        return NULL;
+    }
+    if (stats_obj != Py_None && !PyDict_Check(stats_obj)) {
+        PyErr_SetString(PyExc_TypeError, "stats must be a dict");
+        goto early;
+    }
+    if (n_threads < 0 || offset < 0 || chunk_rows < 1) {
+        PyErr_SetString(PyExc_ValueError, "n_threads and offset must be >= 0, chunk_rows >= 1");
+        goto early;
+    }
+    if (strcmp(dtype, "float64") == 0) {
+        is_float32 = 0;
+    }
+    else if (strcmp(dtype, "float32") == 0) {
+        is_float32 = 1;
+    }
+    else {
+        PyErr_SetString(PyExc_ValueError, "dtype must be \"float64\" or \"float32\"");
+        goto early;
+    }
+    opts.iter = iter;
+    opts.epsilon = epsilon;
+    opts.n_threads = n_threads == 0 ? kmeans_cpu_count() : n_threads;
+    if (parse_algorithm(algorithm, &opts.algorithm) != 0) {
+        goto early;
+    }
+    if (opts.algorithm != KMEANS_LLOYD && opts.algorithm != KMEANS_BLOCKED) {
+        PyErr_SetString(PyExc_ValueError, "fit_file supports the \"lloyd\" and \"blocked\" algorithms");
+        goto early;
+    }
+    if (strcmp(output, "list") == 0) {
+        as_buffers = 0;
+    }
+    else if (strcmp(output, "buffer") == 0) {
+        as_buffers = 1;
+    }
+    else {
+        PyErr_SetString(PyExc_ValueError, "output must be \"list\" or \"buffer\"");
+        goto early;
+    }
+
+    if (python_matrix_open(centroid_obj, &centroid_src) != 0) {
+        goto early;
+    }
+    K = (int)centroid_src.rows;
+
+    rc = kmeans_source_open(&src, PyBytes_AS_STRING(path_bytes), centroid_src.dim, is_float32, (size_t)offset);
+    if (rc == -1) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(path_bytes));
+        python_matrix_close(&centroid_src);
+        goto early;
+    }
+    if (rc != 0) {
+        PyErr_Format(PyExc_ValueError, "%s does not hold a whole number of %d-dimensional %s rows after offset %zd",
+                     PyBytes_AS_STRING(path_bytes), centroid_src.dim, dtype, offset);
+        python_matrix_close(&centroid_src);
+        goto early;
+    }
+
+    if (out_obj != Py_None) {
+        if (python_output_open(out_obj, &out_view, 'd', (Py_ssize_t)K * centroid_src.dim, "out") != 0) goto done;
+        out_data = out_view.buf;
+    }
+    else if (as_buffers) {
+        new_out = new_output_buffer('d', K, centroid_src.dim, (void **)&out_data);
+        if (new_out == NULL) goto done;
+    }
+    if (labels_obj != Py_None) {
+        if (python_output_open(labels_obj, &labels_view, 'i', (Py_ssize_t)src.rows, "labels") != 0) goto done;
+        labels_data = labels_view.buf;
+    }
+    else if (as_buffers) {
+        new_labels = new_output_buffer('i', (Py_ssize_t)src.rows, 0, (void **)&labels_data);
+        if (new_labels == NULL) goto done;
+    }
+
+    /* Only the centroids and one chunk of state: nothing here grows with the file */
+    chunk = (size_t)chunk_rows < src.rows ? (size_t)chunk_rows : src.rows;
+    if (arena_init(&arena, arena_block_size((size_t)K * (size_t)centroid_src.dim * sizeof(double))
+                           + kmeans_stream_bytes(chunk, K, centroid_src.dim, &opts)) != 0) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    if (matrix_carve(&centroids, &arena, (size_t)K, centroid_src.dim) != 0
+        || kmeans_stream_carve(&ws, &arena, chunk, K, centroid_src.dim, &opts) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (python_matrix_copy(&centroid_src, &centroids) != 0) {
+        goto cleanup;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    rc = kmeans_lloyd_stream(&src, &centroids, &ws, &opts, labels_data, &stats);
+    Py_END_ALLOW_THREADS
+    if (rc < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(path_bytes));
+        goto cleanup;
+    }
+
+    if (stats_obj != Py_None && python_fill_stats(stats_obj, &stats) != 0) {
+        goto cleanup;
+    }
+
+    if (out_data != NULL) {
+        memcpy(out_data, centroids.data, (size_t)K * (size_t)centroid_src.dim * sizeof(double));
+    }
+
+    if (as_buffers) {
+        result = PyTuple_Pack(2, new_out != NULL ? new_out : out_obj,
+                                 new_labels != NULL ? new_labels : labels_obj);
+    }
+    else {
+        result = c_matrix_to_python(&centroids);
+    }
+
+cleanup:
+    arena_free(&arena);
+done:
+    if (out_data != NULL && new_out == NULL) PyBuffer_Release(&out_view);
+    if (labels_data != NULL && new_labels == NULL) PyBuffer_Release(&labels_view);
+    Py_XDECREF(new_out);
+    Py_XDECREF(new_labels);
+    kmeans_source_close(&src);
+    python_matrix_close(&centroid_src);
+early:
+    Py_XDECREF(path_bytes);
+    return result;
+}
+
+/*
+ * k-means++ seeding callable from Python.
+ * Expected Python args: (data, K, seed=1234, n_threads=1, n_local_trials=1,
+ *                        sampling="parallel", init="k-means++", rounds=5,
+ *                        oversampling=2K)
+ * Returns the list of the K row indices chosen, in order. Points are drawn
+ * with probability proportional to their distance to the closest centroid
+ * chosen so far, from the generator np.random.seed(seed) sets up, like
+ * kmeans_pp_init in kmeans_pp.py.
+ *
+ * init: "k-means||" samples about `oversampling` candidates per pass over the
+ *       data for `rounds` passes instead of one pass per centroid, then picks
+ *       K of them with a weighted k-means++ (K must not exceed the number of
+ *       points). sampling and n_local_trials only apply to "k-means++".
+ *
+ * sampling: "numpy" reproduces kmeans_pp_init's indices exactly (for float64
+ *           data), with a serial pass per draw; "parallel" (the default)
+ *           draws through per-block prefix sums, which may only differ on
+ *           draws within rounding error of a boundary between two points.
+ * n_local_trials: candidates per centroid; with more than one, the one
+ *           leaving the smallest sum of distances is kept (greedy k-means++).
+ * n_threads: threads for the distance passes (0 = one per CPU), GIL released.
+ */
+static PyObject* kmeanspp_init(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"data", "K", "seed", "n_threads", "n_local_trials", "sampling", "init",
+                             "rounds", "oversampling", NULL};
+    struct arena arena;
+    struct matrix data;
+    struct kmeans_seed_workspace ws;
+    struct kmeans_seed_options opts;
+    struct py_matrix data_src;
+    PyObject *data_obj;
+    PyObject *result = NULL;
+    PyObject *index;
+    long long seed = 1234;
+    int K;
+    int n_threads = 1;
+    int n_local_trials = 1;
+    const char *sampling = "parallel";
+    const char *init = "k-means++";
+    int rounds = 5;
+    double oversampling = 0.0;
+    int scalable;
+    size_t *chosen;
+    size_t arena_bytes;
+    int data_in_place;
+    int k;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oi|Liissid", kwlist, &data_obj, &K, &seed,
+                                     &n_threads, &n_local_trials, &sampling, &init, &rounds, &oversampling)) {
+        return NULL;
+    }
+    if (K < 1 || n_local_trials < 1) {
+        PyErr_SetString(PyExc_ValueError, "K and n_local_trials must be >= 1");
+        return NULL;
+    }
+    if (seed < 0 || seed > 0xffffffffLL) {
+        PyErr_SetString(PyExc_ValueError, "seed must be between 0 and 2**32 - 1");
+        return NULL;
+    }
+    if (n_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "n_threads must be >= 0");
+        return NULL;
+    }
+    if (strcmp(sampling, "parallel") == 0) {
+        opts.numpy_sampling = 0;
+    }
+    else if (strcmp(sampling, "numpy") == 0) {
+        opts.numpy_sampling = 1;
+    }
+    else {
+        PyErr_SetString(PyExc_ValueError, "sampling must be \"parallel\" or \"numpy\"");
+        return NULL;
+    }
+    if (strcmp(init, "k-means++") == 0) {
+        scalable = 0;
+    }
+    else if (strcmp(init, "k-means||") == 0) {
+        scalable = 1;
+    }
+    else {
+        PyErr_SetString(PyExc_ValueError, "init must be \"k-means++\" or \"k-means||\"");
+        return NULL;
+    }
+    if (rounds < 0) {
+        PyErr_SetString(PyExc_ValueError, "rounds must be >= 0");
+        return NULL;
+    }
+    opts.seed = (unsigned long long)seed;
+    opts.n_threads = n_threads == 0 ? kmeans_cpu_count() : n_threads;
+    opts.n_local_trials = n_local_trials;
+    opts.rounds = rounds;
+    opts.oversampling = oversampling;
+
+    if (python_matrix_open(data_obj, &data_src) != 0) {
+        return NULL;
+    }
+    if (scalable && (Py_ssize_t)K > data_src.rows) {
+        PyErr_SetString(PyExc_ValueError, "k-means|| needs K <= the number of points");
+        goto done;
+    }
+
+    data_in_place = data_src.type == PY_MATRIX_FLOAT64;
+    arena_bytes = arena_block_size((size_t)K * sizeof(size_t))
+                + (scalable ? kmeans_parallel_seed_bytes((size_t)data_src.rows, K, data_src.dim, &opts)
+                            : kmeans_seed_bytes((size_t)data_src.rows, data_src.dim, &opts));
+    if (!data_in_place) {
+        arena_bytes += arena_block_size((size_t)data_src.rows * (size_t)data_src.dim * sizeof(double));
+    }
+    if (arena_init(&arena, arena_bytes) != 0) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    if (data_in_place) {
+        data.data = data_src.view.buf;
+        data.rows = (size_t)data_src.rows;
+        data.dim = data_src.dim;
+    }
+    else if (matrix_carve(&data, &arena, (size_t)data_src.rows, data_src.dim) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    chosen = arena_alloc(&arena, (size_t)K * sizeof(size_t));
+    if (chosen == NULL
+        || (scalable ? kmeans_parallel_seed_carve(&ws, &arena, (size_t)data_src.rows, K, data_src.dim, &opts)
+                     : kmeans_seed_carve(&ws, &arena, (size_t)data_src.rows, data_src.dim, &opts)) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (!data_in_place && python_matrix_copy(&data_src, &data) != 0) {
+        goto cleanup;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    if (scalable) {
+        kmeans_parallel_seed(&data, K, &ws, &opts, chosen);
+    }
+    else {
+        kmeans_pp_seed(&data, K, &ws, &opts, chosen);
+    }
+    Py_END_ALLOW_THREADS
+
+    result = PyList_New(K);
+    if (result == NULL) {
+        goto cleanup;
+    }
+    for (k = 0; k < K; k++) {
+        index = PyLong_FromSize_t(chosen[k]);
+        if (index == NULL) {
+            Py_CLEAR(result);
+            goto cleanup;
+        }
+        PyList_SET_ITEM(result, k, index);
+    }
+
+cleanup:
+    arena_free(&arena);
+done:
+    python_matrix_close(&data_src);
+    return result;
+}
+
+/*
+ * Incremental refit callable from Python: resumes the Lloyd iterations of an
+ * earlier fit or refit after points were added to or deleted from the data,
+ * and updates its state in place.
+ * Expected Python args: (iter, epsilon, data, centroids, labels, sums, counts, *,
+ *                        deleted=None, deleted_labels=None, bounds=None,
+ *                        rebuild=False, n_threads=1, stats=None)
+ * Returns the number of iterations performed.
+ *
+ * State (writable C-contiguous buffers, e.g. numpy arrays, kept between calls):
+ * centroids: K x dim float64, the centroids of the previous run; receives the new ones.
+ * labels:    N int32, one per point of data: the previous label of every
+ *            point kept, -1 for new points; receives the new labels.
+ * sums:      K x dim float64 and
+ * counts:    K int32, the sum and the number of the points of every cluster.
+ *            After a plain fit, pass rebuild=True to compute them from labels.
+ * bounds:    optional 2 x N float64 distance bounds of every point (row 0
+ *            upper, row 1 lower), as the previous refit left them; negative
+ *            upper bounds mean unknown (start from np.full((2, N), -1.0)).
+ *            Without them every point is scanned once per refit; with them
+ *            only new points and those the bounds cannot settle are.
+ *
+ * Changes:
+ * data:      the current points (list of lists or float64/float32 buffer);
+ *            labels and bounds follow their order.
+ * deleted:   the points removed since the previous run, and
+ * deleted_labels: the int32 labels they had (both or neither).
+ *
+ * Iterations stop once no centroid moves by epsilon or more, or after iter
+ * of them. A refit costs a bounds check per point plus work in proportion
+ * to the points added, deleted or moving between clusters.
+ * n_threads: threads for the Assignment Steps (0 = one per CPU), GIL released.
+ * stats:     optional dict that receives "iterations", "distance_evals" and
+ *            "distance_evals_avoided" (out of N * K per pass, the first one
+ *            that places the new points included).
+ */
+static PyObject* refit(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"iter", "epsilon", "data", "centroids", "labels", "sums", "counts",
+                             "deleted", "deleted_labels", "bounds", "rebuild", "n_threads", "stats", NULL};
+    struct arena arena;
+    struct matrix data, centroids, deleted;
+    struct kmeans_refit_state state;
+    struct kmeans_workspace ws;
+    struct kmeans_options opts;
+    struct kmeans_stats stats;
+    struct py_matrix data_src, centroid_src, deleted_src;
+    Py_buffer centroid_view, labels_view, sums_view, counts_view, bounds_view, deleted_labels_view;
+    int iter;
+    int n_threads = 1;
+    int rebuild = 0;
+    double epsilon;
+    PyObject *data_obj, *centroid_obj, *labels_obj, *sums_obj, *counts_obj;
+    PyObject *deleted_obj = Py_None, *deleted_labels_obj = Py_None, *bounds_obj = Py_None;
+    PyObject *stats_obj = Py_None;
+    PyObject *result = NULL;
+    int have_centroids = 0, have_labels = 0, have_sums = 0, have_counts = 0, have_bounds = 0;
+    int have_deleted = 0, have_deleted_labels = 0;
+    int data_in_place, deleted_in_place;
+    int K, dim, rc;
+    Py_ssize_t N, M = 0, i;
+    const int *check;
+    size_t arena_bytes;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "idOOOOO|$OOOpiO", kwlist, &iter, &epsilon,
+                                     &data_obj, &centroid_obj, &labels_obj, &sums_obj, &counts_obj,
+                                     &deleted_obj, &deleted_labels_obj, &bounds_obj, &rebuild,
+                                     &n_threads, &stats_obj)) {
+        return NULL;
+    }
+    if (stats_obj != Py_None && !PyDict_Check(stats_obj)) {
+        PyErr_SetString(PyExc_TypeError, "stats must be a dict");
+        return NULL;
+    }
+    if (n_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "n_threads must be >= 0");
+        return NULL;
+    }
+    if ((deleted_obj == Py_None) != (deleted_labels_obj == Py_None)) {
+        PyErr_SetString(PyExc_ValueError, "deleted and deleted_labels go together");
+        return NULL;
+    }
+    opts.iter = iter;
+    opts.epsilon = epsilon;
+    opts.algorithm = KMEANS_HAMERLY;
+    opts.n_threads = n_threads == 0 ? kmeans_cpu_count() : n_threads;
+
+    /* Shapes first: K and dim from the centroids, N from the data */
+    if (python_matrix_open(data_obj, &data_src) != 0) return NULL;
+    if (python_matrix_open(centroid_obj, &centroid_src) != 0) {
+        python_matrix_close(&data_src);
+        return NULL;
+    }
+    if (centroid_src.dim != data_src.dim) {
+        PyErr_SetString(PyExc_ValueError, "centroids and data points must have the same dimension");
+        goto done;
+    }
+    K = (int)centroid_src.rows;
+    dim = data_src.dim;
+    N = data_src.rows;
+    if (deleted_obj != Py_None) {
+        if (python_matrix_open(deleted_obj, &deleted_src) != 0) goto done;
+        have_deleted = 1;
+        M = deleted_src.rows;
+        if (deleted_src.dim != dim) {
+            PyErr_SetString(PyExc_ValueError, "deleted and data points must have the same dimension");
+            goto done;
+        }
+    }
+
+    /* The state is updated in place */
+    if (python_output_open(centroid_obj, &centroid_view, 'd', (Py_ssize_t)K * dim, "centroids") != 0) goto done;
+    have_centroids = 1;
+    if (python_output_open(labels_obj, &labels_view, 'i', N, "labels") != 0) goto done;
+    have_labels = 1;
+    if (python_output_open(sums_obj, &sums_view, 'd', (Py_ssize_t)K * dim, "sums") != 0) goto done;
+    have_sums = 1;
+    if (python_output_open(counts_obj, &counts_view, 'i', K, "counts") != 0) goto done;
+    have_counts = 1;
+    if (bounds_obj != Py_None) {
+        if (python_output_open(bounds_obj, &bounds_view, 'd', 2 * N, "bounds") != 0) goto done;
+        have_bounds = 1;
+    }
+    if (have_deleted) {
+        if (python_output_open(deleted_labels_obj, &deleted_labels_view, 'i', M, "deleted_labels") != 0) goto done;
+        have_deleted_labels = 1;
+    }
+
+    /* Labels index the sums, so check them all before anything runs */
+    check = labels_view.buf;
+    for (i = 0; i < N; i++) {
+        if (check[i] < -1 || check[i] >= K) {
+            PyErr_Format(PyExc_ValueError, "labels must be between -1 and %d", K - 1);
+            goto done;
+        }
+    }
+    if (have_deleted) {
+        check = deleted_labels_view.buf;
+        for (i = 0; i < M; i++) {
+            if (check[i] < 0 || check[i] >= K) {
+                PyErr_Format(PyExc_ValueError, "deleted_labels must be between 0 and %d", K - 1);
+                goto done;
+            }
+        }
+    }
+
+    /* float64 points are used in place, anything else is copied */
+    data_in_place = data_src.type == PY_MATRIX_FLOAT64;
+    deleted_in_place = !have_deleted || deleted_src.type == PY_MATRIX_FLOAT64;
+    arena_bytes = kmeans_refit_bytes(have_bounds ? 0 : (size_t)N, K, dim, &opts);
+    if (!data_in_place) {
+        arena_bytes += arena_block_size((size_t)N * (size_t)dim * sizeof(double));
+    }
+    if (!deleted_in_place) {
+        arena_bytes += arena_block_size((size_t)M * (size_t)dim * sizeof(double));
+    }
+    if (arena_init(&arena, arena_bytes) != 0) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    if (data_in_place) {
+        data.data = data_src.view.buf;
+        data.rows = (size_t)N;
+        data.dim = dim;
+    }
+    else if (matrix_carve(&data, &arena, (size_t)N, dim) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (have_deleted && deleted_in_place) {
+        deleted.data = deleted_src.view.buf;
+        deleted.rows = (size_t)M;
+        deleted.dim = dim;
+    }
+    else if (have_deleted && matrix_carve(&deleted, &arena, (size_t)M, dim) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (kmeans_refit_carve(&ws, &arena, have_bounds ? 0 : (size_t)N, K, dim, &opts) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (!data_in_place && python_matrix_copy(&data_src, &data) != 0) {
+        goto cleanup;
+    }
+    if (!deleted_in_place && python_matrix_copy(&deleted_src, &deleted) != 0) {
+        goto cleanup;
+    }
+
+    centroids.data = centroid_view.buf;
+    centroids.rows = (size_t)K;
+    centroids.dim = dim;
+    state.sums.data = sums_view.buf;
+    state.sums.rows = (size_t)K;
+    state.sums.dim = dim;
+    state.counts = counts_view.buf;
+    state.labels = labels_view.buf;
+    state.upper = have_bounds ? (double *)bounds_view.buf : NULL;
+    state.lower = have_bounds ? (double *)bounds_view.buf + N : NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    if (rebuild) {
+        kmeans_refit_rebuild(&data, &state);
+    }
+    rc = kmeans_refit(&data, &centroids, &state, have_deleted ? &deleted : NULL,
+                      have_deleted ? deleted_labels_view.buf : NULL, &ws, &opts, &stats);
+    Py_END_ALLOW_THREADS
+
+    if (rc < 0) {
+        PyErr_SetString(PyExc_ValueError, "deleted points outnumber the points counted in their clusters");
+        goto cleanup;
+    }
+    if (stats_obj != Py_None && python_fill_stats(stats_obj, &stats) != 0) {
+        goto cleanup;
+    }
+    result = PyLong_FromLong(rc);
+
+cleanup:
+    arena_free(&arena);
+done:
+    if (have_centroids) PyBuffer_Release(&centroid_view);
+    if (have_labels) PyBuffer_Release(&labels_view);
+    if (have_sums) PyBuffer_Release(&sums_view);
+    if (have_counts) PyBuffer_Release(&counts_view);
+    if (have_bounds) PyBuffer_Release(&bounds_view);
+    if (have_deleted_labels) PyBuffer_Release(&deleted_labels_view);
+    if (have_deleted) python_matrix_close(&deleted_src);
+    python_matrix_close(&data_src);
+    python_matrix_close(&centroid_src);
+    return result;
+}
+
+/*
+ * K sweep callable from Python, for elbow curves.
+ * Expected Python args: (data, k_min, k_max, *, iter=300, epsilon=0.001,
+ *                        seed=1234, algorithm="lloyd", n_threads=1, stats=None)
+ * Runs K-means for every K from k_min to k_max (1 <= k_min <= k_max <= N)
+ * and returns the list of their inertias (sum of squared distances of the
+ * points to their final centroid), k_min first.
+ *
+ * Every K starts from the first K of one k-means++ seeding for k_max, which
+ * are the seeds kmeans_pp_init(data, K, seed) in kmeans_pp.py picks, so the
+ * inertia for K is that of fit(K, iter, epsilon, data, None, seed=seed). The
+ * runs share one copy of the data (and, for "blocked", the ||x||^2 of the
+ * points) and run concurrently on n_threads threads, one K per thread, so
+ * the results do not depend on n_threads.
+ *
+ * data:      list of lists or float64/float32 buffer (float64 read in place).
+ * algorithm: as in fit, except "yinyang".
+ * stats:     optional dict that receives "iterations" (a list, one per K) and
+ *            "distance_evals" (over all the runs, the seeding excluded).
+ */
+static PyObject* sweep(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"data", "k_min", "k_max", "iter", "epsilon", "seed", "algorithm",
+                             "n_threads", "stats", NULL};
+    struct arena arena;
+    struct matrix data;
+    struct kmeans_sweep sw;
+    struct kmeans_options opts;
+    struct kmeans_stats stats;
+    struct py_matrix data_src;
+    int k_min, k_max, k;
+    int iter = 300;
+    int n_threads = 1;
+    double epsilon = 0.001;
+    long long seed = 1234;
+    const char *algorithm = "lloyd";
+    PyObject *data_obj, *stats_obj = Py_None;
+    PyObject *inertias = NULL, *iterations = NULL, *value;
+    PyObject *result = NULL;
+    int data_in_place;
+    int dim;
+    size_t arena_bytes;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oii|$idLsiO", kwlist, &data_obj, &k_min, &k_max,
+                                     &iter, &epsilon, &seed, &algorithm, &n_threads, &stats_obj)) {
+        return NULL;
+    }
+    if (stats_obj != Py_None && !PyDict_Check(stats_obj)) {
+        PyErr_SetString(PyExc_TypeError, "stats must be a dict");
+        return NULL;
+    }
+    if (n_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "n_threads must be >= 0");
+        return NULL;
+    }
+    if (seed < 0 || seed > 0xffffffffLL) {
+        PyErr_SetString(PyExc_ValueError, "seed must be between 0 and 2**32 - 1");
+        return NULL;
+    }
+    opts.iter = iter;
+    opts.epsilon = epsilon;
+    opts.n_threads = n_threads == 0 ? kmeans_cpu_count() : n_threads;
+    if (parse_algorithm(algorithm, &opts.algorithm) != 0) {
+        return NULL;
+    }
+    if (opts.algorithm == KMEANS_YINYANG) {
+        PyErr_SetString(PyExc_ValueError, "sweep does not support algorithm=\"yinyang\"");
+        return NULL;
+    }
+
+    if (python_matrix_open(data_obj, &data_src) != 0) return NULL;
+    if (k_min < 1 || k_min > k_max || (Py_ssize_t)k_max > data_src.rows) {
+        PyErr_SetString(PyExc_ValueError, "sweep needs 1 <= k_min <= k_max <= the number of points");
+        goto done;
+    }
+    dim = data_src.dim;
 
+    data_in_place = data_src.type == PY_MATRIX_FLOAT64;
+    arena_bytes = kmeans_sweep_bytes((size_t)data_src.rows, k_min, k_max, dim, &opts);
+    if (!data_in_place) {
+        arena_bytes += arena_block_size((size_t)data_src.rows * (size_t)dim * sizeof(double));
+    }
+    if (arena_init(&arena, arena_bytes) != 0) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    if (data_in_place) {
+        data.data = data_src.view.buf;
+        data.rows = (size_t)data_src.rows;
+        data.dim = dim;
+    }
+    else if (matrix_carve(&data, &arena, (size_t)data_src.rows, dim) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (kmeans_sweep_carve(&sw, &arena, (size_t)data_src.rows, k_min, k_max, dim, &opts) != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (!data_in_place && python_matrix_copy(&data_src, &data) != 0) {
+        goto cleanup;
+    }
 
+    Py_BEGIN_ALLOW_THREADS
+    kmeans_sweep_run(&data, &sw, &opts, k_min, k_max, (unsigned long long)seed, &stats);
+    Py_END_ALLOW_THREADS
 
+    inertias = PyList_New(k_max - k_min + 1);
+    iterations = PyList_New(k_max - k_min + 1);
+    if (inertias == NULL || iterations == NULL) {
+        goto cleanup;
+    }
+    for (k = 0; k <= k_max - k_min; k++) {
+        value = PyFloat_FromDouble(sw.inertias[k]);
+        if (value == NULL) goto cleanup;
+        PyList_SET_ITEM(inertias, k, value);
+        value = PyLong_FromLong(sw.iterations[k]);
+        if (value == NULL) goto cleanup;
+        PyList_SET_ITEM(iterations, k, value);
+    }
+    if (stats_obj != Py_None) {
+        if (dict_set_new(stats_obj, "distance_evals", PyLong_FromUnsignedLongLong(stats.distance_evals)) != 0) {
+            goto cleanup;
+        }
+        Py_INCREF(iterations);
+        if (dict_set_new(stats_obj, "iterations", iterations) != 0) {
+            goto cleanup;
+        }
+    }
+    result = inertias;
+    inertias = NULL;
+
+cleanup:
+    arena_free(&arena);
+done:
+    Py_XDECREF(inertias);
+    Py_XDECREF(iterations);
+    python_matrix_close(&data_src);
+    return result;
+}
 
-/*implementations of structs*/
-struct cord
-{
-    double value;
-    struct cord *next; /* Points to the next dimension/coordinate in the vector */
-};
-struct vector
+/*
+ * A .kmc cache file (kmeans_cache.c) mapped in memory, exported as read-only
+ * bytes: the keys and data load_and_merge returns from a cache are views
+ * into it, and keep it mapped for as long as they live.
+ */
+struct py_cache_mapping
 {
-    struct vector *next; /* Points to the next data point (vector) in the list */
-    struct cord *cords; /* Points to the head of the coordinates list for this vector */
+    PyObject_HEAD
+    struct kmeans_cache cache;
 };
 
+/* The whole file, as read-only unsigned bytes */
+static int py_cache_mapping_getbuffer(PyObject *obj, Py_buffer *view, int flags) {
+    struct py_cache_mapping *self = (struct py_cache_mapping *)obj;
 
-/* Frees all memory allocated for the vectors and their internal coordinate lists */
-void free_vector_list(struct vector *head_vec) {
-    struct vector *curr_vec = head_vec;
-    struct vector *next_vec;
-    struct cord *curr_c, *next_c;
-
-    while (curr_vec != NULL) {
-        curr_c = curr_vec->cords;
-        while (curr_c != NULL) {
-            next_c = curr_c->next;
-            free(curr_c);
-            curr_c = next_c;
-        }
-        next_vec = curr_vec->next;
-        free(curr_vec);
-        curr_vec = next_vec;
-    }
+    return PyBuffer_FillInfo(view, obj, (void *)self->cache.map, (Py_ssize_t)self->cache.map_bytes, 1, flags);
 }
 
-/* Resets all coordinates of a given vector to 0.0*/
-void zero_out_vector(struct vector *v) {
-    struct cord *c = v->cords;
+static void py_cache_mapping_dealloc(PyObject *obj) {
+    struct py_cache_mapping *self = (struct py_cache_mapping *)obj;
 
-    while (c != NULL) {
-        c->value = 0.0;
-        c = c->next;
-    }
+    kmeans_cache_close(&self->cache);
+    Py_TYPE(obj)->tp_free(obj);
 }
 
+static PyBufferProcs py_cache_mapping_as_buffer = {
+    py_cache_mapping_getbuffer,
+    NULL
+};
+
+static PyTypeObject py_cache_mapping_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mykmeanssp._CacheMapping",
+    .tp_basicsize = sizeof(struct py_cache_mapping),
+    .tp_dealloc = py_cache_mapping_dealloc,
+    .tp_as_buffer = &py_cache_mapping_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "A .kmc cache file mapped in memory",
+};
 
 /*
- * Adds the coordinate values of vector v2 to vector v1.
- * v1 is modified in place (accumulating the sum), while v2 remains unchanged.
+ * A rows x dim float64 view (1-D when dim is 0) of the mapping, starting
+ * offset bytes in: what new_output_buffer returns, without the copy.
+ * Returns NULL with a Python exception set on failure.
  */
-struct vector *add_coordinates_from_other_vector(struct vector *v1, struct vector *v2, int dim) {
-    struct cord *curr_cord1 = v1->cords;
-    const struct cord *curr_cord2 = v2->cords;
-    int i;
-
-    for (i = 0; i < dim; i++) {
-        /* Add the value from the second vector to the first */
-        curr_cord1->value += curr_cord2->value;
+static PyObject* mapped_output_buffer(PyObject *mapping, size_t offset, Py_ssize_t rows, int dim) {
+    PyObject *bytes, *slice, *result;
+    Py_ssize_t count = dim > 0 ? rows * dim : rows;
 
-        /* Move to the next coordinate */
-        curr_cord1 = curr_cord1->next;
-        curr_cord2 = curr_cord2->next;
+    bytes = PyMemoryView_FromObject(mapping);
+    if (bytes == NULL) {
+        return NULL;
     }
-
-    return v1; /* Return the modified vector (useful for chaining) */
-}
-
-/*
- * Divides every coordinate in vector v by a scalar integer.
- * This is used in the Update Step to calculate the average (mean) of a cluster.
- */
-void divide_vector_by_scalar(struct vector *v, int scalar) {
-    struct cord *c = v->cords;
-    while(c != NULL) {
-        c->value /= scalar;
-        c = c->next;
+    slice = PySequence_GetSlice(bytes, (Py_ssize_t)offset, (Py_ssize_t)offset + count * (Py_ssize_t)sizeof(double));
+    Py_DECREF(bytes);
+    if (slice == NULL) {
+        return NULL;
+    }
+    if (dim > 0) {
+        result = PyObject_CallMethod(slice, "cast", "s(ni)", "d", rows, dim);
     }
+    else {
+        result = PyObject_CallMethod(slice, "cast", "s", "d");
+    }
+    Py_DECREF(slice);
+    return result;
 }
 
-
 /*
- * Allocates memory for K vectors, initialized to zero.
- * These vectors serve as accumulators for calculating new centroids during iterations.
- * Returns a pointer to the head of the list, or NULL if allocation fails.
+ * The input files of kmeans_pp.py, read without pandas.
+ * Expected Python args: (file1, file2, *, n_threads=1, cache=None)
+ * Parses two CSV files of numbers (no header) and inner-joins them on their
+ * first column, like
+ *     pd.merge(pd.read_csv(file1, header=None), pd.read_csv(file2, header=None),
+ *              on=0, how="inner").sort_values(0)
+ * Returns (keys, data): the keys as an N float64 buffer, in ascending order
+ * (NaN last), and the other columns of file1 followed by those of file2 as
+ * an N x dim float64 buffer (both usable with np.asarray; flat when N is
+ * 0). Rows with equal keys come in merge order. Numbers are correctly
+ * rounded, like float_precision="round_trip" (pandas' default parser can be
+ * one unit in the last place off for 17-digit numbers).
+ * n_threads: threads for parsing and copying (0 = one per CPU), GIL released.
+ * cache:     optional path of a .kmc file (kmeans_cache.c). If it holds the
+ *            join of the two files as they are now (same sizes and
+ *            modification times), keys and data are read-only views of it,
+ *            mapped in memory: nothing is parsed, and the pages are only read
+ *            when used (fit takes them in place). Otherwise the files are
+ *            joined as usual and the result is saved there for the next
+ *            call; a cache that cannot be written is skipped silently.
+ * Raises OSError if a file cannot be read, ValueError if it has no rows, a
+ * row with more fields than the first one or a field that is not a number,
+ * or if neither file has columns besides the key.
  */
-struct vector *initialize_sum_vectors(int K, int dim) {
-    struct vector *head_v=NULL, *curr_v=NULL, *new_v;
-    struct cord *head_c, *curr_c;
-    int i,j;
-
-    for(i = 0; i<K; i++) {
-        new_v = malloc(sizeof(struct vector));
-        if(new_v == NULL) {
-            free_vector_list(head_v);
-            return NULL;
+static PyObject* load_and_merge(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"file1", "file2", "n_threads", "cache", NULL};
+    struct kmeans_csv_join join;
+    struct py_cache_mapping *mapping;
+    PyObject *path1, *path2, *cache_obj = Py_None, *cache_path = NULL;
+    PyObject *keys_obj = NULL, *data_obj = NULL;
+    PyObject *result = NULL;
+    const char *paths[2];
+    const char *path;
+    double *keys, *data;
+    unsigned long long source_bytes[2];
+    long long source_mtime_ns[2];
+    int sources_known = 0;
+    int n_threads = 1;
+    int rc;
+    double started = 0.0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&O&|$iO", kwlist, PyUnicode_FSConverter, &path1,
+                                     PyUnicode_FSConverter, &path2, &n_threads, &cache_obj)) {
+        return NULL;
+    }
+    if (cache_obj != Py_None && !PyUnicode_FSConverter(cache_obj, &cache_path)) {
+        goto done;
+    }
+    if (n_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "n_threads must be >= 0");
+        goto done;
+    }
+    paths[0] = PyBytes_AS_STRING(path1);
+    paths[1] = PyBytes_AS_STRING(path2);
+
+    if (cache_path != NULL) {
+        mapping = PyObject_New(struct py_cache_mapping, &py_cache_mapping_type);
+        if (mapping == NULL) goto done;
+        Py_BEGIN_ALLOW_THREADS
+        if (kmeans_trace_on) {
+            started = kmeans_telemetry_clock();
         }
-
-        new_v->next = NULL;
-
-        head_c = malloc(sizeof(struct cord));
-        if(head_c == NULL) {
-            free(new_v);
-            free_vector_list(head_v);
-            return NULL;
+        rc = kmeans_cache_open(&mapping->cache, PyBytes_AS_STRING(cache_path), paths[0], paths[1]);
+        if (kmeans_trace_on) {
+            kmeans_trace_span("cache open", started, -1);
         }
-        curr_c = head_c;
-
-        for(j = 0; j<dim; j++) {
-            curr_c->value = 0.0;
-            if(j<dim-1) {
-                curr_c->next = malloc(sizeof(struct cord));
-
-                if(curr_c->next == NULL) {
-                    new_v->cords = head_c;
-                    if(head_v == NULL) {
-                        head_v = new_v;
-                    } else {
-                        curr_v->next = new_v;
-                    }
-                     free_vector_list(head_v);
-                     return NULL;
-                }
-
-                curr_c = curr_c->next;
-            } else {
-                curr_c->next = NULL;
+        Py_END_ALLOW_THREADS
+        if (rc == 0) {
+            keys_obj = mapped_output_buffer((PyObject *)mapping, (size_t)mapping->cache.header.keys_offset,
+                                            (Py_ssize_t)mapping->cache.header.rows, 0);
+            if (keys_obj != NULL) {
+                data_obj = mapped_output_buffer((PyObject *)mapping, (size_t)mapping->cache.header.data_offset,
+                                                (Py_ssize_t)mapping->cache.header.rows,
+                                                mapping->cache.header.rows > 0 ? (int)mapping->cache.header.dim : 0);
             }
-
+            if (data_obj != NULL) {
+                result = PyTuple_Pack(2, keys_obj, data_obj);
+            }
+            Py_DECREF(mapping); /* The views keep it mapped */
+            goto done;
         }
+        Py_DECREF(mapping);
+        /* Before the files are read: if they change meanwhile, the cache is stale next time */
+        sources_known = kmeans_cache_stat(paths[0], &source_bytes[0], &source_mtime_ns[0]) == 0
+                     && kmeans_cache_stat(paths[1], &source_bytes[1], &source_mtime_ns[1]) == 0;
+    }
 
-       new_v->cords = head_c;
+    Py_BEGIN_ALLOW_THREADS
+    rc = kmeans_csv_join_open(&join, paths[0], paths[1], n_threads == 0 ? kmeans_cpu_count() : n_threads);
+    Py_END_ALLOW_THREADS
 
-       if(head_v == NULL) {
-          head_v = new_v;
-          curr_v = head_v;
-       } else {
-          curr_v->next = new_v;
-          curr_v = curr_v->next;
-       }
+    path = paths[join.error_file];
+    if (rc == -1) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        goto cleanup;
+    }
+    if (rc == -2 && join.error_line == 0) {
+        PyErr_Format(PyExc_ValueError, "%s: no data", path);
+        goto cleanup;
+    }
+    if (rc == -2 && join.error_fields > 0) {
+        PyErr_Format(PyExc_ValueError, "%s: expected %d fields in line %zu, saw %d", path,
+                     join.left.fields * (join.error_file == 0) + join.right.fields * (join.error_file == 1),
+                     join.error_line, join.error_fields);
+        goto cleanup;
+    }
+    if (rc == -2) {
+        PyErr_Format(PyExc_ValueError, "%s: line %zu has a field that is not a number", path, join.error_line);
+        goto cleanup;
+    }
+    if (rc != 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (join.dim == 0) {
+        PyErr_SetString(PyExc_ValueError, "the files have no columns besides the key");
+        goto cleanup;
+    }
 
+    keys_obj = new_output_buffer('d', (Py_ssize_t)join.rows, 0, (void **)&keys);
+    if (keys_obj == NULL) goto cleanup;
+    /* memoryview cannot take a 0 x dim shape: an empty join gives a flat empty buffer */
+    data_obj = new_output_buffer('d', (Py_ssize_t)join.rows, join.rows > 0 ? join.dim : 0, (void **)&data);
+    if (data_obj == NULL) goto cleanup;
+
+    Py_BEGIN_ALLOW_THREADS
+    kmeans_csv_join_gather(&join, keys, data);
+    if (sources_known) {
+        if (kmeans_trace_on) {
+            started = kmeans_telemetry_clock();
+        }
+        kmeans_cache_write(PyBytes_AS_STRING(cache_path), keys, data, join.rows, join.dim,
+                           source_bytes, source_mtime_ns);
+        if (kmeans_trace_on) {
+            kmeans_trace_span("cache write", started, -1);
+        }
     }
-    return head_v;
+    Py_END_ALLOW_THREADS
+
+    result = PyTuple_Pack(2, keys_obj, data_obj);
+
+cleanup:
+    kmeans_csv_join_close(&join);
+done:
+    Py_XDECREF(keys_obj);
+    Py_XDECREF(data_obj);
+    Py_DECREF(path1);
+    Py_DECREF(path2);
+    Py_XDECREF(cache_path);
+    return result;
 }
 
-
-
 /*
- * Calculates the Euclidean distance between two vectors (points). 
- * It iterates through the coordinates, sums the squared differences, 
- * and returns the square root of that sum.
+ * mykmeanssp.KMeans: a model that stays in native memory between calls.
+ *
+ * KMeans(n_clusters=0, *, iter=300, epsilon=0.001, algorithm="lloyd",
+ *        n_threads=1, dtype="float64", seed=1234)
+ * fit(data, centroids=None) runs the Lloyd iterations like mykmeanssp.fit
+ * (from the given initial centroids, or from n_clusters k-means++ seeds when
+ * there are none) and keeps the final centroids, with the copies and norms
+ * the kernels need, in native memory. predict, transform and score then
+ * take new points (lists of lists or float64/float32 buffers, read in place
+ * when they have the model's dtype) without touching the model again:
+ * predict(data, *, out=None) -> int32 labels of the closest final centroids
+ * transform(data, *, out=None) -> N x K float64 distances to every centroid
+ * score(data) -> inertia, the sum of the squared distances to the closest centroids
+ * The centroids attribute reads (and sets, to load a model) the centroids as
+ * a K x dim float64 buffer. The GIL is released during the native work, and
+ * the calls on one model run one at a time.
  */
-double compute_distance(const struct vector *v1, const struct vector *v2, int dim) {
-    double diff;
-    double cord_val1, cord_val2;
-    double distance;
-    struct cord *curr_cord1, *curr_cord2;
-    int i;
-    double sum_dist = 0.0;
-    curr_cord1 = v1->cords;
-    curr_cord2 = v2->cords;
-    
-    for(i = 0; i<dim; i++) {
 
-        if (curr_cord1 == NULL || curr_cord2 == NULL) {
-            return 0.0; 
-        }
+/* A KMeans object: its settings, plus the fitted model in its own arena */
+struct py_kmeans
+{
+    PyObject_HEAD
+    int n_clusters;              /* Clusters to seed when fit gets no centroids (0 = none set) */
+    int iter;
+    double epsilon;
+    enum kmeans_algorithm algorithm;
+    int n_threads;
+    int is_float32;
+    unsigned long long seed;     /* k-means++ seed, as in kmeanspp_init */
+    struct arena arena;          /* Holds the model; empty until fitted */
+    struct kmeans_model model;
+    int fitted;
+    int n_iter;                  /* Iterations of the last fit */
+    PyObject *labels;            /* int32 labels of the last fit, or NULL */
+    PyThread_type_lock lock;     /* Serializes the native calls on the model */
+};
 
-        cord_val1 = (*curr_cord1).value;
-        cord_val2 = (*curr_cord2).value;
-        diff = cord_val1 - cord_val2;
-        sum_dist += diff * diff;
-        curr_cord1 = curr_cord1->next;
-        curr_cord2 = curr_cord2->next;
+/* Creates an empty, unfitted KMeans */
+static PyObject* py_kmeans_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    struct py_kmeans *self;
+
+    self = (struct py_kmeans *)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        return NULL;
     }
-    distance = sqrt(sum_dist);
-    return distance;
+    self->n_clusters = 0;
+    self->iter = 300;
+    self->epsilon = 0.001;
+    self->algorithm = KMEANS_LLOYD;
+    self->n_threads = 1;
+    self->is_float32 = 0;
+    self->seed = 1234;
+    self->arena.base = NULL;
+    self->arena.capacity = 0;
+    self->arena.used = 0;
+    self->fitted = 0;
+    self->n_iter = 0;
+    self->labels = NULL;
+    self->lock = PyThread_allocate_lock();
+    if (self->lock == NULL) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    return (PyObject *)self;
 }
 
-
-
-/*
- * Iterates through all centroids to find the one closest to vectorX.
- * Returns the index (0 to K-1) of the closest centroid.
- */
-int find_closest_centroid(const struct vector *centroids, const struct vector *vectorX, int K, int dim) {
-    int min_index = 0;
-    int i;
-    const struct vector *curr_centroid = centroids;
-    double distance, min_distance;
-    min_distance = compute_distance(curr_centroid, vectorX, dim);
-    curr_centroid = curr_centroid->next;
-    for(i = 1; i<K; i++) {
-        distance = compute_distance(curr_centroid, vectorX, dim);
-        if(distance<min_distance) {
-            min_distance = distance;
-            min_index = i;
-        }
-        curr_centroid = curr_centroid->next;
+/* KMeans(n_clusters=0, *, iter=300, epsilon=0.001, algorithm="lloyd", n_threads=1, dtype="float64", seed=1234) */
+static int py_kmeans_init(PyObject *obj, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"n_clusters", "iter", "epsilon", "algorithm", "n_threads", "dtype", "seed", NULL};
+    struct py_kmeans *self = (struct py_kmeans *)obj;
+    enum kmeans_algorithm algorithm;
+    const char *algorithm_name = "lloyd";
+    const char *dtype = "float64";
+    int n_clusters = 0, iter = 300, n_threads = 1;
+    double epsilon = 0.001;
+    long long seed = 1234;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i$idsisL", kwlist, &n_clusters, &iter, &epsilon,
+                                     &algorithm_name, &n_threads, &dtype, &seed)) {
+        return -1;
     }
-    return min_index;
+    if (n_clusters < 0 || iter < 0 || n_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "n_clusters, iter and n_threads must be >= 0");
+        return -1;
+    }
+    if (seed < 0 || seed > 0xffffffffLL) {
+        PyErr_SetString(PyExc_ValueError, "seed must be between 0 and 2**32 - 1");
+        return -1;
+    }
+    if (parse_algorithm(algorithm_name, &algorithm) != 0) {
+        return -1;
+    }
+    if (strcmp(dtype, "float64") != 0 && strcmp(dtype, "float32") != 0) {
+        PyErr_SetString(PyExc_ValueError, "dtype must be \"float64\" or \"float32\"");
+        return -1;
+    }
+    if (strcmp(dtype, "float32") == 0 && algorithm != KMEANS_LLOYD) {
+        PyErr_SetString(PyExc_ValueError, "dtype=\"float32\" only supports algorithm=\"lloyd\"");
+        return -1;
+    }
+    self->n_clusters = n_clusters;
+    self->iter = iter;
+    self->epsilon = epsilon;
+    self->algorithm = algorithm;
+    self->n_threads = n_threads == 0 ? kmeans_cpu_count() : n_threads;
+    self->is_float32 = strcmp(dtype, "float32") == 0;
+    self->seed = (unsigned long long)seed;
+    return 0;
 }
 
+static void py_kmeans_dealloc(PyObject *obj) {
+    struct py_kmeans *self = (struct py_kmeans *)obj;
 
-
-/* Frees all memory allocated for the coordinates */
- void free_cords_list(struct cord *head_c) {
-    struct cord *curr;
-    struct cord *temp;
-
-    curr = head_c;
-    while (curr != NULL) {
-        temp = curr;
-        curr = curr->next;
-        free(temp);
+    arena_free(&self->arena);
+    Py_XDECREF(self->labels);
+    if (self->lock != NULL) {
+        PyThread_free_lock(self->lock);
     }
+    Py_TYPE(obj)->tp_free(obj);
 }
 
+/* Takes the model lock, letting other Python threads run while waiting for it */
+static void py_kmeans_lock(struct py_kmeans *self) {
+    if (!PyThread_acquire_lock(self->lock, NOWAIT_LOCK)) {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(self->lock, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
+    }
+}
 
 /*
- * Converts a Python list of lists (e.g., [[1.0, 2.0], ...]) into a C linked list.
- * * Args:
- * py_list: Pointer to the Python list object.
- * N: Pointer to store the number of vectors found.
- * dim: Pointer to store the dimension of the vectors.
- * * Returns:
- * Pointer to the head of the new C linked list.
+ * Makes centroids the model (with the lock held), reallocating it when the
+ * shape changed. Returns 0 on success, -1 with a Python exception set otherwise.
  */
-struct vector* python_to_c_list(PyObject *py_list, int *N, int *dim) {
+static int py_kmeans_set_model(struct py_kmeans *self, const struct matrix *centroids) {
+    struct arena arena;
+    int K = (int)centroids->rows;
+    int dim = centroids->dim;
+
+    if (!self->fitted || self->model.centroids.rows != centroids->rows || self->model.centroids.dim != dim) {
+        if (arena_init(&arena, kmeans_model_bytes(K, dim, self->n_threads)) != 0) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        arena_free(&self->arena);
+        self->arena = arena;
+        self->fitted = 0;
+        if (kmeans_model_carve(&self->model, &self->arena, K, dim, self->n_threads) != 0) {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    memcpy(self->model.centroids.data, centroids->data, (size_t)K * (size_t)dim * sizeof(double));
+    kmeans_model_refresh(&self->model);
+    self->fitted = 1;
+    return 0;
+}
 
-    struct vector *head, *curr, *new_vec;
-    struct cord *head_c, *curr_c, *new_c;
-    PyObject *item, *val;
-    Py_ssize_t n, d;
-    Py_ssize_t i, j;
+/*
+ * Opens the points of a predict/transform/score call and makes them a dense
+ * block of doubles (data) or floats (data_f32, with as_float32): the input
+ * itself when it already has that type, otherwise a copy carved from arena
+ * (which this initializes; free it even on failure). Call it with the lock
+ * held, and keep it until the model is used: waiting for the lock lets a fit
+ * on another thread reshape the model, so checks made before would be stale.
+ * Returns 0 on success, -1 with a Python exception set otherwise.
+ */
+static int py_kmeans_points(struct py_kmeans *self, PyObject *obj, int as_float32, struct py_matrix *src,
+                            struct arena *arena, struct matrix *data, struct matrix_f32 *data_f32) {
+    size_t item = as_float32 ? sizeof(float) : sizeof(double);
+
+    arena->base = NULL;
+    arena->capacity = 0;
+    arena->used = 0;
+    if (!self->fitted) {
+        PyErr_SetString(PyExc_ValueError, "this KMeans is not fitted yet");
+        return -1;
+    }
+    if (python_matrix_open(obj, src) != 0) {
+        return -1;
+    }
+    if (src->dim != self->model.centroids.dim) {
+        PyErr_SetString(PyExc_ValueError, "the points must have the dimension of the centroids");
+        return -1;
+    }
 
-    head = NULL;
-    curr = NULL;
-    n = PyList_Size(py_list);
+    data->rows = data_f32->rows = (size_t)src->rows;
+    data->dim = data_f32->dim = src->dim;
+    if (src->type == (as_float32 ? PY_MATRIX_FLOAT32 : PY_MATRIX_FLOAT64)) {
+        data->data = src->view.buf;
+        data_f32->data = src->view.buf;
+        return 0;
+    }
+    if (arena_init(arena, (size_t)src->rows * (size_t)src->dim * item) != 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (as_float32) {
+        matrix_f32_carve(data_f32, arena, (size_t)src->rows, src->dim);
+        return python_matrix_copy_f32(src, data_f32);
+    }
+    matrix_carve(data, arena, (size_t)src->rows, src->dim);
+    return python_matrix_copy(src, data);
+}
 
-    *N = (int)n; /* Store number of points */
+/* KMeans.fit(data, centroids=None) -> self */
+static PyObject* py_kmeans_fit(PyObject *obj, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"data", "centroids", NULL};
+    struct py_kmeans *self = (struct py_kmeans *)obj;
+    struct arena arena;
+    struct matrix data, seed_data, centroids;
+    struct matrix_f32 data_f32;
+    struct kmeans_workspace ws;
+    struct kmeans_seed_workspace seed_ws;
+    struct kmeans_options opts;
+    struct kmeans_seed_options seed_opts;
+    struct py_matrix data_src, centroid_src;
+    PyObject *data_obj, *centroid_obj = Py_None;
+    PyObject *labels = NULL;
+    PyObject *result = NULL;
+    int *labels_data;
+    size_t *chosen = NULL;
+    size_t arena_bytes, N;
+    int K, dim, k, n_iter;
+    int seeding, data_in_place, seed_in_place;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", kwlist, &data_obj, &centroid_obj)) {
+        return NULL;
+    }
+    seeding = centroid_obj == Py_None;
+    centroid_src.type = PY_MATRIX_LIST;
+    if (python_matrix_open(data_obj, &data_src) != 0) {
+        return NULL;
+    }
+    N = (size_t)data_src.rows;
+    dim = data_src.dim;
+    arena.base = NULL;
 
-    for (i = 0; i < n; i++) {
-        item = PyList_GetItem(py_list, i);  /* Get the inner list (vector) */
-        d = PyList_Size(item);
-        *dim = (int)d; /* Store dimension */
-
-        /* Malloc memory for a vector */
-        new_vec = malloc(sizeof(struct vector));
-        
-        /* Check for memory allocation failure */
-        if (new_vec == NULL) {
-            free_vector_list(head);      /* Clean everything we collected before */
-            PyErr_NoMemory();            /* We tell Python there is a mistake: MemoryError */
-            return NULL;
+    if (!seeding) {
+        if (python_matrix_open(centroid_obj, &centroid_src) != 0) {
+            goto done;
         }
-        
-        new_vec->next = NULL;
-        new_vec->cords = NULL; /* We initialiize to be null */
+        if (centroid_src.dim != dim) {
+            PyErr_SetString(PyExc_ValueError, "centroids and data points must have the same dimension");
+            goto done;
+        }
+        K = (int)centroid_src.rows;
+    }
+    else {
+        K = self->n_clusters;
+        if (K < 1 || (size_t)K > N) {
+            PyErr_SetString(PyExc_ValueError,
+                            "fit without centroids needs 1 <= n_clusters <= the number of points");
+            goto done;
+        }
+    }
 
-        head_c = NULL;
-        curr_c = NULL;
+    labels = new_output_buffer('i', (Py_ssize_t)N, 0, (void **)&labels_data);
+    if (labels == NULL) {
+        goto done;
+    }
 
-        /* Inner loop: Extract coordinates from Python list */
-        for (j = 0; j < d; j++) {
-            val = PyList_GetItem(item, j);
-            
-            new_c = malloc(sizeof(struct cord));
-            
-            /* protection from MALLOC NULL (inside the loop) */
-            if (new_c == NULL) {
-                free(new_c);   
-                free_cords_list(head_c); /* Clean the cooardinate of current vector */
-                free(new_vec);           /* Clean the current vector */
-                free_vector_list(head);  /* Clean all the list */
-                PyErr_NoMemory();        /* Send the error to Python */
-                return NULL;
-            }
+    opts.iter = self->iter;
+    opts.epsilon = self->epsilon;
+    opts.algorithm = self->algorithm;
+    opts.n_threads = self->n_threads;
+    seed_opts.seed = self->seed;
+    seed_opts.n_threads = self->n_threads;
+    seed_opts.n_local_trials = 1;
+    seed_opts.numpy_sampling = 0;
+    seed_opts.rounds = 0;
+    seed_opts.oversampling = 0.0;
+
+    /* Seeding needs the points as doubles: the input or the working copy when they are, a copy otherwise */
+    data_in_place = data_src.type == (self->is_float32 ? PY_MATRIX_FLOAT32 : PY_MATRIX_FLOAT64);
+    seed_in_place = data_src.type == PY_MATRIX_FLOAT64 || !self->is_float32;
+
+    arena_bytes = arena_block_size((size_t)K * (size_t)dim * sizeof(double))
+                + (self->is_float32 ? kmeans_f32_bytes(N, K, dim, &opts)
+                                    : kmeans_workspace_bytes(N, K, dim, &opts));
+    if (!data_in_place) {
+        arena_bytes += arena_block_size(N * (size_t)dim * (self->is_float32 ? sizeof(float) : sizeof(double)));
+    }
+    if (seeding) {
+        arena_bytes += arena_block_size((size_t)K * sizeof(size_t)) + kmeans_seed_bytes(N, dim, &seed_opts);
+        if (!seed_in_place) {
+            arena_bytes += arena_block_size(N * (size_t)dim * sizeof(double));
+        }
+    }
+    if (arena_init(&arena, arena_bytes) != 0) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    if (data_in_place) {
+        data.data = data_src.view.buf;
+        data_f32.data = data_src.view.buf;
+        data.rows = data_f32.rows = N;
+        data.dim = data_f32.dim = dim;
+    }
+    else if (self->is_float32 ? matrix_f32_carve(&data_f32, &arena, N, dim) != 0
+                              : matrix_carve(&data, &arena, N, dim) != 0) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    if (matrix_carve(&centroids, &arena, (size_t)K, dim) != 0
+        || (self->is_float32 ? kmeans_f32_carve(&ws, &arena, N, K, dim, &opts)
+                             : kmeans_workspace_carve(&ws, &arena, N, K, dim, &opts)) != 0) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    if (!data_in_place && (self->is_float32 ? python_matrix_copy_f32(&data_src, &data_f32)
+                                            : python_matrix_copy(&data_src, &data)) != 0) {
+        goto done;
+    }
 
-           /* Convert Python float to C double */
+    if (seeding) {
+        if (data_src.type == PY_MATRIX_FLOAT64) {
+            seed_data.data = data_src.view.buf;
+            seed_data.rows = N;
+            seed_data.dim = dim;
+        }
+        else if (!self->is_float32) {
+            seed_data = data;
+        }
+        else if (matrix_carve(&seed_data, &arena, N, dim) != 0) {
+            PyErr_NoMemory();
+            goto done;
+        }
+        chosen = arena_alloc(&arena, (size_t)K * sizeof(size_t));
+        if (chosen == NULL || kmeans_seed_carve(&seed_ws, &arena, N, dim, &seed_opts) != 0) {
+            PyErr_NoMemory();
+            goto done;
+        }
+        if (!seed_in_place && python_matrix_copy(&data_src, &seed_data) != 0) {
+            goto done;
+        }
+    }
+    else if (python_matrix_copy(&centroid_src, &centroids) != 0) {
+        goto done;
+    }
 
+    py_kmeans_lock(self);
+    Py_BEGIN_ALLOW_THREADS
+    if (seeding) {
+        kmeans_pp_seed(&seed_data, K, &seed_ws, &seed_opts, chosen);
+        for (k = 0; k < K; k++) {
+            memcpy(MATRIX_ROW(&centroids, k), MATRIX_ROW(&seed_data, chosen[k]), (size_t)dim * sizeof(double));
+        }
+    }
+    if (self->is_float32) {
+        n_iter = kmeans_lloyd_f32(&data_f32, &centroids, &ws, &opts, labels_data, NULL);
+    }
+    else {
+        n_iter = kmeans_lloyd(&data, &centroids, &ws, &opts, labels_data, NULL);
+    }
+    Py_END_ALLOW_THREADS
+    k = py_kmeans_set_model(self, &centroids);
+    PyThread_release_lock(self->lock);
+    if (k != 0) {
+        goto done;
+    }
 
-            new_c->value = PyFloat_AsDouble(val);
+    self->n_iter = n_iter;
+    Py_XSETREF(self->labels, labels);
+    labels = NULL;
+    Py_INCREF(obj);
+    result = obj;
+
+done:
+    arena_free(&arena);
+    Py_XDECREF(labels);
+    python_matrix_close(&data_src);
+    python_matrix_close(&centroid_src);
+    return result;
+}
 
-            /* Check if conversion failed (e.g., item was not a number) */
-            if (PyErr_Occurred()) {
-                free_cords_list(head_c);
-                free(new_vec);
-                free_vector_list(head);
-                return NULL;
-            }
+/* KMeans.predict(data, *, out=None) -> int32 labels */
+static PyObject* py_kmeans_predict(PyObject *obj, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"data", "out", NULL};
+    struct py_kmeans *self = (struct py_kmeans *)obj;
+    struct arena arena;
+    struct matrix data;
+    struct matrix_f32 data_f32;
+    struct py_matrix src;
+    Py_buffer out_view;
+    PyObject *data_obj, *out_obj = Py_None;
+    PyObject *result = NULL;
+    int *labels = NULL;
+    int is_float32 = self->is_float32;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$O", kwlist, &data_obj, &out_obj)) {
+        return NULL;
+    }
+    /* Held from the shape checks to the end, so a concurrent fit cannot reshape the model in between */
+    py_kmeans_lock(self);
+    src.type = PY_MATRIX_LIST;
+    if (py_kmeans_points(self, data_obj, is_float32, &src, &arena, &data, &data_f32) != 0) {
+        goto done;
+    }
 
-            new_c->next = NULL;
-            
-            /* Append vector to the main list */
-            if (head_c == NULL) { head_c = new_c; curr_c = new_c; }
-            else { curr_c->next = new_c; curr_c = curr_c->next; }
+    if (out_obj != Py_None) {
+        if (python_output_open(out_obj, &out_view, 'i', src.rows, "out") != 0) {
+            goto done;
+        }
+        labels = out_view.buf;
+    }
+    else {
+        result = new_output_buffer('i', src.rows, 0, (void **)&labels);
+        if (result == NULL) {
+            goto done;
         }
-        new_vec->cords = head_c;
+    }
 
-        if (head == NULL) { head = new_vec; curr = head; }
-        else { curr->next = new_vec; curr = curr->next; }
+    Py_BEGIN_ALLOW_THREADS
+    if (is_float32) {
+        kmeans_model_predict_f32(&self->model, &data_f32, labels);
     }
-    return head;
-}
+    else {
+        kmeans_model_predict(&self->model, &data, labels);
+    }
+    Py_END_ALLOW_THREADS
 
-/*
- * Main K-means algorithm implementation callable from Python.
- * Expected Python args: (K, iter, epsilon, data_list, centroid_list)
- */
+    if (out_obj != Py_None) {
+        PyBuffer_Release(&out_view);
+        Py_INCREF(out_obj);
+        result = out_obj;
+    }
 
-static PyObject* fit(PyObject *self, PyObject *args) {
-    /* Variable Declarations (ANSI C style - all at top) */
-    struct vector *curr_sum;
-    struct vector *curr_cent;
-    struct vector *head_data;
-    struct vector *head_centroids;
-    struct vector *sum_head;
-    struct vector *curr_vec;
-    struct vector *target_sum;
-    struct cord *src;
-    struct cord *dst;
-    struct cord *cent_c;
-    struct cord *sum_c;
-    struct cord *c;
-    int K, iter;
-    double epsilon;
-    int closest_idx;
-    PyObject *data_list, *centroid_list_py;
-    PyObject *result_list;
-    PyObject *py_vec;
-    int *counts;
-    int N, dim;
-    int i, j;
-    int idx;
-    int iteration, converged;
+done:
+    PyThread_release_lock(self->lock);
+    arena_free(&arena);
+    python_matrix_close(&src);
+    return result;
+}
 
-    /*  Parse arguments from Python */
-    if(!PyArg_ParseTuple(args, "iidOO", &K, &iter, &epsilon, &data_list, &centroid_list_py)) {
+/* KMeans.transform(data, *, out=None) -> N x K float64 distances */
+static PyObject* py_kmeans_transform(PyObject *obj, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"data", "out", NULL};
+    struct py_kmeans *self = (struct py_kmeans *)obj;
+    struct arena arena;
+    struct matrix data;
+    struct matrix_f32 data_f32;
+    struct py_matrix src;
+    Py_buffer out_view;
+    PyObject *data_obj, *out_obj = Py_None;
+    PyObject *result = NULL;
+    double *distances = NULL;
+    int K;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$O", kwlist, &data_obj, &out_obj)) {
         return NULL;
     }
+    /* K sizes the output: it must not change before the distances are written */
+    py_kmeans_lock(self);
+    src.type = PY_MATRIX_LIST;
+    if (py_kmeans_points(self, data_obj, 0, &src, &arena, &data, &data_f32) != 0) {
+        goto done;
+    }
+    K = (int)self->model.centroids.rows;
+
+    if (out_obj != Py_None) {
+        if (python_output_open(out_obj, &out_view, 'd', src.rows * K, "out") != 0) {
+            goto done;
+        }
+        distances = out_view.buf;
+    }
+    else {
+        result = new_output_buffer('d', src.rows, K, (void **)&distances);
+        if (result == NULL) {
+            goto done;
+        }
+    }
 
-    /*  Convert Python lists to C linked lists */
-    head_data = python_to_c_list(data_list, &N, &dim);
-    if (!head_data) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    kmeans_model_transform(&self->model, &data, distances);
+    Py_END_ALLOW_THREADS
 
-    /* Convert Python initial centroids list to C linked list */
-    head_centroids = python_to_c_list(centroid_list_py, &K, &dim);
-    if (!head_centroids) {
-        free_vector_list(head_data);
-        return NULL;
+    if (out_obj != Py_None) {
+        PyBuffer_Release(&out_view);
+        Py_INCREF(out_obj);
+        result = out_obj;
     }
 
-    /* Initialize helping structures (accumulators) */
-    sum_head = initialize_sum_vectors(K, dim);
+done:
+    PyThread_release_lock(self->lock);
+    arena_free(&arena);
+    python_matrix_close(&src);
+    return result;
+}
 
-    if (sum_head == NULL) {
-        free_vector_list(head_data);
-        free_vector_list(head_centroids);
-        PyErr_NoMemory();
+/* KMeans.score(data) -> inertia */
+static PyObject* py_kmeans_score(PyObject *obj, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"data", NULL};
+    struct py_kmeans *self = (struct py_kmeans *)obj;
+    struct arena arena;
+    struct matrix data;
+    struct matrix_f32 data_f32;
+    struct py_matrix src;
+    PyObject *data_obj;
+    PyObject *result = NULL;
+    double inertia;
+    int is_float32 = self->is_float32;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &data_obj)) {
         return NULL;
     }
+    py_kmeans_lock(self);
+    src.type = PY_MATRIX_LIST;
+    if (py_kmeans_points(self, data_obj, is_float32, &src, &arena, &data, &data_f32) != 0) {
+        goto done;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    if (is_float32) {
+        inertia = kmeans_model_predict_f32(&self->model, &data_f32, NULL);
+    }
+    else {
+        inertia = kmeans_model_predict(&self->model, &data, NULL);
+    }
+    Py_END_ALLOW_THREADS
+    result = PyFloat_FromDouble(inertia);
+
+done:
+    PyThread_release_lock(self->lock);
+    arena_free(&arena);
+    python_matrix_close(&src);
+    return result;
+}
+
+/* KMeans.centroids: a K x dim float64 copy of the model, or None before fit */
+static PyObject* py_kmeans_get_centroids(PyObject *obj, void *closure) {
+    struct py_kmeans *self = (struct py_kmeans *)obj;
+    PyObject *result;
+    double *out;
 
-    /* Initialize array to count points in each cluster */
-    counts = calloc(K, sizeof(int));
+    if (!self->fitted) {
+        Py_RETURN_NONE;
+    }
+    result = new_output_buffer('d', (Py_ssize_t)self->model.centroids.rows, self->model.centroids.dim,
+                               (void **)&out);
+    if (result != NULL) {
+        memcpy(out, self->model.centroids.data,
+               self->model.centroids.rows * (size_t)self->model.centroids.dim * sizeof(double));
+    }
+    return result;
+}
 
-    if (counts == NULL) {
-        free_vector_list(head_data);
-        free_vector_list(head_centroids);
-        free_vector_list(sum_head);
+/* Setting KMeans.centroids loads a model: predict, transform and score then use those centroids */
+static int py_kmeans_set_centroids(PyObject *obj, PyObject *value, void *closure) {
+    struct py_kmeans *self = (struct py_kmeans *)obj;
+    struct arena arena;
+    struct matrix centroids;
+    struct py_matrix src;
+    int status = -1;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_AttributeError, "cannot delete the centroids");
+        return -1;
+    }
+    if (python_matrix_open(value, &src) != 0) {
+        return -1;
+    }
+    if (arena_init(&arena, arena_block_size((size_t)src.rows * (size_t)src.dim * sizeof(double))) != 0) {
         PyErr_NoMemory();
-        return NULL;
+        goto done;
+    }
+    matrix_carve(&centroids, &arena, (size_t)src.rows, src.dim);
+    if (python_matrix_copy(&src, &centroids) != 0) {
+        goto cleanup;
     }
 
-    iteration = 0;
-    converged = 0;
-
-    /* MAIN K-MEANS LOOP */
-    while (iteration < iter && !converged) {
-        
-        /* Reset accumulators for the new iteration */
-        curr_sum = sum_head;
-        while(curr_sum != NULL) {
-            zero_out_vector(curr_sum);
-            curr_sum = curr_sum->next;
-        }
-        /* Reset counts */
-        for(i = 0; i < K; i++) counts[i] = 0;
-
-        /* Assignment Step: assign each point to the closest centroid */
-        curr_vec = head_data;
-        while(curr_vec != NULL) {
-            closest_idx = find_closest_centroid(head_centroids, curr_vec, K, dim);
-            counts[closest_idx]++;
-
-            /* Find the corresponding sum vector */
-            target_sum = sum_head;
-            for(i = 0; i < closest_idx; i++) target_sum = target_sum->next;
-
-            /* Add current point's coordinates to the cluster sum */
-            add_coordinates_from_other_vector(target_sum, curr_vec, dim);
-            
-            curr_vec = curr_vec->next;
-        }
-
-        /* Update Step: calculate new centroids */
-        converged = 1;
-        curr_cent = head_centroids;
-        curr_sum = sum_head;
-        idx = 0;
-
-        while(curr_cent != NULL) {
-            
-            /* HANDLING EMPTY CLUSTERS */
-            if (counts[idx] == 0) {
-                /* If a cluster is empty, copy coordinates from the FIRST data point */
-                src = head_data->cords; 
-                dst = curr_cent->cords;
-                
-                while(src != NULL && dst != NULL) {
-                    dst->value = src->value; 
-                    src = src->next;
-                    dst = dst->next;
-                }
-                /* If we forced a centroid move, convergence is not reached */
-                converged = 0; 
-            } 
-            else {
-                /* Normal case: calculate the mean (sum / count) */
-                divide_vector_by_scalar(curr_sum, counts[idx]);
-                
-                /* Check convergence: distance between old and new position */
-                if (compute_distance(curr_cent, curr_sum, dim) >= epsilon) {
-                    converged = 0;
-                }
-
-                /* Update centroid coordinates */
-                cent_c = curr_cent->cords;
-                sum_c = curr_sum->cords;
-                while(cent_c != NULL) {
-                    cent_c->value = sum_c->value;
-                    cent_c = cent_c->next;
-                    sum_c = sum_c->next;
-                }
-            }
-            
-            curr_cent = curr_cent->next;
-            curr_sum = curr_sum->next;
-            idx++;
-        }
-        iteration++;
+    py_kmeans_lock(self);
+    status = py_kmeans_set_model(self, &centroids);
+    PyThread_release_lock(self->lock);
+    if (status == 0) {
+        self->n_iter = 0;
+        Py_CLEAR(self->labels);
     }
 
-    /* Convert result back to Python list */
-    result_list = PyList_New(K);
-    curr_cent = head_centroids;
-    for (i = 0; i < K; i++) {
-        py_vec = PyList_New(dim);
-        c = curr_cent->cords;
-        for (j = 0; j < dim; j++) {
-            PyList_SetItem(py_vec, j, PyFloat_FromDouble(c->value));
-            c = c->next;
-        }
-        PyList_SetItem(result_list, i, py_vec);
-        curr_cent = curr_cent->next;
+cleanup:
+    arena_free(&arena);
+done:
+    python_matrix_close(&src);
+    return status;
+}
+
+/* KMeans.labels: int32 labels of the training points from the last fit, or None */
+static PyObject* py_kmeans_get_labels(PyObject *obj, void *closure) {
+    struct py_kmeans *self = (struct py_kmeans *)obj;
+
+    if (self->labels == NULL) {
+        Py_RETURN_NONE;
     }
+    Py_INCREF(self->labels);
+    return self->labels;
+}
 
-    /* Memory Cleanup */
-    free_vector_list(head_data);
-    free_vector_list(head_centroids);
-    free_vector_list(sum_head);
-    free(counts);
+/* KMeans.n_clusters: clusters of the model once fitted, the requested number before */
+static PyObject* py_kmeans_get_n_clusters(PyObject *obj, void *closure) {
+    struct py_kmeans *self = (struct py_kmeans *)obj;
 
-    return result_list;
+    return PyLong_FromLong(self->fitted ? (long)self->model.centroids.rows : (long)self->n_clusters);
+}
+
+/* KMeans.n_iter: iterations of the last fit */
+static PyObject* py_kmeans_get_n_iter(PyObject *obj, void *closure) {
+    return PyLong_FromLong(((struct py_kmeans *)obj)->n_iter);
+}
+
+static PyMethodDef py_kmeans_methods[] = {
+    {"fit", (PyCFunction)(void(*)(void)) py_kmeans_fit, METH_VARARGS | METH_KEYWORDS,
+     "fit(data, centroids=None) -> self: run K-means and keep the centroids"},
+    {"predict", (PyCFunction)(void(*)(void)) py_kmeans_predict, METH_VARARGS | METH_KEYWORDS,
+     "predict(data, *, out=None) -> int32 labels of the closest centroids"},
+    {"transform", (PyCFunction)(void(*)(void)) py_kmeans_transform, METH_VARARGS | METH_KEYWORDS,
+     "transform(data, *, out=None) -> N x K float64 distances to every centroid"},
+    {"score", (PyCFunction)(void(*)(void)) py_kmeans_score, METH_VARARGS | METH_KEYWORDS,
+     "score(data) -> sum of the squared distances to the closest centroids"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef py_kmeans_getset[] = {
+    {"centroids", py_kmeans_get_centroids, py_kmeans_set_centroids,
+     "K x dim float64 centroids (None before fit); set it to load a model", NULL},
+    {"labels", py_kmeans_get_labels, NULL, "int32 labels of the points of the last fit", NULL},
+    {"n_clusters", py_kmeans_get_n_clusters, NULL, "number of clusters", NULL},
+    {"n_iter", py_kmeans_get_n_iter, NULL, "iterations of the last fit", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject py_kmeans_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mykmeanssp.KMeans",
+    .tp_basicsize = sizeof(struct py_kmeans),
+    .tp_dealloc = py_kmeans_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "KMeans(n_clusters=0, *, iter=300, epsilon=0.001, algorithm=\"lloyd\", n_threads=1, "
+              "dtype=\"float64\", seed=1234)\n\nA K-means model kept in native memory between calls.",
+    .tp_methods = py_kmeans_methods,
+    .tp_getset = py_kmeans_getset,
+    .tp_init = py_kmeans_init,
+    .tp_new = py_kmeans_new,
+};
+
+
+/*
+ * Tracing (kmeans_trace.c), switched on by the MYKMEANSSP_TRACE environment
+ * variable: when it names a file at import, every span of the run is
+ * recorded and written there as a Chrome trace-event file when the
+ * interpreter exits (mykmeanssp.TRACE is then True). The C side records its
+ * own spans (CSV parsing, seeding, the fit phases, every Lloyd iteration and
+ * the slices of each thread); Python code adds its own with
+ *     start = mykmeanssp.trace_clock()
+ *     ...
+ *     mykmeanssp.trace_span("name", start)
+ * on the same clock, so they nest with the C ones on the caller's lane.
+ */
+
+/* Path the trace is written to at exit (NULL: not tracing) */
+static char *trace_path = NULL;
+
+/* trace_clock() -> float: the time base of the spans, in seconds */
+static PyObject* trace_clock(PyObject *self, PyObject *args) {
+    (void)self;
+    (void)args;
+    return PyFloat_FromDouble(kmeans_telemetry_clock());
+}
+
+/*
+ * trace_span(name, start, iteration=-1): records the span name from start (a
+ * trace_clock() time) until now on the calling thread's lane; iteration
+ * tags it with a Lloyd iteration. Does nothing when not tracing.
+ */
+static PyObject* trace_span(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"name", "start", "iteration", NULL};
+    const char *name;
+    double start;
+    int iteration = -1;
+
+    (void)self;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sd|i", kwlist, &name, &start, &iteration)) {
+        return NULL;
+    }
+    if (kmeans_trace_on) {
+        kmeans_trace_span(name, start, iteration < 0 ? -1 : iteration);
+    }
+    Py_RETURN_NONE;
+}
+
+/* Writes the trace once the interpreter is gone (it needs no Python objects) */
+static void trace_at_exit(void) {
+    if (trace_path != NULL && kmeans_trace_write(trace_path) != 0) {
+        fprintf(stderr, "mykmeanssp: cannot write the trace to %s\n", trace_path);
+    }
+    free(trace_path);
+    trace_path = NULL;
 }
 
 
@@ -507,10 +2718,58 @@ static PyObject* fit(PyObject *self, PyObject *args) {
 static PyMethodDef mykmeanssp_methods[] = {
     {
         "fit",                   /* The name of the method as seen in Python */
-        (PyCFunction) fit,       /* The actual C function to be called */
-        METH_VARARGS,            /* Flags indicating the function accepts positional arguments */
+        (PyCFunction)(void(*)(void)) fit, /* The actual C function to be called */
+        METH_VARARGS | METH_KEYWORDS,     /* Flags: positional arguments plus keyword options */
         "Run K-means clustering" /* Function documentation (docstring) */
     },
+    {
+        "fit_minibatch",
+        (PyCFunction)(void(*)(void)) fit_minibatch,
+        METH_VARARGS | METH_KEYWORDS,
+        "Run mini-batch K-means clustering on sampled batches of the data"
+    },
+    {
+        "fit_file",
+        (PyCFunction)(void(*)(void)) fit_file,
+        METH_VARARGS | METH_KEYWORDS,
+        "Run K-means clustering over a binary file streamed from disk"
+    },
+    {
+        "kmeanspp_init",
+        (PyCFunction)(void(*)(void)) kmeanspp_init,
+        METH_VARARGS | METH_KEYWORDS,
+        "Pick K initial centroids with k-means++ or k-means|| and return their row indices"
+    },
+    {
+        "refit",
+        (PyCFunction)(void(*)(void)) refit,
+        METH_VARARGS | METH_KEYWORDS,
+        "Resume K-means from a previous solution after points were added or deleted"
+    },
+    {
+        "sweep",
+        (PyCFunction)(void(*)(void)) sweep,
+        METH_VARARGS | METH_KEYWORDS,
+        "Run K-means for every K of a range and return the inertia of each"
+    },
+    {
+        "load_and_merge",
+        (PyCFunction)(void(*)(void)) load_and_merge,
+        METH_VARARGS | METH_KEYWORDS,
+        "Read two CSV files and inner-join them on their first column, sorted by it"
+    },
+    {
+        "trace_clock",
+        (PyCFunction) trace_clock,
+        METH_NOARGS,
+        "Current time on the clock of the trace spans, in seconds"
+    },
+    {
+        "trace_span",
+        (PyCFunction)(void(*)(void)) trace_span,
+        METH_VARARGS | METH_KEYWORDS,
+        "Record a span from a trace_clock() time until now, when MYKMEANSSP_TRACE is set"
+    },
     {NULL, NULL, 0, NULL}        /* Sentinel value to mark the end of the array */
 };
 
@@ -523,17 +2782,55 @@ static struct PyModuleDef mykmeanssp_module = {
     mykmeanssp_methods        /* Reference to the method table defined above */
 };
 
-/* Module initialization function: called when 'import mykmeanssp' is executed */
+/*
+ * Module initialization function: called when 'import mykmeanssp' is executed.
+ * Also picks the Assignment Step kernel for this CPU; the MYKMEANSSP_SIMD
+ * environment variable ("scalar", "sse2", "avx2", "avx512", "neon") overrides it.
+ * The chosen kernel is exposed as mykmeanssp.SIMD; the KMeans type is registered too.
+ * With MYKMEANSSP_TRACE set, tracing starts here (see trace_span).
+ */
 PyMODINIT_FUNC PyInit_mykmeanssp(void) {
     PyObject *m;
+    const char *simd;
+    const char *trace;
+
+    simd = getenv("MYKMEANSSP_SIMD");
+    if (simd == NULL || *simd == '\0' || kmeans_simd_select(simd) != 0) {
+        kmeans_simd_select("auto");
+    }
+    trace = getenv("MYKMEANSSP_TRACE");
+    if (trace != NULL && *trace != '\0' && trace_path == NULL) {
+        trace_path = malloc(strlen(trace) + 1);
+        if (trace_path != NULL) {
+            strcpy(trace_path, trace);
+            if (Py_AtExit(trace_at_exit) == 0) {
+                kmeans_trace_start();
+            }
+            else {
+                free(trace_path);
+                trace_path = NULL;
+            }
+        }
+    }
+
     m = PyModule_Create(&mykmeanssp_module);
     if (!m) {
         return NULL; /* Return NULL to signal an initialization error */
     }
+    if (PyModule_AddStringConstant(m, "SIMD", kmeans_simd_name()) != 0
+        || PyModule_AddObject(m, "TRACE", PyBool_FromLong(kmeans_trace_on)) != 0) {
+        Py_DECREF(m);
+        return NULL;
+    }
+    if (PyType_Ready(&py_kmeans_type) != 0 || PyType_Ready(&py_cache_mapping_type) != 0) {
+        Py_DECREF(m);
+        return NULL;
+    }
+    Py_INCREF(&py_kmeans_type);
+    if (PyModule_AddObject(m, "KMeans", (PyObject *)&py_kmeans_type) != 0) {
+        Py_DECREF(&py_kmeans_type);
+        Py_DECREF(m);
+        return NULL;
+    }
     return m;
 }
-
-
-
-    
-
@@ -1,77 +1,94 @@
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
 #include <math.h>
-#define _GNU_SOURCE 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <unistd.h>
 
 #define ERROR_NUM_CLUSTERS "Incorrect number of clusters!"
 #define ERROR_MAX_ITER "Incorrect maximum iteration!"
 #define ERROR_OCCURED "An Error Has Occurred"
-#define MAX_ITER_DEFAULT 400  /* Default maximum iterations */ 
+#define MAX_ITER_DEFAULT 400  /* Default maximum iterations */
 #define EPS 0.001
 
+#define READ_BLOCK (1 << 22)      /* Bytes asked from read() at a time */
+#define MAX_TOKEN 4096            /* Longest number the tokenizer takes (it always has that much in view) */
+#define INITIAL_CAPACITY (1 << 16) /* Coordinates the matrix holds before it first grows */
+/* Significant digits the exact path keeps in an unsigned long, below 2^53 so exact in a double */
+#if ULONG_MAX > 0xFFFFFFFFUL
+#define EXACT_DIGITS 15
+#else
+#define EXACT_DIGITS 9
+#endif
+
 /*declaration of structs*/
-struct vector;
-struct cord;
+struct matrix;
+struct input;
 
 /*declaration of functions*/
 int isInteger(char *str);
-double compute_distance(const struct vector *v1, const struct vector *v2, int dim); 
-int find_dim(const struct vector *vec);
-struct vector *initialize_centroids(const struct vector *head_vec, int K, int dim);
-int find_closest_centroid(const struct vector *centroids, const struct vector *vectorX, int K, int dim);
-void print_the_result(struct vector *centroids_for_print, int K, int dim );
-struct vector *add_coordinates_from_other_vector(struct vector *v1, struct vector *v2, int dim);
-struct vector *initialize_sum_vectors(int K, int dim);
-void divide_vector_by_scalar(struct vector *v, int scalar);
-void free_vector_list(struct vector *head_vec); 
-void zero_out_vector(struct vector *v);
+double compute_distance(const double *v1, const double *v2, int dim);
+int find_closest_centroid(const struct matrix *centroids, const double *vectorX, int K);
+void print_the_result(const struct matrix *centroids_for_print);
+void add_coordinates_from_other_vector(double *v1, const double *v2, int dim);
+void divide_vector_by_scalar(double *v, int dim, int scalar);
+void zero_out_vector(double *v, int dim);
+int read_points(int fd, struct matrix *points);
+int append_value(struct matrix *points, double value);
+int end_row(struct matrix *points, size_t *row_start);
+int fill_input(struct input *in);
+int next_number(struct input *in, double *value);
+const char *parse_decimal(const char *p, double *value);
 
 /*implementations of structs*/
-struct cord
+
+/*
+ * A dense row-major block of `rows` vectors of `dim` coordinates. While the
+ * input is read it grows: `count` coordinates are in use out of `capacity`,
+ * and dim is fixed by the first row.
+ */
+struct matrix
 {
-    double value;
-    struct cord *next; /* Points to the next dimension/coordinate in the vector */
+    double *data; /* Row i starts at data + i * dim */
+    size_t rows;
+    int dim;
+    size_t count;
+    size_t capacity;
 };
-struct vector
+
+/* The input, read in large blocks: the bytes pos..end-1 of buf are still to be parsed */
+struct input
 {
-    struct vector *next; /* Points to the next data point (vector) in the list */
-    struct cord *cords; /* Points to the head of the coordinates list for this vector */
+    int fd;
+    char *buf;    /* READ_BLOCK + MAX_TOKEN bytes, plus a '\0' after the last one read */
+    size_t pos;
+    size_t end;
+    int eof;      /* read() returned 0 (or failed): nothing more will come */
 };
 
 
 int main(int argc, char **argv)
-{  
+{
     int K, max_iter;
 
-    int i, j, iter, changed;
-    int N = 0, dim = 0;
-    double n;
-    char c;
+    int j, iter, changed;
+    size_t N, x;
+    int dim;
     int closest_index;
 
-    struct vector *head_vec=NULL, *curr_vec=NULL;
-    struct cord *head_cord=NULL, *curr_cord=NULL;
-
-    struct vector *centroids=NULL;
-    struct vector *next_centroids=NULL;
-    struct vector *sum_vectors=NULL;
-
-    int *count_in_cluster=NULL;
-    struct vector *curr_vector_X=NULL;
-    struct vector *curr_sum = NULL;
-    struct vector *curr_cent = NULL;
-    struct vector *curr_next_cent = NULL;
-
+    struct matrix points;
+    struct matrix centroids, next_centroids, sum_vectors, swap;
 
-    /*the variables we use once somewhere and then don't*/
-    struct vector *temp = NULL;
-    struct vector *prev = NULL;
+    /* One block for the centroids, their next values, the sums and the counts */
+    double *block = NULL;
+    int *count_in_cluster = NULL;
 
-    
 
     /* The error when the user entered more or less arguments tham needed */
-    if (argc < 2 || argc > 3) { 
-        printf("%s\n", ERROR_OCCURED); 
+    if (argc < 2 || argc > 3) {
+        printf("%s\n", ERROR_OCCURED);
         return 1;
     }
 
@@ -93,7 +110,7 @@ int main(int argc, char **argv)
     }
 
 
-    if (K <= 1) { 
+    if (K <= 1) {
         printf("%s\n", ERROR_NUM_CLUSTERS);
         return 1;
     }
@@ -103,513 +120,420 @@ int main(int argc, char **argv)
     }
 
 
-    head_vec = malloc(sizeof(struct vector));
-    if(!head_vec) {
+    /*reading the input*/
+    if (read_points(STDIN_FILENO, &points) != 0) {
         printf("%s\n", ERROR_OCCURED);
+        free(points.data);
         return 1;
     }
-
-    curr_vec = head_vec;
-    curr_vec->next = NULL;
-
-    head_cord = malloc(sizeof(struct cord));
-    if (!head_cord) {
-        printf("%s\n", ERROR_OCCURED); 
-        free(head_vec);
-        return 1; 
-    }
-
-    curr_cord = head_cord;
-    curr_cord->next = NULL;
-    curr_vec->cords = head_cord;
-
-    /*reading the input*/
-    while (scanf("%lf%c", &n, &c) == 2)
-    {
-        curr_cord->value = n;
-
-        if (c == '\n')
-        {
-            N++;
-            /* Allocate memory for the next vector in the linked list */
-            curr_vec->next = malloc(sizeof(struct vector));
-            if(curr_vec->next == NULL) {
-                printf("%s\n", ERROR_OCCURED);
-                free_vector_list(head_vec); /* Free all memory allocated so far */
-                return 1;
-            }
-            
-            curr_vec = curr_vec->next;
-            curr_vec->next = NULL;
-            
-            /* CRITICAL: Initialize cords to NULL immediately. 
-               If the next malloc fails, free_vector_list needs this to be NULL 
-               to avoid accessing uninitialized memory. */
-            curr_vec->cords = NULL; 
-
-            /* Allocate the first coordinate for the new vector */
-            head_cord = malloc(sizeof(struct cord));
-            if(head_cord == NULL) {
-                printf("%s\n", ERROR_OCCURED);
-                free_vector_list(head_vec); /* Safe to call because cords is NULL */
-                return 1;
-            }
-            
-            curr_cord = head_cord;
-            curr_cord->next = NULL;
-            curr_vec->cords = head_cord; /* Link the coordinates to the vector */
-            continue;
-        }
-
-        /* Allocate memory for the next coordinate in the current vector */
-        curr_cord->next = malloc(sizeof(struct cord));
-        if(curr_cord->next == NULL) {
-            printf("%s\n", ERROR_OCCURED);
-            free_vector_list(head_vec); /* Free everything on failure */
-            return 1;
-        }
-        curr_cord = curr_cord->next;
-        curr_cord->next = NULL;
-    }
-
-    /*removing the last NULL vector*/
-    temp = head_vec;
-    prev = NULL;
-    for(i = 0; i<N; i++) {
-        prev = temp;
-        temp = temp->next;
-    }
-
-    /*release the last empty vector*/
-    if(prev != NULL) {
-        prev->next = NULL;
-        free_vector_list(temp);
-    }
-
-    dim = find_dim(head_vec);
+    N = points.rows;
+    dim = points.dim;
 
     /* After reading input data */
     if (N == 0 || dim <= 0) {
         printf("%s\n", ERROR_OCCURED);
-        free_vector_list(head_vec);
+        free(points.data);
         return 1;
     }
 
-    if(K >= N) {
-       printf("%s\n", ERROR_NUM_CLUSTERS); 
-       free_vector_list(head_vec);
+    if((size_t)K >= N) {
+       printf("%s\n", ERROR_NUM_CLUSTERS);
+       free(points.data);
        return 1;
     }
 
 
     /*initialization*/
-    centroids = initialize_centroids(head_vec, K, dim);
-    if(centroids == NULL) {
-         printf("%s\n", ERROR_NUM_CLUSTERS); 
-         free_vector_list(head_vec);
-         return 1;
-    }
-
-    sum_vectors = initialize_sum_vectors(K,dim);
-    if(sum_vectors == NULL) {
-         printf("%s\n", ERROR_NUM_CLUSTERS); 
-         free_vector_list(head_vec);
-         free_vector_list(centroids);
-         if(count_in_cluster != NULL) {
-            free(count_in_cluster);
-         }
-         return 1;
-    }
-    count_in_cluster = calloc(K, sizeof(int));
-    if(!count_in_cluster) {
+    block = malloc(3 * (size_t)K * (size_t)dim * sizeof(double) + (size_t)K * sizeof(int));
+    if (block == NULL) {
         printf("%s\n", ERROR_OCCURED);
-        free_vector_list(head_vec);
-        free_vector_list(centroids);
-        free_vector_list(sum_vectors);
+        free(points.data);
         return 1;
     }
+    centroids.data = block;
+    next_centroids.data = block + (size_t)K * (size_t)dim;
+    sum_vectors.data = block + 2 * (size_t)K * (size_t)dim;
+    count_in_cluster = (int *)(block + 3 * (size_t)K * (size_t)dim);
+    centroids.rows = next_centroids.rows = sum_vectors.rows = (size_t)K;
+    centroids.dim = next_centroids.dim = sum_vectors.dim = dim;
+
+    /* The first K points are the initial centroids */
+    memcpy(centroids.data, points.data, (size_t)K * (size_t)dim * sizeof(double));
 
 
     for(iter = 0; iter<max_iter; iter++) {
 
         /* Clear previous iteration data (sums and counts) */
         for(j=0; j<K; j++) count_in_cluster[j] = 0;
+        zero_out_vector(sum_vectors.data, K * dim);
 
         /* Assignment Step - Assign each vector to the closest centroid */
-        curr_sum = sum_vectors;
-        while(curr_sum != NULL) {
-            zero_out_vector(curr_sum);
-            curr_sum = curr_sum->next;
-        }
-
-        curr_vector_X = head_vec;
-
-        while(curr_vector_X != NULL) {
-            closest_index = find_closest_centroid(centroids, curr_vector_X, K,dim);
-
-            curr_sum = sum_vectors;
-            for(j = 0; j<closest_index; j++) {
-                curr_sum = curr_sum->next;
-            }
-
-            add_coordinates_from_other_vector(curr_sum, curr_vector_X, dim);
+        for(x = 0; x < N; x++) {
+            closest_index = find_closest_centroid(&centroids, points.data + x * (size_t)dim, K);
+            add_coordinates_from_other_vector(sum_vectors.data + (size_t)closest_index * (size_t)dim,
+                                              points.data + x * (size_t)dim, dim);
             count_in_cluster[closest_index]++;
-            curr_vector_X = curr_vector_X->next;
         }
 
 
-        /*compute new centroids*/
-        next_centroids = initialize_centroids(sum_vectors, K, dim);
-        if(next_centroids == NULL) {
-            printf("%s\n", ERROR_OCCURED);
-
-            free_vector_list(head_vec);
-            free_vector_list(centroids);
-            free_vector_list(sum_vectors);
-            if(count_in_cluster != NULL) {
-                free(count_in_cluster);
-            }
-            return 1;
-        }
-
-        curr_next_cent = next_centroids;
-        curr_sum = sum_vectors;
-
         /* Update Step - Calculate new centroids by averaging cluster members */
+        memcpy(next_centroids.data, sum_vectors.data, (size_t)K * (size_t)dim * sizeof(double));
         for(j=0; j<K; j++) {
             if(count_in_cluster[j] != 0) {
-                divide_vector_by_scalar(curr_next_cent, count_in_cluster[j]);
+                divide_vector_by_scalar(next_centroids.data + (size_t)j * (size_t)dim, dim, count_in_cluster[j]);
             } else {
-                /*case of empty cluster, create a deep copy of coordinates of the first input vector*/
-                struct cord *source_cord = head_vec->cords;
-                struct cord *destination_cord = curr_next_cent->cords;
-
-                while(source_cord != NULL && destination_cord != NULL) {
-                    destination_cord->value = source_cord->value;
-                    source_cord = source_cord->next;
-                    destination_cord = destination_cord->next;
-                }
+                /*case of empty cluster, take the coordinates of the first input vector*/
+                memcpy(next_centroids.data + (size_t)j * (size_t)dim, points.data, (size_t)dim * sizeof(double));
             }
-            curr_next_cent = curr_next_cent->next;
         }
 
-        
+
         /*checking convergence*/
         changed = 0;
-        curr_cent = centroids;
-        curr_next_cent = next_centroids;
-
         for(j = 0; j<K; j++) {
-            if(compute_distance(curr_cent, curr_next_cent, dim) >= EPS) {
+            if(compute_distance(centroids.data + (size_t)j * (size_t)dim,
+                                next_centroids.data + (size_t)j * (size_t)dim, dim) >= EPS) {
                 changed = 1;
             }
-            curr_cent = curr_cent->next;
-            curr_next_cent = curr_next_cent->next;
         }
 
-    
+
         /*change centorids*/
-        free_vector_list(centroids);
+        swap = centroids;
         centroids = next_centroids;
+        next_centroids = swap;
 
         if(!changed) {
             break;
         }
     }
-    
 
-    print_the_result(centroids, K, dim);
+
+    print_the_result(&centroids);
 
     /*release memory*/
-    free(count_in_cluster);
-    free_vector_list(centroids);
-    free_vector_list(head_vec);
-    free_vector_list(sum_vectors);
- 
+    free(block);
+    free(points.data);
+
     return 0;
 }
 
 
-/* Frees all memory allocated for the vectors and their internal coordinate lists */
-void free_vector_list(struct vector *head_vec) {
-    struct vector *curr_vec = head_vec;
-    struct vector *next_vec;
-    struct cord *curr_c, *next_c;
+/*
+ * Reads every point from fd into a new matrix: one point per line, its
+ * coordinates separated by a single character (a comma), like
+ * scanf("%lf%c") read them. Blanks before a number are skipped, and a line
+ * ends at '\n' (or "\r\n"). The input stops at its end or at the first thing
+ * that is not a number; a last line without its '\n' still counts.
+ * Returns 0 on success, -1 if memory ran out or a line has a different
+ * number of coordinates than the first one. points->data must be freed
+ * either way.
+ */
+int read_points(int fd, struct matrix *points) {
+    struct input in;
+    size_t row_start = 0;
+    double value;
+    char c;
+    int rc = 0;
+
+    points->data = NULL;
+    points->rows = 0;
+    points->dim = 0;
+    points->count = 0;
+    points->capacity = 0;
+
+    in.fd = fd;
+    in.pos = 0;
+    in.end = 0;
+    in.eof = 0;
+    in.buf = malloc(READ_BLOCK + MAX_TOKEN + 1);
+    if (in.buf == NULL) {
+        return -1;
+    }
+    in.buf[0] = '\0';
 
-    while (curr_vec != NULL) {
-        curr_c = curr_vec->cords;
-        while (curr_c != NULL) {
-            next_c = curr_c->next;
-            free(curr_c);
-            curr_c = next_c;
+    while (next_number(&in, &value) == 0) {
+        if (append_value(points, value) != 0) {
+            rc = -1;
+            break;
         }
-        next_vec = curr_vec->next;
-        free(curr_vec);
-        curr_vec = next_vec;
-    }
-}
 
-/*Prints the results, the coordiantes of K centroids*/
-void print_the_result(struct vector *centroids_for_print, int K, int dim ) {
-    const struct vector *curr_vec = centroids_for_print;
-    const struct cord *curr_cord;
-    int i, j;
-
-    for (i = 0; i < K; i++) {
-        /* Safety check: stop if list is shorter than K */
-        if (curr_vec == NULL) break;
-        curr_cord = curr_vec->cords;
-
-        for (j = 0; j < dim; j++) {
-            /* Safety check: stop if coords are missing */
-            if (curr_cord == NULL) break;
-            printf("%.4f", curr_cord->value);
-            /* Print comma only if we are NOT at the last coordinate */
-            if (j < dim - 1) {
-                printf(",");
-            }
-            curr_cord = curr_cord->next;
+        /* The character right after the number: a separator, or the end of the line */
+        if (in.pos == in.end) {
+            break;
+        }
+        c = in.buf[in.pos++];
+        if (c == '\r' && in.pos < in.end && in.buf[in.pos] == '\n') {
+            c = in.buf[in.pos++];
+        }
+        if (c == '\n' && end_row(points, &row_start) != 0) {
+            rc = -1;
+            break;
         }
-        printf("\n");
-        curr_vec = curr_vec->next;
     }
-}
 
+    /* A last line without its '\n' */
+    if (rc == 0 && points->count > row_start && end_row(points, &row_start) != 0) {
+        rc = -1;
+    }
+    free(in.buf);
+    return rc;
+}
 
-/* Resets all coordinates of a given vector to 0.0*/
-void zero_out_vector(struct vector *v) {
-    struct cord *c = v->cords;
+/* Appends one coordinate, growing the matrix when it is full. Returns 0, or -1 if memory ran out */
+int append_value(struct matrix *points, double value) {
+    size_t capacity;
+    double *data;
 
-    while (c != NULL) {
-        c->value = 0.0;
-        c = c->next;
+    if (points->count == points->capacity) {
+        capacity = points->capacity == 0 ? INITIAL_CAPACITY : 2 * points->capacity;
+        data = realloc(points->data, capacity * sizeof(double));
+        if (data == NULL) {
+            return -1;
+        }
+        points->data = data;
+        points->capacity = capacity;
     }
+    points->data[points->count++] = value;
+    return 0;
 }
 
-
 /*
- * Adds the coordinate values of vector v2 to vector v1.
- * v1 is modified in place (accumulating the sum), while v2 remains unchanged.
+ * Closes the row of the coordinates from *row_start on: the first row fixes
+ * the dimension, and every other one has to have it.
+ * Returns 0, or -1 if the row has a different length.
  */
-struct vector *add_coordinates_from_other_vector(struct vector *v1, struct vector *v2, int dim) {
-    struct cord *curr_cord1 = v1->cords;
-    const struct cord *curr_cord2 = v2->cords;
-    int i;
-
-    for (i = 0; i < dim; i++) {
-        /* Add the value from the second vector to the first */
-        curr_cord1->value += curr_cord2->value;
+int end_row(struct matrix *points, size_t *row_start) {
+    size_t length = points->count - *row_start;
 
-        /* Move to the next coordinate */
-        curr_cord1 = curr_cord1->next;
-        curr_cord2 = curr_cord2->next;
+    if (points->rows == 0) {
+        points->dim = (int)length;
     }
-
-    return v1; /* Return the modified vector (useful for chaining) */
+    else if (length != (size_t)points->dim) {
+        return -1;
+    }
+    points->rows++;
+    *row_start = points->count;
+    return 0;
 }
 
 /*
- * Divides every coordinate in vector v by a scalar integer.
- * This is used in the Update Step to calculate the average (mean) of a cluster.
+ * Moves what is left of the buffer to its front and reads the next block
+ * after it. Returns the number of bytes read (0 at the end of the input).
  */
-void divide_vector_by_scalar(struct vector *v, int scalar) {
-    struct cord *c = v->cords;
-    while(c != NULL) {
-        c->value /= scalar;
-        c = c->next;
+int fill_input(struct input *in) {
+    size_t left = in->end - in->pos;
+    ssize_t got;
+
+    memmove(in->buf, in->buf + in->pos, left);
+    in->pos = 0;
+    in->end = left;
+    do {
+        got = read(in->fd, in->buf + in->end, READ_BLOCK);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) {
+        in->eof = 1;
+        got = 0;
     }
+    in->end += (size_t)got;
+    in->buf[in->end] = '\0'; /* strtod and the tokenizer stop there */
+    return (int)got;
 }
 
-
 /*
- * Allocates memory for K vectors, initialized to zero.
- * These vectors serve as accumulators for calculating new centroids during iterations.
- * Returns a pointer to the head of the list, or NULL if allocation fails.
+ * Skips the blanks before the next number and parses it into *value,
+ * keeping at least MAX_TOKEN bytes in view so no number is cut by a block.
+ * Returns 0 on success, -1 at the end of the input or if what follows is
+ * not a number.
  */
-struct vector *initialize_sum_vectors(int K, int dim) {
-    struct vector *head_v=NULL, *curr_v=NULL, *new_v;
-    struct cord *head_c, *curr_c;
-    int i,j;
-
-    for(i = 0; i<K; i++) {
-        new_v = malloc(sizeof(struct vector));
-        if(new_v == NULL) {
-            free_vector_list(head_v);
-            return NULL;
-        }
+int next_number(struct input *in, double *value) {
+    const char *start, *stop;
+    char *slow_stop;
 
-        new_v->next = NULL;
-
-        head_c = malloc(sizeof(struct cord));
-        if(head_c == NULL) {
-            free(new_v);
-            free_vector_list(head_v);
-            return NULL;
+    for (;;) {
+        if (in->end - in->pos < MAX_TOKEN && !in->eof) {
+            fill_input(in);
         }
-        curr_c = head_c;
-
-        for(j = 0; j<dim; j++) {
-            curr_c->value = 0.0;
-            if(j<dim-1) {
-                curr_c->next = malloc(sizeof(struct cord));
-
-                if(curr_c->next == NULL) {
-                    new_v->cords = head_c;
-                    if(head_v == NULL) {
-                        head_v = new_v;
-                    } else {
-                        curr_v->next = new_v;
-                    }
-                     free_vector_list(head_v);
-                     return NULL;
-                }
-
-                curr_c = curr_c->next;
-            } else {
-                curr_c->next = NULL;
-            }
-
+        while (in->pos < in->end && (in->buf[in->pos] == ' ' || in->buf[in->pos] == '\n'
+                                     || in->buf[in->pos] == '\t' || in->buf[in->pos] == '\r'
+                                     || in->buf[in->pos] == '\v' || in->buf[in->pos] == '\f')) {
+            in->pos++;
         }
+        if (in->pos < in->end) {
+            break;
+        }
+        if (in->eof) {
+            return -1;
+        }
+    }
+    if (in->end - in->pos < MAX_TOKEN && !in->eof) {
+        fill_input(in);
+    }
 
-       new_v->cords = head_c;
-
-       if(head_v == NULL) {
-          head_v = new_v;
-          curr_v = head_v;
-       } else {
-          curr_v->next = new_v;
-          curr_v = curr_v->next;
-       }
-
+    start = in->buf + in->pos;
+    stop = parse_decimal(start, value);
+    if (stop == NULL) {
+        /* inf, nan, hexadecimal, long mantissas...: the C library decides */
+        *value = strtod(start, &slow_stop);
+        stop = slow_stop;
+        if (stop == start) {
+            return -1;
+        }
     }
-    return head_v;
+    in->pos += (size_t)(stop - start);
+    return 0;
 }
 
-
 /*
- * Creates a deep copy of the first K vectors from the input list to serve as initial centroids.
- * Returns the head of the new centroid list, or NULL on failure.
+ * Parses the decimal number at p ([+-]digits[.digits][(e|E)[+-]digits]) into
+ * *value when it can be done exactly: at most EXACT_DIGITS significant digits
+ * (an exact double) scaled by a power of ten up to 1e22 (exact too) is a
+ * single correctly rounded operation, so it gives what strtod gives.
+ * Returns the end of the number, or NULL when strtod has to parse it instead.
  */
-struct vector *initialize_centroids(const struct vector *head_vec, int K, int dim) {
-    struct vector *head_centroid=NULL, *curr_centroid=NULL, *new_centroid;
-    const struct vector *source_v = head_vec;
-    struct cord *head_cord, *curr_cord;
-    const struct cord *source_c;
-    int i,j;
-    
-    for(i=0; i<K && source_v != NULL;i++) {
-        new_centroid = malloc(sizeof(struct vector));
-        if(new_centroid == NULL) {
-            free_vector_list(head_centroid);
-            return NULL;
+const char *parse_decimal(const char *p, double *value) {
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    unsigned long mantissa = 0;
+    int digits = 0, seen_digit = 0, after_point = 0;
+    int exp10 = 0, exp_value = 0, exp_negative = 0;
+    int negative = 0;
+    const char *e;
+
+    if (*p == '+' || *p == '-') {
+        negative = *p == '-';
+        p++;
+    }
+    for (;; p++) {
+        if (*p == '.' && !after_point) {
+            after_point = 1;
+            continue;
+        }
+        if (*p < '0' || *p > '9') {
+            break;
         }
-        new_centroid->next = NULL;
-        source_c = source_v->cords;
-        head_cord = malloc(sizeof(struct cord));
-        if(head_cord == NULL) {
-            free(new_centroid);
-            free_vector_list(head_centroid);
+        seen_digit = 1;
+        if (digits == EXACT_DIGITS) {
             return NULL;
         }
-        curr_cord = head_cord;
-
-        for(j=0; j<dim; j++) {
-            curr_cord->value = source_c->value;
-            source_c = source_c->next;
-            
-            if(j <dim -1) {
-                curr_cord->next = malloc(sizeof(struct cord));
-                if(curr_cord->next == NULL) {
-                    new_centroid->cords = head_cord;
-                    
-                    if(head_centroid == NULL) {
-                        head_centroid = new_centroid;
-                    } else {
-                        curr_centroid->next = new_centroid;
-                    }
-
-                    free_vector_list(head_centroid);
-                    return NULL;
+        /* Leading zeros are not significant, but still move the point */
+        mantissa = mantissa * 10 + (unsigned long)(*p - '0');
+        digits += mantissa != 0;
+        exp10 -= after_point;
+    }
+    if (!seen_digit) {
+        return NULL;
+    }
+    if (*p == 'e' || *p == 'E') {
+        e = p + 1;
+        if (*e == '+' || *e == '-') {
+            exp_negative = *e == '-';
+            e++;
+        }
+        /* "1e" or "1e+" is the number 1 followed by the rest, for strtod as for scanf */
+        if (*e >= '0' && *e <= '9') {
+            for (; *e >= '0' && *e <= '9'; e++) {
+                if (exp_value < 100000) {
+                    exp_value = exp_value * 10 + (*e - '0');
                 }
-                curr_cord = curr_cord->next;
-
-            } else {
-                curr_cord->next = NULL;
             }
+            exp10 += exp_negative ? -exp_value : exp_value;
+            p = e;
         }
+    }
+    /* Hexadecimal and the like continue with letters */
+    if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || *p == '.') {
+        return NULL;
+    }
+
+    if (mantissa == 0) {
+        *value = negative ? -0.0 : 0.0;
+        return p;
+    }
+    if (exp10 < -22 || exp10 > 22) {
+        return NULL;
+    }
+    *value = exp10 < 0 ? (double)mantissa / powers_of_ten[-exp10] : (double)mantissa * powers_of_ten[exp10];
+    if (negative) {
+        *value = -*value;
+    }
+    return p;
+}
 
-           new_centroid->cords = head_cord;
-           
-           if(head_centroid == NULL) {
-            head_centroid = new_centroid;
-            curr_centroid = head_centroid;
-           } else {
-            curr_centroid->next = new_centroid;
-            curr_centroid = curr_centroid->next;
-           }
 
-        source_v = source_v->next;   
+/*Prints the results, the coordiantes of K centroids*/
+void print_the_result(const struct matrix *centroids_for_print) {
+    size_t i;
+    int j;
+
+    for (i = 0; i < centroids_for_print->rows; i++) {
+        for (j = 0; j < centroids_for_print->dim; j++) {
+            printf("%.4f", centroids_for_print->data[i * (size_t)centroids_for_print->dim + (size_t)j]);
+            /* Print comma only if we are NOT at the last coordinate */
+            if (j < centroids_for_print->dim - 1) {
+                printf(",");
+            }
+        }
+        printf("\n");
     }
-    return head_centroid;
 }
 
 
+/* Resets all coordinates of a given vector to 0.0*/
+void zero_out_vector(double *v, int dim) {
+    int i;
+
+    for (i = 0; i < dim; i++) {
+        v[i] = 0.0;
+    }
+}
+
 
 /*
- * Calculates the Euclidean distance between two vectors (points). 
- * It iterates through the coordinates, sums the squared differences, 
- * and returns the square root of that sum.
+ * Adds the coordinate values of vector v2 to vector v1.
+ * v1 is modified in place (accumulating the sum), while v2 remains unchanged.
  */
-double compute_distance(const struct vector *v1, const struct vector *v2, int dim) {
-    double diff;
-    double cord_val1, cord_val2;
-    double distance;
-    struct cord *curr_cord1, *curr_cord2;
+void add_coordinates_from_other_vector(double *v1, const double *v2, int dim) {
     int i;
-    double sum_dist = 0.0;
-    curr_cord1 = v1->cords;
-    curr_cord2 = v2->cords;
-    
-    for(i = 0; i<dim; i++) {
-
-        if (curr_cord1 == NULL || curr_cord2 == NULL) {
-            return 0.0; 
-        }
 
-        cord_val1 = (*curr_cord1).value;
-        cord_val2 = (*curr_cord2).value;
-        diff = cord_val1 - cord_val2;
-        sum_dist += diff * diff;
-        curr_cord1 = curr_cord1->next;
-        curr_cord2 = curr_cord2->next;
+    for (i = 0; i < dim; i++) {
+        v1[i] += v2[i];
     }
-    distance = sqrt(sum_dist);
-    return distance;
 }
 
-
 /*
- * Determines the dimensionality (number of coordinates) of a vector 
- * by counting the length of its coordinate linked list.
+ * Divides every coordinate in vector v by a scalar integer.
+ * This is used in the Update Step to calculate the average (mean) of a cluster.
  */
-int find_dim(const struct vector *vec)
-{
-    int dim = 0;
-    const struct cord *c;
+void divide_vector_by_scalar(double *v, int dim, int scalar) {
+    int i;
 
-    if (vec == NULL) {
-        return 0;
+    for (i = 0; i < dim; i++) {
+        v[i] /= scalar;
     }
+}
 
-    c = vec->cords;
-    while (c != NULL) {
-        dim++;
-        c = c->next;
-    }
 
-    return dim;
+/*
+ * Calculates the Euclidean distance between two vectors (points).
+ * It iterates through the coordinates, sums the squared differences,
+ * and returns the square root of that sum.
+ */
+double compute_distance(const double *v1, const double *v2, int dim) {
+    double diff;
+    double sum_dist = 0.0;
+    int i;
+
+    for(i = 0; i<dim; i++) {
+        diff = v1[i] - v2[i];
+        sum_dist += diff * diff;
+    }
+    return sqrt(sum_dist);
 }
 
+
 /*
  * Validates if a string represents a positive integer.
  * Returns 1 if valid, 0 otherwise.
@@ -617,36 +541,34 @@ int find_dim(const struct vector *vec)
 int isInteger(char *str) {
 
     if (str == NULL || *str == '\0') {
-        return 0; 
+        return 0;
     }
-    
+
     while (*str) {
         if (*str < '0' || *str > '9') {
-            return 0; 
+            return 0;
         }
         str++;
     }
-    return 1; 
+    return 1;
 }
 
 /*
  * Iterates through all centroids to find the one closest to vectorX.
  * Returns the index (0 to K-1) of the closest centroid.
  */
-int find_closest_centroid(const struct vector *centroids, const struct vector *vectorX, int K, int dim) {
+int find_closest_centroid(const struct matrix *centroids, const double *vectorX, int K) {
     int min_index = 0;
     int i;
-    const struct vector *curr_centroid = centroids;
     double distance, min_distance;
-    min_distance = compute_distance(curr_centroid, vectorX, dim);
-    curr_centroid = curr_centroid->next;
+
+    min_distance = compute_distance(centroids->data, vectorX, centroids->dim);
     for(i = 1; i<K; i++) {
-        distance = compute_distance(curr_centroid, vectorX, dim);
+        distance = compute_distance(centroids->data + (size_t)i * (size_t)centroids->dim, vectorX, centroids->dim);
         if(distance<min_distance) {
             min_distance = distance;
             min_index = i;
         }
-        curr_centroid = curr_centroid->next;
     }
     return min_index;
 }
@@ -1,7 +1,24 @@
+import sys
 from setuptools import setup, Extension
 
+# Keep a*b + c as two roundings everywhere, so the SIMD kernels and the scalar
+# loop produce bit-identical distances (GCC fuses them by default on aarch64).
+extra_compile_args = [] if sys.platform == "win32" else ["-ffp-contract=off", "-pthread"]
+# The Assignment Step thread pool (kmeans_threads.c) is built on pthreads
+extra_link_args = [] if sys.platform == "win32" else ["-pthread"]
+
 # Name of the module "mykmeanssp" should be the same as in C
-module = Extension("mykmeanssp", sources=['kmeansmodule.c'])
+# The Python glue lives in kmeansmodule.c, the pure C engine in kmeans*.c
+module = Extension("mykmeanssp",
+                   sources=['kmeansmodule.c', 'kmeans.c', 'kmeans_simd.c', 'kmeans_blocked.c',
+                            'kmeans_threads.c', 'kmeans_bounds.c', 'kmeans_kdtree.c',
+                            'kmeans_minibatch.c', 'kmeans_stream.c', 'kmeans_seed.c',
+                            'kmeans_f32.c', 'kmeans_model.c', 'kmeans_refit.c',
+                            'kmeans_restarts.c', 'kmeans_sweep.c', 'kmeans_csv.c', 'kmeans_cache.c',
+                            'kmeans_telemetry.c', 'kmeans_trace.c'],
+                   depends=['kmeans.h'],
+                   extra_compile_args=extra_compile_args,
+                   extra_link_args=extra_link_args)
 
 setup(
     name='mykmeanssp',
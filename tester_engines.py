@@ -0,0 +1,163 @@
+import sys
+import os
+import json
+import subprocess
+
+from tester_giant import GREEN, RED, YELLOW, CYAN, log, compile_extension, check_output_match
+
+# ================= CONFIGURATION =================
+
+TEST_DIR = "tests"
+
+# Every engine of fit(algorithm=...), checked against "lloyd"
+ALGORITHMS = ["lloyd", "blocked", "elkan", "hamerly", "yinyang", "kdtree"]
+
+# Engines that add the cluster sums in another order: same labels, centroids equal up to the last bits
+LAST_BITS_ALGORITHMS = ["kdtree"]
+LAST_BITS_TOLERANCE = 1e-12
+
+# Values of $MYKMEANSSP_SIMD, checked against "scalar" (the kernel is picked when the module loads)
+SIMD_MODES = ["scalar", "auto"]
+
+# (name, K, max_iter, eps, n) as in tests/test_readme.txt, on input_<n>_db_*.txt / output_<n>.txt
+CASES = [
+    ("Test 1 (K=3)", 3, 333, 0.0, 1),
+    ("Test 2 (K=7)", 7, 300, 0.0, 2),
+    ("Test 3 (K=15)", 15, 750, 0.0, 3),
+]
+
+# ================= HELPER FUNCTIONS =================
+
+def run_engines():
+    """
+    Worker side (--worker): runs every case with every algorithm under the
+    kernel $MYKMEANSSP_SIMD picked, seeded exactly like kmeans_pp.py, and
+    prints the results as JSON. Centroids are written with float.hex so the
+    other side can compare them bit for bit.
+    """
+    import numpy as np
+    import mykmeanssp
+    from kmeans_pp import load_and_merge, kmeans_pp_init, format_row
+
+    results = {"simd": mykmeanssp.SIMD, "cases": {}}
+    for name, K, max_iter, eps, n in CASES:
+        keys, data_points = load_and_merge(f"{TEST_DIR}/input_{n}_db_1.txt", f"{TEST_DIR}/input_{n}_db_2.txt")
+        chose_idxs, init_centroids = kmeans_pp_init(data_points, K)
+        data_points = np.ascontiguousarray(data_points, dtype=np.float64)
+        keys_line = ",".join(str(int(keys[i])) for i in chose_idxs)
+
+        runs = {}
+        for algorithm in ALGORITHMS:
+            centroids, labels = mykmeanssp.fit(K, max_iter, eps, data_points,
+                                               np.ascontiguousarray(init_centroids, dtype=np.float64),
+                                               output="buffer", algorithm=algorithm)
+            centroids = np.asarray(centroids)
+            runs[algorithm] = {
+                "centroids": [[float(x).hex() for x in row] for row in centroids],
+                "labels": [int(c) for c in np.asarray(labels)],
+                "output": "\n".join([keys_line] + [format_row(row) for row in centroids]),
+            }
+        results["cases"][name] = runs
+    print(json.dumps(results))
+
+
+def collect(simd):
+    """
+    Runs the worker side in a fresh interpreter with $MYKMEANSSP_SIMD=simd.
+    Returns its parsed results, or None if it failed.
+    """
+    env = dict(os.environ, MYKMEANSSP_SIMD=simd)
+    cmd = [sys.executable, os.path.abspath(__file__), "--worker"]
+    try:
+        res = subprocess.run(cmd, capture_output=True, text=True, timeout=300, env=env)
+    except subprocess.TimeoutExpired:
+        log(f"MYKMEANSSP_SIMD={simd}: TIMEOUT [FAIL]", RED)
+        return None
+    if res.returncode != 0:
+        log(f"MYKMEANSSP_SIMD={simd}: worker failed (Return Code: {res.returncode}) [FAIL]", RED)
+        print(f"Stderr: {res.stderr}")
+        return None
+    return json.loads(res.stdout)
+
+
+def compare_run(run, reference, last_bits=False):
+    """
+    Compares one run with the reference run (lloyd, scalar kernel).
+    Labels must be identical, and so must the centroids unless last_bits
+    is set, in which case they may differ by a relative LAST_BITS_TOLERANCE.
+    """
+    if run["labels"] != reference["labels"]:
+        first = next(i for i, (a, b) in enumerate(zip(run["labels"], reference["labels"])) if a != b)
+        return False, f"Labels differ from lloyd/scalar, first at point {first}"
+    if run["centroids"] == reference["centroids"]:
+        return True, "Identical"
+    if not last_bits:
+        return False, "Centroids differ from lloyd/scalar"
+    for row, ref_row in zip(run["centroids"], reference["centroids"]):
+        for g, e in zip(row, ref_row):
+            g, e = float.fromhex(g), float.fromhex(e)
+            if abs(g - e) > LAST_BITS_TOLERANCE * max(abs(e), 1.0):
+                return False, f"Centroids differ from lloyd/scalar beyond the last bits: {g!r} vs {e!r}"
+    return True, "Equal up to the last bits"
+
+
+def run_check(label, run, reference, n, last_bits=False):
+    """
+    Checks one (case, simd, algorithm) run: the same as the reference (see
+    compare_run) and matching tests/output_<n>.txt.
+    """
+    print(f"Running {label}...", end=" ")
+    success, reason = compare_run(run, reference, last_bits)
+    if success:
+        success, reason = check_output_match(run["output"], f"{TEST_DIR}/output_{n}.txt")
+    if not success:
+        log(f"[FAIL] ({reason})", RED)
+        return False
+    log("[PASS]", GREEN)
+    return True
+
+
+# ================= MAIN TESTER LOGIC =================
+
+def main():
+    if "--worker" in sys.argv:
+        run_engines()
+        return
+
+    log(">> Every engine and SIMD kernel must give the same answer", YELLOW)
+    compile_extension()
+
+    if not os.path.isdir(TEST_DIR):
+        log(f"Warning: '{TEST_DIR}' directory not found. Nothing to check.", YELLOW)
+        return
+
+    passed = 0
+    total = 0
+
+    results = {}
+    for simd in SIMD_MODES:
+        results[simd] = collect(simd)
+
+    reference = results[SIMD_MODES[0]]
+    for simd in SIMD_MODES:
+        log(f"\n--- MYKMEANSSP_SIMD={simd} ---", CYAN)
+        if results[simd] is None or reference is None:
+            total += len(CASES) * len(ALGORITHMS)
+            continue
+        log(f"(kernel: {results[simd]['simd']})", YELLOW)
+        for name, K, max_iter, eps, n in CASES:
+            for algorithm in ALGORITHMS:
+                total += 1
+                passed += run_check(f"{name} algorithm={algorithm}", results[simd]["cases"][name][algorithm],
+                                    reference["cases"][name]["lloyd"], n, algorithm in LAST_BITS_ALGORITHMS)
+
+    log("\n========================================")
+    if passed == total:
+        log(f"SUMMARY: {passed}/{total} TESTS PASSED. EXCELLENT JOB!", GREEN)
+    else:
+        log(f"SUMMARY: {passed}/{total} TESTS PASSED.", YELLOW)
+        log("Please fix the [FAIL] cases above.", RED)
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()